@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <google/protobuf/arena.h>
+
+#include "rpc.pb.h"
+#include "app/atp_arena.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The request scoped arena benchmark, decode the same message repeatedly like a connection does,
+ * with malloc temporaries and with the arena reset after each message.
+ */
+
+static const int kRounds = 200000;
+static const int kJsonFields = 32;
+static const size_t kProtobufBlockSize = 2048;
+
+template <typename Alloc>
+using BasicString = std::basic_string<char, std::char_traits<char>, typename std::allocator_traits<Alloc>::template rebind_alloc<char>>;
+
+template <typename Alloc>
+struct JsonField {
+    BasicString<Alloc> key;
+    BasicString<Alloc> value;
+
+    JsonField(const char* k, size_t kl, const char* v, size_t vl, const Alloc& alloc)
+        : key(k, kl, alloc), value(v, vl, alloc) {}
+};
+
+/* Decode the flat json object of string values, the keys and values are copied out like a real decoder. */
+template <typename Alloc>
+static size_t json_decode(const std::string& text, const Alloc& alloc) {
+    typedef JsonField<Alloc> Field;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Field> FieldAlloc;
+
+    std::vector<Field, FieldAlloc> fields{FieldAlloc(alloc)};
+
+    const char* p = text.c_str();
+    while ((p = strchr(p, '"')) != NULL) {
+        const char* key = ++ p;
+        p = strchr(p, '"');
+        size_t key_len = p - key;
+
+        p = strchr(p + 1, '"');
+        const char* value = ++ p;
+        p = strchr(p, '"');
+        size_t value_len = p ++ - value;
+
+        fields.emplace_back(key, key_len, value, value_len, alloc);
+    }
+
+    size_t bytes = 0;
+    for (auto& field : fields) {
+        bytes += field.key.size() + field.value.size();
+    }
+
+    return bytes;
+}
+
+static std::string make_json() {
+    std::string text = "{";
+    for (int i = 0; i < kJsonFields; ++ i) {
+        char field[128];
+        snprintf(field, sizeof(field), "%s\"field_name_%02d\":\"the value of field %02d is long enough to be on heap\"",
+            i ? "," : "", i, i);
+        text += field;
+    }
+
+    return text + "}";
+}
+
+static std::string make_rpc_message() {
+    RpcMessage message;
+    message.set_type(REQUEST);
+    message.set_id(123456789);
+    message.set_service("atp.EchoService");
+    message.set_method("Echo");
+    message.set_request(std::string(1024, 'x'));
+    message.set_timeout_ms(3000);
+
+    return message.SerializeAsString();
+}
+
+template <typename Fn>
+static void bench(const char* name, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+
+    size_t check = 0;
+    for (int i = 0; i < kRounds; ++ i) {
+        check += fn();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[%-24s] messages per second: %.0f (check %zu)\n", name, kRounds / seconds, check);
+}
+
+int main() {
+    std::string json = make_json();
+    std::string wire = make_rpc_message();
+
+    Arena arena;
+
+    bench("json decode malloc", [&json]() {
+        return json_decode(json, std::allocator<char>());
+    });
+
+    bench("json decode arena", [&json, &arena]() {
+        size_t bytes = json_decode(json, ArenaAllocator<char>(&arena));
+        arena.reset();
+        return bytes;
+    });
+
+    bench("protobuf parse malloc", [&wire]() {
+        RpcMessage message;
+        message.ParseFromString(wire);
+        return message.request().size();
+    });
+
+    bench("protobuf parse arena", [&wire, &arena]() {
+        size_t bytes = 0;
+        {
+            // The protobuf arena takes its first block from the request arena, no malloc for the small message.
+            google::protobuf::ArenaOptions options;
+            options.initial_block = static_cast<char*>(arena.allocate(kProtobufBlockSize));
+            options.initial_block_size = kProtobufBlockSize;
+
+            google::protobuf::Arena pb_arena(options);
+            RpcMessage* message = google::protobuf::Arena::CreateMessage<RpcMessage>(&pb_arena);
+            message->ParseFromString(wire);
+            bytes = message->request().size();
+        }
+
+        arena.reset();
+        return bytes;
+    });
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "net/atp_tcp_conn.h"
+#include "net/atp_tcp_server.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The fan-out latency of one message to kConnections connections, from the call until all the clients
+ * received it. The Connection::send for each connection from the caller thread queues one task for
+ * each, the Server::broadcast queues one task for each IO event loop with the shared payload. The client
+ * shares the CPU with the server, so the CPU time of all the IO event loop threads is printed too.
+ *
+ * 100k connections need about 200k fds in this process(ulimit -n), the clients connect from several
+ * loopback addresses for the ephemeral ports. It stops at the fd limit and prints the connections made.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kServerPort = 7911;
+static const int kConnections = 100000;
+static const int kConnectionsPerAddr = 25000;
+static const int kIOThreads = 4;
+static const size_t kMessageSize = 64;
+static const int kRounds = 5;
+
+static std::mutex mutex;
+static std::vector<ConnectionPtr> server_conns;
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static Server* startServer() {
+    ServerAddress address = { kServerAddr, kServerPort };
+    Server* server = new Server("broadcast-server", address, kIOThreads);
+
+    server->setConnectionCallback([](const ConnectionPtr& conn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        server_conns.push_back(conn);
+    });
+
+    // The server runs until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+
+    return server;
+}
+
+// The CPU time ns of the event loop thread, read in the event loop.
+static int64_t threadCpuNs(EventLoop* event_loop) {
+    std::promise<int64_t> promise;
+    event_loop->sendToQueue([&promise]() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        promise.set_value(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+    });
+
+    return promise.get_future().get();
+}
+
+static int64_t loopsCpuNs(const std::vector<EventLoop*>& event_loops) {
+    int64_t cpu_ns = 0;
+    for (EventLoop* event_loop : event_loops) {
+        cpu_ns += threadCpuNs(event_loop);
+    }
+
+    return cpu_ns;
+}
+
+// The fds are watched by the epoll_fd.
+static void connectAll(int epoll_fd, int connections, std::vector<int>* fds) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(kServerPort);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    for (int i = 0; i < connections; ++ i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            break;
+        }
+
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK + i / kConnectionsPerAddr);
+
+        if (bind(fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) < 0 ||
+            connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+            close(fd);
+            break;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+        fds->push_back(fd);
+    }
+}
+
+// Read until every connection received kMessageSize bytes.
+static bool receiveAll(int epoll_fd, size_t connections, std::vector<size_t>* received) {
+    std::vector<struct epoll_event> events(1024);
+    std::vector<char> buf(kMessageSize);
+    size_t done = 0;
+
+    while (done < connections) {
+        int ready = epoll_wait(epoll_fd, &events[0], static_cast<int>(events.size()), 3000);
+        if (ready <= 0) {
+            return false;
+        }
+
+        for (int i = 0; i < ready; ++ i) {
+            int fd = events[i].data.fd;
+            ssize_t n = recv(fd, &buf[0], kMessageSize - (*received)[fd], 0);
+            if (n <= 0) {
+                return false;
+            }
+
+            (*received)[fd] += n;
+            if ((*received)[fd] == kMessageSize) {
+                ++ done;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void benchFanout(Server* server, bool broadcast, int epoll_fd, const std::vector<int>& fds) {
+    const char* name = broadcast ? "Server::broadcast" : "send for each";
+
+    std::vector<ConnectionPtr> conns;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        conns = server_conns;
+    }
+
+    std::vector<EventLoop*> event_loops;
+    for (const ConnectionPtr& conn : conns) {
+        if (std::find(event_loops.begin(), event_loops.end(), conn->getEventLoop()) == event_loops.end()) {
+            event_loops.push_back(conn->getEventLoop());
+        }
+    }
+
+    double total_call_ms = 0;
+    double total_fanout_ms = 0;
+    int64_t total_cpu_ns = 0;
+
+    for (int round = 0; round < kRounds; ++ round) {
+        std::vector<size_t> received(fds.back() + 1, 0);
+        std::string payload(kMessageSize, static_cast<char>('a' + round));
+
+        int64_t cpu_start = loopsCpuNs(event_loops);
+        auto start = std::chrono::steady_clock::now();
+
+        if (broadcast) {
+            server->broadcast(payload);
+        } else {
+            for (const ConnectionPtr& conn : conns) {
+                conn->send(payload.data(), payload.size());
+            }
+        }
+
+        auto called = std::chrono::steady_clock::now();
+
+        if (!receiveAll(epoll_fd, fds.size(), &received)) {
+            printf("[%s] receive failed\n", name);
+            return;
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        total_call_ms += std::chrono::duration<double, std::milli>(called - start).count();
+        total_fanout_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        total_cpu_ns += loopsCpuNs(event_loops) - cpu_start;
+    }
+
+    printf("[%-17s] connections: %zu call ms: %.2f fan-out ms: %.2f server cpu ms: %.2f\n", name, fds.size(),
+        total_call_ms / kRounds, total_fanout_ms / kRounds, total_cpu_ns / 1000000.0 / kRounds);
+}
+
+int main() {
+    atp_logger_init();
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    Server* server = startServer();
+
+    sleep(1);
+
+    // Half of the fds are the server side of the connections.
+    int connections = kConnections;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur / 2 < static_cast<rlim_t>(kConnections) + 128) {
+        connections = static_cast<int>(limit.rlim_cur / 2) - 128;
+        printf("the fd limit %llu is less than the connections need\n", static_cast<unsigned long long>(limit.rlim_cur));
+    }
+
+    int epoll_fd = epoll_create1(0);
+    std::vector<int> fds;
+
+    connectAll(epoll_fd, connections, &fds);
+    if (fds.empty()) {
+        printf("connect failed\n");
+        _exit(1);
+    }
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (server_conns.size() >= fds.size()) {
+                break;
+            }
+        }
+
+        usleep(10000);
+    }
+
+    benchFanout(server, false, epoll_fd, fds);
+    benchFanout(server, true, epoll_fd, fds);
+
+    fflush(stdout);
+    _exit(0);
+}
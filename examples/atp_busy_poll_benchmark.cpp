@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "net/atp_tcp_server.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The round trip latency of one echo connection and of the cross thread tasks, on the native epoll loop
+ * blocking in epoll_wait, busy polling, and busy polling with SO_BUSY_POLL on the sockets. The server
+ * IO thread CPU usage is the CPU time of the loop thread divided by the wall time of the run.
+ *
+ * The busy poll needs a spare core for the loop thread, on a machine with less cores than the spinning
+ * loops plus the client the spinning steals the CPU from the client and the latency gets worse.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const int kRounds = 20000;
+static const size_t kMessageSize = 64;
+static const int64_t kBusyPollUs = 50;
+
+struct BusyPollCase {
+    const char* name_;
+    unsigned int port_;
+    int64_t busy_poll_us_;
+    int socket_busy_poll_us_;
+    std::atomic<EventLoop*> event_loop_;
+};
+
+static BusyPollCase cases[] = {
+    { "blocking", 7851, 0, 0, { nullptr } },
+    { "busy poll", 7852, kBusyPollUs, 0, { nullptr } },
+    { "busy poll + SO_BUSY_POLL", 7853, kBusyPollUs, kBusyPollUs, { nullptr } },
+};
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static void onEchoMessage(const ConnectionPtr& conn, ByteBuffer& buffer) {
+    conn->send(&buffer);
+}
+
+static void startServer(BusyPollCase* bench_case) {
+    ServerAddress address = { kServerAddr, bench_case->port_ };
+    Server* server = new Server(bench_case->name_, address, 1, IO_BACKEND_EPOLL);
+
+    server->setBusyPoll(bench_case->busy_poll_us_, bench_case->socket_busy_poll_us_);
+    server->setMessageCallback(&onEchoMessage);
+    server->setConnectionCallback([bench_case](const ConnectionPtr& conn) {
+        bench_case->event_loop_.store(conn->getEventLoop());
+    });
+
+    // The servers run until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+}
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The CPU time ns of the event loop thread, read in the event loop.
+static int64_t threadCpuNs(EventLoop* event_loop) {
+    std::promise<int64_t> promise;
+    event_loop->sendToQueue([&promise]() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        promise.set_value(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+    });
+
+    return promise.get_future().get();
+}
+
+static void printLatency(const char* name, const char* what, std::vector<int64_t>& rtts, double cpu_usage) {
+    std::sort(rtts.begin(), rtts.end());
+
+    size_t size = rtts.size();
+    printf("[%s] %s p50: %.1fus p99: %.1fus p999: %.1fus server cpu: %.0f%%\n", name, what,
+        rtts[size / 2] / 1000.0, rtts[size * 99 / 100] / 1000.0, rtts[size * 999 / 1000] / 1000.0, cpu_usage * 100);
+}
+
+static void benchEcho(BusyPollCase* bench_case) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(bench_case->port_);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+        printf("[%s] connect failed\n", bench_case->name_);
+        close(fd);
+        return;
+    }
+
+    while (bench_case->event_loop_.load() == nullptr) {
+        usleep(1000);
+    }
+
+    EventLoop* event_loop = bench_case->event_loop_.load();
+
+    const std::string message(kMessageSize, 'x');
+    char response[kMessageSize];
+    std::vector<int64_t> rtts;
+    rtts.reserve(kRounds);
+
+    int64_t cpu_start = threadCpuNs(event_loop);
+    int64_t start = nowNs();
+
+    for (int round = 0; round < kRounds; ++ round) {
+        int64_t begin = nowNs();
+        if (send(fd, message.data(), message.size(), 0) != static_cast<ssize_t>(message.size())) {
+            printf("[%s] send failed\n", bench_case->name_);
+            close(fd);
+            return;
+        }
+
+        size_t received = 0;
+        while (received < message.size()) {
+            ssize_t n = recv(fd, response + received, message.size() - received, 0);
+            if (n <= 0) {
+                printf("[%s] recv failed\n", bench_case->name_);
+                close(fd);
+                return;
+            }
+
+            received += n;
+        }
+
+        rtts.push_back(nowNs() - begin);
+    }
+
+    double cpu_usage = static_cast<double>(threadCpuNs(event_loop) - cpu_start) / (nowNs() - start);
+    printLatency(bench_case->name_, "echo rtt", rtts, cpu_usage);
+
+    close(fd);
+}
+
+static void benchTasks(BusyPollCase* bench_case) {
+    EventLoop* event_loop = bench_case->event_loop_.load();
+
+    std::vector<int64_t> rtts;
+    rtts.reserve(kRounds);
+
+    int64_t cpu_start = threadCpuNs(event_loop);
+    int64_t start = nowNs();
+
+    for (int round = 0; round < kRounds; ++ round) {
+        int64_t begin = nowNs();
+
+        std::promise<void> promise;
+        event_loop->sendToQueue([&promise]() {
+            promise.set_value();
+        });
+
+        promise.get_future().wait();
+        rtts.push_back(nowNs() - begin);
+    }
+
+    double cpu_usage = static_cast<double>(threadCpuNs(event_loop) - cpu_start) / (nowNs() - start);
+    printLatency(bench_case->name_, "task rtt", rtts, cpu_usage);
+}
+
+int main() {
+    atp_logger_init();
+
+    for (BusyPollCase& bench_case : cases) {
+        startServer(&bench_case);
+    }
+
+    sleep(1);
+
+    for (BusyPollCase& bench_case : cases) {
+        benchEcho(&bench_case);
+        benchTasks(&bench_case);
+    }
+
+    fflush(stdout);
+    _exit(0);
+}
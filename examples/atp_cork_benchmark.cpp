@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "net/atp_tcp_conn.h"
+#include "net/atp_tcp_server.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The response of each request is sent by three sends(header, body and trailer), the request/response
+ * pattern of the rpc and the http handlers. The client keeps one request in flight on each connection.
+ * The sends go to the kernel one by one without the cork, by one send with the auto cork or the explicit
+ * cork. The TCP_NODELAY server sends one segment for each send, so the data segments the client received
+ * per request is the server send syscalls per request.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const int kConnections = 64;
+static const int kRounds = 2000;
+static const size_t kRequestSize = 16;
+static const size_t kHeaderSize = 8;
+static const size_t kBodySize = 64;
+static const size_t kTrailerSize = 8;
+static const size_t kResponseSize = kHeaderSize + kBodySize + kTrailerSize;
+
+typedef enum {
+    CORK_NONE       =   (0),
+    CORK_AUTO       =   (1),
+    CORK_EXPLICIT   =   (2)
+} CorkMode;
+
+struct CorkCase {
+    const char* name_;
+    unsigned int port_;
+    CorkMode mode_;
+    std::atomic<EventLoop*> event_loop_;
+};
+
+static CorkCase cases[] = {
+    { "no cork", 7891, CORK_NONE, { nullptr } },
+    { "auto cork", 7892, CORK_AUTO, { nullptr } },
+    { "explicit cork", 7893, CORK_EXPLICIT, { nullptr } },
+};
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static void onMessage(const ConnectionPtr& conn, ByteBuffer& buffer, CorkMode mode) {
+    static const std::string header(kHeaderSize, 'h');
+    static const std::string body(kBodySize, 'b');
+    static const std::string trailer(kTrailerSize, 't');
+
+    ByteBufferedReader reader(buffer);
+    while (buffer.unreadBytes() >= kRequestSize) {
+        reader.remove(kRequestSize);
+
+        if (mode == CORK_EXPLICIT) {
+            conn->cork();
+        }
+
+        conn->send(header.data(), header.size());
+        conn->send(body.data(), body.size());
+        conn->send(trailer.data(), trailer.size());
+
+        if (mode == CORK_EXPLICIT) {
+            conn->uncork();
+        }
+    }
+}
+
+static void startServer(CorkCase* bench_case) {
+    ServerAddress address = { kServerAddr, bench_case->port_ };
+    Server* server = new Server(bench_case->name_, address, 1);
+
+    CorkMode mode = bench_case->mode_;
+    server->setConnectionCallback([bench_case, mode](const ConnectionPtr& conn) {
+        bench_case->event_loop_.store(conn->getEventLoop());
+        conn->setAutoCork(mode == CORK_AUTO);
+    });
+
+    server->setMessageCallback([mode](const ConnectionPtr& conn, ByteBuffer& buffer) {
+        onMessage(conn, buffer, mode);
+    });
+
+    // The servers run until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+}
+
+// The CPU time ns of the event loop thread, read in the event loop.
+static int64_t threadCpuNs(EventLoop* event_loop) {
+    std::promise<int64_t> promise;
+    event_loop->sendToQueue([&promise]() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        promise.set_value(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+    });
+
+    return promise.get_future().get();
+}
+
+static uint64_t dataSegmentsIn(const std::vector<int>& fds) {
+    uint64_t segments = 0;
+    for (int fd : fds) {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+            segments += info.tcpi_data_segs_in;
+        }
+    }
+
+    return segments;
+}
+
+static void benchCork(CorkCase* bench_case) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(bench_case->port_);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    std::vector<int> fds;
+    for (int i = 0; i < kConnections; ++ i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+            printf("[%s] connect failed\n", bench_case->name_);
+            close(fd);
+            return;
+        }
+
+        fds.push_back(fd);
+    }
+
+    while (bench_case->event_loop_.load() == nullptr) {
+        usleep(1000);
+    }
+
+    EventLoop* event_loop = bench_case->event_loop_.load();
+
+    const std::string request(kRequestSize, 'x');
+    char response[kResponseSize];
+
+    uint64_t segments_start = dataSegmentsIn(fds);
+    int64_t cpu_start = threadCpuNs(event_loop);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < kRounds; ++ round) {
+        for (int fd : fds) {
+            if (send(fd, request.data(), request.size(), 0) != static_cast<ssize_t>(request.size())) {
+                printf("[%s] send failed\n", bench_case->name_);
+                return;
+            }
+        }
+
+        for (int fd : fds) {
+            size_t received = 0;
+            while (received < kResponseSize) {
+                ssize_t n = recv(fd, response + received, kResponseSize - received, 0);
+                if (n <= 0) {
+                    printf("[%s] recv failed\n", bench_case->name_);
+                    return;
+                }
+
+                received += n;
+            }
+
+            if (response[0] != 'h' || response[kHeaderSize] != 'b' || response[kResponseSize - 1] != 't') {
+                printf("[%s] bad response\n", bench_case->name_);
+                return;
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double requests = static_cast<double>(kConnections) * kRounds;
+    double cpu_ns = static_cast<double>(threadCpuNs(event_loop) - cpu_start);
+
+    printf("[%-13s] requests/s: %.0f server cpu ns/request: %.0f segments/request: %.2f\n", bench_case->name_,
+        requests / seconds, cpu_ns / requests, (dataSegmentsIn(fds) - segments_start) / requests);
+
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+
+int main() {
+    atp_logger_init();
+
+    for (CorkCase& bench_case : cases) {
+        startServer(&bench_case);
+    }
+
+    sleep(1);
+
+    for (CorkCase& bench_case : cases) {
+        benchCork(&bench_case);
+    }
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+
+#include "echo_server.pb.h"
+#include "net/atp_coroutine.h"
+#include "net/atp_tcp_server.h"
+#include "net/atp_event_loop_thread_pool.h"
+#include "app/atp_rpc_server.h"
+#include "app/atp_rpc_controller.h"
+#include "app/atp_rpc_client_pool.h"
+#include "app/atp_rpc_coroutine.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The coroutine handler benchmark, build it with -std=c++20. The same length prefixed echo protocol
+ * is served by a callback handler and a coroutine handler, the client measures the round trips.
+ * Then a coroutine awaits the rpc client calls one by one.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kCallbackPort = 7821;
+static const unsigned int kCoroutinePort = 7822;
+static const unsigned int kRpcPort = 7823;
+static const int kRoundTrips = 100000;
+static const int kRpcCalls = 20000;
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+// The callback handler keeps the partial message in the read buffer until the whole message arrived.
+static void onCallbackMessage(const ConnectionPtr& conn, ByteBuffer& buffer) {
+    while (buffer.unreadBytes() >= sizeof(uint32_t)) {
+        uint32_t len = 0;
+        memcpy(&len, buffer.data(), sizeof(len));
+        len = ntohl(len);
+
+        if (buffer.unreadBytes() < sizeof(len) + len) {
+            break;
+        }
+
+        conn->send(buffer.data(), sizeof(len) + len);
+
+        ByteBufferedReader reader(buffer);
+        reader.remove(sizeof(len) + len);
+    }
+}
+
+// The coroutine handler reads the header and the body straight line.
+static CoTask<void> echoSession(ConnectionPtr conn) {
+    while (true) {
+        std::string header = co_await asyncRead(conn, sizeof(uint32_t));
+        if (header.empty()) {
+            break;
+        }
+
+        uint32_t len = 0;
+        memcpy(&len, header.data(), sizeof(len));
+        len = ntohl(len);
+
+        std::string body = co_await asyncRead(conn, len);
+        if (body.empty()) {
+            break;
+        }
+
+        if (!co_await asyncWrite(conn, header + body)) {
+            break;
+        }
+    }
+}
+
+static void onCoroutineConnection(const ConnectionPtr& conn) {
+    coSpawn(conn->getEventLoop(), echoSession(conn));
+}
+
+static void startServer(unsigned int port, bool coroutine) {
+    ServerAddress address = { kServerAddr, port };
+    Server* server = new Server(coroutine ? "coroutine-server" : "callback-server", address, 1);
+
+    if (coroutine) {
+        server->setConnectionCallback(&onCoroutineConnection);
+    } else {
+        server->setMessageCallback(&onCallbackMessage);
+    }
+
+    // The servers run until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+}
+
+static void benchEcho(unsigned int port, const char* name) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+        printf("[%s] connect failed\n", name);
+        close(fd);
+        return;
+    }
+
+    const std::string body(64, 'x');
+    uint32_t len = htonl(body.size());
+    std::string message(reinterpret_cast<const char*>(&len), sizeof(len));
+    message += body;
+
+    char response[128];
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < kRoundTrips; ++ i) {
+        if (send(fd, message.data(), message.size(), 0) != static_cast<ssize_t>(message.size())) {
+            break;
+        }
+
+        size_t received = 0;
+        while (received < message.size()) {
+            ssize_t n = recv(fd, response + received, message.size() - received, 0);
+            if (n <= 0) {
+                printf("[%s] recv failed\n", name);
+                close(fd);
+                return;
+            }
+
+            received += n;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[%s] round trips/s: %.0f avg: %.2fus\n", name, kRoundTrips / seconds, seconds * 1e6 / kRoundTrips);
+
+    close(fd);
+}
+
+class EchoServiceImpl : public EchoService {
+public:
+    virtual void Echo(::google::protobuf::RpcController* controller,
+                        const ::atp::EchoRequest* request,
+                        ::atp::EchoResponse* response,
+                        ::google::protobuf::Closure* done) {
+        response->set_message(request->message());
+        done->Run();
+    }
+};
+
+static std::atomic<bool> rpc_done(false);
+
+static CoTask<int> rpcCalls(EventLoop* loop, EchoService_Stub* stub) {
+    int failed = 0;
+
+    for (int i = 0; i < kRpcCalls; ++ i) {
+        EchoRequest request;
+        EchoResponse response;
+        RpcController controller;
+
+        request.set_message("hello");
+        controller.setTimeout(3000);
+
+        co_await asyncRpcCall(loop, [&](::google::protobuf::Closure* done) {
+            stub->Echo(&controller, &request, &response, done);
+        });
+
+        if (controller.Failed() || response.message() != "hello") {
+            ++ failed;
+        }
+    }
+
+    co_return failed;
+}
+
+static CoTask<void> benchRpc(EventLoop* loop, EchoService_Stub* stub) {
+    auto start = std::chrono::steady_clock::now();
+
+    int failed = co_await rpcCalls(loop, stub);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The sleep resumes in the event loop too.
+    auto sleep_start = std::chrono::steady_clock::now();
+    co_await asyncSleep(loop, 10);
+    double slept = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sleep_start).count();
+
+    printf("[rpc coroutine] sequential calls/s: %.0f failed: %d sleep(10ms): %.1fms\n",
+        kRpcCalls / seconds, failed, slept);
+
+    rpc_done.store(true);
+}
+
+int main() {
+    atp_logger_init();
+
+    startServer(kCallbackPort, false);
+    startServer(kCoroutinePort, true);
+
+    RpcServer* rpc_server = new RpcServer(kServerAddr, kRpcPort);
+    rpc_server->registerService(new EchoServiceImpl());
+    std::thread([rpc_server]() {
+        rpc_server->start();
+    }).detach();
+
+    sleep(1);
+
+    benchEcho(kCallbackPort, "callback");
+    benchEcho(kCoroutinePort, "coroutine");
+
+    RpcClientPool pool(1, RPC_BALANCE_LEAST_OUTSTANDING, 1);
+    pool.addBackend(kServerAddr, kRpcPort);
+    pool.start();
+
+    while (pool.getAvailableConnections() < 1) {
+        usleep(10000);
+    }
+
+    EchoService_Stub stub(&pool);
+
+    EventLoopThread loop_thread;
+    loop_thread.start();
+
+    coSpawn(loop_thread.getEventLoop(), benchRpc(loop_thread.getEventLoop(), &stub));
+
+    while (!rpc_done.load()) {
+        usleep(10000);
+    }
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -1,8 +1,26 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "net/atp_libevent.h"
 #include "net/atp_event_loop.h"
+#include "net/atp_cycle_timer.h"
 #include "glog/logging.h"
 
 using namespace atp;
 
+/*
+ * The timer benchmark, schedules 1M timers to the event loop timer queue, cancels half of them and
+ * fires the others, compares with one libevent timer event per timer. Then measures the lateness
+ * of the sub millisecond timers.
+ */
+
+static const int kTimers = 1000000;
+
 void atp_logger_init() {
     FLAGS_alsologtostderr = true;                                                
     FLAGS_colorlogtostderr = true;
@@ -17,16 +35,209 @@ void atp_logger_close() {
     google::ShutdownGoogleLogging();
 }
 
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct FireStats {
+    EventLoop* loop_;
+    int expected_;
+    int fired_;
+    int64_t total_late_ns_;
+    int64_t max_late_ns_;
+
+    // The timers expired before the loop dispatched are late from the dispatch.
+    int64_t dispatch_ns_;
+};
+
+static void onFired(FireStats* stats, int64_t deadline_ns) {
+    int64_t late = nowNs() - std::max(deadline_ns, stats->dispatch_ns_);
+    stats->total_late_ns_ += late;
+    stats->max_late_ns_ = std::max(stats->max_late_ns_, late);
+
+    if (++ stats->fired_ == stats->expected_) {
+        stats->loop_->stop();
+    }
+}
+
+static std::vector<int64_t> randomDelaysUs(int n, int64_t min_us, int64_t max_us) {
+    std::mt19937 random(2019);
+    std::uniform_int_distribution<int64_t> dist(min_us, max_us);
+
+    std::vector<int64_t> delays(n);
+    for (int i = 0; i < n; ++ i) {
+        delays[i] = dist(random);
+    }
+
+    return delays;
+}
+
+static void benchTimerQueue() {
+    EventLoop loop;
+    FireStats stats = { &loop, kTimers / 2, 0, 0, 0, 0 };
+    std::vector<int64_t> delays = randomDelaysUs(kTimers, 100000, 1100000);
+    std::vector<TimerId> ids(kTimers);
+
+    int64_t start = nowNs();
+    for (int i = 0; i < kTimers; ++ i) {
+        int64_t deadline = start + delays[i] * 1000;
+        FireStats* s = &stats;
+        ids[i] = loop.addTimerTask(delays[i], [s, deadline]() {
+            onFired(s, deadline);
+        });
+    }
+
+    int64_t added = nowNs();
+    for (int i = 0; i < kTimers; i += 2) {
+        loop.cancelTimerTask(ids[i]);
+    }
+
+    int64_t canceled = nowNs();
+
+    // The second cancel of the same id is ignored.
+    for (int i = 0; i < kTimers; i += 2) {
+        loop.cancelTimerTask(ids[i]);
+    }
+
+    stats.dispatch_ns_ = nowNs();
+    loop.dispatch();
+
+    printf("[timer queue] add: %.0fns/timer cancel: %.0fns/timer fired: %d avg late: %.0fus max late: %.0fus\n",
+        static_cast<double>(added - start) / kTimers, static_cast<double>(canceled - added) / (kTimers / 2),
+        stats.fired_, stats.total_late_ns_ / 1000.0 / stats.fired_, stats.max_late_ns_ / 1000.0);
+}
+
+struct LibeventTimer {
+    struct event* event_;
+    FireStats* stats_;
+    int64_t deadline_ns_;
+};
+
+static void onLibeventTimer(int fd, short which, void* args) {
+    LibeventTimer* timer = static_cast<LibeventTimer*>(args);
+    onFired(timer->stats_, timer->deadline_ns_);
+}
+
+// The previous CycleTimer owned a libevent timer event each, besides its shared_ptr and functors.
+static void benchLibeventTimers() {
+    EventLoop loop;
+    FireStats stats = { &loop, kTimers / 2, 0, 0, 0, 0 };
+    std::vector<int64_t> delays = randomDelaysUs(kTimers, 100000, 1100000);
+    std::vector<LibeventTimer> timers(kTimers);
+
+    int64_t start = nowNs();
+    for (int i = 0; i < kTimers; ++ i) {
+        LibeventTimer& timer = timers[i];
+        timer.stats_ = &stats;
+        timer.deadline_ns_ = start + delays[i] * 1000;
+        timer.event_ = evtimer_new(loop.getEventBase(), &onLibeventTimer, &timer);
+
+        struct timeval tv = { static_cast<time_t>(delays[i] / 1000000), static_cast<suseconds_t>(delays[i] % 1000000) };
+        evtimer_add(timer.event_, &tv);
+    }
+
+    int64_t added = nowNs();
+    for (int i = 0; i < kTimers; i += 2) {
+        evtimer_del(timers[i].event_);
+    }
+
+    int64_t canceled = nowNs();
+
+    stats.dispatch_ns_ = nowNs();
+    loop.dispatch();
+
+    for (int i = 0; i < kTimers; ++ i) {
+        event_free(timers[i].event_);
+    }
+
+    printf("[libevent timer] add: %.0fns/timer cancel: %.0fns/timer fired: %d avg late: %.0fus max late: %.0fus\n",
+        static_cast<double>(added - start) / kTimers, static_cast<double>(canceled - added) / (kTimers / 2),
+        stats.fired_, stats.total_late_ns_ / 1000.0 / stats.fired_, stats.max_late_ns_ / 1000.0);
+}
+
+// The timers 100us to 900us apart, the precise timer fires them without rounding to ms.
+static void benchSubMillisecond() {
+    const int timers = 1000;
+
+    EventLoop loop;
+    FireStats stats = { &loop, timers, 0, 0, 0, 0 };
+    std::vector<int64_t> delays = randomDelaysUs(timers, 100, 900);
+
+    int64_t base = 0;
+    for (int i = 0; i < timers; ++ i) {
+        base += delays[i];
+        int64_t deadline = nowNs() + base * 1000;
+        FireStats* s = &stats;
+        loop.addTimerTask(base, [s, deadline]() {
+            onFired(s, deadline);
+        });
+    }
+
+    stats.dispatch_ns_ = nowNs();
+    loop.dispatch();
+
+    printf("[sub ms timer] fired: %d avg late: %.1fus max late: %.1fus\n",
+        stats.fired_, stats.total_late_ns_ / 1000.0 / stats.fired_, stats.max_late_ns_ / 1000.0);
+}
+
+// The cached event loop time in a callback against the steady clock call.
+static void benchCachedClock() {
+    const int calls = 10000000;
+
+    EventLoop loop;
+    loop.addTimerTask(0, [&loop, calls]() {
+        int64_t sum = 0;
+
+        int64_t start = nowNs();
+        for (int i = 0; i < calls; ++ i) {
+            sum += loop.now();
+        }
+
+        int64_t cached = nowNs();
+        for (int i = 0; i < calls; ++ i) {
+            sum += nowNs();
+        }
+
+        int64_t end = nowNs();
+
+        printf("[clock] EventLoop::now: %.1fns steady_clock: %.1fns (%lld)\n",
+            static_cast<double>(cached - start) / calls, static_cast<double>(end - cached) / calls,
+            static_cast<long long>(sum & 1));
+
+        loop.stop();
+    });
+
+    loop.dispatch();
+}
+
 int main() {
     atp_logger_init();
-    LOG(INFO) << "test";
+
+    benchCachedClock();
+
+    benchTimerQueue();
+    benchLibeventTimers();
+    benchSubMillisecond();
+
+    // The persist cycle timer is canceled by the handle, and the one shot timer stops the loop.
     {
-        std::unique_ptr<EventLoop> event_loop(new EventLoop());
-        event_loop->addCycleTask(5, []() {
-            LOG(INFO) << "timedout";
+        EventLoop loop;
+        int ticks = 0;
+        std::shared_ptr<CycleTimer> timer = loop.addCycleTask(10, [&ticks]() {
+            ++ ticks;
         }, true);
 
-        event_loop->dispatch();
+        loop.addCycleTask(105, [&loop, timer]() {
+            timer->cancel();
+            loop.addCycleTask(50, [&loop]() {
+                loop.stop();
+            }, false);
+        }, false);
+
+        loop.dispatch();
+
+        printf("[cycle timer] ticks in 105ms: %d\n", ticks);
     }
 
     atp_logger_close();
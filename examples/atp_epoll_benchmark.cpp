@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "net/atp_tcp_server.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The same echo server on the libevent and the native epoll event loop. The client keeps one small message
+ * in flight on each of the connections, so the event loop dispatch cost is a large part of each request.
+ * Each message size runs on both backends in turn, the best of kRepeats is printed. The client shares the
+ * CPU with the servers, so the server IO thread CPU time per request is printed too.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kLibeventPort = 7841;
+static const unsigned int kEpollPort = 7842;
+static const int kConnections = 64;
+static const int kRounds = 2000;
+static const int kRepeats = 3;
+static const size_t kMessageSizes[] = { 16, 64, 256 };
+
+struct BenchResult {
+    double requests_per_second_;
+    double cpu_ns_per_request_;
+};
+
+static std::atomic<EventLoop*> io_event_loops[3];
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static void onEchoMessage(const ConnectionPtr& conn, ByteBuffer& buffer) {
+    conn->send(&buffer);
+}
+
+static void startServer(unsigned int port, IOBackend io_backend) {
+    ServerAddress address = { kServerAddr, port };
+    Server* server = new Server(io_backend == IO_BACKEND_EPOLL ? "epoll-server" : "libevent-server",
+        address, 1, io_backend);
+
+    server->setMessageCallback(&onEchoMessage);
+    server->setConnectionCallback([io_backend](const ConnectionPtr& conn) {
+        io_event_loops[io_backend].store(conn->getEventLoop());
+    });
+
+    // The servers run until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+}
+
+static bool connectAll(unsigned int port, std::vector<int>* fds) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    for (int i = 0; i < kConnections; ++ i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+            close(fd);
+            return false;
+        }
+
+        fds->push_back(fd);
+    }
+
+    return true;
+}
+
+// The CPU time ns of the event loop thread, read in the event loop.
+static int64_t threadCpuNs(EventLoop* event_loop) {
+    std::promise<int64_t> promise;
+    event_loop->sendToQueue([&promise]() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        promise.set_value(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+    });
+
+    return promise.get_future().get();
+}
+
+// The requests per second is 0 if the connection failed.
+static BenchResult benchEcho(const std::vector<int>& fds, IOBackend io_backend, size_t message_size) {
+    const std::string message(message_size, 'x');
+    std::vector<char> response(message_size);
+    BenchResult result = { 0, 0 };
+
+    EventLoop* event_loop = io_event_loops[io_backend].load();
+    int64_t cpu_start = threadCpuNs(event_loop);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < kRounds; ++ round) {
+        for (int fd : fds) {
+            if (send(fd, message.data(), message.size(), 0) != static_cast<ssize_t>(message.size())) {
+                return result;
+            }
+        }
+
+        for (int fd : fds) {
+            size_t received = 0;
+            while (received < message.size()) {
+                ssize_t n = recv(fd, &response[received], message.size() - received, 0);
+                if (n <= 0) {
+                    return result;
+                }
+
+                received += n;
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double requests = static_cast<double>(kConnections) * kRounds;
+
+    result.requests_per_second_ = requests / seconds;
+    result.cpu_ns_per_request_ = (threadCpuNs(event_loop) - cpu_start) / requests;
+
+    return result;
+}
+
+int main() {
+    atp_logger_init();
+
+    startServer(kLibeventPort, IO_BACKEND_LIBEVENT);
+    startServer(kEpollPort, IO_BACKEND_EPOLL);
+
+    sleep(1);
+
+    std::vector<int> libevent_fds;
+    std::vector<int> epoll_fds;
+    if (!connectAll(kLibeventPort, &libevent_fds) || !connectAll(kEpollPort, &epoll_fds)) {
+        printf("connect failed\n");
+        _exit(1);
+    }
+
+    while (io_event_loops[IO_BACKEND_LIBEVENT].load() == nullptr || io_event_loops[IO_BACKEND_EPOLL].load() == nullptr) {
+        usleep(1000);
+    }
+
+    // Warm up the connections and the buffers.
+    benchEcho(libevent_fds, IO_BACKEND_LIBEVENT, kMessageSizes[0]);
+    benchEcho(epoll_fds, IO_BACKEND_EPOLL, kMessageSizes[0]);
+
+    for (size_t size : kMessageSizes) {
+        BenchResult libevent_best = { 0, 0 };
+        BenchResult epoll_best = { 0, 0 };
+
+        for (int i = 0; i < kRepeats; ++ i) {
+            BenchResult libevent = benchEcho(libevent_fds, IO_BACKEND_LIBEVENT, size);
+            if (libevent.requests_per_second_ > libevent_best.requests_per_second_) {
+                libevent_best = libevent;
+            }
+
+            BenchResult epoll = benchEcho(epoll_fds, IO_BACKEND_EPOLL, size);
+            if (epoll.requests_per_second_ > epoll_best.requests_per_second_) {
+                epoll_best = epoll;
+            }
+        }
+
+        printf("[%4zu bytes] libevent requests/s: %.0f cpu ns/request: %.0f || epoll requests/s: %.0f cpu ns/request: %.0f\n",
+            size, libevent_best.requests_per_second_, libevent_best.cpu_ns_per_request_,
+            epoll_best.requests_per_second_, epoll_best.cpu_ns_per_request_);
+    }
+
+    fflush(stdout);
+    _exit(0);
+}
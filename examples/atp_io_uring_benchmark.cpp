@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "net/atp_io_uring.h"
+#include "net/atp_tcp_server.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The same echo server on the libevent and the io_uring backend. The client keeps one message in flight
+ * on each of the connections, so one loop iteration of the server handles many connections.
+ *
+ * The io_uring backend prints its io_uring_enter calls per request. To compare all the syscalls of both
+ * backends, run it under: strace -f -c -e trace=epoll_wait,read,readv,recvfrom,sendto,io_uring_enter
+ * the libevent backend costs one readv and one send per request, the io_uring backend one epoll_wait,
+ * one eventfd read and one io_uring_enter per loop iteration.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kLibeventPort = 7831;
+static const unsigned int kIoUringPort = 7832;
+static const int kConnections = 64;
+static const int kRounds = 2000;
+static const size_t kMessageSize = 64;
+
+struct BackendStats {
+    EventLoop* event_loop_;
+    std::atomic<IoUring*> io_uring_;
+    std::atomic<int> connections_;
+};
+
+static BackendStats backend_stats[2];
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static void onEchoMessage(const ConnectionPtr& conn, ByteBuffer& buffer) {
+    conn->send(&buffer);
+}
+
+static void startServer(unsigned int port, IOBackend io_backend) {
+    ServerAddress address = { kServerAddr, port };
+    Server* server = new Server(io_backend == IO_BACKEND_IO_URING ? "io-uring-server" : "libevent-server",
+        address, 1, io_backend);
+
+    BackendStats* stats = &backend_stats[io_backend];
+    server->setMessageCallback(&onEchoMessage);
+    server->setConnectionCallback([stats, io_backend](const ConnectionPtr& conn) {
+        // The connection callback runs in the IO event loop, the io_uring is already created.
+        stats->event_loop_ = conn->getEventLoop();
+        if (io_backend == IO_BACKEND_IO_URING && conn->getEventLoop()->getIoUring() != nullptr) {
+            stats->io_uring_.store(conn->getEventLoop()->getIoUring());
+        }
+
+        ++ stats->connections_;
+    });
+
+    // The servers run until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+}
+
+// The counters are read in the event loop, returns enter calls, submitted requests and completions.
+static std::vector<uint64_t> snapshot(BackendStats* stats) {
+    IoUring* io_uring = stats->io_uring_.load();
+    if (io_uring == nullptr) {
+        return std::vector<uint64_t>(3, 0);
+    }
+
+    std::promise<std::vector<uint64_t>> promise;
+    stats->event_loop_->sendToQueue([io_uring, &promise]() {
+        promise.set_value({ io_uring->getEnterCalls(), io_uring->getSubmittedRequests(), io_uring->getCompletions() });
+    });
+
+    return promise.get_future().get();
+}
+
+static void benchEcho(unsigned int port, IOBackend io_backend, const char* name) {
+    BackendStats* stats = &backend_stats[io_backend];
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    std::vector<int> fds;
+    for (int i = 0; i < kConnections; ++ i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+            printf("[%s] connect failed\n", name);
+            close(fd);
+            return;
+        }
+
+        fds.push_back(fd);
+    }
+
+    while (stats->connections_.load() < kConnections) {
+        usleep(1000);
+    }
+
+    if (io_backend == IO_BACKEND_IO_URING && stats->io_uring_.load() == nullptr) {
+        printf("[%s] the kernel has no io_uring, the server fell back to libevent\n", name);
+    }
+
+    const std::string message(kMessageSize, 'x');
+    char response[kMessageSize];
+
+    std::vector<uint64_t> before = snapshot(stats);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int round = 0; round < kRounds; ++ round) {
+        for (int fd : fds) {
+            if (send(fd, message.data(), message.size(), 0) != static_cast<ssize_t>(message.size())) {
+                printf("[%s] send failed\n", name);
+                return;
+            }
+        }
+
+        for (int fd : fds) {
+            size_t received = 0;
+            while (received < message.size()) {
+                ssize_t n = recv(fd, response + received, message.size() - received, 0);
+                if (n <= 0) {
+                    printf("[%s] recv failed\n", name);
+                    return;
+                }
+
+                received += n;
+            }
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<uint64_t> after = snapshot(stats);
+
+    double requests = static_cast<double>(kConnections) * kRounds;
+    printf("[%s] requests/s: %.0f", name, requests / seconds);
+    if (stats->io_uring_.load() != nullptr) {
+        printf(" io_uring_enter/request: %.3f sqes/request: %.3f cqes/request: %.3f",
+            (after[0] - before[0]) / requests, (after[1] - before[1]) / requests, (after[2] - before[2]) / requests);
+    }
+
+    printf("\n");
+
+    for (int fd : fds) {
+        close(fd);
+    }
+}
+
+int main() {
+    atp_logger_init();
+
+    startServer(kLibeventPort, IO_BACKEND_LIBEVENT);
+    startServer(kIoUringPort, IO_BACKEND_IO_URING);
+
+    sleep(1);
+
+    benchEcho(kLibeventPort, IO_BACKEND_LIBEVENT, "libevent");
+    benchEcho(kIoUringPort, IO_BACKEND_IO_URING, "io_uring");
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -1,3 +1,10 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
 #include "glog/logging.h"
 #include "atp_memory_pool.h"
 
@@ -31,6 +38,178 @@ void print_pool_helper_info(pool_helper_t* helper) {
     LOG(INFO) << "Pool helper cap: " << get_pool_helper_capacity(helper);
 }
 
+/* The per thread create/alloc/release loop, each pool serves a few small allocations like one request */
+const int kLoopCount = 200000;
+const int kAllocCount = 8;
+const int kPoolsInFlight = 4;
+
+static void bench_pool_worker(pool_helper_t* helper) {
+    pool_factory_t* factory = get_pool_helper_factory(helper);
+    pool_t* pools[kPoolsInFlight] = { NULL };
+
+    for (int i = 0; i < kLoopCount; ++ i) {
+        int slot = i % kPoolsInFlight;
+        if (pools[slot]) {
+            release_pool(pools[slot], factory);
+        }
+
+        pools[slot] = create_pool(factory, "bench", 4096, 4096);
+        for (int j = 0; j < kAllocCount; ++ j) {
+            char* buf = static_cast<char*>(pool_alloc(pools[slot], 64 + j * 32));
+            buf[0] = 'a';
+        }
+    }
+
+    for (int i = 0; i < kPoolsInFlight; ++ i) {
+        if (pools[i]) {
+            release_pool(pools[i], factory);
+        }
+    }
+}
+
+static void bench_malloc_worker() {
+    void* mems[kAllocCount];
+
+    for (int i = 0; i < kLoopCount; ++ i) {
+        for (int j = 0; j < kAllocCount; ++ j) {
+            mems[j] = malloc(64 + j * 32);
+            static_cast<char*>(mems[j])[0] = 'a';
+        }
+
+        for (int j = 0; j < kAllocCount; ++ j) {
+            free(mems[j]);
+        }
+    }
+}
+
+static double bench_run(int threads, pool_helper_t* helper) {
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < threads; ++ i) {
+        if (helper) {
+            workers.emplace_back(bench_pool_worker, helper);
+        } else {
+            workers.emplace_back(bench_malloc_worker);
+        }
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return (double)threads * kLoopCount / seconds;
+}
+
+static void bench_pool_helper(bool thread_cache) {
+    const int thread_counts[] = { 1, 2, 4, 8 };
+
+    for (int threads : thread_counts) {
+        pool_helper_t* helper = create_pool_helper();
+        pool_helper_init(helper, NULL, kMaxCapacity);
+        pool_helper_enable_thread_cache(helper, thread_cache);
+
+        double ops = bench_run(threads, helper);
+
+        pool_helper_stats_t stats;
+        get_pool_helper_stats(helper, &stats);
+
+        printf("[pool %-11s] threads: %d create/release per second: %.0f allocs: %zu hits: %zu misses: %zu refills: %zu flushes: %zu\n",
+            thread_cache ? "cache" : "no cache", threads, ops, stats.pool_allocs_, stats.cache_hits_,
+            stats.cache_misses_, stats.cache_refills_, stats.cache_flushes_);
+
+        pool_helper_destroy(helper);
+    }
+}
+
+/* The long lived pool grows hundreds of chunks, the allocation must not walk all of them */
+static void bench_long_lived_pool() {
+    const int alloc_count = 1000000;
+
+    pool_helper_t* helper = create_pool_helper();
+    pool_helper_init(helper, NULL, kMaxCapacity);
+
+    pool_t* pl = create_pool(get_pool_helper_factory(helper), "long-lived", 4096, 4096);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < alloc_count; ++ i) {
+        /* The mixed sizes leave the old chunks nearly full, every 64th is a large allocation */
+        size_t size = (i % 64 == 0) ? 8192 : 24 + (i % 7) * 40;
+        char* buf = static_cast<char*>(pool_alloc(pl, size));
+        buf[0] = 'a';
+
+        if (size > ATP_MEMORY_POOL_LARGE_SIZE && (i % 128 == 0)) {
+            pool_free(pl, buf);
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[long lived pool ] allocs per second: %.0f pool capacity: %zu\n", alloc_count / seconds, get_pool_capacity(pl));
+
+    release_pool(pl, get_pool_helper_factory(helper));
+    pool_helper_destroy(helper);
+}
+
+/* The random access over a large pool footprint, the huge page policies reduce the TLB misses */
+static void bench_policy(const char* name, const pool_factory_policy_t* policy) {
+    const int pool_count = 2048;
+    const size_t pool_size = 65535;
+    const int access_count = 20000000;
+
+    pool_helper_t* helper = create_pool_helper();
+    pool_helper_init(helper, policy, kMaxCapacity);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<pool_t*> pools;
+    std::vector<unsigned char*> blocks;
+    for (int i = 0; i < pool_count; ++ i) {
+        pool_t* pl = create_pool(get_pool_helper_factory(helper), "policy", pool_size, 4096);
+        pools.push_back(pl);
+
+        for (int j = 0; j < 15; ++ j) {
+            unsigned char* buf = static_cast<unsigned char*>(pool_alloc(pl, 4000));
+            memset(buf, j, 4000);
+            blocks.push_back(buf);
+        }
+    }
+
+    double alloc_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+
+    size_t sum = 0;
+    unsigned int seed = 12345;
+    for (int i = 0; i < access_count; ++ i) {
+        seed = seed * 1103515245 + 12345;
+        sum += blocks[(seed >> 8) % blocks.size()][(seed >> 4) & 2047];
+    }
+
+    double access_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[policy %-9s] alloc and touch: %.3fs random access per second: %.0f (check %zu)\n",
+        name, alloc_seconds, access_count / access_seconds, sum);
+
+    for (pool_t* pl : pools) {
+        release_pool(pl, get_pool_helper_factory(helper));
+    }
+
+    pool_helper_destroy(helper);
+}
+
+static void bench_malloc() {
+    const int thread_counts[] = { 1, 2, 4, 8 };
+
+    for (int threads : thread_counts) {
+        printf("[malloc/free     ] threads: %d rounds per second: %.0f\n", threads, bench_run(threads, NULL));
+    }
+}
+
 int main() {
     atp_logger_init();
     pool_helper_t* helper = create_pool_helper();
@@ -74,6 +253,15 @@ int main() {
 
     pool_helper_destroy(helper);
 
+    bench_pool_helper(true);
+    bench_pool_helper(false);
+    bench_malloc();
+    bench_long_lived_pool();
+
+    bench_policy("calloc", get_factory_default_policy());
+    bench_policy("mmap", get_factory_mmap_policy());
+    bench_policy("dontneed", get_factory_mmap_dontneed_policy());
+
     atp_logger_close();
 
     return 0;
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "net/atp_config.h"
+#include "net/atp_channel.h"
+#include "net/atp_tcp_conn.h"
+#include "net/atp_tcp_server.h"
+#include "net/atp_timing_wheel.hpp"
+#include "net/atp_object_pool.hpp"
+
+using namespace atp;
+
+/*
+ * The object pool benchmark, the connection setup/teardown over loopback and the allocations of the
+ * hot objects with the pool. Build with ENABLED_OBJECT_POOL 0 in atp_config.h for the numbers before.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kServerPort = 7799;
+static const int kConnections = 20000;
+static const int kObjectRounds = 1000000;
+
+void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+template <typename T>
+static void print_stats(const char* name, bool shared) {
+    ObjectPoolStats stats = shared ? ObjectPool<T>::getSharedStats() : ObjectPool<T>::getStats();
+    printf("    %-12s allocs: %zu frees: %zu remote frees: %zu news: %zu deletes: %zu shards: %zu\n",
+        name, stats.allocs_, stats.frees_, stats.remote_frees_, stats.news_, stats.deletes_, stats.shards_);
+}
+
+/* Connect and reset the connection, the server creates and destroys a Connection, Channel and event each time. */
+static void bench_connection() {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kServerPort);
+    inet_pton(AF_INET, kServerAddr, &addr.sin_addr);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < kConnections; ++ i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror("connect");
+            ::close(fd);
+            return;
+        }
+
+        // The listener defers the accept until the data arrived.
+        char request = 'a';
+        if (write(fd, &request, 1) != 1) {
+            perror("write");
+        }
+
+        // Reset instead of FIN, no TIME_WAIT on the client ports.
+        struct linger lin = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+        ::close(fd);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[connection setup/teardown] object pool: %d connections per second: %.0f\n",
+        ENABLED_OBJECT_POOL, kConnections / seconds);
+}
+
+/* The objects allocated by one thread and freed by another, like the Connection accepted and closed in different loops. */
+static void bench_remote_free() {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<EntryPtr> queue;
+    bool done = false;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread consumer([&]() {
+        std::vector<EntryPtr> batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]() { return !queue.empty() || done; });
+                if (queue.empty() && done) {
+                    break;
+                }
+
+                batch.swap(queue);
+            }
+
+            batch.clear();
+        }
+    });
+
+    for (int i = 0; i < kObjectRounds; ++ i) {
+        EntryPtr entry = ENABLED_OBJECT_POOL ? ObjectPool<Entry>::makeShared(WeakConnectionPtr())
+                                             : std::make_shared<Entry>(WeakConnectionPtr());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(entry);
+        if (queue.size() >= 64) {
+            cond.notify_one();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+
+    cond.notify_one();
+    consumer.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[entry remote free        ] object pool: %d objects per second: %.0f\n", ENABLED_OBJECT_POOL, kObjectRounds / seconds);
+}
+
+static void bench_channel() {
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < kObjectRounds; ++ i) {
+        Channel* channel = new Channel(nullptr, 1, false, false);
+        channel->close();
+        delete channel;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[channel new/delete       ] object pool: %d objects per second: %.0f\n", ENABLED_OBJECT_POOL, kObjectRounds / seconds);
+}
+
+int main() {
+    atp_logger_init();
+
+    ServerAddress srvaddr = {
+        .addr_ = std::string(kServerAddr),
+        .port_ = kServerPort,
+    };
+
+    // The server runs until the process exit.
+    Server* server = new Server("object-pool-server", srvaddr, 2);
+    server->setConnectionCallback([](const ConnectionPtr& conn) {});
+    server->setMessageCallback([](const ConnectionPtr& conn, ByteBuffer& buff) {});
+
+    std::thread([server]() {
+        server->start();
+    }).detach();
+
+    sleep(1);
+
+    bench_connection();
+    bench_connection();
+
+    bench_channel();
+    bench_remote_free();
+
+    sleep(1);
+
+    printf("object pool stats:\n");
+    print_stats<Connection>("Connection", true);
+    print_stats<Channel>("Channel", false);
+    print_stats<struct event>("event", false);
+    print_stats<Entry>("Entry", true);
+
+    fflush(stdout);
+    _exit(0);
+}
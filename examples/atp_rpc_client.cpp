@@ -61,6 +61,7 @@ int main() {
     core_message.set_id(10011);
     core_message.set_service("atp.EchoService");
     core_message.set_method("Echo");
+    core_message.set_timeout_ms(3000);
 
     request.set_message("Hello,World!");
     request.SerializeToString(&req_message);
@@ -68,6 +69,10 @@ int main() {
     core_message.set_request(req_message);    
     core_message.SerializeToString(&message);
 
+    // The rpc frame is [4 bytes length | RpcMessage].
+    uint32_t length = htonl(message.size());
+    message.insert(0, reinterpret_cast<const char*>(&length), sizeof(length));
+
     sleep(5);
     ret = send(fd, message.c_str(), message.size(), 0);
     if (ret == message.size()) {
@@ -84,7 +89,7 @@ int main() {
         LOG(ERROR) << "Recv message failed: " << strerror(errno);
     }
 
-    r1.ParseFromArray(buff, ret);
+    r1.ParseFromArray(buff + sizeof(uint32_t), ret - sizeof(uint32_t));
 
     LOG(INFO) << "===111==" << r1.id();
     LOG(INFO) << "===222==" << r1.type();
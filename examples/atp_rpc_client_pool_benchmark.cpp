@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <condition_variable>
+
+#include "echo_server.pb.h"
+#include "app/atp_rpc_server.h"
+#include "app/atp_rpc_controller.h"
+#include "app/atp_rpc_client_pool.h"
+#include "net/atp_memory_stats.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The rpc client pool benchmark with in-process backends, keeps a fixed number of calls in flight,
+ * removes one backend in the middle and adds it back, the draining must not fail any call.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kServerPorts[] = { 7801, 7802, 7803 };
+static const int kServerSize = sizeof(kServerPorts) / sizeof(kServerPorts[0]);
+static const int kConcurrency = 64;
+static const int kPhaseSeconds = 2;
+
+class EchoServiceImpl : public EchoService {
+public:
+    virtual void Echo(::google::protobuf::RpcController* controller,
+                        const ::atp::EchoRequest* request,
+                        ::atp::EchoResponse* response,
+                        ::google::protobuf::Closure* done) {
+        // Simulate the backend work, so the outstanding calls on each connection differ.
+        usleep(200);
+
+        response->set_message(request->message());
+        done->Run();
+    }
+};
+
+struct EchoCall {
+    EchoRequest request;
+    EchoResponse response;
+    RpcController controller;
+};
+
+static std::mutex mutex;
+static std::condition_variable cond;
+static int inflight = 0;
+static std::atomic<uint64_t> succeeded(0);
+static std::atomic<uint64_t> failed(0);
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static void onEchoDone(EchoCall* call) {
+    if (call->controller.Failed()) {
+        ++ failed;
+    } else {
+        ++ succeeded;
+    }
+
+    delete call;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    -- inflight;
+    cond.notify_one();
+}
+
+static void runPhase(EchoService_Stub* stub, const char* name) {
+    uint64_t start_succeeded = succeeded.load();
+    uint64_t start_failed = failed.load();
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(kPhaseSeconds);
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, []() { return inflight < kConcurrency; });
+            ++ inflight;
+        }
+
+        EchoCall* call = new EchoCall();
+        call->request.set_message("hello");
+        call->controller.setTimeout(3000);
+
+        stub->Echo(&call->controller, &call->request, &call->response,
+            ::google::protobuf::NewCallback(&onEchoDone, call));
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[%s] calls/s: %.0f failed: %llu\n", name, (succeeded.load() - start_succeeded) / seconds,
+        static_cast<unsigned long long>(failed.load() - start_failed));
+}
+
+static void runPolicy(RpcBalancePolicy policy, const char* name) {
+    RpcClientPool pool(2, policy, 2);
+    for (int i = 0; i < kServerSize; ++ i) {
+        pool.addBackend(kServerAddr, kServerPorts[i]);
+    }
+
+    pool.start();
+
+    while (pool.getAvailableConnections() < static_cast<size_t>(kServerSize * 2)) {
+        usleep(10000);
+    }
+
+    EchoService_Stub stub(&pool);
+
+    printf("==== %s ====\n", name);
+
+    runPhase(&stub, "all backends");
+
+    pool.removeBackend(kServerAddr, kServerPorts[1]);
+    runPhase(&stub, "draining 7802");
+    printf("%s", pool.dumpStatus().c_str());
+
+    pool.addBackend(kServerAddr, kServerPorts[1]);
+    while (pool.getAvailableConnections() < static_cast<size_t>(kServerSize * 2)) {
+        usleep(10000);
+    }
+
+    runPhase(&stub, "re-added 7802");
+    printf("%s", pool.dumpStatus().c_str());
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, []() { return inflight == 0; });
+
+    // All the calls finished, the rpc calls of every event loop must be back to 0.
+    printf("%s", MemoryStats::dumpText().c_str());
+}
+
+int main() {
+    atp_logger_init();
+
+    // The servers run until the process exit.
+    EchoServiceImpl* echo_service = new EchoServiceImpl();
+    for (int i = 0; i < kServerSize; ++ i) {
+        RpcServer* server = new RpcServer(kServerAddr, kServerPorts[i]);
+        server->registerService(echo_service, RPC_EXECUTE_DEDICATED_POOL, 1024, 4);
+
+        std::thread([server]() {
+            server->start();
+        }).detach();
+    }
+
+    sleep(1);
+
+    runPolicy(RPC_BALANCE_LEAST_OUTSTANDING, "least outstanding");
+    runPolicy(RPC_BALANCE_POWER_OF_TWO, "power of two choices");
+
+    printf("%s\n", MemoryStats::dumpJson().c_str());
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <thread>
+#include <chrono>
+#include <string>
+
+#include "rpc.pb.h"
+#include "echo_server.pb.h"
+#include "app/atp_rpc_server.h"
+#include "app/atp_rpc_compress.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * The rpc payload compression benchmark over loopback, the server and client in the same process,
+ * so the CPU time is both sides cost of serialize, compress, send, receive and decompress.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kServerPort = 7766;
+static const int kRounds = 200;
+
+class EchoServiceImpl : public EchoService {
+public:
+    virtual void Echo(::google::protobuf::RpcController* controller,
+                        const ::atp::EchoRequest* request,
+                        ::atp::EchoResponse* response,
+                        ::google::protobuf::Closure* done) {
+        response->set_message(request->message());
+        done->Run();
+    }
+};
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static double cpuSeconds() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+/* The json like records payload, it is compressible as the real bulk data. */
+static std::string makePayload(size_t size) {
+    std::string payload;
+    payload.reserve(size + 128);
+
+    unsigned int seed = 3399;
+    while (payload.size() < size) {
+        seed = seed * 1103515245 + 12345;
+        payload += "{\"id\":" + std::to_string(seed % 100000) + ",\"name\":\"user-" +
+            std::to_string(seed % 977) + "\",\"score\":" + std::to_string(seed % 100) + "},";
+    }
+
+    payload.resize(size);
+
+    return payload;
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+
+        sent += n;
+    }
+
+    return true;
+}
+
+static bool recvAll(int fd, char* buf, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        ssize_t n = ::recv(fd, buf + received, size - received, 0);
+        if (n <= 0) {
+            return false;
+        }
+
+        received += n;
+    }
+
+    return true;
+}
+
+static int connectServer() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(kServerPort);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    if (connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0) {
+        LOG(ERROR) << "Connect met error: " << strerror(errno);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* One echo round trip, return the request and response bytes on the wire. */
+static size_t echoOnce(int fd, int type, const std::string& payload, uint64_t id) {
+    EchoRequest request;
+    request.set_message(payload);
+
+    std::string body = request.SerializeAsString();
+    std::string compressed;
+
+    RpcMessage message;
+    message.set_type(REQUEST);
+    message.set_id(id);
+    message.set_service("atp.EchoService");
+    message.set_method("Echo");
+    message.set_accept_compress(type == COMPRESS_NONE ? 0 : (1 << type));
+
+    if (type != COMPRESS_NONE && rpcCompress(type, body, &compressed)) {
+        message.set_compress_type(static_cast<RpcCompressType>(type));
+        message.set_request(compressed);
+    } else {
+        message.set_request(body);
+    }
+
+    std::string frame(sizeof(uint32_t), '\0');
+    message.AppendToString(&frame);
+    uint32_t length = htonl(frame.size() - sizeof(uint32_t));
+    memcpy(&frame[0], &length, sizeof(length));
+
+    if (!sendAll(fd, frame)) {
+        return 0;
+    }
+
+    if (!recvAll(fd, reinterpret_cast<char*>(&length), sizeof(length))) {
+        return 0;
+    }
+
+    std::string reply(ntohl(length), '\0');
+    if (!recvAll(fd, &reply[0], reply.size())) {
+        return 0;
+    }
+
+    RpcMessage response;
+    std::string response_body;
+    EchoResponse echo;
+    if (!response.ParseFromString(reply) ||
+        !rpcDecompress(response.compress_type(), response.response(), &response_body) ||
+        !echo.ParseFromString(response_body) || echo.message().size() != payload.size()) {
+        LOG(ERROR) << "Echo response invalid";
+        return 0;
+    }
+
+    return frame.size() + sizeof(length) + reply.size();
+}
+
+int main() {
+    atp_logger_init();
+
+    // The server runs until the process exit, so it is never released.
+    EchoServiceImpl echo_service;
+    RpcServer* server = new RpcServer(kServerAddr, kServerPort);
+    server->registerService(&echo_service);
+    server->setCompression(COMPRESS_LZ4, 1024);
+
+    std::thread server_thread([server]() {
+        server->start();
+    });
+    server_thread.detach();
+
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    const size_t sizes[] = { 1024, 16 * 1024, 128 * 1024, 512 * 1024 };
+    const int types[] = { COMPRESS_NONE, COMPRESS_LZ4, COMPRESS_ZSTD };
+    const char* type_names[] = { "none", "lz4", "zstd" };
+
+    printf("%-10s %-6s %10s %10s %12s %10s %8s\n", "payload", "type", "req/s", "MB/s", "wire B/req", "cpu s", "cpu %");
+
+    for (size_t size : sizes) {
+        std::string payload = makePayload(size);
+
+        for (int type : types) {
+            if (type != COMPRESS_NONE && !(rpcSupportedCompressMask() & (1 << type))) {
+                continue;
+            }
+
+            int fd = connectServer();
+            if (fd < 0) {
+                return -1;
+            }
+
+            size_t wire_bytes = 0;
+            double cpu_begin = cpuSeconds();
+            auto begin = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < kRounds; ++ i) {
+                wire_bytes += echoOnce(fd, type, payload, i + 1);
+            }
+
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            double cpu = cpuSeconds() - cpu_begin;
+
+            printf("%-10zu %-6s %10.0f %10.2f %12zu %10.3f %8.1f\n", size, type_names[type],
+                kRounds / elapsed, (2.0 * size * kRounds) / elapsed / (1024 * 1024),
+                wire_bytes / kRounds, cpu, 100.0 * cpu / elapsed);
+
+            close(fd);
+        }
+    }
+
+    fflush(stdout);
+
+    google::ShutdownGoogleLogging();
+
+    return 0;
+}
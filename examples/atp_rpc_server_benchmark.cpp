@@ -1,6 +1,6 @@
 #include "echo_server.pb.h"
-#include "atp_rpc_server.h"
-#include "atp_rsa_crypto.hpp"
+#include "app/atp_rpc_server.h"
+#include "app/atp_rsa_crypto.hpp"
 #include "glog/logging.h"
 
 using namespace atp;
@@ -43,7 +43,8 @@ int main() {
  
     EchoServiceImpl echo_service;
     RpcServer server("127.0.0.1", 7765);
-    server.registerService(&echo_service);
+    // The echo methods executed in server shared thread pool, at most 1024 requests queued.
+    server.registerService(&echo_service, RPC_EXECUTE_SHARED_POOL, 1024, 0);
     server.start();
 
 //    ::google::protobuf::ShutdownProtobufLibrary();
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "net/atp_tcp_conn.h"
+#include "net/atp_tcp_server.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * Download one file from the server: read into the user memory and send, or sendFile. The server IO
+ * thread CPU time and the throughput are printed for each, the sendFile never copies the file to the user.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const char* kFilePath = "/tmp/atp_sendfile_benchmark.bin";
+static const unsigned int kCopyPort = 7871;
+static const unsigned int kSendFilePort = 7872;
+static const size_t kFileSize = 64 * 1024 * 1024;
+static const int kDownloads = 5;
+
+static std::atomic<EventLoop*> io_event_loops[2];
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static void onCopyConnection(const ConnectionPtr& conn) {
+    io_event_loops[0].store(conn->getEventLoop());
+
+    int fd = open(kFilePath, O_RDONLY);
+    std::string data(kFileSize, '\0');
+    if (pread(fd, &data[0], kFileSize, 0) != static_cast<ssize_t>(kFileSize)) {
+        printf("read the file failed\n");
+    }
+
+    close(fd);
+    conn->send(data.data(), data.size());
+}
+
+static void onSendFileConnection(const ConnectionPtr& conn) {
+    io_event_loops[1].store(conn->getEventLoop());
+
+    int fd = open(kFilePath, O_RDONLY);
+    conn->sendFile(fd, 0, kFileSize, [fd](const ConnectionPtr& conn, bool success) {
+        if (!success) {
+            printf("sendFile failed\n");
+        }
+
+        close(fd);
+    });
+}
+
+static void startServer(unsigned int port, const ConnectionCallback& fn) {
+    ServerAddress address = { kServerAddr, port };
+    Server* server = new Server("sendfile-server", address, 1);
+    server->setConnectionCallback(fn);
+
+    // The servers run until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+}
+
+// The CPU time ns of the event loop thread, read in the event loop.
+static int64_t threadCpuNs(EventLoop* event_loop) {
+    std::promise<int64_t> promise;
+    event_loop->sendToQueue([&promise]() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        promise.set_value(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+    });
+
+    return promise.get_future().get();
+}
+
+static bool download(unsigned int port) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    std::vector<char> buf(256 * 1024);
+    size_t received = 0;
+    while (received < kFileSize) {
+        ssize_t n = recv(fd, &buf[0], buf.size(), 0);
+        if (n <= 0) {
+            break;
+        }
+
+        received += n;
+    }
+
+    close(fd);
+    return received == kFileSize;
+}
+
+static void benchDownload(unsigned int port, int index, const char* name) {
+    // The first download creates the IO event loop connection, it is not measured.
+    if (!download(port)) {
+        printf("[%s] download failed\n", name);
+        return;
+    }
+
+    EventLoop* event_loop = io_event_loops[index].load();
+    int64_t cpu_start = threadCpuNs(event_loop);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < kDownloads; ++ i) {
+        if (!download(port)) {
+            printf("[%s] download failed\n", name);
+            return;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu_ms = (threadCpuNs(event_loop) - cpu_start) / 1000000.0;
+
+    printf("[%s] MB/s: %.0f server cpu ms/download: %.1f\n", name,
+        kFileSize * static_cast<double>(kDownloads) / seconds / (1024 * 1024), cpu_ms / kDownloads);
+}
+
+int main() {
+    atp_logger_init();
+
+    int fd = open(kFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::string block(1024 * 1024, 'x');
+    for (size_t i = 0; i < kFileSize / block.size(); ++ i) {
+        if (write(fd, block.data(), block.size()) != static_cast<ssize_t>(block.size())) {
+            printf("write the file failed\n");
+            _exit(1);
+        }
+    }
+
+    close(fd);
+
+    startServer(kCopyPort, &onCopyConnection);
+    startServer(kSendFilePort, &onSendFileConnection);
+
+    sleep(1);
+
+    benchDownload(kCopyPort, 0, "read + send");
+    benchDownload(kSendFilePort, 1, "sendFile");
+
+    unlink(kFilePath);
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
+
+#include "net/atp_config.h"
+#include "net/atp_dynamic_thread_pool.h"
+
+using namespace atp;
+
+/*
+ * The dynamic thread pool benchmark: the submit throughput of the tiny tasks with several producers,
+ * the queue latency percentiles, the grow and shrink under the blocking tasks, the reject policies,
+ * and the priorities: the probe latency while the pool is saturated, the starvation and the deadline order.
+ */
+
+static const int kProducers = 4;
+static const int kTasksPerProducer = 250000;
+static const int kLatencySamples = 20000;
+
+void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void waitDone(std::atomic<int>& done, int total) {
+    while (done.load() < total) {
+        std::this_thread::yield();
+    }
+}
+
+static void bench_throughput(size_t core_threads, size_t max_threads) {
+    DynamicThreadPool pool(core_threads, max_threads);
+    std::atomic<int> done(0);
+
+    int64_t start = nowNs();
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < kProducers; ++ i) {
+        producers.push_back(std::thread([&pool, &done]() {
+            for (int j = 0; j < kTasksPerProducer; ++ j) {
+                pool.add([&done]() { ++ done; });
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < producers.size(); ++ i) {
+        producers[i].join();
+    }
+
+    int64_t submitted = nowNs();
+
+    waitDone(done, kProducers * kTasksPerProducer);
+
+    int64_t finished = nowNs();
+    int total = kProducers * kTasksPerProducer;
+
+    printf("[throughput %zu/%zu threads] submit: %.2fM tasks/s, execute: %.2fM tasks/s, threads: %zu\n",
+        core_threads, max_threads, total * 1000.0 / (submitted - start), total * 1000.0 / (finished - start),
+        pool.getCurrentThreads());
+}
+
+static void bench_latency(size_t core_threads, size_t max_threads, int interval_us) {
+    DynamicThreadPool pool(core_threads, max_threads);
+    std::vector<int64_t> latencies(kLatencySamples);
+    std::atomic<int> done(0);
+
+    for (int i = 0; i < kLatencySamples; ++ i) {
+        int64_t submit = nowNs();
+        pool.add([&latencies, &done, submit, i]() {
+            latencies[i] = nowNs() - submit;
+            ++ done;
+        });
+
+        if (interval_us > 0) {
+            usleep(interval_us);
+        }
+    }
+
+    waitDone(done, kLatencySamples);
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("[latency %zu/%zu threads, interval %dus] p50: %.1fus p99: %.1fus p999: %.1fus max: %.1fus\n",
+        core_threads, max_threads, interval_us,
+        latencies[kLatencySamples / 2] / 1000.0, latencies[kLatencySamples * 99 / 100] / 1000.0,
+        latencies[kLatencySamples * 999 / 1000] / 1000.0, latencies[kLatencySamples - 1] / 1000.0);
+}
+
+static void bench_elastic() {
+    DynamicThreadPool pool(2, 32);
+    std::atomic<int> done(0);
+    const int tasks = 256;
+
+    int64_t start = nowNs();
+    for (int i = 0; i < tasks; ++ i) {
+        pool.add([&done]() {
+            usleep(5000);
+            ++ done;
+        });
+    }
+
+    size_t peak = 0;
+    while (done.load() < tasks) {
+        peak = std::max(peak, pool.getCurrentThreads());
+        usleep(1000);
+    }
+
+    printf("[elastic] %d blocking tasks of 5ms: %.1fms, peak threads: %zu\n",
+        tasks, (nowNs() - start) / 1000000.0, peak);
+
+    // The threads exceed the core threads exit after idle timeout, and are reaped by the manager.
+    usleep((THREAD_POOL_IDLE_TIMEOUT + 4 * THREAD_POOL_MANAGE_INTERVAL) * 1000);
+    printf("[elastic] after idle %dms, threads: %zu\n", THREAD_POOL_IDLE_TIMEOUT, pool.getCurrentThreads());
+}
+
+static void bench_reject(ThreadPoolRejectPolicy policy, const char* name) {
+    std::atomic<int> executed(0);
+    int accepted = 0;
+    const int tasks = 10000;
+
+    {
+        DynamicThreadPool pool(1, 1, 64, policy);
+        for (int i = 0; i < tasks; ++ i) {
+            if (pool.add([&executed]() { usleep(10); ++ executed; })) {
+                ++ accepted;
+            }
+        }
+
+        printf("[reject %s] accepted: %d rejected: %zu", name, accepted, pool.getRejectedTasks());
+    }
+
+    printf(" executed: %d\n", executed.load());
+}
+
+static void busyWait(int64_t ns) {
+    int64_t end = nowNs() + ns;
+    while (nowNs() < end) {
+    }
+}
+
+static void bench_priority(ThreadPoolPriority probe, const char* name) {
+    const int probes = 50;
+    DynamicThreadPool pool(2, 2);
+    std::atomic<bool> running(true);
+
+    // Keep the pool saturated by the 200us batch tasks.
+    std::thread feeder([&pool, &running]() {
+        while (running.load()) {
+            if (pool.getTaskQueueSize(THREAD_POOL_PRIORITY_NORMAL) < 200) {
+                pool.add([]() { busyWait(200000); }, THREAD_POOL_PRIORITY_NORMAL);
+            } else {
+                usleep(100);
+            }
+        }
+    });
+
+    usleep(10000);
+
+    std::vector<int64_t> latencies;
+    for (int i = 0; i < probes; ++ i) {
+        std::atomic<int64_t> latency(-1);
+        int64_t submit = nowNs();
+        pool.add([&latency, submit]() { latency = nowNs() - submit; }, probe);
+
+        while (latency.load() < 0) {
+            usleep(100);
+        }
+
+        latencies.push_back(latency.load());
+        usleep(1000);
+    }
+
+    size_t batch_queued = pool.getTaskQueueSize(THREAD_POOL_PRIORITY_NORMAL);
+
+    running = false;
+    feeder.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("[priority %s probe, normal batch queued %zu] p50: %.1fus p99: %.1fus\n", name, batch_queued,
+        latencies[probes / 2] / 1000.0, latencies[probes * 99 / 100] / 1000.0);
+}
+
+static void bench_starvation() {
+    std::atomic<int> high(0);
+    std::atomic<int> low(0);
+
+    {
+        DynamicThreadPool pool(1, 1);
+        for (int i = 0; i < 20000; ++ i) {
+            pool.add([&high]() { busyWait(10000); ++ high; }, THREAD_POOL_PRIORITY_HIGH);
+        }
+
+        for (int i = 0; i < 1000; ++ i) {
+            pool.add([&low]() { busyWait(10000); ++ low; }, THREAD_POOL_PRIORITY_LOW);
+        }
+
+        usleep(50000);
+        printf("[starvation] high saturated 50ms, executed high: %d low: %d\n", high.load(), low.load());
+    }
+}
+
+static void bench_deadline() {
+    const int tasks = 1000;
+    std::vector<int> deadlines;
+    std::mutex mutex;
+
+    {
+        DynamicThreadPool pool(1, 1);
+
+        // Block the only thread, so all the deadline tasks are queued before any runs.
+        std::atomic<bool> blocked(true);
+        pool.add([&blocked]() {
+            while (blocked.load()) {
+                usleep(100);
+            }
+        });
+
+        usleep(10000);
+
+        for (int i = 0; i < tasks; ++ i) {
+            // The deadlines are 10ms apart, more than the time to add all of them.
+            int deadline = 100 + (i * 7919) % tasks * 10;
+            pool.addWithDeadline([&deadlines, &mutex, deadline]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                deadlines.push_back(deadline);
+            }, deadline);
+        }
+
+        printf("[deadline] queued: %zu", pool.getTaskQueueSize(THREAD_POOL_PRIORITY_DEADLINE));
+        blocked = false;
+    }
+
+    printf(" executed in deadline order: %s\n", std::is_sorted(deadlines.begin(), deadlines.end()) ? "yes" : "no");
+}
+
+int main() {
+    atp_logger_init();
+
+    bench_throughput(1, 1);
+    bench_throughput(4, 4);
+    bench_throughput(2, 16);
+
+    bench_latency(4, 4, 50);
+    bench_latency(4, 4, 0);
+
+    bench_elastic();
+
+    bench_reject(THREAD_POOL_REJECT_DISCARD, "discard");
+    bench_reject(THREAD_POOL_REJECT_DISCARD_OLDEST, "discard oldest");
+    bench_reject(THREAD_POOL_REJECT_CALLER_RUNS, "caller runs");
+    bench_reject(THREAD_POOL_REJECT_BLOCK, "block");
+
+    bench_priority(THREAD_POOL_PRIORITY_NORMAL, "normal");
+    bench_priority(THREAD_POOL_PRIORITY_HIGH, "high");
+    bench_starvation();
+    bench_deadline();
+
+    return 0;
+}
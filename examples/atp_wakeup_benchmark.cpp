@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "net/atp_event_loop.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * kProducers threads send kTasks small tasks each to one event loop, the control event loop pattern.
+ * The eventfd wakeups, the tasks per wakeup and the loop thread CPU time are printed with and without
+ * the deferred wakeup, on the libevent and the native epoll loop.
+ */
+
+static const int kProducers = 4;
+static const int kTasks = 200000;
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+// The CPU time ns of the event loop thread, read in the event loop.
+static int64_t threadCpuNs(EventLoop* event_loop) {
+    std::promise<int64_t> promise;
+    event_loop->sendToQueue([&promise]() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        promise.set_value(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+    });
+
+    return promise.get_future().get();
+}
+
+static void benchWakeup(IOBackend io_backend, bool defer_wakeup) {
+    EventLoop* event_loop = new EventLoop(io_backend);
+    event_loop->setDeferWakeup(defer_wakeup);
+
+    // The loop runs until the process exit.
+    std::thread([event_loop]() {
+        event_loop->dispatch();
+    }).detach();
+
+    // The tasks are sent from other threads, the first one runs after the dispatch started.
+    int64_t cpu_start = 0;
+    std::thread([&cpu_start, event_loop]() {
+        cpu_start = threadCpuNs(event_loop);
+    }).join();
+
+    WakeupStats start_stats = event_loop->getWakeupStats();
+    std::atomic<int64_t> done(0);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < kProducers; ++ i) {
+        producers.emplace_back([event_loop, &done]() {
+            for (int n = 0; n < kTasks; ++ n) {
+                event_loop->sendToQueue([&done]() {
+                    done.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+        });
+    }
+
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+
+    while (done.load() < static_cast<int64_t>(kProducers) * kTasks) {
+        usleep(100);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int64_t cpu_ns = 0;
+    std::thread([&cpu_ns, cpu_start, event_loop]() {
+        cpu_ns = threadCpuNs(event_loop) - cpu_start;
+    }).join();
+
+    WakeupStats stats = event_loop->getWakeupStats();
+    uint64_t wakeups = stats.wakeups_ - start_stats.wakeups_;
+    uint64_t rounds = stats.task_rounds_ - start_stats.task_rounds_;
+    uint64_t tasks = stats.tasks_ - start_stats.tasks_;
+
+    printf("[%-8s %-13s] tasks/s: %.0f wakeups: %llu tasks/wakeup: %.1f rounds: %llu loop cpu ns/task: %.0f\n",
+        io_backend == IO_BACKEND_EPOLL ? "epoll" : "libevent", defer_wakeup ? "defer wakeup" : "notify",
+        tasks / seconds, static_cast<unsigned long long>(wakeups), wakeups > 0 ? static_cast<double>(tasks) / wakeups : 0.0,
+        static_cast<unsigned long long>(rounds), static_cast<double>(cpu_ns) / tasks);
+}
+
+int main() {
+    atp_logger_init();
+
+    benchWakeup(IO_BACKEND_LIBEVENT, false);
+    benchWakeup(IO_BACKEND_LIBEVENT, true);
+    benchWakeup(IO_BACKEND_EPOLL, false);
+    benchWakeup(IO_BACKEND_EPOLL, true);
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "net/atp_config.h"
+#include "net/atp_dynamic_thread_pool.h"
+#include "net/atp_work_stealing_thread_pool.h"
+
+using namespace atp;
+
+/*
+ * The work stealing pool against the dynamic thread pool with the same threads: the parallel sum,
+ * the recursive fib and many tiny tasks added from the outside and from inside a worker.
+ */
+
+static const size_t kSumSize = 16 * 1024 * 1024;
+static const size_t kSumGrain = 64 * 1024;
+static const int kFibN = 32;
+static const int kFibCutoff = 16;
+static const int kTinyTasks = 1000000;
+
+void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+static double nowMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void waitZero(std::atomic<long>& pending) {
+    while (pending.load() > 0) {
+        std::this_thread::yield();
+    }
+}
+
+static long serialSum(const std::vector<int>& data, size_t begin, size_t end) {
+    long sum = 0;
+    for (size_t i = begin; i < end; ++ i) {
+        sum += data[i];
+    }
+
+    return sum;
+}
+
+static long forkSum(WorkStealingThreadPool* pool, const std::vector<int>& data, size_t begin, size_t end) {
+    if (end - begin <= kSumGrain) {
+        return serialSum(data, begin, end);
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    long left = 0;
+
+    TaskGroup group(pool);
+    group.run([&]() { left = forkSum(pool, data, begin, middle); });
+    long right = forkSum(pool, data, middle, end);
+    group.wait();
+
+    return left + right;
+}
+
+static long serialFib(int n) {
+    return n < 2 ? n : serialFib(n - 1) + serialFib(n - 2);
+}
+
+static long forkFib(WorkStealingThreadPool* pool, int n) {
+    if (n <= kFibCutoff) {
+        return serialFib(n);
+    }
+
+    long x = 0;
+
+    TaskGroup group(pool);
+    group.run([&]() { x = forkFib(pool, n - 1); });
+    long y = forkFib(pool, n - 2);
+    group.wait();
+
+    return x + y;
+}
+
+// The fib without join for the dynamic thread pool, the waiting task would block its thread.
+static void spawnFib(BaseThreadPool* pool, int n, std::atomic<long>* sum, std::atomic<long>* pending) {
+    if (n <= kFibCutoff) {
+        sum->fetch_add(serialFib(n));
+    } else {
+        pending->fetch_add(2);
+        pool->add([=]() { spawnFib(pool, n - 1, sum, pending); });
+        pool->add([=]() { spawnFib(pool, n - 2, sum, pending); });
+    }
+
+    pending->fetch_sub(1);
+}
+
+static void bench_sum(size_t threads) {
+    std::vector<int> data(kSumSize);
+    for (size_t i = 0; i < kSumSize; ++ i) {
+        data[i] = static_cast<int>(i & 0xff);
+    }
+
+    long expected = serialSum(data, 0, kSumSize);
+
+    {
+        DynamicThreadPool pool(threads, threads);
+        std::atomic<long> sum(0);
+        std::atomic<long> pending(kSumSize / kSumGrain);
+
+        double start = nowMs();
+        for (size_t begin = 0; begin < kSumSize; begin += kSumGrain) {
+            pool.add([&data, &sum, &pending, begin]() {
+                sum.fetch_add(serialSum(data, begin, begin + kSumGrain));
+                pending.fetch_sub(1);
+            });
+        }
+
+        waitZero(pending);
+        printf("[sum] dynamic pool: %.1fms %s\n", nowMs() - start, sum.load() == expected ? "ok" : "wrong");
+    }
+
+    {
+        WorkStealingThreadPool pool(threads);
+        long sum = 0;
+
+        double start = nowMs();
+        TaskGroup group(&pool);
+        group.run([&]() { sum = forkSum(&pool, data, 0, kSumSize); });
+        group.wait();
+        printf("[sum] work stealing fork/join: %.1fms %s steals: %llu\n", nowMs() - start,
+            sum == expected ? "ok" : "wrong", static_cast<unsigned long long>(pool.getStealCount()));
+    }
+}
+
+static void bench_fib(size_t threads) {
+    long expected = serialFib(kFibN);
+
+    {
+        DynamicThreadPool pool(threads, threads);
+        std::atomic<long> sum(0);
+        std::atomic<long> pending(1);
+
+        double start = nowMs();
+        spawnFib(&pool, kFibN, &sum, &pending);
+        waitZero(pending);
+        printf("[fib] dynamic pool spawn: %.1fms %s\n", nowMs() - start, sum.load() == expected ? "ok" : "wrong");
+    }
+
+    {
+        WorkStealingThreadPool pool(threads);
+        std::atomic<long> sum(0);
+        std::atomic<long> pending(1);
+
+        double start = nowMs();
+        spawnFib(&pool, kFibN, &sum, &pending);
+        waitZero(pending);
+        printf("[fib] work stealing spawn: %.1fms %s\n", nowMs() - start, sum.load() == expected ? "ok" : "wrong");
+    }
+
+    {
+        WorkStealingThreadPool pool(threads);
+        long sum = 0;
+
+        double start = nowMs();
+        TaskGroup group(&pool);
+        group.run([&]() { sum = forkFib(&pool, kFibN); });
+        group.wait();
+        printf("[fib] work stealing fork/join: %.1fms %s\n", nowMs() - start, sum == expected ? "ok" : "wrong");
+    }
+}
+
+template <typename Pool>
+static void bench_tiny(Pool* pool, const char* name) {
+    std::atomic<long> pending(kTinyTasks);
+
+    double start = nowMs();
+    for (int i = 0; i < kTinyTasks; ++ i) {
+        pool->add([&pending]() { pending.fetch_sub(1); });
+    }
+
+    waitZero(pending);
+    double outside = nowMs() - start;
+
+    // One task spawns all the tiny tasks, the work stealing pool pushes them to the worker own deque.
+    pending = kTinyTasks + 1;
+    start = nowMs();
+    pool->add([pool, &pending]() {
+        for (int i = 0; i < kTinyTasks; ++ i) {
+            pool->add([&pending]() { pending.fetch_sub(1); });
+        }
+
+        pending.fetch_sub(1);
+    });
+
+    waitZero(pending);
+    double inside = nowMs() - start;
+
+    printf("[tiny] %s: outside %.2fM tasks/s, inside worker %.2fM tasks/s\n", name,
+        kTinyTasks / outside / 1000, kTinyTasks / inside / 1000);
+}
+
+int main(int argc, char* argv[]) {
+    atp_logger_init();
+
+    // The threads of both pools, default is the cpu cores.
+    size_t threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+    if (threads == 0) {
+        threads = 4;
+    }
+
+    printf("threads: %zu\n", threads);
+
+    bench_sum(threads);
+    bench_fib(threads);
+
+    {
+        DynamicThreadPool pool(threads, threads);
+        bench_tiny(&pool, "dynamic pool");
+    }
+
+    {
+        WorkStealingThreadPool pool(threads);
+        bench_tiny(&pool, "work stealing");
+    }
+
+    return 0;
+}
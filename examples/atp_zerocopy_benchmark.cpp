@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "net/atp_tcp_conn.h"
+#include "net/atp_tcp_server.h"
+#include "glog/logging.h"
+
+using namespace atp;
+
+/*
+ * Download kTotalSize bytes of the messages of one size from the server, the copying send and the
+ * MSG_ZEROCOPY send. The message is built for each send by both. The server IO thread CPU time, the
+ * throughput and the zero copy sends the kernel copied anyway are printed.
+ *
+ * Over the loopback the kernel copies the zero copy data to the receiver too and notifies it as copied,
+ * so the zero copy only adds the page pinning and the completions here. It saves the copy on the real NIC.
+ */
+
+static const char* kServerAddr = "127.0.0.1";
+static const unsigned int kCopyPort = 7881;
+static const unsigned int kZeroCopyPort = 7882;
+static const size_t kTotalSize = 64 * 1024 * 1024;
+static const size_t kMessageSizes[] = { 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024 };
+static const int kDownloads = 5;
+
+static std::atomic<EventLoop*> io_event_loops[2];
+static std::atomic<uint64_t> zerocopy_copied(0);
+
+static void atp_logger_init() {
+    FLAGS_alsologtostderr = false;
+    FLAGS_logbufsecs = 0;
+    FLAGS_max_log_size = 1800;
+
+    google::InitGoogleLogging("test");
+    google::SetLogDestination(google::GLOG_INFO,"log-");
+}
+
+// The client asks for the message size, the server sends kTotalSize bytes of the messages.
+static void onMessage(const ConnectionPtr& conn, ByteBuffer& buffer, bool zerocopy) {
+    if (buffer.unreadBytes() < sizeof(int32_t)) {
+        return;
+    }
+
+    ByteBufferedReader reader(buffer);
+    size_t message_size = reader.readInt32();
+
+    for (size_t i = 0; i < kTotalSize / message_size; ++ i) {
+        std::string message(message_size, static_cast<char>('a' + i % 26));
+        if (zerocopy) {
+            conn->send(std::move(message));
+        } else {
+            conn->send(message.data(), message.size());
+        }
+    }
+}
+
+static void startServer(unsigned int port, bool zerocopy) {
+    ServerAddress address = { kServerAddr, port };
+    Server* server = new Server("zerocopy-server", address, 1);
+
+    server->setConnectionCallback([zerocopy](const ConnectionPtr& conn) {
+        io_event_loops[zerocopy].store(conn->getEventLoop());
+        if (zerocopy && !conn->enableZeroCopy()) {
+            printf("enableZeroCopy failed\n");
+        }
+    });
+
+    server->setMessageCallback([zerocopy](const ConnectionPtr& conn, ByteBuffer& buffer) {
+        onMessage(conn, buffer, zerocopy);
+    });
+
+    server->setCloseCallback([](const ConnectionPtr& conn) {
+        zerocopy_copied += conn->getZeroCopyCopiedSends();
+    });
+
+    // The servers run until the process exit.
+    std::thread([server]() {
+        server->start();
+    }).detach();
+}
+
+// The CPU time ns of the event loop thread, read in the event loop.
+static int64_t threadCpuNs(EventLoop* event_loop) {
+    std::promise<int64_t> promise;
+    event_loop->sendToQueue([&promise]() {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        promise.set_value(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+    });
+
+    return promise.get_future().get();
+}
+
+// Check each byte, the message i is filled with 'a' + i % 26.
+static bool download(unsigned int port, size_t message_size) {
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = inet_addr(kServerAddr);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&server), sizeof(server)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    int32_t request = htonl(static_cast<int32_t>(message_size));
+    if (send(fd, &request, sizeof(request), 0) != sizeof(request)) {
+        close(fd);
+        return false;
+    }
+
+    std::vector<char> buf(256 * 1024);
+    size_t received = 0;
+    bool valid = true;
+    while (received < kTotalSize) {
+        ssize_t n = recv(fd, &buf[0], buf.size(), 0);
+        if (n <= 0) {
+            break;
+        }
+
+        for (ssize_t i = 0; i < n && valid; ++ i) {
+            valid = buf[i] == static_cast<char>('a' + (received + i) / message_size % 26);
+        }
+
+        received += n;
+    }
+
+    close(fd);
+    return valid && received == kTotalSize;
+}
+
+static void benchDownload(unsigned int port, bool zerocopy, size_t message_size) {
+    const char* name = zerocopy ? "zero copy" : "copy";
+
+    // The first download creates the IO event loop connection, it is not measured.
+    if (!download(port, message_size)) {
+        printf("[%s] download failed\n", name);
+        return;
+    }
+
+    EventLoop* event_loop = io_event_loops[zerocopy].load();
+    int64_t cpu_start = threadCpuNs(event_loop);
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < kDownloads; ++ i) {
+        if (!download(port, message_size)) {
+            printf("[%s] download failed\n", name);
+            return;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu_ms = (threadCpuNs(event_loop) - cpu_start) / 1000000.0;
+
+    printf("[%2zuMB %-9s] MB/s: %.0f server cpu ms/download: %.1f\n", message_size / (1024 * 1024), name,
+        kTotalSize * static_cast<double>(kDownloads) / seconds / (1024 * 1024), cpu_ms / kDownloads);
+}
+
+int main() {
+    atp_logger_init();
+
+    startServer(kCopyPort, false);
+    startServer(kZeroCopyPort, true);
+
+    sleep(1);
+
+    for (size_t size : kMessageSizes) {
+        benchDownload(kCopyPort, false, size);
+        benchDownload(kZeroCopyPort, true, size);
+    }
+
+    // The close callbacks of the last downloads.
+    usleep(100000);
+    printf("zero copy sends copied by the kernel: %llu\n", static_cast<unsigned long long>(zerocopy_copied.load()));
+
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,124 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+
+#include "app/atp_arena.h"
+#include "app/atp_memory_pool.h"
+#include "net/atp_memory_stats.h"
+#include "glog/logging.h"
+
+namespace atp {
+
+/* The process wide pool helper of all arenas, never destroyed, the arena can be released in any static destructor */
+static pool_helper_t* getArenaPoolHelper() {
+    static pool_helper_t* helper = []() {
+        pool_helper_t* ph = create_pool_helper();
+        assert(ph != NULL);
+        pool_helper_init(ph, NULL, ATP_ARENA_POOL_MAX_CAPACITY);
+        return ph;
+    }();
+
+    return helper;
+}
+
+Arena::Arena(size_t block_size)
+    : pool_(NULL), block_size_(block_size), memory_stats_(NULL), accounted_(0) {
+
+}
+
+Arena::~Arena() {
+    reset();
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+    if (!pool_) {
+        pool_ = create_pool(get_pool_helper_factory(getArenaPoolHelper()), "arena", block_size_, block_size_);
+        if (!pool_) {
+            LOG(ERROR) << "Arena create pool failed";
+            return NULL;
+        }
+    }
+
+    // The pool allocation is aligned to ATP_MEMORY_POOL_ALIGN, over allocate for the larger alignment,
+    // the pool_free finds the large allocation by the aligned pointer inside it.
+    if (alignment <= ATP_MEMORY_POOL_ALIGN) {
+        void* mem = pool_alloc(pool_, size ? size : 1);
+        updateMemoryStats();
+        return mem;
+    }
+
+    unsigned char* mem = static_cast<unsigned char*>(pool_alloc(pool_, size + alignment - ATP_MEMORY_POOL_ALIGN));
+    updateMemoryStats();
+    if (!mem) {
+        return NULL;
+    }
+
+    return ATP_ALIGN_PTR(mem, alignment);
+}
+
+void Arena::deallocate(void* mem, size_t size) {
+    if (pool_ && mem && size > ATP_MEMORY_POOL_LARGE_SIZE) {
+        pool_free(pool_, mem);
+        updateMemoryStats();
+    }
+}
+
+void Arena::reset() {
+    if (pool_) {
+        release_pool(pool_, get_pool_helper_factory(getArenaPoolHelper()));
+        pool_ = NULL;
+        updateMemoryStats();
+    }
+}
+
+size_t Arena::getCapacity() const {
+    return pool_ ? get_pool_capacity(pool_) : 0;
+}
+
+void Arena::setMemoryStats(MemoryStats* memory_stats) {
+    if (memory_stats_) {
+        memory_stats_->add(MEMORY_POOL, -static_cast<int64_t>(accounted_), 0);
+    }
+
+    memory_stats_ = memory_stats;
+    accounted_ = 0;
+    updateMemoryStats();
+}
+
+void Arena::updateMemoryStats() {
+    if (!memory_stats_) {
+        return;
+    }
+
+    size_t capacity = getCapacity();
+    if (capacity != accounted_) {
+        // The pool is the one object, counted when the arena took it and uncounted when given back.
+        int64_t objects = (accounted_ == 0) - (capacity == 0);
+        memory_stats_->add(MEMORY_POOL, static_cast<int64_t>(capacity) - static_cast<int64_t>(accounted_), objects);
+        accounted_ = capacity;
+    }
+}
+
+} /* end namespace atp */
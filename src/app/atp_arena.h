@@ -0,0 +1,187 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ATP_ARENA_H__
+#define __ATP_ARENA_H__
+
+#include <stddef.h>
+
+#include <new>
+#include <limits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+
+namespace atp {
+
+// The memory pool header is not included, its macros conflict with the net config.
+typedef struct pool pool_t;
+
+class MemoryStats;
+
+// The first block size of the arena, the arena grows by the same size.
+#define ATP_ARENA_BLOCK_SIZE            (4096)
+
+// The max bytes of the released arena blocks kept by the shared pool helper.
+#define ATP_ARENA_POOL_MAX_CAPACITY     (64 * 1024 * 1024)
+
+/*
+ * The Arena is a bump allocator for the temporaries of one request, it allocates from a pool_t
+ * and frees everything at once by reset. The pool is taken from a process wide pool helper on
+ * the first allocation and given back by reset, so an idle arena holds no memory, and with the
+ * pool helper thread cache the reset and the next first allocation don't take any lock.
+ *
+ * The Arena is not thread safe, the memory allocated must not be used after reset.
+ */
+class Arena {
+public:
+    explicit Arena(size_t block_size = ATP_ARENA_BLOCK_SIZE);
+
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+
+    Arena& operator=(const Arena&) = delete;
+
+public:
+    /* Allocate size bytes, return NULL if out of memory. */
+    void* allocate(size_t size, size_t alignment = alignof(max_align_t));
+
+    /* The small allocation is freed only by reset, the large one is freed immediately. */
+    void deallocate(void* mem, size_t size);
+
+    /* Free all the allocations. */
+    void reset();
+
+    /* The bytes of the blocks held, includes the unused space. */
+    size_t getCapacity() const;
+
+    /* Account the blocks held to the MEMORY_POOL category of the stats, NULL to stop. */
+    void setMemoryStats(MemoryStats* memory_stats);
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        void* mem = allocate(sizeof(T), alignof(T));
+        return mem ? new (mem) T(std::forward<Args>(args)...) : NULL;
+    }
+
+private:
+    void updateMemoryStats();
+
+private:
+    pool_t* pool_;
+
+    size_t block_size_;
+
+    MemoryStats* memory_stats_;
+
+    // The capacity already added to the memory_stats_.
+    size_t accounted_;
+};
+
+/* The STL allocator allocates from Arena, e.g. std::vector<int, ArenaAllocator<int>> v(ArenaAllocator<int>(&arena)). */
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    explicit ArenaAllocator(Arena* arena) : arena_(arena) {
+
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.getArena()) {
+
+    }
+
+    T* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+
+        void* mem = arena_->allocate(n * sizeof(T), alignof(T));
+        if (!mem) {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<T*>(mem);
+    }
+
+    void deallocate(T* mem, size_t n) {
+        arena_->deallocate(mem, n * sizeof(T));
+    }
+
+    Arena* getArena() const {
+        return arena_;
+    }
+
+private:
+    Arena* arena_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.getArena() == b.getArena();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.getArena() != b.getArena();
+}
+
+#if __cplusplus >= 201703L
+/* The pmr memory resource for the C++17 users, the libatp itself is built as C++11. */
+class ArenaMemoryResource : public std::pmr::memory_resource {
+public:
+    explicit ArenaMemoryResource(Arena* arena) : arena_(arena) {
+
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        void* mem = arena_->allocate(bytes, alignment);
+        if (!mem) {
+            throw std::bad_alloc();
+        }
+
+        return mem;
+    }
+
+    void do_deallocate(void* mem, size_t bytes, size_t alignment) override {
+        arena_->deallocate(mem, bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    Arena* arena_;
+};
+#endif
+
+} /* end namespace atp */
+
+#endif /* __ATP_ARENA_H__ */
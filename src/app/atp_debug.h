@@ -38,6 +38,20 @@ namespace atp {
 #define ATP_MEMORY_POOL_START (5)
 #define ATP_MEMORY_POOL_CACHING_SIZE (16)
 
+/* The per thread cache of ready pools, each size class magazine holds at most MAGAZINE_SIZE pools */
+#define ATP_MEMORY_POOL_MAGAZINE_SIZE (16)
+#define ATP_MEMORY_POOL_THREAD_CACHE_CAPACITY (1024 * 1024)
+
+/* The chunk failed to serve more than FAILED times is skipped, the allocation larger than LARGE_SIZE bypass chunks */
+#define ATP_MEMORY_POOL_CHUNK_FAILED (4)
+#define ATP_MEMORY_POOL_LARGE_SIZE (4096)
+
+/* The mmap policy maps HUGE_PAGE_SIZE regions, and carves them to power of two chunks from MMAP_MIN_CHUNK */
+#define ATP_MEMORY_POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define ATP_MEMORY_POOL_MMAP_MIN_SHIFT (8)
+#define ATP_MEMORY_POOL_MMAP_MAX_SHIFT (20)
+#define ATP_MEMORY_POOL_MMAP_CLASSES (ATP_MEMORY_POOL_MMAP_MAX_SHIFT - ATP_MEMORY_POOL_MMAP_MIN_SHIFT + 1)
+
 /* The atp event flags */
 #define ATP_NONE_EVENT  (0x00)
 #define ATP_READ_EVENT  (0x02)
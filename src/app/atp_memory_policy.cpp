@@ -24,10 +24,12 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include "atp_memory_pool.h"
 
-/* Memory pool factory policy /new/delete/malloc/free */
+/* Memory pool factory policy /new/delete/malloc/free/mmap */
 
 namespace atp {
 
@@ -35,6 +37,9 @@ static void* chunk_alloc__(pool_factory_t* factory, size_t size);
 static void chunk_free__(pool_factory_t* factory, void* mem, size_t size);
 static void* chunk_new__(pool_factory_t* factory, size_t size);
 static void chunk_delete__(pool_factory_t* factory, void* mem, size_t size);
+static void* chunk_mmap__(pool_factory_t* factory, size_t size);
+static void chunk_munmap__(pool_factory_t* factory, void* mem, size_t size);
+static void chunk_munmap_dontneed__(pool_factory_t* factory, void* mem, size_t size);
 
 
 pool_factory_policy_t default_policy {
@@ -47,6 +52,28 @@ pool_factory_policy_t new_policy {
     chunk_delete__,
 };
 
+pool_factory_policy_t mmap_policy {
+    chunk_mmap__,
+    chunk_munmap__,
+};
+
+pool_factory_policy_t mmap_dontneed_policy {
+    chunk_mmap__,
+    chunk_munmap_dontneed__,
+};
+
+/* The chunks of the mmap policies, shared by all pool helpers */
+struct mmap_heap {
+    pthread_mutex_t mutex_;
+    unsigned char*  cur_;
+    unsigned char*  end_;
+    size_t          mapped_size_;
+    bool            hugetlb_;
+    void*           free_list_[ATP_MEMORY_POOL_MMAP_CLASSES];
+};
+
+static struct mmap_heap mmap_heap_ = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, false, { NULL } };
+
 pool_factory_policy_t* get_factory_default_policy() {
     return &default_policy;
 }
@@ -55,6 +82,14 @@ pool_factory_policy_t* get_factory_new_policy() {
     return &new_policy;
 }
 
+pool_factory_policy_t* get_factory_mmap_policy() {
+    return &mmap_policy;
+}
+
+pool_factory_policy_t* get_factory_mmap_dontneed_policy() {
+    return &mmap_dontneed_policy;
+}
+
 static void* chunk_alloc__(pool_factory_t* factory, size_t size) {
     assert(factory != NULL);
 
@@ -109,4 +144,211 @@ static void chunk_delete__(pool_factory_t* factory, void* mem, size_t size) {
     mem = NULL;
 }
 
+/* Map size bytes aligned to the huge page size, the size must be the multiple of huge page size */
+static unsigned char* mmap_huge_region__(size_t size, bool populate) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | (populate ? MAP_POPULATE : 0);
+
+#ifdef MAP_HUGETLB
+    if (mmap_heap_.hugetlb_) {
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            return (unsigned char*)mem;
+        }
+
+        /* The explicit huge pages exhausted, use the transparent huge pages from now on */
+        mmap_heap_.hugetlb_ = false;
+    }
+#endif
+
+    /* Map one more huge page and trim, the transparent huge page needs the aligned region */
+    size_t map_size = size + ATP_MEMORY_POOL_HUGE_PAGE_SIZE;
+    unsigned char* mem = (unsigned char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == (unsigned char*)MAP_FAILED) {
+        return NULL;
+    }
+
+    unsigned char* aligned = ATP_ALIGN_PTR(mem, ATP_MEMORY_POOL_HUGE_PAGE_SIZE);
+    if (aligned > mem) {
+        munmap(mem, aligned - mem);
+    }
+
+    if (mem + map_size > aligned + size) {
+        munmap(aligned + size, mem + map_size - (aligned + size));
+    }
+
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+    /* The MAP_POPULATE before madvise would fault the small pages, pre-fault after advised */
+    if (populate) {
+        for (size_t off = 0; off < size; off += 4096) {
+            *(volatile unsigned char*)(aligned + off) = 0;
+        }
+    }
+
+    return aligned;
+}
+
+static int mmap_class__(size_t size) {
+    int shift = ATP_MEMORY_POOL_MMAP_MIN_SHIFT;
+    while (((size_t)1 << shift) < size) {
+        ++ shift;
+    }
+
+    return shift - ATP_MEMORY_POOL_MMAP_MIN_SHIFT;
+}
+
+/* Carve the tail of current region to the free lists, the region can't serve the request, must hold the mutex */
+static void mmap_retire_region__() {
+    while (mmap_heap_.cur_ < mmap_heap_.end_) {
+        int cls = ATP_MEMORY_POOL_MMAP_CLASSES - 1;
+        while (((size_t)1 << (cls + ATP_MEMORY_POOL_MMAP_MIN_SHIFT)) > (size_t)(mmap_heap_.end_ - mmap_heap_.cur_)) {
+            -- cls;
+        }
+
+        if (cls < 0) {
+            break;
+        }
+
+        *(void**)mmap_heap_.cur_ = mmap_heap_.free_list_[cls];
+        mmap_heap_.free_list_[cls] = mmap_heap_.cur_;
+        mmap_heap_.cur_ += (size_t)1 << (cls + ATP_MEMORY_POOL_MMAP_MIN_SHIFT);
+    }
+}
+
+bool pool_mmap_policy_init(size_t prefault_size, bool hugetlb) {
+    pthread_mutex_lock(&mmap_heap_.mutex_);
+
+    mmap_heap_.hugetlb_ = hugetlb;
+
+    bool res = true;
+    if (prefault_size > 0) {
+        size_t size = (prefault_size + ATP_MEMORY_POOL_HUGE_PAGE_SIZE - 1) & ~((size_t)ATP_MEMORY_POOL_HUGE_PAGE_SIZE - 1);
+        unsigned char* mem = mmap_huge_region__(size, true);
+        if (mem) {
+            mmap_retire_region__();
+            mmap_heap_.cur_ = mem;
+            mmap_heap_.end_ = mem + size;
+            mmap_heap_.mapped_size_ += size;
+        } else {
+            res = false;
+        }
+    }
+
+    pthread_mutex_unlock(&mmap_heap_.mutex_);
+
+    return res;
+}
+
+size_t get_pool_mmap_policy_mapped_size() {
+    pthread_mutex_lock(&mmap_heap_.mutex_);
+    size_t size = mmap_heap_.mapped_size_;
+    pthread_mutex_unlock(&mmap_heap_.mutex_);
+
+    return size;
+}
+
+static void* chunk_mmap__(pool_factory_t* factory, size_t size) {
+    assert(factory != NULL);
+
+    if (factory->on_chunk_alloc) {
+        factory->on_chunk_alloc(factory, size);
+    }
+
+    unsigned char* mem = NULL;
+
+    /* The chunk larger than the max class is mapped alone */
+    if (size > ((size_t)1 << ATP_MEMORY_POOL_MMAP_MAX_SHIFT)) {
+        size_t map_size = (size + ATP_MEMORY_POOL_HUGE_PAGE_SIZE - 1) & ~((size_t)ATP_MEMORY_POOL_HUGE_PAGE_SIZE - 1);
+
+        pthread_mutex_lock(&mmap_heap_.mutex_);
+        mem = mmap_huge_region__(map_size, false);
+        if (mem) {
+            mmap_heap_.mapped_size_ += map_size;
+        }
+        pthread_mutex_unlock(&mmap_heap_.mutex_);
+
+        return mem;
+    }
+
+    int cls = mmap_class__(size);
+    size_t class_size = (size_t)1 << (cls + ATP_MEMORY_POOL_MMAP_MIN_SHIFT);
+
+    pthread_mutex_lock(&mmap_heap_.mutex_);
+
+    if (mmap_heap_.free_list_[cls]) {
+        mem = (unsigned char*)mmap_heap_.free_list_[cls];
+        mmap_heap_.free_list_[cls] = *(void**)mem;
+        *(void**)mem = NULL;
+    } else {
+        if ((size_t)(mmap_heap_.end_ - mmap_heap_.cur_) < class_size) {
+            mmap_retire_region__();
+
+            unsigned char* region = mmap_huge_region__(ATP_MEMORY_POOL_HUGE_PAGE_SIZE, false);
+            if (!region) {
+                pthread_mutex_unlock(&mmap_heap_.mutex_);
+                return NULL;
+            }
+
+            mmap_heap_.cur_ = region;
+            mmap_heap_.end_ = region + ATP_MEMORY_POOL_HUGE_PAGE_SIZE;
+            mmap_heap_.mapped_size_ += ATP_MEMORY_POOL_HUGE_PAGE_SIZE;
+        }
+
+        /* The power of two chunks carved in order from the aligned region are naturally aligned */
+        mem = mmap_heap_.cur_;
+        mmap_heap_.cur_ += class_size;
+    }
+
+    pthread_mutex_unlock(&mmap_heap_.mutex_);
+
+    return mem;
+}
+
+static void chunk_munmap_free__(void* mem, size_t size, bool dontneed) {
+    if (size > ((size_t)1 << ATP_MEMORY_POOL_MMAP_MAX_SHIFT)) {
+        size_t map_size = (size + ATP_MEMORY_POOL_HUGE_PAGE_SIZE - 1) & ~((size_t)ATP_MEMORY_POOL_HUGE_PAGE_SIZE - 1);
+        munmap(mem, map_size);
+
+        pthread_mutex_lock(&mmap_heap_.mutex_);
+        mmap_heap_.mapped_size_ -= map_size;
+        pthread_mutex_unlock(&mmap_heap_.mutex_);
+        return;
+    }
+
+    int cls = mmap_class__(size);
+    size_t class_size = (size_t)1 << (cls + ATP_MEMORY_POOL_MMAP_MIN_SHIFT);
+
+    /* The first page keeps the free list link, the reused chunk pages are faulted again as zero pages */
+    if (dontneed && class_size > 4096) {
+        madvise((unsigned char*)mem + 4096, class_size - 4096, MADV_DONTNEED);
+    }
+
+    pthread_mutex_lock(&mmap_heap_.mutex_);
+    *(void**)mem = mmap_heap_.free_list_[cls];
+    mmap_heap_.free_list_[cls] = mem;
+    pthread_mutex_unlock(&mmap_heap_.mutex_);
+}
+
+static void chunk_munmap__(pool_factory_t* factory, void* mem, size_t size) {
+    assert(factory != NULL);
+
+    if (factory->on_chunk_free) {
+        factory->on_chunk_free(factory, size);
+    }
+
+    chunk_munmap_free__(mem, size, false);
+}
+
+static void chunk_munmap_dontneed__(pool_factory_t* factory, void* mem, size_t size) {
+    assert(factory != NULL);
+
+    if (factory->on_chunk_free) {
+        factory->on_chunk_free(factory, size);
+    }
+
+    chunk_munmap_free__(mem, size, true);
+}
+
 } /* end namespace atp */
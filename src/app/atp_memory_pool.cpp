@@ -36,47 +36,115 @@ static size_t pool_size_array[ATP_MEMORY_POOL_CACHING_SIZE] = {
     40960, 49125, 57344, 65535
 };
 
+/* The pool state, for check the pool released twice */
+enum {
+    POOL_STATE_USED   = 1,
+    POOL_STATE_CACHED = 2
+};
+
 /* 内存池的内部以pool_chunk为单位进行内存分配 */
 struct pool_chunk {
     unsigned char* buf_;
     unsigned char* cur_;
     unsigned char* end_;
+    unsigned int   failed_;
 
     TAILQ_ENTRY(pool_chunk) entry_;
 };
 
+/* The large allocation is allocated from factory policy directly, the header is before the memory */
+struct pool_large {
+    size_t size_;
+
+    TAILQ_ENTRY(pool_large) entry_;
+};
+
+typedef struct pool_large pool_large_t;
+
 struct pool {
     char   name_[ATP_MEMORY_POOL_NAME];
     size_t capacity_;
     size_t incr_size_;
     void*  data_;
+    int    state_;
 
     pool_factory_t* factory_;
 
+    /* The chunks before current are nearly full, allocation starts from current */
+    pool_chunk_t* current_;
+
     TAILQ_HEAD(, pool_chunk) chunk_list_;
+    TAILQ_HEAD(, pool_large) large_list_;
     TAILQ_ENTRY(pool) entry_;
+
+    /* All the pools allocated by pool helper, for destroy */
+    TAILQ_ENTRY(pool) all_entry_;
+};
+
+/* The magazine of ready pools for one size class */
+struct pool_magazine {
+    size_t  count_;
+    pool_t* pools_[ATP_MEMORY_POOL_MAGAZINE_SIZE];
+};
+
+/* The per thread cache in front of the pool helper, only the owner thread touches the magazines */
+struct pool_thread_cache {
+    pool_helper_t*  helper_;
+    size_t          cached_size_;
+    size_t          hits_;
+    size_t          misses_;
+    size_t          refills_;
+    size_t          flushes_;
+
+    struct pool_magazine magazines_[ATP_MEMORY_POOL_CACHING_SIZE];
+
+    TAILQ_ENTRY(pool_thread_cache) entry_;
 };
 
+typedef struct pool_thread_cache pool_thread_cache_t;
+
 struct pool_helper {
-    pool_factory_t       factory_;                                               
-    size_t               capacity_;                                              
-    size_t               max_capacity_;                                          
-    size_t               used_count_;                                            
-    size_t               used_size_;                                             
-    void*                data_;                                                  
-    pthread_mutex_t      mutex_;                                                 
-                                                                                 
-    TAILQ_HEAD(, pool) used_pool_list_;
+    pool_factory_t       factory_;
+    size_t               capacity_;
+    size_t               max_capacity_;
+    size_t               used_count_;
+    size_t               used_size_;
+    size_t               pool_allocs_;
+    size_t               pool_frees_;
+    void*                data_;
+    pthread_mutex_t      mutex_;
+
+    /* The thread cache key, the cache is flushed when the thread exit */
+    bool                 cache_enabled_;
+    pthread_key_t        cache_key_;
+
+    /* The counters of the exited threads caches */
+    size_t               retired_hits_;
+    size_t               retired_misses_;
+    size_t               retired_refills_;
+    size_t               retired_flushes_;
+
+    TAILQ_HEAD(, pool) all_pool_list_;
     TAILQ_HEAD(, pool) free_pool_list_[ATP_MEMORY_POOL_CACHING_SIZE];
+    TAILQ_HEAD(, pool_thread_cache) cache_list_;
 };
 
 
 static void* pool_alloc_find(pool_t* pool, size_t size);
+static void* pool_alloc_large(pool_t* pool, size_t size);
 static void* pool_alloc_from_chunk(pool_chunk_t* chunk, size_t size);
 static pool_chunk_t* create_chunk_append_pool(pool_t* pool, size_t chunk_size);
 static pool_t* create_pool__(pool_factory_t* factory, const char* name, size_t init_size, size_t incr_size);
 static void release_pool__(pool_factory_t* factory, pool_t* pool);
 static void release_pool2(pool_t* pool);
+static void reset_pool__(pool_t* pool);
+static pool_t* alloc_pool__(pool_helper_t* ph, ssize_t pos, size_t init_size);
+static void free_pool_locked__(pool_helper_t* ph, pool_t* pool, ssize_t pos);
+static pool_thread_cache_t* get_thread_cache__(pool_helper_t* ph);
+static pool_t* thread_cache_pop__(pool_thread_cache_t* tc, ssize_t pos);
+static bool thread_cache_push__(pool_thread_cache_t* tc, ssize_t pos, pool_t* pool);
+static void thread_cache_flush__(pool_thread_cache_t* tc, ssize_t pos, size_t count);
+static void thread_cache_destroy__(void* arg);
 static void dump_status__(pool_factory_t* factory, bool detail);
 static void on_chunk_free__(pool_factory_t* factory, size_t size);
 static void on_chunk_alloc__(pool_factory_t* factory, size_t size);
@@ -90,9 +158,9 @@ static void* pool_alloc_find(pool_t* pool, size_t size) {
     }
 
     void* mem = NULL;
-    pool_chunk_t* chunk_node = TAILQ_FIRST(&pool->chunk_list_);
+    pool_chunk_t* chunk_node = pool->current_;
 
-    /* Traverse the chunk list */
+    /* Only the chunks from current are tried, the failed ones are retired below */
     while (chunk_node != NULL) {
         mem = pool_alloc_from_chunk(chunk_node, size);
         if (mem != NULL) {
@@ -102,7 +170,7 @@ static void* pool_alloc_find(pool_t* pool, size_t size) {
         chunk_node = TAILQ_NEXT(chunk_node, entry_);
     }
 
-    /* In this, all nodes in pool chunk list not have enough memory, we create a new */
+    /* In this, all nodes from current not have enough memory, we create a new */
 
     if (pool->incr_size_ <= 0) {
         return NULL;
@@ -115,13 +183,20 @@ static void* pool_alloc_find(pool_t* pool, size_t size) {
         new_chunk_size = pool->incr_size_ * counts;
     }
 
-    chunk_node = create_chunk_append_pool(pool, new_chunk_size);
-    if (!chunk_node) {
+    pool_chunk_t* new_chunk = create_chunk_append_pool(pool, new_chunk_size);
+    if (!new_chunk) {
         return NULL;
     }
 
+    /* Like nginx, the chunk failed too many times is nearly full, move current past it */
+    for (chunk_node = pool->current_; chunk_node != new_chunk; chunk_node = TAILQ_NEXT(chunk_node, entry_)) {
+        if (chunk_node->failed_ ++ > ATP_MEMORY_POOL_CHUNK_FAILED) {
+            pool->current_ = TAILQ_NEXT(chunk_node, entry_);
+        }
+    }
+
     /* Allocate memroy from new chunk */
-    mem = pool_alloc_from_chunk(chunk_node, size);
+    mem = pool_alloc_from_chunk(new_chunk, size);
     if (!mem) {
         return NULL;
     }
@@ -129,6 +204,18 @@ static void* pool_alloc_find(pool_t* pool, size_t size) {
     return mem;
 }
 
+static void* pool_alloc_large(pool_t* pool, size_t size) {
+    pool_large_t* large = (pool_large_t*)(*pool->factory_->policy_.chunk_alloc)(pool->factory_, sizeof(pool_large_t) + size);
+    if (!large) {
+        return NULL;
+    }
+
+    large->size_ = sizeof(pool_large_t) + size;
+    TAILQ_INSERT_HEAD(&pool->large_list_, large, entry_);
+
+    return (unsigned char*)large + sizeof(pool_large_t);
+}
+
 static void* pool_alloc_from_chunk(pool_chunk_t* chunk, size_t size) {
     if (!chunk || size <= 0) {
         LOG(ERROR) << "invalid args, chunk or size is nil";
@@ -140,10 +227,6 @@ static void* pool_alloc_from_chunk(pool_chunk_t* chunk, size_t size) {
         size = (size + ATP_MEMORY_POOL_ALIGN) & ~(ATP_MEMORY_POOL_ALIGN - 1);
     }
 
-    if (ATP_DEBUG_ON) {
-        LOG(INFO) << "pool_alloc_from_chunk alloc size: " << size;
-    }
-
     size_t curr_chunk_size = size_t(chunk->end_ - chunk->cur_);
     if (curr_chunk_size >= size) {
         void* mem = chunk->cur_;
@@ -172,13 +255,41 @@ static pool_chunk_t* create_chunk_append_pool(pool_t* pool, size_t chunk_size) {
     new_chunk->buf_ = ((unsigned char*)new_chunk) + sizeof(pool_chunk_t);
     new_chunk->cur_ = ATP_ALIGN_PTR(new_chunk->buf_, ATP_MEMORY_POOL_ALIGN);
     new_chunk->end_ = ((unsigned char*)new_chunk) + chunk_size;
+    new_chunk->failed_ = 0;
 
-    /* Insert the new chunk to pool chunk list */
-    TAILQ_INSERT_HEAD(&pool->chunk_list_, new_chunk, entry_);
+    /* Append the new chunk to pool chunk list, the current is never behind it */
+    TAILQ_INSERT_TAIL(&pool->chunk_list_, new_chunk, entry_);
 
     return new_chunk;
 }
 
+/* The first chunk is in the pool memory, it is the head of the chunk list */
+static pool_chunk_t* pool_first_chunk__(pool_t* pool) {
+    return (pool_chunk_t*)((unsigned char*)pool + sizeof(pool_t));
+}
+
+/* Free the chunks appended and the large allocations by pool_alloc, and rewind the first chunk, the pool looks like a new one */
+static void reset_pool__(pool_t* pool) {
+    pool_chunk_t* first_chunk = pool_first_chunk__(pool);
+    pool_chunk_t* chunk = NULL;
+    pool_large_t* large = NULL;
+
+    while ((large = TAILQ_FIRST(&pool->large_list_)) != NULL) {
+        TAILQ_REMOVE(&pool->large_list_, large, entry_);
+        pool->factory_->policy_.chunk_free(pool->factory_, large, large->size_);
+    }
+
+    while ((chunk = TAILQ_NEXT(first_chunk, entry_)) != NULL) {
+        TAILQ_REMOVE(&pool->chunk_list_, chunk, entry_);
+        pool->capacity_ -= size_t(chunk->end_ - (unsigned char*)chunk);
+        pool->factory_->policy_.chunk_free(pool->factory_, chunk, size_t(chunk->end_ - (unsigned char*)chunk));
+    }
+
+    first_chunk->cur_ = ATP_ALIGN_PTR(first_chunk->buf_, ATP_MEMORY_POOL_ALIGN);
+    first_chunk->failed_ = 0;
+    pool->current_ = first_chunk;
+}
+
 void release_pool2(pool_t* pool) {
     assert(pool != NULL);
 
@@ -186,19 +297,9 @@ void release_pool2(pool_t* pool) {
         LOG(INFO) << "release_pool2 really release pool";
     }
 
-    pool_chunk_t* first_chunk = TAILQ_FIRST(&pool->chunk_list_);
-    TAILQ_REMOVE(&pool->chunk_list_, first_chunk, entry_);
+    reset_pool__(pool);
 
-    pool_chunk_t* tmp = NULL;
-
-    TAILQ_FOREACH(tmp, &pool->chunk_list_, entry_) {
-        TAILQ_REMOVE(&pool->chunk_list_, tmp, entry_);
-
-        if (ATP_DEBUG_ON) {
-            LOG(INFO) << "release_pool2 relase tmp mem size: " << size_t(tmp->end_ - tmp->buf_);
-        }
-        pool->factory_->policy_.chunk_free(pool->factory_, tmp, size_t(tmp->end_ - tmp->buf_));
-    }
+    pool_chunk_t* first_chunk = pool_first_chunk__(pool);
 
     if (ATP_DEBUG_ON) {
         LOG(INFO) << "release_pool2 relase mem size: " << size_t(first_chunk->end_ - (unsigned char*)pool);
@@ -232,8 +333,11 @@ void release_pool(pool_t* pool, pool_factory_t* factory) {
 void* pool_alloc(pool_t* pool, size_t size) {
     assert(pool != NULL);
 
-    pool_chunk_t* chunk_node = TAILQ_FIRST(&pool->chunk_list_);
-    void* mem = pool_alloc_from_chunk(chunk_node, size);
+    if (size > ATP_MEMORY_POOL_LARGE_SIZE) {
+        return pool_alloc_large(pool, size);
+    }
+
+    void* mem = pool_alloc_from_chunk(pool->current_, size);
     if (!mem) {
         mem = pool_alloc_find(pool, size);
     }
@@ -241,6 +345,22 @@ void* pool_alloc(pool_t* pool, size_t size) {
     return mem;
 }
 
+bool pool_free(pool_t* pool, void* mem) {
+    assert(pool != NULL);
+
+    pool_large_t* large = NULL;
+    TAILQ_FOREACH(large, &pool->large_list_, entry_) {
+        unsigned char* data = (unsigned char*)large + sizeof(pool_large_t);
+        if ((unsigned char*)mem >= data && (unsigned char*)mem < (unsigned char*)large + large->size_) {
+            TAILQ_REMOVE(&pool->large_list_, large, entry_);
+            pool->factory_->policy_.chunk_free(pool->factory_, large, large->size_);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 
 pool_helper_t* create_pool_helper() {
     pool_helper_t* ph = (pool_helper_t*)calloc(1, sizeof(pool_helper_t));
@@ -253,24 +373,27 @@ void pool_helper_destroy(pool_helper_t* ph) {
     }
 
     pool_t* pl;
+    pool_thread_cache_t* tc;
+
+    /* The thread caches of the living threads are freed here, their destructor won't be called any more */
+    pthread_key_delete(ph->cache_key_);
 
     pthread_mutex_lock(&ph->mutex_);
 
-    while (pl = TAILQ_FIRST(&ph->used_pool_list_)) {
+    while ((tc = TAILQ_FIRST(&ph->cache_list_)) != NULL) {
+        TAILQ_REMOVE(&ph->cache_list_, tc, entry_);
+        free(tc);
+    }
+
+    /* The used, thread cached and free pools are all in the all pool list */
+    while ((pl = TAILQ_FIRST(&ph->all_pool_list_)) != NULL) {
         if (ATP_DEBUG_ON) {
             LOG(INFO) << "Pool helper destroy pool";
         }
-        TAILQ_REMOVE(&ph->used_pool_list_, pl, entry_);
+        TAILQ_REMOVE(&ph->all_pool_list_, pl, all_entry_);
         release_pool2(pl);
     }
-    
-    for (int i = 0; i < ATP_MEMORY_POOL_CACHING_SIZE; ++ i) {
-        while (pl = TAILQ_FIRST(&ph->free_pool_list_[i])) {
-            TAILQ_REMOVE(&ph->free_pool_list_[i], pl, entry_);
-            release_pool2(pl);
-        }
-    }
-    
+
     pthread_mutex_unlock(&ph->mutex_);
 
     pthread_mutex_destroy(&ph->mutex_);
@@ -285,7 +408,11 @@ void pool_helper_init(pool_helper_t* ph, const pool_factory_policy_t* policy, si
 
     pthread_mutex_init(&ph->mutex_, NULL);
 
-    TAILQ_INIT(&ph->used_pool_list_);
+    ph->cache_enabled_ = true;
+    pthread_key_create(&ph->cache_key_, &thread_cache_destroy__);
+
+    TAILQ_INIT(&ph->all_pool_list_);
+    TAILQ_INIT(&ph->cache_list_);
     for (int i = 0; i < ATP_MEMORY_POOL_CACHING_SIZE; ++ i) {
         TAILQ_INIT(&ph->free_pool_list_[i]);
     }
@@ -299,13 +426,14 @@ void pool_helper_init(pool_helper_t* ph, const pool_factory_policy_t* policy, si
 
     ph->factory_.create_pool = &create_pool__;
     ph->factory_.release_pool = &release_pool__;
+    ph->factory_.dump_status = &dump_status__;
     ph->factory_.on_chunk_alloc = &on_chunk_alloc__;
     ph->factory_.on_chunk_free =  &on_chunk_free__;
 
 }
 
 size_t get_pool_helper_reference(pool_helper* ph) {
-    return ph->used_count_;
+    return __atomic_load_n(&ph->used_count_, __ATOMIC_RELAXED);
 }
 
 size_t get_pool_helper_capacity(pool_helper* ph) {
@@ -317,146 +445,383 @@ size_t get_pool_helper_max_capacity(pool_helper* ph) {
 }
 
 size_t get_pool_helper_used_mem_size(pool_helper* ph) {
-    return ph->used_size_;
+    return __atomic_load_n(&ph->used_size_, __ATOMIC_RELAXED);
 }
 
 pool_factory_t* get_pool_helper_factory(pool_helper* ph) {
     return &ph->factory_;
 }
 
+void get_pool_helper_stats(pool_helper* ph, pool_helper_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&ph->mutex_);
+
+    stats->used_count_ = __atomic_load_n(&ph->used_count_, __ATOMIC_RELAXED);
+    stats->capacity_ = ph->capacity_;
+    stats->max_capacity_ = ph->max_capacity_;
+    stats->used_size_ = __atomic_load_n(&ph->used_size_, __ATOMIC_RELAXED);
+    stats->pool_allocs_ = ph->pool_allocs_;
+    stats->pool_frees_ = ph->pool_frees_;
+    stats->cache_hits_ = ph->retired_hits_;
+    stats->cache_misses_ = ph->retired_misses_;
+    stats->cache_refills_ = ph->retired_refills_;
+    stats->cache_flushes_ = ph->retired_flushes_;
+
+    /* The thread cache counters are written by the owner thread, read them relaxed */
+    pool_thread_cache_t* tc = NULL;
+    TAILQ_FOREACH(tc, &ph->cache_list_, entry_) {
+        ++ stats->thread_caches_;
+        stats->thread_cached_size_ += __atomic_load_n(&tc->cached_size_, __ATOMIC_RELAXED);
+        stats->cache_hits_ += __atomic_load_n(&tc->hits_, __ATOMIC_RELAXED);
+        stats->cache_misses_ += __atomic_load_n(&tc->misses_, __ATOMIC_RELAXED);
+        stats->cache_refills_ += __atomic_load_n(&tc->refills_, __ATOMIC_RELAXED);
+        stats->cache_flushes_ += __atomic_load_n(&tc->flushes_, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&ph->mutex_);
+}
+
+void pool_helper_enable_thread_cache(pool_helper* ph, bool enable) {
+    ph->cache_enabled_ = enable;
+}
+
+void pool_helper_flush_thread_cache(pool_helper* ph) {
+    pool_thread_cache_t* tc = (pool_thread_cache_t*)pthread_getspecific(ph->cache_key_);
+    if (!tc) {
+        return;
+    }
+
+    for (ssize_t pos = 0; pos < ATP_MEMORY_POOL_CACHING_SIZE; ++ pos) {
+        thread_cache_flush__(tc, pos, tc->magazines_[pos].count_);
+    }
+}
+
 static pool_t* create_pool__(pool_factory_t* factory, const char* name, size_t init_size, size_t incr_size) {
     ssize_t pos = atp_binary_search(init_size);
 
-    if (ATP_DEBUG_ON) {
-        if (pos < ATP_MEMORY_POOL_CACHING_SIZE) {
-            LOG(INFO) << "The binary search pos: " << pos << " init_size: " << init_size << " auto adjusted: " << pool_size_array[pos];
-        }
-    }
-                                                                                 
     pool_t* pool = NULL;
     pool_helper_t* ph = (pool_helper_t*)factory;
 
-    /* The pool helper list operations is not thread safe, so we locked */
-    pthread_mutex_lock(&ph->mutex_);
+    /* The thread cache serves the pool without lock, the lock is only taken when it refills */
+    pool_thread_cache_t* tc = NULL;
+    if (pos < ATP_MEMORY_POOL_CACHING_SIZE && (tc = get_thread_cache__(ph)) != NULL) {
+        pool = thread_cache_pop__(tc, pos);
+    }
 
-    if (pos == ATP_MEMORY_POOL_CACHING_SIZE || TAILQ_EMPTY(&ph->free_pool_list_[pos])) {
-        if (pos < ATP_MEMORY_POOL_CACHING_SIZE) {
-            init_size = pool_size_array[pos];
+    if (!pool) {
+        pool = alloc_pool__(ph, pos, init_size);
+        if (!pool) {
+            return NULL;
         }
+    }
 
-        if (ATP_DEBUG_ON) {
-            LOG(INFO) << "The 1 case init_size: " << init_size;
-        }
+    pool->incr_size_ = incr_size;
+    pool->data_ = (void*)pos;
+    pool->state_ = POOL_STATE_USED;
+    snprintf(pool->name_, sizeof(pool->name_), "%s", name);
 
-        assert(init_size >= sizeof(pool_t) + sizeof(pool_chunk_t));
-        unsigned char* mem = (unsigned char*)factory->policy_.chunk_alloc(factory, init_size);
-        if (!mem) {
-            pthread_mutex_unlock(&ph->mutex_);
-            LOG(ERROR) << "The factory policy chunk alloc failed";
-            return NULL;
-        }
+    __atomic_add_fetch(&ph->used_count_, 1, __ATOMIC_RELAXED);
+
+    return pool;
+}
+
+static void release_pool__(pool_factory_t* factory, pool_t* pool) {
+    if (!factory || !pool) {
+        return;
+    }
 
-        pool = (pool_t*)mem;
-        pool->factory_ = factory;
-        pool->capacity_ = init_size;
-        pool->incr_size_ = incr_size;
-        strncpy(pool->name_, name, strlen(name));
-        TAILQ_INIT(&pool->chunk_list_);
+    pool_helper_t* ph = (pool_helper_t*)factory;
 
-        pool_chunk_t* chunk = (pool_chunk_t*)(mem + sizeof(*pool));
-        chunk->buf_ = ((unsigned char*)chunk) + sizeof(pool_chunk_t);
-        chunk->cur_ = ATP_ALIGN_PTR(chunk->buf_, ATP_MEMORY_POOL_ALIGN);
-        chunk->end_ = mem + init_size;
+    if (pool->state_ != POOL_STATE_USED) {
+        LOG(ERROR) << "The release pool: " << pool->name_ << " is not in used";
+        return;
+    }
 
-        if (ATP_DEBUG_ON) {
-            LOG(INFO) << "====###====== current size: " << (size_t)(chunk->end_ - chunk->cur_);
+    pool->state_ = POOL_STATE_CACHED;
+    __atomic_sub_fetch(&ph->used_count_, 1, __ATOMIC_RELAXED);
+
+    ssize_t pos = (ssize_t)(void*)pool->data_;
+
+    /* The reused pool must not carry the chunks and allocations of last user */
+    reset_pool__(pool);
+
+    pool_thread_cache_t* tc = NULL;
+    if (pos < ATP_MEMORY_POOL_CACHING_SIZE && (tc = get_thread_cache__(ph)) != NULL) {
+        if (thread_cache_push__(tc, pos, pool)) {
+            return;
         }
+    }
 
-        TAILQ_INSERT_TAIL(&pool->chunk_list_, chunk, entry_);
-    } else {
+    pthread_mutex_lock(&ph->mutex_);
+    free_pool_locked__(ph, pool, pos);
+    pthread_mutex_unlock(&ph->mutex_);
+}
+
+/* Allocate a new pool from factory policy, or take one from the shared free list if the cache disabled */
+static pool_t* alloc_pool__(pool_helper_t* ph, ssize_t pos, size_t init_size) {
+    pool_factory_t* factory = &ph->factory_;
+    pool_t* pool = NULL;
+
+    /* The pool helper list operations is not thread safe, so we locked */
+    pthread_mutex_lock(&ph->mutex_);
+
+    if (pos < ATP_MEMORY_POOL_CACHING_SIZE && !TAILQ_EMPTY(&ph->free_pool_list_[pos])) {
         pool = TAILQ_FIRST(&ph->free_pool_list_[pos]);
         TAILQ_REMOVE(&ph->free_pool_list_[pos], pool, entry_);
-        pool->incr_size_ = incr_size;
-        strncpy(pool->name_, name, strlen(name));
 
         if (ph->capacity_ > get_pool_capacity(pool)) {
             ph->capacity_ -= get_pool_capacity(pool);
         } else {
             ph->capacity_ = 0;
         }
+
+        pthread_mutex_unlock(&ph->mutex_);
+        return pool;
     }
 
-    pool->data_ = (void*)pos;
-    TAILQ_INSERT_HEAD(&ph->used_pool_list_, pool, entry_);
-    ++ ph->used_count_;
+    if (pos < ATP_MEMORY_POOL_CACHING_SIZE) {
+        init_size = pool_size_array[pos];
+    }
 
-    if (ATP_DEBUG_ON) {
-        LOG(INFO) << "The pool helper use count: " << ph->used_count_;
+    assert(init_size >= sizeof(pool_t) + sizeof(pool_chunk_t));
+    unsigned char* mem = (unsigned char*)factory->policy_.chunk_alloc(factory, init_size);
+    if (!mem) {
+        pthread_mutex_unlock(&ph->mutex_);
+        LOG(ERROR) << "The factory policy chunk alloc failed";
+        return NULL;
     }
 
-    /* The pool helper unlock */
+    pool = (pool_t*)mem;
+    pool->factory_ = factory;
+    pool->capacity_ = init_size;
+    TAILQ_INIT(&pool->chunk_list_);
+    TAILQ_INIT(&pool->large_list_);
+
+    pool_chunk_t* chunk = pool_first_chunk__(pool);
+    chunk->buf_ = ((unsigned char*)chunk) + sizeof(pool_chunk_t);
+    chunk->cur_ = ATP_ALIGN_PTR(chunk->buf_, ATP_MEMORY_POOL_ALIGN);
+    chunk->end_ = mem + init_size;
+
+    chunk->failed_ = 0;
+
+    pool->current_ = chunk;
+
+    TAILQ_INSERT_TAIL(&pool->chunk_list_, chunk, entry_);
+    TAILQ_INSERT_TAIL(&ph->all_pool_list_, pool, all_entry_);
+    ++ ph->pool_allocs_;
+
     pthread_mutex_unlock(&ph->mutex_);
 
     return pool;
 }
 
-static void release_pool__(pool_factory_t* factory, pool_t* pool) {
-    if (!factory || !pool) {
+/* Put the released pool to the shared free list, or free it if exceeds the max capacity, must hold the mutex */
+static void free_pool_locked__(pool_helper_t* ph, pool_t* pool, ssize_t pos) {
+    size_t cap = get_pool_capacity(pool);
+
+    if (pos == ATP_MEMORY_POOL_CACHING_SIZE || (cap + ph->capacity_) > ph->max_capacity_) {
+        TAILQ_REMOVE(&ph->all_pool_list_, pool, all_entry_);
+        ++ ph->pool_frees_;
+        release_pool2(pool);
         return;
     }
 
-    pool_helper_t* ph = (pool_helper_t*)factory;
+    TAILQ_INSERT_TAIL(&ph->free_pool_list_[pos], pool, entry_);
+    ph->capacity_ += cap;
+}
+
+static pool_thread_cache_t* get_thread_cache__(pool_helper_t* ph) {
+    if (!ph->cache_enabled_) {
+        return NULL;
+    }
+
+    pool_thread_cache_t* tc = (pool_thread_cache_t*)pthread_getspecific(ph->cache_key_);
+    if (tc) {
+        return tc;
+    }
+
+    tc = (pool_thread_cache_t*)calloc(1, sizeof(pool_thread_cache_t));
+    if (!tc) {
+        return NULL;
+    }
+
+    tc->helper_ = ph;
 
     pthread_mutex_lock(&ph->mutex_);
+    TAILQ_INSERT_TAIL(&ph->cache_list_, tc, entry_);
+    pthread_mutex_unlock(&ph->mutex_);
+
+    pthread_setspecific(ph->cache_key_, tc);
+
+    return tc;
+}
+
+static pool_t* thread_cache_pop__(pool_thread_cache_t* tc, ssize_t pos) {
+    pool_helper_t* ph = tc->helper_;
+    struct pool_magazine* magazine = &tc->magazines_[pos];
+
+    /* Refill half of the magazine by one lock, the following creates are lock free */
+    if (magazine->count_ == 0) {
+        pthread_mutex_lock(&ph->mutex_);
+
+        while (magazine->count_ < ATP_MEMORY_POOL_MAGAZINE_SIZE / 2 && !TAILQ_EMPTY(&ph->free_pool_list_[pos])) {
+            pool_t* pool = TAILQ_FIRST(&ph->free_pool_list_[pos]);
+            TAILQ_REMOVE(&ph->free_pool_list_[pos], pool, entry_);
 
-    int exist = 0;
-    pool_t* tmp = NULL;
+            size_t cap = get_pool_capacity(pool);
+            ph->capacity_ = ph->capacity_ > cap ? ph->capacity_ - cap : 0;
 
-    TAILQ_FOREACH(tmp, &ph->used_pool_list_, entry_) {
-        if (tmp == pool) {
-            exist = 1;
-            break;
+            magazine->pools_[magazine->count_ ++] = pool;
+            __atomic_store_n(&tc->cached_size_, tc->cached_size_ + cap, __ATOMIC_RELAXED);
         }
-    }
 
-    if (exist == 0) {
         pthread_mutex_unlock(&ph->mutex_);
-        LOG(ERROR) << "The release pool: " << pool->name_ << " not in used_pool_list_";
-        return;
+
+        if (magazine->count_ == 0) {
+            __atomic_store_n(&tc->misses_, tc->misses_ + 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        __atomic_store_n(&tc->refills_, tc->refills_ + 1, __ATOMIC_RELAXED);
     }
 
-    TAILQ_REMOVE(&ph->used_pool_list_, pool, entry_);
-    -- ph->used_count_;
+    pool_t* pool = magazine->pools_[-- magazine->count_];
+    __atomic_store_n(&tc->cached_size_, tc->cached_size_ - get_pool_capacity(pool), __ATOMIC_RELAXED);
+    __atomic_store_n(&tc->hits_, tc->hits_ + 1, __ATOMIC_RELAXED);
 
-    ssize_t pos = (ssize_t)(void*)pool->data_;
+    return pool;
+}
+
+static bool thread_cache_push__(pool_thread_cache_t* tc, ssize_t pos, pool_t* pool) {
+    struct pool_magazine* magazine = &tc->magazines_[pos];
     size_t cap = get_pool_capacity(pool);
 
-    if (pos == ATP_MEMORY_POOL_CACHING_SIZE ||
-        (cap + ph->capacity_) > ph->max_capacity_ ||
-        cap > pool_size_array[ATP_MEMORY_POOL_CACHING_SIZE - 1]) {
-        release_pool2(pool);
-        pthread_mutex_unlock(&ph->mutex_);
+    /* The magazine is full or the thread caches too much, flush half of the magazine by one lock */
+    if (magazine->count_ == ATP_MEMORY_POOL_MAGAZINE_SIZE ||
+        tc->cached_size_ + cap > ATP_MEMORY_POOL_THREAD_CACHE_CAPACITY) {
+        thread_cache_flush__(tc, pos, (magazine->count_ + 1) / 2);
+
+        if (magazine->count_ == ATP_MEMORY_POOL_MAGAZINE_SIZE ||
+            tc->cached_size_ + cap > ATP_MEMORY_POOL_THREAD_CACHE_CAPACITY) {
+            return false;
+        }
+    }
+
+    magazine->pools_[magazine->count_ ++] = pool;
+    __atomic_store_n(&tc->cached_size_, tc->cached_size_ + cap, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+/* Flush the oldest count pools of the magazine to the shared free lists */
+static void thread_cache_flush__(pool_thread_cache_t* tc, ssize_t pos, size_t count) {
+    pool_helper_t* ph = tc->helper_;
+    struct pool_magazine* magazine = &tc->magazines_[pos];
+
+    if (count == 0 || magazine->count_ == 0) {
         return;
     }
 
-    TAILQ_INSERT_TAIL(&ph->free_pool_list_[pos], pool, entry_);
-    ph->capacity_ += cap;
+    if (count > magazine->count_) {
+        count = magazine->count_;
+    }
+
+    size_t flushed_size = 0;
+
+    pthread_mutex_lock(&ph->mutex_);
+
+    for (size_t i = 0; i < count; ++ i) {
+        flushed_size += get_pool_capacity(magazine->pools_[i]);
+        free_pool_locked__(ph, magazine->pools_[i], pos);
+    }
 
     pthread_mutex_unlock(&ph->mutex_);
+
+    /* Keep the most recently released pools, they are hot in CPU cache */
+    memmove(magazine->pools_, magazine->pools_ + count, (magazine->count_ - count) * sizeof(pool_t*));
+    magazine->count_ -= count;
+
+    __atomic_store_n(&tc->cached_size_, tc->cached_size_ - flushed_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&tc->flushes_, tc->flushes_ + 1, __ATOMIC_RELAXED);
+}
+
+/* The thread exit, return the cached pools to pool helper */
+static void thread_cache_destroy__(void* arg) {
+    pool_thread_cache_t* tc = (pool_thread_cache_t*)arg;
+    pool_helper_t* ph = tc->helper_;
+
+    for (ssize_t pos = 0; pos < ATP_MEMORY_POOL_CACHING_SIZE; ++ pos) {
+        thread_cache_flush__(tc, pos, tc->magazines_[pos].count_);
+    }
+
+    pthread_mutex_lock(&ph->mutex_);
+
+    ph->retired_hits_ += tc->hits_;
+    ph->retired_misses_ += tc->misses_;
+    ph->retired_refills_ += tc->refills_;
+    ph->retired_flushes_ += tc->flushes_;
+
+    TAILQ_REMOVE(&ph->cache_list_, tc, entry_);
+
+    pthread_mutex_unlock(&ph->mutex_);
+
+    free(tc);
 }
 
 static void dump_status__(pool_factory_t* factory, bool detail) {
-	/* Todo */
+    pool_helper_t* ph = (pool_helper_t*)factory;
+
+    pool_helper_stats_t stats;
+    get_pool_helper_stats(ph, &stats);
+
+    LOG(INFO) << "Pool helper used pools: " << stats.used_count_
+              << " used size: " << stats.used_size_
+              << " capacity: " << stats.capacity_ << "/" << stats.max_capacity_
+              << " allocs: " << stats.pool_allocs_
+              << " frees: " << stats.pool_frees_;
+
+    LOG(INFO) << "Pool helper thread caches: " << stats.thread_caches_
+              << " cached size: " << stats.thread_cached_size_
+              << " hits: " << stats.cache_hits_
+              << " misses: " << stats.cache_misses_
+              << " refills: " << stats.cache_refills_
+              << " flushes: " << stats.cache_flushes_;
+
+    if (!detail) {
+        return;
+    }
+
+    pthread_mutex_lock(&ph->mutex_);
+
+    for (int i = 0; i < ATP_MEMORY_POOL_CACHING_SIZE; ++ i) {
+        size_t count = 0;
+        pool_t* pl = NULL;
+        TAILQ_FOREACH(pl, &ph->free_pool_list_[i], entry_) {
+            ++ count;
+        }
+
+        size_t cached = 0;
+        pool_thread_cache_t* tc = NULL;
+        TAILQ_FOREACH(tc, &ph->cache_list_, entry_) {
+            cached += __atomic_load_n(&tc->magazines_[i].count_, __ATOMIC_RELAXED);
+        }
+
+        LOG(INFO) << "Pool helper size class: " << pool_size_array[i]
+                  << " free pools: " << count << " thread cached pools: " << cached;
+    }
+
+    pthread_mutex_unlock(&ph->mutex_);
 }
 
 static void on_chunk_free__(pool_factory_t* factory, size_t size) {
     pool_helper_t* ph = (pool_helper_t*)factory;
-    ph->used_size_ -= size;
+    __atomic_sub_fetch(&ph->used_size_, size, __ATOMIC_RELAXED);
 }
 
 static void on_chunk_alloc__(pool_factory_t* factory, size_t size) {
     pool_helper_t* ph = (pool_helper_t*)factory;
-    ph->used_size_ += size;
+    __atomic_add_fetch(&ph->used_size_, size, __ATOMIC_RELAXED);
 }
 
 static int atp_binary_search(size_t value) {
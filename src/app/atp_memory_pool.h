@@ -26,6 +26,8 @@
 #define __ATP_MEMORY_POOL_H__
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <sys/queue.h>
 
@@ -44,6 +46,7 @@ typedef struct pool_chunk pool_chunk_t;
 typedef struct pool_factory pool_factory_t;
 typedef struct pool_factory_policy pool_factory_policy_t;
 typedef struct pool_helper pool_helper_t;
+typedef struct pool_helper_stats pool_helper_stats_t;
 
 
 /* The memory pool public interface */
@@ -52,6 +55,11 @@ ATP_EXPORT_SYMBOL const char* get_pool_name(pool_t* pool);
 ATP_EXPORT_SYMBOL pool_t* create_pool(pool_factory_t* factory, const char* name, size_t init_size, size_t incr_size);
 ATP_EXPORT_SYMBOL void release_pool(pool_t* pool, pool_factory_t* factory);
 ATP_EXPORT_SYMBOL void* pool_alloc(pool_t* pool, size_t size);
+/*
+ * Only the large allocation can be freed before the pool released, mem can point anywhere in it(e.g. aligned
+ * up by the caller), return false if mem is not large
+ */
+ATP_EXPORT_SYMBOL bool pool_free(pool_t* pool, void* mem);
 
 /* Factory policy for new/delete/malloc/free */
 struct pool_factory_policy {
@@ -61,10 +69,30 @@ struct pool_factory_policy {
 
 extern pool_factory_policy_t default_policy;
 extern pool_factory_policy_t new_policy;
+extern pool_factory_policy_t mmap_policy;
+extern pool_factory_policy_t mmap_dontneed_policy;
 
 ATP_EXPORT_SYMBOL pool_factory_policy_t* get_factory_default_policy();
 ATP_EXPORT_SYMBOL pool_factory_policy_t* get_factory_new_policy();
 
+/*
+ * The mmap policies allocate chunks from 2MB huge page regions (MADV_HUGEPAGE), the new mapped memory
+ * is zeroed lazily by the kernel instead of calloc. The freed chunks are kept for reuse, the dontneed
+ * policy also returns the pages of the freed chunks to the OS by MADV_DONTNEED, except the first page.
+ */
+ATP_EXPORT_SYMBOL pool_factory_policy_t* get_factory_mmap_policy();
+ATP_EXPORT_SYMBOL pool_factory_policy_t* get_factory_mmap_dontneed_policy();
+
+/*
+ * Optional, call it at startup before any mmap policy allocation. Pre-fault prefault_size bytes by MAP_POPULATE,
+ * and map the regions from the explicit huge pages (MAP_HUGETLB, must be reserved by vm.nr_hugepages) if hugetlb
+ * is true, it falls back to the transparent huge pages if the explicit huge pages are not available.
+ */
+ATP_EXPORT_SYMBOL bool pool_mmap_policy_init(size_t prefault_size, bool hugetlb);
+
+/* The bytes mapped by the mmap policies. */
+ATP_EXPORT_SYMBOL size_t get_pool_mmap_policy_mapped_size();
+
 
 struct pool_factory {
     pool_factory_policy_t policy_;
@@ -76,6 +104,22 @@ struct pool_factory {
 };
 
 
+/* The pool helper counters, the thread cache counters are summed of all threads */
+struct pool_helper_stats {
+    size_t used_count_;         /* The pools created and not released */
+    size_t capacity_;           /* The bytes of pools in the shared free lists */
+    size_t max_capacity_;
+    size_t used_size_;          /* The bytes allocated from factory policy */
+    size_t pool_allocs_;        /* The pools allocated from factory policy */
+    size_t pool_frees_;         /* The pools freed to factory policy */
+    size_t thread_caches_;      /* The threads have cache */
+    size_t thread_cached_size_; /* The bytes of pools in thread caches */
+    size_t cache_hits_;         /* create_pool served by thread cache */
+    size_t cache_misses_;       /* create_pool allocated new pool */
+    size_t cache_refills_;      /* Thread cache refilled from the shared free lists, with lock */
+    size_t cache_flushes_;      /* Thread cache flushed to the shared free lists, with lock */
+};
+
 /* Unified management of memory pool */
 /* The pool helper public interface */
 ATP_EXPORT_SYMBOL pool_helper_t* create_pool_helper();
@@ -86,6 +130,14 @@ ATP_EXPORT_SYMBOL size_t get_pool_helper_capacity(pool_helper* ph);
 ATP_EXPORT_SYMBOL size_t get_pool_helper_max_capacity(pool_helper* ph);
 ATP_EXPORT_SYMBOL size_t get_pool_helper_used_mem_size(pool_helper* ph);
 ATP_EXPORT_SYMBOL pool_factory_t* get_pool_helper_factory(pool_helper* ph);
+ATP_EXPORT_SYMBOL void get_pool_helper_stats(pool_helper* ph, pool_helper_stats_t* stats);
+
+/*
+ * The thread cache is enabled by default, the create_pool/release_pool only lock the pool helper
+ * when the calling thread cache refill or flush. Flush returns the calling thread cached pools.
+ */
+ATP_EXPORT_SYMBOL void pool_helper_enable_thread_cache(pool_helper* ph, bool enable);
+ATP_EXPORT_SYMBOL void pool_helper_flush_thread_cache(pool_helper* ph);
 
 } /* end namespace atp */
 
@@ -1,25 +1,85 @@
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <arpa/inet.h>
 #include <google/protobuf/descriptor.h>
 
 #include "rpc.pb.h"
-#include "atp_buffer.h"
-#include "atp_tcp_conn.h"
-#include "atp_rpc_channel.h"
+#include "net/atp_buffer.hpp"
+#include "net/atp_tcp_conn.h"
+#include "net/atp_event_loop.h"
+#include "net/atp_dynamic_thread_pool.h"
+#include "app/atp_rpc_channel.h"
+#include "app/atp_rpc_compress.h"
 #include "glog/logging.h"
 
 namespace atp {
 
+static int64_t steadyClockMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * The done closure for server side method, it owns the request and response until the method finished.
+ * The method maybe finished in the worker thread, the response will be hand back to the connection event loop.
+ */
+class RpcChannel::DoneClosure : public ::google::protobuf::Closure {
+public:
+    DoneClosure(const RpcChannelPtr& channel, const ConnectionPtr& conn, uint64_t id, const RpcControllerPtr& controller,
+                ::google::protobuf::Message* request, ::google::protobuf::Message* response)
+        : channel_(channel), conn_(conn), id_(id), controller_(controller), request_(request), response_(response) {}
+
+    ~DoneClosure() {}
+
+public:
+    void Run() override {
+        channel_->doneCallback(conn_, id_, controller_, response_.release());
+        delete this;
+    }
+
+private:
+    RpcChannelPtr channel_;
+    ConnectionPtr conn_;
+    uint64_t id_;
+    RpcControllerPtr controller_;
+    std::unique_ptr<::google::protobuf::Message> request_;
+    std::unique_ptr<::google::protobuf::Message> response_;
+};
+
+
 RpcChannel::RpcChannel()
-    : prototype_(&RpcMessage::default_instance()) {
+    : prototype_(&RpcMessage::default_instance()), memory_stats_(nullptr), services_(nullptr), stream_methods_(nullptr),
+      compress_type_(COMPRESS_NONE), compress_threshold_(RPC_COMPRESS_DEFAULT_THRESHOLD),
+      peer_accept_compress_(0), id_(0), last_received_ms_(steadyClockMs()) {
 
 }
 
 RpcChannel::~RpcChannel() {
     LOG(INFO) << "RpcChannel destory";
 
+    // The response and done are owned by caller, fail the calls which never finished.
     for (auto it = outstandings_.begin(); it != outstandings_.end(); ++ it) {
         outstanding_call out_call = it->second;
-        delete out_call.response;
-        delete out_call.done; 
+        if (out_call.timer.valid()) {
+            out_call.event_loop->cancelTimerTask(out_call.timer);
+        }
+
+        out_call.memory_stats->add(MEMORY_RPC_CALL, -out_call.bytes, -1);
+
+        if (out_call.controller) {
+            out_call.controller->setCancelCallback(RpcController::CancelCallback());
+            out_call.controller->setErrorCode(CANCELED, "rpc channel destroyed");
+        }
+
+        if (out_call.done) {
+            out_call.done->Run();
+        }
+    }
+
+    if (!inflights_.empty()) {
+        int64_t calls = static_cast<int64_t>(inflights_.size());
+        memory_stats_->add(MEMORY_RPC_CALL, -calls * static_cast<int64_t>(sizeof(RpcController)), -calls);
     }
 }
 
@@ -28,35 +88,204 @@ void RpcChannel::CallMethod(const ::google::protobuf::MethodDescriptor* method,
                     const ::google::protobuf::Message* request,
                     ::google::protobuf::Message* response,
                     ::google::protobuf::Closure* done) {
-    // This function(CallMethod) for rpc client call remote method.
+    // This function(CallMethod) for rpc client call remote method, the channel must be owned by shared_ptr.
+    RpcController* rpc_controller = dynamic_cast<RpcController*>(controller);
+
+    ConnectionPtr conn = conn_.lock();
+    if (!conn) {
+        if (controller) {
+            controller->SetFailed("rpc channel connection not ready");
+        }
+
+        if (done) {
+            done->Run();
+        }
+
+        return;
+    }
+
+    uint64_t id = ++ id_;
+
+    RpcMessage message;
+    message.set_type(REQUEST);
+    message.set_id(id);
+    message.set_service(method->service()->full_name());
+    message.set_method(method->name());
+    std::string payload = request->SerializeAsString();
+    encodePayload(&message, payload, true);
+
+    MemoryStats* memory_stats = &conn->getEventLoop()->getMemoryStats();
+    outstanding_call out_call = {response, done, rpc_controller, TimerId(), conn->getEventLoop(),
+        static_cast<int64_t>(message.request().size()), memory_stats};
+
+    // The call must be outstanding before the cancel and the timer armed, the caller thread may be not
+    // the event loop one, and they fail only the outstanding call.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstandings_[id] = out_call;
+    }
+
+    memory_stats->add(MEMORY_RPC_CALL, out_call.bytes, 1);
+
+    std::weak_ptr<RpcChannel> weak_self(shared_from_this());
+    if (rpc_controller) {
+        rpc_controller->setCancelCallback([weak_self, id]() {
+            RpcChannelPtr self = weak_self.lock();
+            if (self) {
+                self->onCallFailed(id, CANCELED, "rpc call canceled");
+            }
+        });
+    }
+
+    if (rpc_controller && rpc_controller->getTimeout() > 0) {
+        message.set_timeout_ms(rpc_controller->getTimeout());
+
+        // The timer fail the outstanding call, if the response arrived it will be canceled.
+        int64_t timeout_us = static_cast<int64_t>(rpc_controller->getTimeout()) * 1000;
+        TimerId timer = conn->getEventLoop()->addTimerTask(timeout_us, [weak_self, id]() {
+            RpcChannelPtr self = weak_self.lock();
+            if (self) {
+                self->onCallFailed(id, TIMEDOUT, "rpc call timedout");
+            }
+        });
+
+        bool outstanding = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto iter = outstandings_.find(id);
+            if (iter != outstandings_.end()) {
+                iter->second.timer = timer;
+                outstanding = true;
+            }
+        }
+
+        // Canceled before the timer armed.
+        if (!outstanding) {
+            conn->getEventLoop()->cancelTimerTask(timer);
+        }
+    }
+
+    sendRpcMessage(conn, &message);
 }
 
-void RpcChannel::onMessage(const ConnectionPtr& conn, ByteBuffer& buff) {
-    ByteBufferedReader reader(buff);
+RpcStreamPtr RpcChannel::openStream(const std::string& service, const std::string& method) {
+    ConnectionPtr conn = conn_.lock();
+    if (!conn) {
+        return RpcStreamPtr();
+    }
+
+    uint64_t id = ++ id_;
+
+    RpcStreamPtr stream(new RpcStream(shared_from_this(), conn, id, false));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        streams_[id] = stream;
+    }
+
+    RpcMessage message;
+    message.set_type(STREAM_OPEN);
+    message.set_stream_id(id);
+    message.set_service(service);
+    message.set_method(method);
+
+    sendRpcMessage(conn, &message);
+
+    return stream;
+}
+
+void RpcChannel::onWriteComplete(const ConnectionPtr& conn) {
+    std::vector<RpcStreamPtr> streams;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (streams_.empty()) {
+            return;
+        }
 
-    slice ss = reader.consume(65535);
-    if (ss.empty()) {
-        LOG(ERROR) << "RpcChannel::OnMessage error, the message body to short";
+        for (auto it = streams_.begin(); it != streams_.end(); ++ it) {
+            streams.push_back(it->second);
+        }
+    }
+
+    for (size_t i = 0; i < streams.size(); ++ i) {
+        streams[i]->onWritable();
+    }
+}
+
+void RpcChannel::onClose(const ConnectionPtr& conn) {
+    std::map<uint64_t, RpcStreamPtr> streams;
+    std::vector<uint64_t> calls;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        streams.swap(streams_);
 
+        for (auto it = outstandings_.begin(); it != outstandings_.end(); ++ it) {
+            calls.push_back(it->first);
+        }
+    }
+
+    // The responses will never arrive, fail the calls instead of waiting for the timeout.
+    for (size_t i = 0; i < calls.size(); ++ i) {
+        onCallFailed(calls[i], FAILED, "rpc connection closed");
+    }
+
+    // Wake up the readers and writers blocked on the streams, and break the stream and channel reference.
+    for (auto it = streams.begin(); it != streams.end(); ++ it) {
+        it->second->onAbort(CANCELED);
+    }
+}
+
+void RpcChannel::ping() {
+    ConnectionPtr conn = conn_.lock();
+    if (!conn) {
         return;
     }
 
-    LOG(INFO) << "The read remote data: " << ss.data();
+    RpcMessage message;
+    message.set_type(PING);
+    message.set_id(++ id_);
+
+    sendRpcMessage(conn, &message);
+}
+
+void RpcChannel::onMessage(const ConnectionPtr& conn, ByteBuffer& buff) {
+    ByteBufferedReader reader(buff);
 
-    MessagePtr message(prototype_->New());
+    // The rpc frame is [4 bytes length | RpcMessage], handle all the completed frames in buffer.
+    while (buff.unreadBytes() >= RPC_FRAME_HEADER_SIZE) {
+        int32_t length = reader.peekInt32();
+        if (length < 0 || length > RPC_FRAME_MAX_SIZE) {
+            LOG(ERROR) << "RpcChannel::OnMessage error, invalid frame length: " << length;
+            conn->close();
+            return;
+        }
 
-    RpcMessagePtr rpc_message = ::std::dynamic_pointer_cast<RpcMessage>(message);
+        if (buff.unreadBytes() < RPC_FRAME_HEADER_SIZE + static_cast<size_t>(length)) {
+            break;
+        }
 
-    rpc_message->ParseFromArray(ss.data(), ss.size());
+        reader.remove(RPC_FRAME_HEADER_SIZE);
+        slice ss = reader.consume(length);
 
-    LOG(INFO) << "RpcMessage: " << rpc_message->id() << "|" << rpc_message->service() << "|" << rpc_message->method();
+        RpcMessagePtr rpc_message(static_cast<RpcMessage*>(prototype_->New()));
+        if (!rpc_message->ParseFromArray(ss.data(), ss.size())) {
+            LOG(ERROR) << "RpcChannel::OnMessage error, parse rpc message failed";
+            conn->close();
+            return;
+        }
 
-    if (rpc_message) {
         onRpcMessage(conn, rpc_message);
     }
 }
 
 void RpcChannel::onRpcMessage(const ConnectionPtr& conn, const RpcMessagePtr& message) {
+    // The event loop cached time is the same steady clock, no clock call per message.
+    last_received_ms_.store(conn->getEventLoop()->now() / 1000000);
+
+    // Negotiate compression with the compress types the peer advertised.
+    if (message->has_accept_compress()) {
+        peer_accept_compress_.store(message->accept_compress());
+    }
+
     switch (message->type()) {
         case REQUEST:
             onRpcRequest(conn, message);
@@ -64,6 +293,26 @@ void RpcChannel::onRpcMessage(const ConnectionPtr& conn, const RpcMessagePtr& me
         case RESPONSE:
             onRpcResponse(conn, message);
             break;
+        case CANCEL:
+            message->has_stream_id() ? onStreamMessage(conn, message) : onRpcCancel(conn, message);
+            break;
+        case STREAM_OPEN:
+            onStreamOpen(conn, message);
+            break;
+        case STREAM_DATA:
+        case STREAM_END:
+        case STREAM_WINDOW:
+            onStreamMessage(conn, message);
+            break;
+        case PING: {
+            RpcMessage pong;
+            pong.set_type(PONG);
+            pong.set_id(message->id());
+            sendRpcMessage(conn, &pong);
+            break;
+        }
+        case PONG:
+            break;
         default:
             LOG(ERROR) << "OnRpcMessage the message type is invalid";
     }
@@ -72,49 +321,434 @@ void RpcChannel::onRpcMessage(const ConnectionPtr& conn, const RpcMessagePtr& me
 void RpcChannel::onRpcRequest(const ConnectionPtr& conn, const RpcMessagePtr& message) {
     LOG(INFO) << "OnRpcRequest ......";
 
-    int error = RPC_SERVER_SUCCESS;
     auto iter = services_->find(message->service());
-    if (iter != services_->end()) {
-        ::google::protobuf::Service* service = iter->second;
-        assert(service != NULL);
-
-        const ::google::protobuf::ServiceDescriptor* descriptor = service->GetDescriptor();
-        const ::google::protobuf::MethodDescriptor* method = descriptor->FindMethodByName(message->method());
-
-        if (!method) {
-            error = RPC_SERVER_NO_METHOD;
-        } else {
-            std::unique_ptr<::google::protobuf::Message> request(service->GetRequestPrototype(method).New());
-            if (request->ParseFromString(message->request())) {
-                ::google::protobuf::Message* response = service->GetResponsePrototype(method).New();
-                setRpcMessageId(message->id());
-                service->CallMethod(method, NULL, request.get(), response,
-                    ::google::protobuf::NewCallback(this, &RpcChannel::doneCallback, conn, response));
-            }
+    if (iter == services_->end()) {
+        sendErrorResponse(conn, message->id(), NO_SERVICE);
+        return;
+    }
+
+    RpcServiceEntryPtr entry = iter->second;
+    assert(entry->service_ != NULL);
+
+    const ::google::protobuf::ServiceDescriptor* descriptor = entry->service_->GetDescriptor();
+    const ::google::protobuf::MethodDescriptor* method = descriptor->FindMethodByName(message->method());
+    if (!method) {
+        sendErrorResponse(conn, message->id(), NO_METHOD);
+        return;
+    }
+
+    RpcControllerPtr controller(new RpcController());
+    if (message->has_timeout_ms() && message->timeout_ms() > 0) {
+        controller->setTimeout(message->timeout_ms(), conn->getEventLoop()->now());
+    }
+
+    if (entry->policy_ == RPC_EXECUTE_INLINE || !entry->pool_) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            addInflight(conn, message->id(), controller);
         }
+
+        invokeMethod(conn, entry, method, message, controller);
+        return;
+    }
+
+    // Load shedding, the service queue exceeds its budget, reply overload error immediately
+    // instead of queueing the request which response nobody will wait for.
+    if (entry->max_queue_depth_ > 0 && entry->queue_depth_.load() >= entry->max_queue_depth_) {
+        ++ entry->rejected_;
+        LOG(ERROR) << "RpcChannel service overloaded: " << message->service() << " queue depth: " << entry->queue_depth_.load();
+
+        sendErrorResponse(conn, message->id(), OVERLOADED);
+        return;
+    }
+
+    ++ entry->queue_depth_;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        addInflight(conn, message->id(), controller);
+    }
+
+    RpcChannelPtr self = shared_from_this();
+    auto fn = [self, conn, entry, method, message, controller]() {
+        -- entry->queue_depth_;
+        self->invokeMethod(conn, entry, method, message, controller);
+    };
+
+    // The request with timeout is scheduled by its deadline, so it runs before the caller gives up.
+    bool added = false;
+    if (controller->getTimeout() > 0) {
+        added = entry->pool_->addWithDeadline(fn, controller->getTimeout());
     } else {
-        error = RPC_SERVER_NO_SERVICE;
+        added = entry->pool_->add(fn);
     }
 
-    if (error != RPC_SERVER_SUCCESS) {
+    // The pool is shutting down or full, the rpc pools reject the new task and never drop a queued one.
+    if (!added) {
+        -- entry->queue_depth_;
+        ++ entry->rejected_;
+        LOG(ERROR) << "RpcChannel service pool rejected: " << message->service() << "." << message->method();
 
+        removeInflight(message->id());
+        sendErrorResponse(conn, message->id(), OVERLOADED);
     }
 }
 
 void RpcChannel::onRpcResponse(const ConnectionPtr& conn, const RpcMessagePtr& message) {
-    LOG(INFO) << "OnRpcResponse ......";
+    outstanding_call out_call;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = outstandings_.find(message->id());
+        if (iter == outstandings_.end()) {
+            // The call already timedout or canceled.
+            return;
+        }
+
+        out_call = iter->second;
+        outstandings_.erase(iter);
+    }
+
+    out_call.memory_stats->add(MEMORY_RPC_CALL, -out_call.bytes, -1);
+
+    if (out_call.timer.valid()) {
+        out_call.event_loop->cancelTimerTask(out_call.timer);
+    }
+
+    if (out_call.controller) {
+        out_call.controller->setCancelCallback(RpcController::CancelCallback());
+    }
+
+    if (message->has_error() && message->error() != SUCCESS) {
+        if (out_call.controller) {
+            out_call.controller->setErrorCode(message->error(), RpcError_Name(message->error()));
+        }
+    } else {
+        if (!parsePayload(*message, false, out_call.response)) {
+            if (out_call.controller) {
+                out_call.controller->SetFailed("rpc parse response failed");
+            }
+        }
+    }
+
+    if (out_call.done) {
+        out_call.done->Run();
+    }
 }
 
-void RpcChannel::doneCallback(const ConnectionPtr conn, ::google::protobuf::Message* response) {
+void RpcChannel::onRpcCancel(const ConnectionPtr& conn, const RpcMessagePtr& message) {
+    RpcControllerPtr controller;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = inflights_.find(message->id());
+        if (iter == inflights_.end()) {
+            return;
+        }
+
+        controller = iter->second;
+    }
+
+    // The queued request will be skipped, the running method can check IsCanceled or NotifyOnCancel.
+    controller->onCancel();
+}
+
+void RpcChannel::onStreamOpen(const ConnectionPtr& conn, const RpcMessagePtr& message) {
+    uint64_t id = message->stream_id();
+
+    if (!stream_methods_) {
+        sendStreamEnd(conn, id, NO_METHOD);
+        return;
+    }
+
+    auto iter = stream_methods_->find(message->service() + "." + message->method());
+    if (iter == stream_methods_->end()) {
+        sendStreamEnd(conn, id, NO_METHOD);
+        return;
+    }
+
+    RpcStreamMethodEntryPtr entry = iter->second;
+
+    // Each executing stream holds one worker thread, reject the stream more than the budget.
+    if (entry->max_streams_ > 0 && entry->active_streams_.load() >= entry->max_streams_) {
+        ++ entry->rejected_;
+        LOG(ERROR) << "RpcChannel stream method overloaded: " << iter->first << " active streams: " << entry->active_streams_.load();
+
+        sendStreamEnd(conn, id, OVERLOADED);
+        return;
+    }
+
+    ++ entry->active_streams_;
+
+    RpcStreamPtr stream(new RpcStream(shared_from_this(), conn, id, true));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        streams_[id] = stream;
+    }
+
+    RpcChannelPtr self = shared_from_this();
+    auto fn = [self, entry, stream]() {
+        entry->handler_(stream);
+
+        // The handler returned without finish, finish the stream successfully.
+        stream->finish(SUCCESS);
+        self->removeStream(stream->getId());
+
+        -- entry->active_streams_;
+    };
+
+    // The pool is shutting down or full, end the stream the handler will never serve.
+    if (!entry->pool_->add(fn)) {
+        removeStream(id);
+        -- entry->active_streams_;
+        ++ entry->rejected_;
+        LOG(ERROR) << "RpcChannel stream method pool rejected: " << iter->first;
+
+        sendStreamEnd(conn, id, OVERLOADED);
+    }
+}
+
+void RpcChannel::onStreamMessage(const ConnectionPtr& conn, const RpcMessagePtr& message) {
+    RpcStreamPtr stream = findStream(message->stream_id());
+    if (!stream) {
+        // The stream already finished or canceled, drop the late messages.
+        return;
+    }
+
+    switch (message->type()) {
+        case STREAM_DATA: {
+            // The client writes the request field, the server writes the response field.
+            std::string payload;
+            if (!decodePayload(*message, stream->server_side_, &payload)) {
+                stream->cancel();
+                break;
+            }
+
+            stream->onData(payload);
+            break;
+        }
+        case STREAM_END:
+            stream->onEnd(message->has_error() ? message->error() : SUCCESS);
+            if (!stream->server_side_) {
+                removeStream(stream->getId());
+            }
+            break;
+        case STREAM_WINDOW:
+            stream->onWindow(message->window());
+            break;
+        case CANCEL:
+            stream->onAbort(CANCELED);
+            removeStream(stream->getId());
+            break;
+        default:
+            break;
+    }
+}
+
+void RpcChannel::sendStreamEnd(const ConnectionPtr& conn, uint64_t stream_id, int error) {
+    RpcMessage message;
+    message.set_type(STREAM_END);
+    message.set_stream_id(stream_id);
+    message.set_error(static_cast<RpcError>(error));
+
+    sendRpcMessage(conn, &message);
+}
+
+RpcStreamPtr RpcChannel::findStream(uint64_t stream_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = streams_.find(stream_id);
+    return iter == streams_.end() ? RpcStreamPtr() : iter->second;
+}
+
+void RpcChannel::removeStream(uint64_t stream_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.erase(stream_id);
+}
+
+void RpcChannel::invokeMethod(const ConnectionPtr& conn, const RpcServiceEntryPtr& entry,
+                    const ::google::protobuf::MethodDescriptor* method,
+                    const RpcMessagePtr& message, const RpcControllerPtr& controller) {
+    // Skip the work which response nobody will read.
+    if (controller->IsCanceled()) {
+        removeInflight(message->id());
+        return;
+    }
+
+    if (controller->isExpired()) {
+        LOG(ERROR) << "RpcChannel request expired before execute: " << message->service() << "." << message->method();
+
+        removeInflight(message->id());
+        sendErrorResponse(conn, message->id(), TIMEDOUT);
+        return;
+    }
+
+    ::google::protobuf::Service* service = entry->service_;
+
+    std::unique_ptr<::google::protobuf::Message> request(service->GetRequestPrototype(method).New());
+    if (!parsePayload(*message, true, request.get())) {
+        LOG(ERROR) << "RpcChannel parse request failed: " << message->service() << "." << message->method();
+
+        removeInflight(message->id());
+        sendErrorResponse(conn, message->id(), BAD_REQUEST);
+        return;
+    }
+
+    ::google::protobuf::Message* response = service->GetResponsePrototype(method).New();
+    ::google::protobuf::Message* raw_request = request.release();
+
+    service->CallMethod(method, controller.get(), raw_request, response,
+        new DoneClosure(shared_from_this(), conn, message->id(), controller, raw_request, response));
+}
+
+void RpcChannel::doneCallback(const ConnectionPtr& conn, uint64_t id,
+                    const RpcControllerPtr& controller, ::google::protobuf::Message* response) {
     std::unique_ptr<::google::protobuf::Message> body(response);
+
+    removeInflight(id);
+
+    // The client already gave up the call.
+    if (controller->IsCanceled()) {
+        return;
+    }
+
+    RpcMessage message;
+    message.set_type(RESPONSE);
+    message.set_id(id);
+
+    if (controller->Failed()) {
+        message.set_error(static_cast<RpcError>(controller->getErrorCode()));
+    } else {
+        std::string payload = body->SerializeAsString();
+        encodePayload(&message, payload, false);
+    }
+
+    // If the done closure run in worker thread, the Connection::send will copy
+    // the frame and hand back to the connection event loop by sendToQueue.
+    sendRpcMessage(conn, &message);
+}
+
+void RpcChannel::sendErrorResponse(const ConnectionPtr& conn, uint64_t id, int error) {
     RpcMessage message;
     message.set_type(RESPONSE);
-    message.set_id(id_);
-    message.set_response(body->SerializeAsString());
+    message.set_id(id);
+    message.set_error(static_cast<RpcError>(error));
+
+    sendRpcMessage(conn, &message);
+}
+
+void RpcChannel::removeInflight(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (inflights_.erase(id) > 0) {
+        memory_stats_->add(MEMORY_RPC_CALL, -static_cast<int64_t>(sizeof(RpcController)), -1);
+    }
+}
+
+void RpcChannel::addInflight(const ConnectionPtr& conn, uint64_t id, const RpcControllerPtr& controller) {
+    // The server side channel serves only one connection, its stats never change.
+    memory_stats_ = &conn->getEventLoop()->getMemoryStats();
+
+    // The duplicate request id replaces the previous call, which is counted only once.
+    RpcControllerPtr& inflight = inflights_[id];
+    if (!inflight) {
+        memory_stats_->add(MEMORY_RPC_CALL, sizeof(RpcController), 1);
+    }
+
+    inflight = controller;
+}
+
+void RpcChannel::onCallFailed(uint64_t id, int error, const std::string& reason) {
+    outstanding_call out_call;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = outstandings_.find(id);
+        if (iter == outstandings_.end()) {
+            return;
+        }
+
+        out_call = iter->second;
+        outstandings_.erase(iter);
+    }
+
+    out_call.memory_stats->add(MEMORY_RPC_CALL, -out_call.bytes, -1);
+
+    if (out_call.timer.valid()) {
+        out_call.event_loop->cancelTimerTask(out_call.timer);
+    }
+
+    if (out_call.controller) {
+        out_call.controller->setCancelCallback(RpcController::CancelCallback());
+        out_call.controller->setErrorCode(error, reason);
+    }
+
+    // Propagate the cancellation to server, stop wasting server CPU on the response nobody will read.
+    ConnectionPtr conn = conn_.lock();
+    if (conn) {
+        RpcMessage message;
+        message.set_type(CANCEL);
+        message.set_id(id);
+
+        sendRpcMessage(conn, &message);
+    }
+
+    if (out_call.done) {
+        out_call.done->Run();
+    }
+}
+
+void RpcChannel::encodePayload(RpcMessage* message, std::string& payload, bool request) {
+    // Only compress the large payload, and the peer must be able to decompress it.
+    int type = COMPRESS_NONE;
+    if (payload.size() >= compress_threshold_) {
+        type = rpcSelectCompressType(compress_type_, peer_accept_compress_.load());
+    }
+
+    std::string compressed;
+    if (type != COMPRESS_NONE && rpcCompress(type, payload, &compressed) && compressed.size() < payload.size()) {
+        message->set_compress_type(static_cast<RpcCompressType>(type));
+        payload.swap(compressed);
+    }
+
+    if (request) {
+        message->set_request(payload);
+    } else {
+        message->set_response(payload);
+    }
+}
+
+bool RpcChannel::decodePayload(const RpcMessage& message, bool request, std::string* payload) {
+    const std::string& data = request ? message.request() : message.response();
+    if (!message.has_compress_type() || message.compress_type() == COMPRESS_NONE) {
+        payload->assign(data);
+        return true;
+    }
+
+    if (!rpcDecompress(message.compress_type(), data, payload)) {
+        LOG(ERROR) << "RpcChannel decompress payload failed, compress type: " << message.compress_type();
+        return false;
+    }
+
+    return true;
+}
+
+bool RpcChannel::parsePayload(const RpcMessage& message, bool request, ::google::protobuf::Message* body) {
+    if (!message.has_compress_type() || message.compress_type() == COMPRESS_NONE) {
+        return body->ParseFromString(request ? message.request() : message.response());
+    }
+
+    std::string payload;
+    return decodePayload(message, request, &payload) && body->ParseFromString(payload);
+}
+
+void RpcChannel::sendRpcMessage(const ConnectionPtr& conn, RpcMessage* message) {
+    // Advertise the compress types this side can decompress.
+    message->set_accept_compress(rpcSupportedCompressMask());
+
+    std::string frame;
+    frame.resize(RPC_FRAME_HEADER_SIZE);
+    message->AppendToString(&frame);
+
+    uint32_t length = htonl(frame.size() - RPC_FRAME_HEADER_SIZE);
+    memcpy(&frame[0], &length, sizeof(length));
 
-    std::string buff;
-    message.SerializeToString(&buff);
-    conn->send(buff.c_str(), buff.length());
+    conn->send(frame.data(), frame.size());
 }
 
 } /* end namespace atp */
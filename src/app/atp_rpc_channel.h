@@ -2,9 +2,16 @@
 #define __ATP_RPC_CHANNEL_H__
 
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
 #include <google/protobuf/service.h>
 
-#include "atp_cbs.h"
+#include "net/atp_cbs.h"
+#include "net/atp_timer_queue.h"
+#include "net/atp_dynamic_thread_pool.h"
+#include "app/atp_rpc_controller.h"
+#include "app/atp_rpc_stream.h"
 
 
 namespace google {
@@ -28,17 +35,96 @@ class Service;
 
 namespace atp {
 
+class EventLoop;
+class MemoryStats;
+
+// The rpc frame header is 4 bytes message length.
+#define RPC_FRAME_HEADER_SIZE      (sizeof(int32_t))
+
+// The max rpc frame size.
+#define RPC_FRAME_MAX_SIZE         (64 * 1024 * 1024)
+
 typedef enum {
     RPC_SERVER_ERROR_BASE   =   (-700),
     RPC_SERVER_SUCCESS      =   (0),
     RPC_SERVER_NO_SERVICE   =   (RPC_SERVER_ERROR_BASE - 1),
-    RPC_SERVER_NO_METHOD    =   (RPC_SERVER_ERROR_BASE - 2)
+    RPC_SERVER_NO_METHOD    =   (RPC_SERVER_ERROR_BASE - 2),
+    RPC_SERVER_OVERLOADED   =   (RPC_SERVER_ERROR_BASE - 3)
 } RpcServerError;
 
 
-typedef std::unordered_map<std::string, ::google::protobuf::Service*> ProtobufServicesMap;
+/* Where the service methods are executed. */
+typedef enum {
+    /* Execute in the connection IO event loop, only for the non-blocking and short methods. */
+    RPC_EXECUTE_INLINE          =   (0),
+
+    /* Execute in the Server shared DynamicThreadPool. */
+    RPC_EXECUTE_SHARED_POOL     =   (1),
+
+    /* Execute in the thread pool owned by the service itself. */
+    RPC_EXECUTE_DEDICATED_POOL  =   (2)
+} RpcExecutionPolicy;
+
+
+struct RpcServiceEntry {
+    RpcServiceEntry(::google::protobuf::Service* service, RpcExecutionPolicy policy, int max_queue_depth)
+        : service_(service), policy_(policy), pool_(nullptr),
+          max_queue_depth_(max_queue_depth), queue_depth_(0), rejected_(0) {}
+
+    ::google::protobuf::Service* service_;
+
+    RpcExecutionPolicy policy_;
+
+    // The thread pool for execute methods, it is nullptr when the policy is RPC_EXECUTE_INLINE.
+    // It must reject the new task when full(THREAD_POOL_REJECT_DISCARD), the rejected one is answered
+    // with OVERLOADED, but a dropped queued one never is.
+    BaseThreadPool* pool_;
+
+    // The thread pool ownership when the policy is RPC_EXECUTE_DEDICATED_POOL.
+    std::unique_ptr<BaseThreadPool> dedicated_pool_;
+
+    // The max requests waiting in the pool queue, 0 is unlimited.
+    int max_queue_depth_;
+
+    // The requests already dispatched to pool but not executed.
+    std::atomic<int> queue_depth_;
+
+    // The requests rejected by load shedding or the thread pool.
+    std::atomic<uint64_t> rejected_;
+};
+
+using RpcServiceEntryPtr = std::shared_ptr<RpcServiceEntry>;
 
-class RpcChannel : public ::google::protobuf::RpcChannel {
+typedef std::unordered_map<std::string, RpcServiceEntryPtr> ProtobufServicesMap;
+
+struct RpcStreamMethodEntry {
+    RpcStreamMethodEntry(const RpcStreamHandler& handler, int max_streams)
+        : handler_(handler), pool_(nullptr), max_streams_(max_streams), active_streams_(0), rejected_(0) {}
+
+    RpcStreamHandler handler_;
+
+    // The handler blocks on the stream read and write, it is always executed in the thread pool.
+    // Like the service pool, it must reject the new task when full instead of dropping a queued one.
+    BaseThreadPool* pool_;
+
+    std::unique_ptr<BaseThreadPool> dedicated_pool_;
+
+    // The max streams executing at the same time, 0 is unlimited.
+    int max_streams_;
+
+    std::atomic<int> active_streams_;
+
+    // The streams rejected by load shedding or the thread pool.
+    std::atomic<uint64_t> rejected_;
+};
+
+using RpcStreamMethodEntryPtr = std::shared_ptr<RpcStreamMethodEntry>;
+
+// The key is "service full name.method name".
+typedef std::unordered_map<std::string, RpcStreamMethodEntryPtr> RpcStreamMethodsMap;
+
+class RpcChannel : public ::google::protobuf::RpcChannel,
+                   public std::enable_shared_from_this<RpcChannel> {
 public:
     RpcChannel();
 
@@ -55,34 +141,145 @@ public:
         services_ = services;
     }
 
+    void setRpcStreamMethods(const RpcStreamMethodsMap* stream_methods) {
+        stream_methods_ = stream_methods;
+    }
+
+    /*
+     * Client side open a stream to the remote stream method, return nullptr if the connection not ready.
+     * The returned stream must be read and written in the thread other than the connection event loop.
+     */
+    RpcStreamPtr openStream(const std::string& service, const std::string& method);
+
+    /*
+     * Compress the request/response payload not less than threshold, with the type(RpcCompressType)
+     * if the peer supports it. The channel learns the peer supported types from each received message.
+     * COMPRESS_NONE(the default) disables the compression.
+     */
+    void setCompression(int type, size_t threshold) {
+        compress_type_ = type;
+        compress_threshold_ = threshold;
+    }
+
+    /* The client side channel must set the connection before CallMethod. */
+    void setConnection(const ConnectionPtr& conn) {
+        conn_ = conn;
+    }
+
     void onMessage(const ConnectionPtr& conn, ByteBuffer& buff);
 
-private:
-    void setRpcMessageId(int64_t id) {
-        id_ = id;
+    /* The connection write buffer drained, wake up the stream writers waiting for it. */
+    void onWriteComplete(const ConnectionPtr& conn);
+
+    /* The connection closed, fail the outstanding calls and abort all the streams. */
+    void onClose(const ConnectionPtr& conn);
+
+    /* Send the lightweight ping, the peer channel replies pong without any service. */
+    void ping();
+
+    /* The steady clock ms of the last message received, for the health check. */
+    int64_t getLastReceivedTime() const {
+        return last_received_ms_.load();
     }
 
+private:
+    class DoneClosure;
+
+    friend class RpcStream;
+
     void onRpcMessage(const ConnectionPtr& conn, const RpcMessagePtr& message);
 
     void onRpcRequest(const ConnectionPtr& conn, const RpcMessagePtr& message);
 
     void onRpcResponse(const ConnectionPtr& conn, const RpcMessagePtr& message);
 
-    void doneCallback(const ConnectionPtr conn, ::google::protobuf::Message* response);
+    void onRpcCancel(const ConnectionPtr& conn, const RpcMessagePtr& message);
+
+    void onStreamOpen(const ConnectionPtr& conn, const RpcMessagePtr& message);
+
+    void onStreamMessage(const ConnectionPtr& conn, const RpcMessagePtr& message);
+
+    void sendStreamEnd(const ConnectionPtr& conn, uint64_t stream_id, int error);
+
+    RpcStreamPtr findStream(uint64_t stream_id);
+
+    void removeStream(uint64_t stream_id);
+
+    void invokeMethod(const ConnectionPtr& conn, const RpcServiceEntryPtr& entry,
+                        const ::google::protobuf::MethodDescriptor* method,
+                        const RpcMessagePtr& message, const RpcControllerPtr& controller);
+
+    void doneCallback(const ConnectionPtr& conn, uint64_t id,
+                        const RpcControllerPtr& controller, ::google::protobuf::Message* response);
+
+    void sendErrorResponse(const ConnectionPtr& conn, uint64_t id, int error);
+
+    void removeInflight(uint64_t id);
+
+    /* Add the server side inflight call to inflights_ and account it, must hold the mutex_. */
+    void addInflight(const ConnectionPtr& conn, uint64_t id, const RpcControllerPtr& controller);
+
+    void encodePayload(RpcMessage* message, std::string& payload, bool request);
+
+    bool decodePayload(const RpcMessage& message, bool request, std::string* payload);
+
+    /* Parse the payload to body, the uncompressed payload is parsed in place without copy. */
+    bool parsePayload(const RpcMessage& message, bool request, ::google::protobuf::Message* body);
+
+    /* Frame the message with length header and send it. */
+    void sendRpcMessage(const ConnectionPtr& conn, RpcMessage* message);
+
+    /* Client side outstanding call failed by timeout or canceled. */
+    void onCallFailed(uint64_t id, int error, const std::string& reason);
 
 private:
     typedef struct {
         ::google::protobuf::Message* response;
-        ::google::protobuf::Closure* done;        
+        ::google::protobuf::Closure* done;
+        RpcController* controller;
+        // The timeout timer in the connection event loop.
+        TimerId timer;
+        EventLoop* event_loop;
+
+        // The request bytes accounted to the connection event loop memory stats.
+        int64_t bytes;
+        MemoryStats* memory_stats;
     } outstanding_call;
 
     const ::google::protobuf::Message* prototype_;
 
+    // The outstandings_ and inflights_ are accessed by caller, IO and worker threads.
+    std::mutex mutex_;
+
+    // Client side calls waiting for response.
     std::map<int64_t, outstanding_call> outstandings_;
 
+    // Server side requests not finished, for cancel them.
+    std::map<int64_t, RpcControllerPtr> inflights_;
+
+    // The server side connection event loop memory stats, the inflights_ are accounted to.
+    MemoryStats* memory_stats_;
+
+    // The opened streams, client side and server side.
+    std::map<uint64_t, RpcStreamPtr> streams_;
+
     const ProtobufServicesMap* services_;
 
-    int64_t id_;
+    const RpcStreamMethodsMap* stream_methods_;
+
+    WeakConnectionPtr conn_;
+
+    // The preferred compress type and min payload size to compress.
+    int compress_type_;
+
+    size_t compress_threshold_;
+
+    // The compress types the peer can decompress, negotiated per connection.
+    std::atomic<uint32_t> peer_accept_compress_;
+
+    std::atomic<uint64_t> id_;
+
+    std::atomic<int64_t> last_received_ms_;
 };
 
 } /* end namespace atp */
@@ -0,0 +1,445 @@
+#include <chrono>
+#include <sstream>
+#include <google/protobuf/stubs/common.h>
+
+#include "net/atp_tcp_conn.h"
+#include "net/atp_event_loop.h"
+#include "net/atp_cycle_timer.h"
+#include "net/atp_object_pool.hpp"
+#include "net/atp_event_loop_thread_pool.h"
+#include "app/atp_uuid.h"
+#include "app/atp_rpc_channel.h"
+#include "app/atp_rpc_client_pool.h"
+#include "glog/logging.h"
+
+namespace atp {
+
+struct RpcClientPool::ClientConn {
+    explicit ClientConn(Backend* backend)
+        : backend_(backend), event_loop_(nullptr), connecting_(false), healthy_(false), outstanding_(0), calls_(0) {}
+
+    // The backend is alive until all its connections closed.
+    Backend* backend_;
+
+    // The following are protected by the pool mutex_.
+    EventLoop* event_loop_;
+    ConnectionPtr conn_;
+    RpcChannelPtr channel_;
+    ConnectorPtr connector_;
+    bool connecting_;
+    bool healthy_;
+
+    // The calls not finished, decreased by the call done closure.
+    std::atomic<int> outstanding_;
+
+    std::atomic<uint64_t> calls_;
+};
+
+struct RpcClientPool::Backend {
+    Backend(const std::string& ip, unsigned int port)
+        : ip_(ip), port_(port), draining_(false) {}
+
+    std::string ip_;
+    unsigned int port_;
+
+    // Removed by application layer, waiting for the outstanding calls finished.
+    bool draining_;
+
+    std::vector<ClientConnPtr> conns_;
+};
+
+static int64_t steadyClockMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string backendKey(const std::string& ip, unsigned int port) {
+    return ip + ":" + std::to_string(port);
+}
+
+RpcClientPool::RpcClientPool(size_t conns_per_backend, RpcBalancePolicy policy, size_t io_threads)
+    : conns_per_backend_(conns_per_backend), policy_(policy), io_threads_(io_threads),
+      event_loop_pool_(new EventLoopPool(io_threads)), health_loop_(nullptr),
+      uuid_generator_(new UUIDGenerator()), next_index_(0),
+      random_(static_cast<std::minstd_rand::result_type>(steadyClockMs())), running_(false) {
+    assert(conns_per_backend_ > 0);
+    assert(io_threads_ > 0);
+}
+
+RpcClientPool::~RpcClientPool() {
+    stop();
+}
+
+void RpcClientPool::start() {
+    if (running_.load()) {
+        return;
+    }
+
+    bool started = event_loop_pool_->autoStart();
+    assert(started);
+    (void)started;
+
+    running_.store(true);
+
+    health_loop_ = event_loop_pool_->getIOEventLoop();
+
+    // Connect the backends added before start immediately, and then check them periodically.
+    health_loop_->sendToQueue(std::bind(&RpcClientPool::healthCheck, this));
+    health_timer_ = health_loop_->addCycleTask(RPC_CLIENT_POOL_HEALTH_INTERVAL,
+                        std::bind(&RpcClientPool::healthCheck, this), true);
+}
+
+void RpcClientPool::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+
+    if (health_timer_) {
+        health_timer_->cancel();
+    }
+
+    std::vector<ConnectionPtr> conns;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = backends_.begin(); it != backends_.end(); ++ it) {
+            for (auto& client : it->second->conns_) {
+                if (client->conn_) {
+                    conns.push_back(client->conn_);
+                }
+            }
+        }
+    }
+
+    // The close is queued before the event loop stop, the outstanding calls are failed by the channel.
+    for (auto& conn : conns) {
+        conn->close();
+    }
+
+    event_loop_pool_->autoStop();
+    event_loop_pool_->autoJoin();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    backends_.clear();
+    candidates_.clear();
+}
+
+void RpcClientPool::addBackend(const std::string& ip, unsigned int port) {
+    std::string key = backendKey(ip, port);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = backends_.find(key);
+        if (iter != backends_.end()) {
+            if (!iter->second->draining_) {
+                LOG(ERROR) << "RpcClientPool backend already exists: " << key;
+                return;
+            }
+
+            // Added again before the drained connections closed, keep using them.
+            iter->second->draining_ = false;
+            rebuildCandidates();
+        } else {
+            BackendPtr backend(new Backend(ip, port));
+            for (size_t i = 0; i < conns_per_backend_; ++ i) {
+                backend->conns_.push_back(ClientConnPtr(new ClientConn(backend.get())));
+            }
+
+            backends_[key] = backend;
+        }
+    }
+
+    LOG(INFO) << "RpcClientPool add backend: " << key;
+
+    if (running_.load()) {
+        health_loop_->sendToQueue(std::bind(&RpcClientPool::healthCheck, this));
+    }
+}
+
+void RpcClientPool::removeBackend(const std::string& ip, unsigned int port) {
+    std::string key = backendKey(ip, port);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto iter = backends_.find(key);
+        if (iter == backends_.end()) {
+            LOG(ERROR) << "RpcClientPool backend not exists: " << key;
+            return;
+        }
+
+        // No new calls to the backend, the connections are closed by health check after outstanding calls finished.
+        iter->second->draining_ = true;
+        rebuildCandidates();
+    }
+
+    LOG(INFO) << "RpcClientPool remove backend: " << key;
+
+    if (running_.load()) {
+        health_loop_->sendToQueue(std::bind(&RpcClientPool::healthCheck, this));
+    }
+}
+
+void RpcClientPool::CallMethod(const ::google::protobuf::MethodDescriptor* method,
+                    ::google::protobuf::RpcController* controller,
+                    const ::google::protobuf::Message* request,
+                    ::google::protobuf::Message* response,
+                    ::google::protobuf::Closure* done) {
+    RpcChannelPtr channel;
+    ClientConnPtr client = pick(&channel);
+    if (!client) {
+        if (controller) {
+            controller->SetFailed("rpc client pool no available connection");
+        }
+
+        if (done) {
+            done->Run();
+        }
+
+        return;
+    }
+
+    ++ client->outstanding_;
+    ++ client->calls_;
+
+    channel->CallMethod(method, controller, request, response,
+        ::google::protobuf::NewCallback(&RpcClientPool::onCallDone, client, done));
+}
+
+size_t RpcClientPool::getAvailableConnections() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return candidates_.size();
+}
+
+std::string RpcClientPool::dumpStatus() {
+    std::ostringstream status;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = backends_.begin(); it != backends_.end(); ++ it) {
+        size_t connected = 0;
+        size_t healthy = 0;
+        int outstanding = 0;
+        uint64_t calls = 0;
+
+        for (auto& client : it->second->conns_) {
+            connected += client->conn_ ? 1 : 0;
+            healthy += (client->conn_ && client->healthy_) ? 1 : 0;
+            outstanding += client->outstanding_.load();
+            calls += client->calls_.load();
+        }
+
+        status << "backend: " << it->first << " draining: " << it->second->draining_
+               << " connected: " << connected << "/" << it->second->conns_.size() << " healthy: " << healthy
+               << " outstanding: " << outstanding << " calls: " << calls << "\n";
+    }
+
+    return status.str();
+}
+
+RpcClientPool::ClientConnPtr RpcClientPool::pick(RpcChannelPtr* channel) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    size_t size = candidates_.size();
+    if (size == 0) {
+        return ClientConnPtr();
+    }
+
+    ClientConnPtr best;
+    if (policy_ == RPC_BALANCE_POWER_OF_TWO && size > 2) {
+        // Two different connections, O(1) and avoid the herd to the same least loaded connection.
+        size_t first = random_() % size;
+        size_t second = (first + 1 + random_() % (size - 1)) % size;
+
+        best = candidates_[first];
+        if (candidates_[second]->outstanding_.load() < best->outstanding_.load()) {
+            best = candidates_[second];
+        }
+    } else {
+        size_t start = next_index_ ++;
+        for (size_t i = 0; i < size; ++ i) {
+            const ClientConnPtr& client = candidates_[(start + i) % size];
+            if (!best || client->outstanding_.load() < best->outstanding_.load()) {
+                best = client;
+            }
+        }
+    }
+
+    *channel = best->channel_;
+    return best;
+}
+
+void RpcClientPool::connect(const BackendPtr& backend, const ClientConnPtr& client) {
+    EventLoop* event_loop = event_loop_pool_->getIOEventLoop();
+
+    ConnectorPtr connector(new Connector(event_loop, backend->ip_, backend->port_, RPC_CLIENT_POOL_CONNECT_TIMEOUT));
+    connector->setConnectCallback(std::bind(&RpcClientPool::onConnected, this, client,
+                                    std::placeholders::_1, std::placeholders::_2));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        client->event_loop_ = event_loop;
+        client->connector_ = connector;
+    }
+
+    connector->start();
+}
+
+void RpcClientPool::onConnected(const ClientConnPtr& client, int fd, std::string& remote_addr) {
+    bool dropped = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        client->connector_.reset();
+
+        dropped = (fd < 0 || !running_.load() || client->backend_->draining_);
+        if (dropped) {
+            client->connecting_ = false;
+        }
+    }
+
+    // Failed connection will be retried by the next health check.
+    if (dropped) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+
+        return;
+    }
+
+    ConnectionPtr conn = ObjectPool<Connection>::makeShared(client->event_loop_, fd, uuid_generator_->generateUUID(), remote_addr);
+    RpcChannelPtr channel(new atp::RpcChannel());
+    channel->setConnection(conn);
+
+    conn->setReadMessageCallback([channel](const ConnectionPtr& conn, ByteBuffer& buff) {
+        channel->onMessage(conn, buff);
+    });
+
+    conn->setWriteCompleteCallback([channel](const ConnectionPtr& conn) {
+        channel->onWriteComplete(conn);
+    });
+
+    conn->setCloseCallback(std::bind(&RpcClientPool::onClose, this, client, std::placeholders::_1));
+    conn->attachToEventLoop();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    client->conn_ = conn;
+    client->channel_ = channel;
+    client->connecting_ = false;
+    client->healthy_ = true;
+    rebuildCandidates();
+}
+
+void RpcClientPool::onClose(const ClientConnPtr& client, const ConnectionPtr& conn) {
+    RpcChannelPtr channel;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (client->conn_ != conn) {
+            return;
+        }
+
+        channel = client->channel_;
+        client->conn_.reset();
+        client->channel_.reset();
+        client->healthy_ = false;
+        rebuildCandidates();
+    }
+
+    // Fail the outstanding calls out of the lock, the done closures maybe call the pool again.
+    channel->onClose(conn);
+}
+
+void RpcClientPool::healthCheck() {
+    if (!running_.load()) {
+        return;
+    }
+
+    int64_t now = steadyClockMs();
+
+    std::vector<ConnectionPtr> closing;
+    std::vector<RpcChannelPtr> pinging;
+    std::vector<std::pair<BackendPtr, ClientConnPtr>> connecting;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = backends_.begin(); it != backends_.end();) {
+            BackendPtr backend = it->second;
+            bool alive = false;
+
+            for (auto& client : backend->conns_) {
+                if (client->conn_) {
+                    alive = true;
+
+                    if (backend->draining_) {
+                        if (client->outstanding_.load() == 0) {
+                            closing.push_back(client->conn_);
+                        }
+
+                        continue;
+                    }
+
+                    // The pong updates the last received time, the silent connection is not picked.
+                    int64_t silent = now - client->channel_->getLastReceivedTime();
+                    client->healthy_ = (silent < RPC_CLIENT_POOL_UNHEALTHY_TIMEOUT);
+
+                    if (silent >= RPC_CLIENT_POOL_DEAD_TIMEOUT) {
+                        LOG(ERROR) << "RpcClientPool connection dead, reconnect: " << it->first;
+                        closing.push_back(client->conn_);
+                    } else {
+                        pinging.push_back(client->channel_);
+                    }
+                } else if (client->connecting_) {
+                    alive = true;
+                } else if (!backend->draining_) {
+                    alive = true;
+                    client->connecting_ = true;
+                    connecting.push_back(std::make_pair(backend, client));
+                }
+            }
+
+            // The drained backend is removed after all its connections closed.
+            if (backend->draining_ && !alive) {
+                LOG(INFO) << "RpcClientPool backend drained: " << it->first;
+                it = backends_.erase(it);
+            } else {
+                ++ it;
+            }
+        }
+
+        rebuildCandidates();
+    }
+
+    for (auto& conn : closing) {
+        conn->close();
+    }
+
+    for (auto& channel : pinging) {
+        channel->ping();
+    }
+
+    for (auto& pair : connecting) {
+        connect(pair.first, pair.second);
+    }
+}
+
+void RpcClientPool::rebuildCandidates() {
+    candidates_.clear();
+
+    for (auto it = backends_.begin(); it != backends_.end(); ++ it) {
+        if (it->second->draining_) {
+            continue;
+        }
+
+        for (auto& client : it->second->conns_) {
+            if (client->conn_ && client->healthy_) {
+                candidates_.push_back(client);
+            }
+        }
+    }
+}
+
+void RpcClientPool::onCallDone(ClientConnPtr client, ::google::protobuf::Closure* done) {
+    -- client->outstanding_;
+
+    if (done) {
+        done->Run();
+    }
+}
+
+} /* end namespace atp */
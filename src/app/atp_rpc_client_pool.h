@@ -0,0 +1,134 @@
+#ifndef __ATP_RPC_CLIENT_POOL_H__
+#define __ATP_RPC_CLIENT_POOL_H__
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <google/protobuf/service.h>
+
+#include "net/atp_cbs.h"
+#include "net/atp_connector.h"
+
+namespace atp {
+
+class EventLoop;
+class EventLoopPool;
+class CycleTimer;
+class UUIDGenerator;
+
+// The connect timeout ms of each backend connection.
+#define RPC_CLIENT_POOL_CONNECT_TIMEOUT     (1000)
+
+// The health check interval ms, each tick pings the connections and reconnects the closed ones.
+#define RPC_CLIENT_POOL_HEALTH_INTERVAL     (1000)
+
+// The connection received nothing in the ms is unhealthy and no more calls are picked to it.
+#define RPC_CLIENT_POOL_UNHEALTHY_TIMEOUT   (3 * RPC_CLIENT_POOL_HEALTH_INTERVAL)
+
+// The unhealthy connection received nothing in the ms is closed and reconnected.
+#define RPC_CLIENT_POOL_DEAD_TIMEOUT        (2 * RPC_CLIENT_POOL_UNHEALTHY_TIMEOUT)
+
+typedef enum {
+    /* Pick the connection with the least outstanding calls. */
+    RPC_BALANCE_LEAST_OUTSTANDING   =   (0),
+
+    /* Pick two connections randomly, use the one with less outstanding calls. */
+    RPC_BALANCE_POWER_OF_TWO        =   (1)
+} RpcBalancePolicy;
+
+/*
+ * The rpc client pool keeps N connections to each backend and spreads the calls to them,
+ * it is a protobuf RpcChannel, so the generated service stub can be used on it directly.
+ *
+ * The removed backend is drained: no new calls are picked to it, the outstanding calls finish
+ * normally, and then its connections are closed. Adding it again before closed cancels the drain.
+ */
+class RpcClientPool : public ::google::protobuf::RpcChannel {
+public:
+    explicit RpcClientPool(size_t conns_per_backend, RpcBalancePolicy policy, size_t io_threads = 1);
+
+    ~RpcClientPool();
+
+public:
+    void start();
+
+    void stop();
+
+    void addBackend(const std::string& ip, unsigned int port);
+
+    void removeBackend(const std::string& ip, unsigned int port);
+
+    void CallMethod(const ::google::protobuf::MethodDescriptor* method,
+                        ::google::protobuf::RpcController* controller,
+                        const ::google::protobuf::Message* request,
+                        ::google::protobuf::Message* response,
+                        ::google::protobuf::Closure* done) override;
+
+    /* The connections can be picked for the new calls. */
+    size_t getAvailableConnections();
+
+    /* The backends, connections, outstanding and finished calls, one backend per line. */
+    std::string dumpStatus();
+
+private:
+    struct ClientConn;
+    struct Backend;
+
+    using ClientConnPtr = std::shared_ptr<ClientConn>;
+    using BackendPtr = std::shared_ptr<Backend>;
+
+    ClientConnPtr pick(RpcChannelPtr* channel);
+
+    void connect(const BackendPtr& backend, const ClientConnPtr& client);
+
+    void onConnected(const ClientConnPtr& client, int fd, std::string& remote_addr);
+
+    void onClose(const ClientConnPtr& client, const ConnectionPtr& conn);
+
+    void healthCheck();
+
+    /* Rebuild the connections can be picked, must hold the mutex_. */
+    void rebuildCandidates();
+
+    static void onCallDone(ClientConnPtr client, ::google::protobuf::Closure* done);
+
+private:
+    size_t conns_per_backend_;
+
+    RpcBalancePolicy policy_;
+
+    size_t io_threads_;
+
+    // The event loops for the connections, one of them also runs the health check.
+    std::unique_ptr<EventLoopPool> event_loop_pool_;
+
+    EventLoop* health_loop_;
+
+    std::unique_ptr<UUIDGenerator> uuid_generator_;
+
+    std::shared_ptr<CycleTimer> health_timer_;
+
+    // Protect the backends_, candidates_ and the connection states.
+    std::mutex mutex_;
+
+    // The key is "ip:port".
+    std::map<std::string, BackendPtr> backends_;
+
+    // The connected, healthy and not draining connections.
+    std::vector<ClientConnPtr> candidates_;
+
+    // Rotate the least outstanding scan start, to spread the calls when all connections idle.
+    size_t next_index_;
+
+    std::minstd_rand random_;
+
+    std::atomic<bool> running_;
+};
+
+} /* end namespace atp */
+
+#endif /* __ATP_RPC_CLIENT_POOL_H__ */
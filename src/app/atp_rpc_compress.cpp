@@ -0,0 +1,231 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#ifdef ATP_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef ATP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "rpc.pb.h"
+#include "app/atp_thread_storage.hpp"
+#include "app/atp_rpc_compress.h"
+#include "glog/logging.h"
+
+namespace atp {
+
+/* The compression contexts for each thread. */
+struct rpc_compress_context {
+#ifdef ATP_HAVE_LZ4
+    void* lz4_state;
+#endif
+
+#ifdef ATP_HAVE_ZSTD
+    ZSTD_CCtx* zstd_cctx;
+    ZSTD_DCtx* zstd_dctx;
+#endif
+};
+
+PRIVATE_API(int rpc_compress_tls_init(void* data),
+{
+    struct rpc_compress_context* ctx = (struct rpc_compress_context*)data;
+
+#ifdef ATP_HAVE_LZ4
+    ctx->lz4_state = malloc(LZ4_sizeofState());
+    if (!ctx->lz4_state) {
+        return -1;
+    }
+#endif
+
+#ifdef ATP_HAVE_ZSTD
+    ctx->zstd_cctx = ZSTD_createCCtx();
+    ctx->zstd_dctx = ZSTD_createDCtx();
+    if (!ctx->zstd_cctx || !ctx->zstd_dctx) {
+        return -1;
+    }
+#endif
+
+    (void)ctx;
+    return 0;
+})
+
+PRIVATE_API(void rpc_compress_tls_cleanup(void* data),
+{
+    struct rpc_compress_context* ctx = (struct rpc_compress_context*)data;
+
+#ifdef ATP_HAVE_LZ4
+    free(ctx->lz4_state);
+#endif
+
+#ifdef ATP_HAVE_ZSTD
+    ZSTD_freeCCtx(ctx->zstd_cctx);
+    ZSTD_freeDCtx(ctx->zstd_dctx);
+#endif
+
+    free(ctx);
+})
+
+THREADSTORAGE_CUSTOM_SCOPE(rpc_compress_tls, rpc_compress_tls_init, rpc_compress_tls_cleanup, static);
+
+static struct rpc_compress_context* getCompressContext() {
+    return (struct rpc_compress_context*)THREADSTORAGE_GET(&rpc_compress_tls, sizeof(struct rpc_compress_context));
+}
+
+#ifdef ATP_HAVE_LZ4
+/* The LZ4 block format doesn't record the original size, prepend it with 4 bytes network order. */
+static bool lz4Compress(struct rpc_compress_context* ctx, const std::string& input, std::string* output) {
+    if (input.size() > (size_t)LZ4_MAX_INPUT_SIZE) {
+        return false;
+    }
+
+    int bound = LZ4_compressBound(input.size());
+    output->resize(sizeof(uint32_t) + bound);
+
+    uint32_t origin_size = htonl(input.size());
+    memcpy(&(*output)[0], &origin_size, sizeof(origin_size));
+
+    int n = LZ4_compress_fast_extState(ctx->lz4_state, input.data(), &(*output)[sizeof(uint32_t)],
+        input.size(), bound, 1);
+    if (n <= 0) {
+        return false;
+    }
+
+    output->resize(sizeof(uint32_t) + n);
+
+    return true;
+}
+
+static bool lz4Decompress(const std::string& input, std::string* output) {
+    if (input.size() < sizeof(uint32_t)) {
+        return false;
+    }
+
+    uint32_t origin_size = 0;
+    memcpy(&origin_size, input.data(), sizeof(origin_size));
+    origin_size = ntohl(origin_size);
+    if (origin_size > RPC_DECOMPRESS_MAX_SIZE) {
+        return false;
+    }
+
+    output->resize(origin_size);
+    int n = LZ4_decompress_safe(input.data() + sizeof(uint32_t), &(*output)[0],
+        input.size() - sizeof(uint32_t), origin_size);
+
+    return n >= 0 && (uint32_t)n == origin_size;
+}
+#endif
+
+#ifdef ATP_HAVE_ZSTD
+static bool zstdCompress(struct rpc_compress_context* ctx, const std::string& input, std::string* output) {
+    output->resize(ZSTD_compressBound(input.size()));
+
+    size_t n = ZSTD_compressCCtx(ctx->zstd_cctx, &(*output)[0], output->size(),
+        input.data(), input.size(), RPC_ZSTD_COMPRESS_LEVEL);
+    if (ZSTD_isError(n)) {
+        return false;
+    }
+
+    output->resize(n);
+
+    return true;
+}
+
+static bool zstdDecompress(struct rpc_compress_context* ctx, const std::string& input, std::string* output) {
+    unsigned long long origin_size = ZSTD_getFrameContentSize(input.data(), input.size());
+    if (origin_size == ZSTD_CONTENTSIZE_ERROR || origin_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        origin_size > RPC_DECOMPRESS_MAX_SIZE) {
+        return false;
+    }
+
+    output->resize(origin_size);
+    size_t n = ZSTD_decompressDCtx(ctx->zstd_dctx, &(*output)[0], output->size(), input.data(), input.size());
+
+    return !ZSTD_isError(n) && n == origin_size;
+}
+#endif
+
+uint32_t rpcSupportedCompressMask() {
+    uint32_t mask = 0;
+
+#ifdef ATP_HAVE_LZ4
+    mask |= (1 << COMPRESS_LZ4);
+#endif
+
+#ifdef ATP_HAVE_ZSTD
+    mask |= (1 << COMPRESS_ZSTD);
+#endif
+
+    return mask;
+}
+
+int rpcSelectCompressType(int preferred, uint32_t peer_accept_mask) {
+    uint32_t mask = rpcSupportedCompressMask() & peer_accept_mask;
+
+    if (preferred == COMPRESS_NONE) {
+        return COMPRESS_NONE;
+    }
+
+    if (mask & (1 << preferred)) {
+        return preferred;
+    }
+
+    // The peer does not support the preferred one, fall back to the cheapest one.
+    if (mask & (1 << COMPRESS_LZ4)) {
+        return COMPRESS_LZ4;
+    }
+
+    if (mask & (1 << COMPRESS_ZSTD)) {
+        return COMPRESS_ZSTD;
+    }
+
+    return COMPRESS_NONE;
+}
+
+bool rpcCompress(int type, const std::string& input, std::string* output) {
+    struct rpc_compress_context* ctx = getCompressContext();
+    if (!ctx) {
+        LOG(ERROR) << "rpcCompress get thread compress context failed";
+        return false;
+    }
+
+    switch (type) {
+#ifdef ATP_HAVE_LZ4
+        case COMPRESS_LZ4:
+            return lz4Compress(ctx, input, output);
+#endif
+#ifdef ATP_HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            return zstdCompress(ctx, input, output);
+#endif
+        default:
+            return false;
+    }
+}
+
+bool rpcDecompress(int type, const std::string& input, std::string* output) {
+    struct rpc_compress_context* ctx = getCompressContext();
+    if (!ctx) {
+        LOG(ERROR) << "rpcDecompress get thread compress context failed";
+        return false;
+    }
+
+    switch (type) {
+        case COMPRESS_NONE:
+            output->assign(input);
+            return true;
+#ifdef ATP_HAVE_LZ4
+        case COMPRESS_LZ4:
+            return lz4Decompress(input, output);
+#endif
+#ifdef ATP_HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            return zstdDecompress(ctx, input, output);
+#endif
+        default:
+            return false;
+    }
+}
+
+} /* end namespace atp */
@@ -0,0 +1,40 @@
+#ifndef __ATP_RPC_COMPRESS_H__
+#define __ATP_RPC_COMPRESS_H__
+
+#include <string>
+#include <stdint.h>
+
+namespace atp {
+
+// The rpc payload less than this size never be compressed.
+#define RPC_COMPRESS_DEFAULT_THRESHOLD     (4096)
+
+// The max rpc payload size after decompress, reject the larger for decompression bomb.
+#define RPC_DECOMPRESS_MAX_SIZE            (64 * 1024 * 1024)
+
+// The zstd compression level, level 1 is fast enough for IO event loop.
+#define RPC_ZSTD_COMPRESS_LEVEL            (1)
+
+/*
+ * The compress type bit for RpcMessage accept_compress, same as (1 << RpcCompressType).
+ * The LZ4 and ZSTD are available only if the library found when build.
+ */
+uint32_t rpcSupportedCompressMask();
+
+/*
+ * Select the preferred compress type if both sides support it, otherwise the one both sides support.
+ * Return COMPRESS_NONE if the preferred is COMPRESS_NONE or none supported.
+ */
+int rpcSelectCompressType(int preferred, uint32_t peer_accept_mask);
+
+/*
+ * Compress and decompress rpc payload, the compression context is cached in thread local storage,
+ * so each IO event loop(and worker thread) reuses its own contexts without any lock.
+ */
+bool rpcCompress(int type, const std::string& input, std::string* output);
+
+bool rpcDecompress(int type, const std::string& input, std::string* output);
+
+} /* end namespace atp */
+
+#endif /* __ATP_RPC_COMPRESS_H__ */
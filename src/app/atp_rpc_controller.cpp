@@ -0,0 +1,133 @@
+#include "rpc.pb.h"
+#include "app/atp_rpc_controller.h"
+
+namespace atp {
+
+RpcController::RpcController()
+    : canceled_(false), failed_(false), error_(SUCCESS),
+      timeout_ms_(0), cancel_closure_(nullptr) {
+
+}
+
+RpcController::~RpcController() {
+    // The NotifyOnCancel closure must be called once, but the call finished without cancel, release it.
+    delete cancel_closure_;
+    cancel_closure_ = nullptr;
+}
+
+void RpcController::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    canceled_.store(false);
+    failed_ = false;
+    error_ = SUCCESS;
+    reason_.clear();
+    timeout_ms_ = 0;
+    deadline_ = std::chrono::steady_clock::time_point();
+
+    delete cancel_closure_;
+    cancel_closure_ = nullptr;
+    cancel_fn_ = CancelCallback();
+}
+
+bool RpcController::Failed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+}
+
+std::string RpcController::ErrorText() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reason_;
+}
+
+void RpcController::StartCancel() {
+    CancelCallback fn;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn.swap(cancel_fn_);
+    }
+
+    // The client channel will fail the outstanding call and notify the server.
+    if (fn) {
+        fn();
+    }
+}
+
+void RpcController::SetFailed(const std::string& reason) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = true;
+    if (error_ == SUCCESS) {
+        error_ = FAILED;
+    }
+    reason_ = reason;
+}
+
+bool RpcController::IsCanceled() const {
+    return canceled_.load();
+}
+
+void RpcController::NotifyOnCancel(::google::protobuf::Closure* callback) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!canceled_.load()) {
+            delete cancel_closure_;
+            cancel_closure_ = callback;
+            return;
+        }
+    }
+
+    // Already canceled, call it immediately.
+    callback->Run();
+}
+
+void RpcController::setTimeout(int timeout_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    timeout_ms_ = timeout_ms;
+    if (timeout_ms_ > 0) {
+        deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms_);
+    }
+}
+
+void RpcController::setTimeout(int timeout_ms, int64_t now_ns) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    timeout_ms_ = timeout_ms;
+    if (timeout_ms_ > 0) {
+        deadline_ = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(now_ns)) +
+                    std::chrono::milliseconds(timeout_ms_);
+    }
+}
+
+bool RpcController::isExpired() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return timeout_ms_ > 0 && std::chrono::steady_clock::now() >= deadline_;
+}
+
+void RpcController::setErrorCode(int error, const std::string& reason) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = (error != SUCCESS);
+    error_ = error;
+    reason_ = reason;
+}
+
+void RpcController::onCancel() {
+    ::google::protobuf::Closure* closure = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (canceled_.exchange(true)) {
+            return;
+        }
+
+        closure = cancel_closure_;
+        cancel_closure_ = nullptr;
+    }
+
+    if (closure) {
+        closure->Run();
+    }
+}
+
+void RpcController::setCancelCallback(const CancelCallback& fn) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancel_fn_ = fn;
+}
+
+} /* end namespace atp */
@@ -0,0 +1,96 @@
+#ifndef __ATP_RPC_CONTROLLER_H__
+#define __ATP_RPC_CONTROLLER_H__
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <google/protobuf/service.h>
+
+namespace atp {
+
+/*
+ * The RpcController used by both rpc client and rpc server.
+ * Client: set the call timeout before CallMethod, StartCancel abort the outstanding call.
+ * Server: the deadline comes from request timeout, IsCanceled is true when the client canceled the call.
+ */
+class RpcController : public ::google::protobuf::RpcController {
+public:
+    using CancelCallback = std::function<void()>;
+
+public:
+    RpcController();
+
+    virtual ~RpcController();
+
+public:
+    /* Client side methods. */
+    void Reset() override;
+
+    bool Failed() const override;
+
+    std::string ErrorText() const override;
+
+    void StartCancel() override;
+
+    /* Server side methods. */
+    void SetFailed(const std::string& reason) override;
+
+    bool IsCanceled() const override;
+
+    void NotifyOnCancel(::google::protobuf::Closure* callback) override;
+
+public:
+    /* Set the call timeout and the deadline is now + timeout_ms, 0 is never timeout. */
+    void setTimeout(int timeout_ms);
+
+    /* The same as above, the deadline starts from the steady clock now_ns, e.g. the event loop cached time. */
+    void setTimeout(int timeout_ms, int64_t now_ns);
+
+    int getTimeout() const {
+        return timeout_ms_;
+    }
+
+    /* Whether the deadline already passed. */
+    bool isExpired() const;
+
+    /* The RpcError code of the failed call. */
+    void setErrorCode(int error, const std::string& reason);
+
+    int getErrorCode() const {
+        return error_;
+    }
+
+    /* Called by rpc server channel when the client canceled the call. */
+    void onCancel();
+
+    /* Set by rpc client channel, StartCancel will call it. */
+    void setCancelCallback(const CancelCallback& fn);
+
+private:
+    mutable std::mutex mutex_;
+
+    std::atomic<bool> canceled_;
+
+    bool failed_;
+
+    int error_;
+
+    std::string reason_;
+
+    int timeout_ms_;
+
+    std::chrono::steady_clock::time_point deadline_;
+
+    // The closure set by NotifyOnCancel, it will be called once when canceled.
+    ::google::protobuf::Closure* cancel_closure_;
+
+    CancelCallback cancel_fn_;
+};
+
+using RpcControllerPtr = std::shared_ptr<RpcController>;
+
+} /* end namespace atp */
+
+#endif /* __ATP_RPC_CONTROLLER_H__ */
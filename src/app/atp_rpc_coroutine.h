@@ -0,0 +1,78 @@
+#ifndef __ATP_RPC_COROUTINE_H__
+#define __ATP_RPC_COROUTINE_H__
+
+#include "net/atp_coroutine.h"
+
+#ifdef ATP_COROUTINE_ENABLED
+
+#include <atomic>
+#include <utility>
+#include <google/protobuf/stubs/callback.h>
+
+namespace atp {
+
+/*
+ * Await a rpc client call, the awaiter itself is the done closure of the call, so no closure is
+ * allocated. The done may run in the other event loop, the coroutine is resumed in its own loop.
+ */
+template <typename Call>
+class CoRpcCallAwaiter : public ::google::protobuf::Closure {
+public:
+    CoRpcCallAwaiter(EventLoop* loop, Call&& call) : loop_(loop), call_(std::move(call)), arrived_(false) {
+
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        call_(this);
+
+        // The call failed at once and Run already called, don't suspend and go on directly.
+        return !arrived_.exchange(true, std::memory_order_acq_rel);
+    }
+
+    void await_resume() const noexcept {
+
+    }
+
+    void Run() override {
+        if (!arrived_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+
+        std::coroutine_handle<> handle = handle_;
+        loop_->sendToQueue([handle]() {
+            handle.resume();
+        });
+    }
+
+private:
+    EventLoop* loop_;
+
+    Call call_;
+
+    std::coroutine_handle<> handle_;
+
+    // Both the await_suspend and Run arrived, the later one resumes the coroutine.
+    std::atomic<bool> arrived_;
+};
+
+/*
+ * The call is invoked with the done closure, e.g.
+ *   co_await asyncRpcCall(loop, [&](::google::protobuf::Closure* done) {
+ *       stub.Echo(&controller, &request, &response, done);
+ *   });
+ */
+template <typename Call>
+inline CoRpcCallAwaiter<Call> asyncRpcCall(EventLoop* loop, Call call) {
+    return CoRpcCallAwaiter<Call>(loop, std::move(call));
+}
+
+} /* end namespace atp */
+
+#endif /* ATP_COROUTINE_ENABLED */
+
+#endif /* __ATP_RPC_COROUTINE_H__ */
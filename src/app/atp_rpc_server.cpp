@@ -1,13 +1,16 @@
 #include <google/protobuf/service.h>
 #include <google/protobuf/descriptor.h>
 
-#include "atp_rpc_channel.h"
-#include "atp_rpc_server.h"
+#include "net/atp_dynamic_thread_pool.h"
+#include "app/atp_rpc_channel.h"
+#include "app/atp_rpc_server.h"
+#include "app/atp_rpc_compress.h"
 #include "glog/logging.h"
 
 namespace atp {
 
-RpcServer::RpcServer(std::string ip, unsigned int port) {
+RpcServer::RpcServer(std::string ip, unsigned int port)
+    : compress_type_(0), compress_threshold_(RPC_COMPRESS_DEFAULT_THRESHOLD) {
     srvaddr_.addr_ = ip;
     srvaddr_.port_ = port;
 
@@ -21,6 +24,7 @@ RpcServer::RpcServer(std::string ip, unsigned int port) {
     server_.reset(new Server("RpcServer", srvaddr, threads));
     server_->setConnectionCallback(std::bind(&RpcServer::onConnection, this, std::placeholders::_1));
     server_->setMessageCallback(std::bind(&RpcServer::onMessage, this, std::placeholders::_1, std::placeholders::_2));
+    server_->setCloseCallback(std::bind(&RpcServer::onClose, this, std::placeholders::_1));
 }
 
 RpcServer::~RpcServer() {
@@ -28,25 +32,107 @@ RpcServer::~RpcServer() {
 }
 
 void RpcServer::registerService(google::protobuf::Service* service) {
+    registerService(service, RPC_EXECUTE_INLINE, 0, 0);
+}
+
+void RpcServer::registerService(google::protobuf::Service* service, RpcExecutionPolicy policy,
+                    int max_queue_depth, size_t dedicated_threads) {
     const google::protobuf::ServiceDescriptor* descriptor = service->GetDescriptor();
 
-    if (services_map_.insert({descriptor->full_name(), service}).second == false) {
+    RpcServiceEntryPtr entry(new RpcServiceEntry(service, policy, max_queue_depth));
+
+    switch (policy) {
+        case RPC_EXECUTE_SHARED_POOL:
+            entry->pool_ = server_->getDynamicThreadPool();
+            if (!entry->pool_) {
+                LOG(ERROR) << "RpcServer the shared thread pool is disabled, execute inline: " << descriptor->full_name();
+                entry->policy_ = RPC_EXECUTE_INLINE;
+            }
+            break;
+        case RPC_EXECUTE_DEDICATED_POOL:
+            assert(dedicated_threads > 0);
+            // The dedicated pool is bounded, it never grows more than dedicated_threads.
+            entry->dedicated_pool_.reset(new DynamicThreadPool(dedicated_threads, dedicated_threads));
+            entry->pool_ = entry->dedicated_pool_.get();
+            break;
+        default:
+            break;
+    }
+
+    if (services_map_.insert({descriptor->full_name(), entry}).second == false) {
         LOG(ERROR) << "RpcServer register service error: " << descriptor->full_name();
     }
 
-    LOG(INFO) << "RpcServer register servce: " << descriptor->full_name();
+    LOG(INFO) << "RpcServer register servce: " << descriptor->full_name() << " policy: " << entry->policy_;
+}
+
+void RpcServer::registerStreamMethod(const std::string& service, const std::string& method, const RpcStreamHandler& handler,
+                    RpcExecutionPolicy policy, int max_streams, size_t dedicated_threads) {
+    std::string name = service + "." + method;
+
+    RpcStreamMethodEntryPtr entry(new RpcStreamMethodEntry(handler, max_streams));
+
+    if (policy != RPC_EXECUTE_DEDICATED_POOL) {
+        entry->pool_ = server_->getDynamicThreadPool();
+    }
+
+    // The handler blocks on the stream, it can't be executed in the event loop, so fall back to a dedicated pool.
+    if (!entry->pool_) {
+        if (dedicated_threads == 0) {
+            LOG(ERROR) << "RpcServer the shared thread pool is disabled, use dedicated pool: " << name;
+            dedicated_threads = 1;
+        }
+
+        entry->dedicated_pool_.reset(new DynamicThreadPool(dedicated_threads, dedicated_threads));
+        entry->pool_ = entry->dedicated_pool_.get();
+    }
+
+    if (stream_methods_map_.insert({name, entry}).second == false) {
+        LOG(ERROR) << "RpcServer register stream method error: " << name;
+    }
+
+    LOG(INFO) << "RpcServer register stream method: " << name;
 }
 
 void RpcServer::onConnection(const ConnectionPtr& conn) {
     LOG(INFO) << "============RpcServer::OnConnection===============";
-}
 
-void RpcServer::onMessage(const ConnectionPtr& conn, ByteBuffer& buff) {
+    // Each connection owns one rpc channel, the channel lifetime is same as the connection,
+    // and the method executed in worker thread holds the channel until it finished.
     RpcChannelPtr channel(new RpcChannel());
     channel->setRpcServices(&services_map_);
+    channel->setRpcStreamMethods(&stream_methods_map_);
+    channel->setCompression(compress_type_, compress_threshold_);
+    conn->setContext(channel);
+
+    // The stream writers wait for the connection write buffer drained.
+    std::weak_ptr<RpcChannel> weak_channel(channel);
+    conn->setWriteCompleteCallback([weak_channel](const ConnectionPtr& conn) {
+        RpcChannelPtr channel = weak_channel.lock();
+        if (channel) {
+            channel->onWriteComplete(conn);
+        }
+    });
+}
+
+void RpcServer::onMessage(const ConnectionPtr& conn, ByteBuffer& buff) {
+    RpcChannelPtr channel(any_cast<RpcChannelPtr>(conn->getContext()));
+    assert(channel != nullptr);
+
     channel->onMessage(conn, buff);
 }
 
+void RpcServer::onClose(const ConnectionPtr& conn) {
+    if (conn->getContext().empty()) {
+        return;
+    }
+
+    RpcChannelPtr channel(any_cast<RpcChannelPtr>(conn->getContext()));
+    if (channel) {
+        channel->onClose(conn);
+    }
+}
+
 void RpcServer::start() {
     server_->start();
 }
@@ -1,7 +1,8 @@
 #ifndef __ATP_RPC_SERVER_H__
 #define __ATP_RPC_SERVER_H__
 
-#include "atp_tcp_server.h"
+#include "net/atp_tcp_server.h"
+#include "app/atp_rpc_channel.h"
 
 namespace google {
 
@@ -29,19 +30,52 @@ public:
 public:
     void start();
 
+    /* Register the service, the service methods are executed in the IO event loop. */
     void registerService(::google::protobuf::Service* service);
 
+    /*
+     * Register the service with execution policy.
+     * max_queue_depth: the max requests waiting for execute, the more requests will be rejected, 0 is unlimited.
+     * dedicated_threads: the thread pool size for RPC_EXECUTE_DEDICATED_POOL, ignored by the other policy.
+     */
+    void registerService(::google::protobuf::Service* service, RpcExecutionPolicy policy,
+                            int max_queue_depth, size_t dedicated_threads);
+
+    /*
+     * Register the streaming method handler, the client opens the stream by service full name and method name.
+     * The handler reads and writes the stream until it returned, it is executed in the shared thread pool,
+     * or the dedicated thread pool of dedicated_threads size if the policy is RPC_EXECUTE_DEDICATED_POOL.
+     * max_streams: the max streams executing at the same time, the more streams will be rejected, 0 is unlimited.
+     */
+    void registerStreamMethod(const std::string& service, const std::string& method, const RpcStreamHandler& handler,
+                                RpcExecutionPolicy policy, int max_streams, size_t dedicated_threads);
+
+    /*
+     * Compress the payload not less than threshold with the type(RpcCompressType),
+     * it takes effect only if the client advertised the type. COMPRESS_NONE(the default) disables the compression.
+     */
+    void setCompression(int type, size_t threshold) {
+        compress_type_ = type;
+        compress_threshold_ = threshold;
+    }
+
 private:
     void onConnection(const ConnectionPtr& conn);
 
     void onMessage(const ConnectionPtr& conn, ByteBuffer& buff);
 
+    void onClose(const ConnectionPtr& conn);
+
 private:
     ServerPtr server_;
     ServerAddress srvaddr_;
 
-    std::unordered_map<std::string, RpcChannelPtr> rpc_channels_;
-    std::unordered_map<std::string, ::google::protobuf::Service*> services_map_;
+    ProtobufServicesMap services_map_;
+
+    RpcStreamMethodsMap stream_methods_map_;
+
+    int compress_type_;
+    size_t compress_threshold_;
 };
 
 } /* end namespace atp */
@@ -0,0 +1,300 @@
+#include <chrono>
+#include <google/protobuf/message.h>
+
+#include "rpc.pb.h"
+#include "net/atp_tcp_conn.h"
+#include "net/atp_event_loop.h"
+#include "app/atp_rpc_channel.h"
+#include "app/atp_rpc_stream.h"
+#include "glog/logging.h"
+
+namespace atp {
+
+RpcStream::RpcStream(const RpcChannelPtr& channel, const ConnectionPtr& conn, uint64_t id, bool server_side)
+    : channel_(channel), conn_(conn), id_(id), server_side_(server_side),
+      recv_bytes_(0), recv_consumed_(0), send_window_(RPC_STREAM_WINDOW_SIZE),
+      read_closed_(false), write_closed_(false), finished_(false), error_(SUCCESS) {
+
+}
+
+RpcStream::~RpcStream() {
+
+}
+
+bool RpcStream::write(const ::google::protobuf::Message& message, int timeout_ms) {
+    ConnectionPtr conn = conn_.lock();
+    if (!conn) {
+        return false;
+    }
+
+    // The writer waits for the window given back by the event loop, it would never wake up in the event loop.
+    assert(!conn->getEventLoop()->threadSafety());
+
+    std::string payload = message.SerializeAsString();
+    int64_t bytes = static_cast<int64_t>(payload.size());
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        /*
+         * Wait until the peer has window for the message and the connection write buffer is drained below
+         * the high water mark. The message larger than window is allowed when half of the window is free,
+         * otherwise it would never be sent, the reader always gives the window back once it read half.
+         */
+        auto pred = [this, bytes, &conn]() {
+            if (write_closed_) {
+                return true;
+            }
+
+            bool window = send_window_ >= bytes || send_window_ >= RPC_STREAM_WINDOW_SIZE / 2;
+            return window && conn->getPendingWriteBytes() <= RPC_STREAM_WRITE_HIGH_WATER;
+        };
+
+        if (!waitUntil(lock, timeout_ms, pred, true) || write_closed_) {
+            return false;
+        }
+
+        send_window_ -= bytes;
+    }
+
+    RpcMessage rpc_message;
+    rpc_message.set_type(STREAM_DATA);
+    rpc_message.set_stream_id(id_);
+    channel_->encodePayload(&rpc_message, payload, !server_side_);
+    channel_->sendRpcMessage(conn, &rpc_message);
+
+    return true;
+}
+
+void RpcStream::writesDone() {
+    if (server_side_) {
+        finish(SUCCESS);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (write_closed_) {
+            return;
+        }
+
+        write_closed_ = true;
+    }
+
+    sendControl(STREAM_END, SUCCESS, 0);
+}
+
+void RpcStream::finish(int error) {
+    if (!server_side_) {
+        error == SUCCESS ? writesDone() : cancel();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) {
+            return;
+        }
+
+        finished_ = true;
+        read_closed_ = true;
+        write_closed_ = true;
+        error_ = error;
+    }
+
+    cond_.notify_all();
+    sendControl(STREAM_END, error, 0);
+}
+
+bool RpcStream::read(::google::protobuf::Message* message, int timeout_ms) {
+    std::string payload;
+    uint32_t increment = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto pred = [this]() {
+            return !recv_queue_.empty() || read_closed_;
+        };
+
+        // The queued messages are still readable after the peer closed.
+        if (!waitUntil(lock, timeout_ms, pred, false) || recv_queue_.empty()) {
+            return false;
+        }
+
+        payload.swap(recv_queue_.front());
+        recv_queue_.pop_front();
+
+        // Give the window back in batches, one window update for every half window read.
+        recv_consumed_ += payload.size();
+        if (recv_consumed_ >= RPC_STREAM_WINDOW_SIZE / 2 && !read_closed_) {
+            increment = static_cast<uint32_t>(recv_consumed_);
+            recv_bytes_ -= recv_consumed_;
+            recv_consumed_ = 0;
+        }
+    }
+
+    if (increment > 0) {
+        sendControl(STREAM_WINDOW, SUCCESS, increment);
+    }
+
+    if (!message->ParseFromString(payload)) {
+        LOG(ERROR) << "RpcStream parse message failed, stream id: " << id_;
+        return false;
+    }
+
+    return true;
+}
+
+void RpcStream::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) {
+            return;
+        }
+
+        finished_ = true;
+        read_closed_ = true;
+        write_closed_ = true;
+        error_ = CANCELED;
+        recv_queue_.clear();
+    }
+
+    cond_.notify_all();
+    sendControl(CANCEL, SUCCESS, 0);
+    channel_->removeStream(id_);
+}
+
+int RpcStream::getErrorCode() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+bool RpcStream::isFinished() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return finished_;
+}
+
+void RpcStream::onData(std::string& payload) {
+    bool violated = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (read_closed_) {
+            return;
+        }
+
+        // The peer writer never has more than one window unread, except one oversized message.
+        if (recv_bytes_ > RPC_STREAM_WINDOW_SIZE / 2 && recv_bytes_ + payload.size() > RPC_STREAM_WINDOW_SIZE) {
+            violated = true;
+        } else {
+            recv_bytes_ += payload.size();
+            recv_queue_.push_back(std::string());
+            recv_queue_.back().swap(payload);
+        }
+    }
+
+    if (violated) {
+        LOG(ERROR) << "RpcStream peer exceeded the flow control window, stream id: " << id_;
+        cancel();
+        return;
+    }
+
+    cond_.notify_all();
+}
+
+void RpcStream::onEnd(int error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        read_closed_ = true;
+
+        // The server finished the stream, the client can't write any more.
+        if (!server_side_) {
+            finished_ = true;
+            write_closed_ = true;
+            error_ = error;
+        }
+    }
+
+    cond_.notify_all();
+}
+
+void RpcStream::onWindow(uint32_t increment) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        send_window_ += increment;
+    }
+
+    cond_.notify_all();
+}
+
+void RpcStream::onAbort(int error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (finished_) {
+            return;
+        }
+
+        finished_ = true;
+        read_closed_ = true;
+        write_closed_ = true;
+        error_ = error;
+        recv_queue_.clear();
+    }
+
+    cond_.notify_all();
+}
+
+void RpcStream::onWritable() {
+    // Lock to make sure the waiting writer not missed the notify between check and wait.
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+    }
+
+    cond_.notify_all();
+}
+
+void RpcStream::sendControl(int type, int error, uint32_t window) {
+    ConnectionPtr conn = conn_.lock();
+    if (!conn) {
+        return;
+    }
+
+    RpcMessage message;
+    message.set_type(static_cast<RpcMessageType>(type));
+    message.set_stream_id(id_);
+    if (error != SUCCESS) {
+        message.set_error(static_cast<RpcError>(error));
+    }
+
+    if (window > 0) {
+        message.set_window(window);
+    }
+
+    channel_->sendRpcMessage(conn, &message);
+}
+
+bool RpcStream::waitUntil(std::unique_lock<std::mutex>& lock, int timeout_ms,
+                    const std::function<bool()>& pred, bool poll) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (!pred()) {
+        auto now = std::chrono::steady_clock::now();
+        if (timeout_ms > 0 && now >= deadline) {
+            return false;
+        }
+
+        // The write complete only notifies when the write buffer totally drained, poll the high water mark.
+        if (poll) {
+            auto wake = now + std::chrono::milliseconds(RPC_STREAM_WAIT_INTERVAL);
+            cond_.wait_until(lock, (timeout_ms > 0 && deadline < wake) ? deadline : wake);
+        } else if (timeout_ms > 0) {
+            cond_.wait_until(lock, deadline);
+        } else {
+            cond_.wait(lock);
+        }
+    }
+
+    return true;
+}
+
+} /* end namespace atp */
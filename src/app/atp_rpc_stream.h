@@ -0,0 +1,138 @@
+#ifndef __ATP_RPC_STREAM_H__
+#define __ATP_RPC_STREAM_H__
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+#include "net/atp_cbs.h"
+
+namespace google {
+
+namespace protobuf {
+
+class Message;
+
+} /* end namespace protobuf */
+
+} /* end namespace google */
+
+namespace atp {
+
+// The flow control window bytes of each stream direction.
+#define RPC_STREAM_WINDOW_SIZE          (256 * 1024)
+
+// The stream writer waits while the connection pending write bytes exceed it.
+#define RPC_STREAM_WRITE_HIGH_WATER     (4 * 1024 * 1024)
+
+// The max ms a waiting writer sleeps before checking the connection write buffer again.
+#define RPC_STREAM_WAIT_INTERVAL        (50)
+
+/*
+ * The RpcStream is one side of a streaming call, used by both rpc client and rpc server.
+ * Server streaming, client streaming and bidi streaming are the same object with different usage:
+ *   client: write requests, writesDone, read responses until false, getErrorCode.
+ *   server: read requests until false, write responses, finish(or return from the handler).
+ *
+ * Flow control: the writer consumes the peer window, the reader gives the window back after
+ * the message was read, so the reader side buffers at most one window. The writer also waits
+ * while the connection write buffer exceeds RPC_STREAM_WRITE_HIGH_WATER, so the stream is never
+ * buffered in memory when the peer is slow.
+ *
+ * The read and write are blocking, they must be called in the worker thread, never in the event loop.
+ */
+class RpcStream : public std::enable_shared_from_this<RpcStream> {
+public:
+    RpcStream(const RpcChannelPtr& channel, const ConnectionPtr& conn, uint64_t id, bool server_side);
+
+    ~RpcStream();
+
+public:
+    /* Write one message, wait for the flow control. Return false if the stream closed or timedout, 0 is never timeout. */
+    bool write(const ::google::protobuf::Message& message, int timeout_ms = 0);
+
+    /* Half close the write direction, the peer reader gets the end of stream. */
+    void writesDone();
+
+    /* Server side finish the stream with RpcError code, the client reader gets the end of stream and the code. */
+    void finish(int error);
+
+    /* Read one message, wait for the peer. Return false at the end of stream, error or timedout. */
+    bool read(::google::protobuf::Message* message, int timeout_ms = 0);
+
+    /* Abort the stream in both directions, the peer gets CANCELED. */
+    void cancel();
+
+    /* The RpcError code the stream finished with. */
+    int getErrorCode() const;
+
+    bool isFinished() const;
+
+    uint64_t getId() const {
+        return id_;
+    }
+
+private:
+    friend class RpcChannel;
+
+    /* The following are called by the rpc channel in the connection event loop. */
+    void onData(std::string& payload);
+
+    void onEnd(int error);
+
+    void onWindow(uint32_t increment);
+
+    void onAbort(int error);
+
+    void onWritable();
+
+private:
+    void sendControl(int type, int error, uint32_t window);
+
+    bool waitUntil(std::unique_lock<std::mutex>& lock, int timeout_ms,
+                    const std::function<bool()>& pred, bool poll);
+
+private:
+    RpcChannelPtr channel_;
+
+    WeakConnectionPtr conn_;
+
+    uint64_t id_;
+
+    bool server_side_;
+
+    mutable std::mutex mutex_;
+
+    std::condition_variable cond_;
+
+    // The received messages not read yet.
+    std::deque<std::string> recv_queue_;
+
+    // The received bytes not given back to peer, queued or read.
+    size_t recv_bytes_;
+
+    // The read bytes not given back to peer.
+    size_t recv_consumed_;
+
+    // The bytes can be sent before the peer gives window back, negative after an oversized message.
+    int64_t send_window_;
+
+    bool read_closed_;
+
+    bool write_closed_;
+
+    bool finished_;
+
+    int error_;
+};
+
+using RpcStreamPtr = std::shared_ptr<RpcStream>;
+
+using RpcStreamHandler = std::function<void(const RpcStreamPtr&)>;
+
+} /* end namespace atp */
+
+#endif /* __ATP_RPC_STREAM_H__ */
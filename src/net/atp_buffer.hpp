@@ -76,6 +76,15 @@ public:
         return buff_;
     }
 
+    // Exchange the memory and indexes with other, no data copied.
+    void swap(ByteBuffer& other) {
+        std::swap(buff_, other.buff_);
+        std::swap(caps_, other.caps_);
+        std::swap(read_index_, other.read_index_);
+        std::swap(write_index_, other.write_index_);
+        std::swap(reserved_prepend_size_, other.reserved_prepend_size_);
+    }
+
     // Update the core buffer read/write index, if don't need any index, set 0.
     void updateReadWriteIndex(size_t read_index, size_t write_index, bool increment) {
         if (increment) {
@@ -350,7 +359,8 @@ public:
         const int iov_count = (writable < sizeof(extrbuffer)) ? 2 : 1;
         const ssize_t n = ::readv(fd, iov, iov_count);
         if (n <= 0) {
-            if (EVUTIL_ERR_RW_RETRIABLE(errno)) {
+            // The errno is not set by the end of stream.
+            if (n < 0 && EVUTIL_ERR_RW_RETRIABLE(errno)) {
                 return RETRIABLE_ERROR;
             } else {
                 return n;
@@ -361,7 +371,7 @@ public:
             buffer_.updateReadWriteIndex(0, buffer_.getCaps(), false);
             ByteBufferedWriter writer(buffer_);
             writer.grow(n - writable);
-            writer.append(extrbuffer);
+            writer.append(extrbuffer, n - writable);
         }
         
         return n;
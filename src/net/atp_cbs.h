@@ -60,6 +60,8 @@ using ReadMessageCallback = std::function<void(const ConnectionPtr&, ByteBuffer&
 using WriteCompleteCallback = std::function<void(const ConnectionPtr&)>;
 using TimedoutCallback = std::function<void(const ConnectionPtr&)>;
 using CloseCallback = std::function<void(const ConnectionPtr&)>;
+using SendFileCallback = std::function<void(const ConnectionPtr&, bool)>;
+using BroadcastFilter = std::function<bool(const ConnectionPtr&)>;
 
 } /* end namespace atp */
 
@@ -23,6 +23,7 @@
  */
 
 #include <string.h>
+#include <sys/epoll.h>
 
 #include "net/atp_libevent.h"
 #include "net/atp_channel.h"
@@ -33,18 +34,25 @@ namespace atp {
 static_assert(ATP_READ_EVENT == EV_READ, "CHECK LIBEVENT VERSION FOR EV_READ");
 static_assert(ATP_WRITE_EVENT == EV_WRITE, "CHECK LIBEVENT VERSION FOR EV_WRITE");
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
 Channel::Channel(EventLoop* event_loop, int fd, bool readable, bool writable)
-    : event_loop_(event_loop), attached_(false) {
+    : event_loop_(event_loop), event_(NULL), attached_(false), exclusive_(false) {
 
     events_ = (readable ? ATP_READ_EVENT : 0) | (writable ? ATP_WRITE_EVENT : 0);
 
     fd_ = fd;
     assert(fd_ > 0);
 
-    event_ = new(std::nothrow) event;
-    assert(event_);
+    // The native epoll loop adds the fd to its epoll directly, the channel needn't the libevent event.
+    if (event_loop_->getIOBackend() != IO_BACKEND_EPOLL) {
+        event_ = ENABLED_OBJECT_POOL ? static_cast<struct event*>(ObjectPool<struct event>::allocate()) : new(std::nothrow) event;
+        assert(event_);
 
-    memset(event_, 0, sizeof(*event_));
+        memset(event_, 0, sizeof(*event_));
+    }
 
     if (ATP_NET_DEBUG_ON) {
         LOG(INFO) << "New channel(" << fd_ << ").";
@@ -65,6 +73,11 @@ void Channel::attachToEventLoop() {
         return;
     }
 
+    if (event_loop_->getIOBackend() == IO_BACKEND_EPOLL) {
+        epollAttach();
+        return;
+    }
+
     // If the channel attached to event loop. need detach it.
     if (attached_) {
         detachFromEventLoop();
@@ -89,6 +102,17 @@ void Channel::attachToEventLoop() {
 }
 
 void Channel::detachFromEventLoop() {
+    // The fd maybe closed already and removed from the epoll by the kernel, ignore the error.
+    if (event_loop_->getIOBackend() == IO_BACKEND_EPOLL) {
+        if (attached_) {
+            epoll_ctl(event_loop_->getEpollFd(), EPOLL_CTL_DEL, fd_, NULL);
+            event_loop_->removeReadyChannel(this);
+            attached_ = false;
+        }
+
+        return;
+    }
+
     // Delete event from libevent event base, update state.
     if (attached_ && event_del(event_) == 0) {
         attached_ = false;
@@ -107,9 +131,10 @@ void Channel::updateEvents() {
 
 void Channel::close() {
     // The ownership of fd_ is Connection, needn't to close fd_.
+    detachFromEventLoop();
+
     if (event_) {
-        detachFromEventLoop();
-        delete event_;
+        ENABLED_OBJECT_POOL ? ObjectPool<struct event>::deallocate(event_) : delete event_;
         event_ = NULL;
     }
 
@@ -192,4 +217,45 @@ void Channel::eventHandle(int fd, short which, void* args) {
     owner->eventHandle(fd, which);
 }
 
+void Channel::epollEventHandle(uint32_t events) {
+    short which = 0;
+
+    // The same as libevent, the error and hang up wake both callbacks, the read or write gets the error.
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        which = ATP_READ_EVENT | ATP_WRITE_EVENT;
+    }
+
+    if (events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP)) {
+        which |= ATP_READ_EVENT;
+    }
+
+    if (events & EPOLLOUT) {
+        which |= ATP_WRITE_EVENT;
+    }
+
+    eventHandle(fd_, which & events_);
+}
+
+void Channel::epollAttach() {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = (isReadable() ? static_cast<uint32_t>(EPOLLIN) : 0u) | (isWritable() ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    ev.data.ptr = this;
+
+    // The EPOLLEXCLUSIVE can't be modified, the exclusive fd is deleted and added again.
+    if (exclusive_) {
+        ev.events |= EPOLLEXCLUSIVE;
+        detachFromEventLoop();
+    }
+
+    // One epoll_ctl for each events change, the level triggered is the same as libevent.
+    int op = attached_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(event_loop_->getEpollFd(), op, fd_, &ev) == 0) {
+        attached_ = true;
+    } else {
+        LOG(ERROR) << "Attached channel(" << fd_ << ") to epoll failed: " << strerror(errno);
+    }
+}
+
 } /* end namespace atp */
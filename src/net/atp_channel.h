@@ -25,9 +25,12 @@
 #ifndef __ATP_CHANNEL_H__
 #define __ATP_CHANNEL_H__
 
+#include <stdint.h>
+
 #include <functional>
 
 #include "net/atp_config.h"
+#include "net/atp_object_pool.hpp"
 
 struct event;
 struct event_base;
@@ -40,6 +43,8 @@ class Channel {
 public:
     using EventCallbackPtr = std::function<void()>;
 
+    ATP_OBJECT_POOL_NEW_DELETE(Channel)
+
 public:
     Channel(EventLoop* event_loop, int fd, bool readable, bool writable);
 
@@ -90,17 +95,32 @@ public:
         return (events_ & ATP_WRITE_EVENT) != 0;
     }
 
+    /*
+     * Must be set before attached. The fd watched by several native epoll loops wakes only one of them
+     * for each event(EPOLLEXCLUSIVE), e.g. the listening fd. The libevent loop ignores it.
+     */
+    void setExclusive(bool exclusive) {
+        exclusive_ = exclusive;
+    }
+
 private:
+    friend class EventLoop;
+
     // In this, using two event handle to avoid the limitation of static function.
     void eventHandle(int fd, short which);
 
     static void eventHandle(int fd, short which, void* args);
 
+    // The native epoll loop dispatches the epoll events to the channel directly.
+    void epollEventHandle(uint32_t events);
+
+    void epollAttach();
+
 private:
     // IO event loop.
     EventLoop*       event_loop_;
 
-    // Libevent event for socket read/write.
+    // Libevent event for socket read/write, NULL in the native epoll loop.
     struct event*    event_;
 
     // Socket file description.
@@ -112,6 +132,9 @@ private:
     // Identify event weather or not attach to libevent event_base.
     bool             attached_;
 
+    // Add the fd to the native epoll with EPOLLEXCLUSIVE.
+    bool             exclusive_;
+
     // The libevent event read cb.
     EventCallbackPtr read_cb_;
 
@@ -61,6 +61,30 @@ namespace atp {
 // Dynamic thread pool max threads.
 #define THREAD_POOL_MAX_THREADS        (128)
 
+// Dynamic thread pool lock free task queue size, the unbounded pool queues the overflow tasks in a list.
+#define THREAD_POOL_QUEUE_CAPACITY     (4096)
+
+// Dynamic thread pool reaps the exited threads and checks the queue latency every ms.
+#define THREAD_POOL_MANAGE_INTERVAL    (10)
+
+// Dynamic thread pool grows when the task waited in the queue more than the ms.
+#define THREAD_POOL_GROW_LATENCY       (2)
+
+// Dynamic thread pool thread exceeds the core threads exits after idle the ms.
+#define THREAD_POOL_IDLE_TIMEOUT       (3000)
+
+// Dynamic thread pool high and low priority lock free task queue size of the unbounded pool.
+#define THREAD_POOL_PRIORITY_QUEUE_CAPACITY     (1024)
+
+// Dynamic thread pool thread takes one task from the lower priorities first every the tasks.
+#define THREAD_POOL_STARVATION_INTERVAL         (8)
+
+// Work stealing thread pool initial deque size of each worker, the deque grows when full.
+#define WORK_STEALING_DEQUE_SIZE       (256)
+
+// Work stealing thread pool worker scans all the queues the rounds before parking.
+#define WORK_STEALING_SPIN_ROUNDS      (4)
+
 
 // Whether to use timing wheel to manage Connections.
 #define ENABLED_TIMING_WHEEL           (1)
@@ -75,6 +99,61 @@ namespace atp {
 #define TIMIING_WHEEL_STEP             (1)
 
 
+// Whether to recycle the Connection, Channel and Entry objects by the per thread object pools.
+#define ENABLED_OBJECT_POOL            (1)
+
+// The max free objects cached by each thread of one object pool.
+#define OBJECT_POOL_MAX_FREE_OBJECTS   (4096)
+
+// The max coroutine frame size recycled by the frame pool, the larger frame uses new/delete.
+#define COROUTINE_FRAME_POOL_MAX_SIZE  (2048)
+
+// The max free frames cached by each thread of one size class.
+#define COROUTINE_FRAME_POOL_MAX_FREE  (1024)
+
+
+// Whether the event loop uses the precise timer(timerfd on epoll), the timeout is not rounded to ms.
+#define ENABLED_PRECISE_TIMER          (1)
+
+// The timer nodes allocated at once by the timer queue.
+#define TIMER_QUEUE_NODE_CHUNK         (1024)
+
+
+// The io_uring submission queue entries, the requests of one loop iteration more than it are submitted early.
+#define IO_URING_SQ_ENTRIES            (256)
+
+// The io_uring completion queue entries, the multishot requests post many completions for one submission.
+#define IO_URING_CQ_ENTRIES            (4096)
+
+// The provided buffers for the multishot recv of one event loop, must be power of 2.
+#define IO_URING_BUFFER_COUNT          (256)
+
+// The provided buffer size, the received data is copied to the connection read buffer at once.
+#define IO_URING_BUFFER_SIZE           (16384)
+
+
+// The max events returned by one epoll_wait of the native epoll event loop.
+#define EPOLL_MAX_EVENTS               (256)
+
+
+// The tasks sent while the event loop is running the pending tasks needn't the eventfd notify.
+#define ENABLED_DEFER_WAKEUP           (1)
+
+// The pending task rounds of one wakeup at most, the loop notifies itself for the rest to handle the IO first.
+#define DEFER_WAKEUP_MAX_ROUNDS        (16)
+
+
+// The sends of one loop iteration are buffered and sent together at the end of the iteration.
+#define ENABLED_AUTO_CORK              (1)
+
+// The corked data is sent at once when it reaches this size, the large send isn't buffered.
+#define CORK_FLUSH_SIZE                (64 * 1024)
+
+
+// The default size the data sent by MSG_ZEROCOPY from, the page pinning and the completion cost more for the small data.
+#define ZEROCOPY_SEND_THRESHOLD        (1024 * 1024)
+
+
 // Socket retriable error.
 #define RETRIABLE_ERROR                (-11)
 
@@ -0,0 +1,158 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <errno.h>
+
+#include "net/atp_config.h"
+#include "net/atp_channel.h"
+#include "net/atp_connector.h"
+#include "net/atp_event_loop.h"
+#include "net/atp_cycle_timer.h"
+
+namespace atp {
+
+Connector::Connector(EventLoop* event_loop, const std::string& address, unsigned int port, int timeout_ms)
+    : event_loop_(event_loop), connect_fd_(-1), timeout_ms_(timeout_ms), completed_(false) {
+    address_.host_ = address;
+    address_.port_ = port;
+}
+
+Connector::~Connector() {
+    // The connector destroyed before completed, e.g. the event loop stopped.
+    if (channel_ && !completed_) {
+        channel_->close();
+        ::close(connect_fd_);
+    }
+}
+
+void Connector::start() {
+    auto self = shared_from_this();
+    event_loop_->sendToQueue([self]() {
+        self->connectInLoop();
+    });
+}
+
+void Connector::connectInLoop() {
+    assert(event_loop_->threadSafety());
+
+    connect_fd_ = create(true);
+    if (connect_fd_ < 0) {
+        LOG(ERROR) << "[Connector] create socket failed: " << strerror(errno);
+        complete(-1);
+        return;
+    }
+
+    setOption(connect_fd_, TCP_NODELAY, 1);
+
+    struct sockaddr_in srvaddr;
+    memset(&srvaddr, 0, sizeof(srvaddr));
+    srvaddr.sin_family = AF_INET;
+    srvaddr.sin_port = htons(address_.port_);
+    srvaddr.sin_addr.s_addr = inet_addr(address_.host_.c_str());
+
+    int ret = 0;
+    do {
+        ret = ::connect(connect_fd_, reinterpret_cast<struct sockaddr*>(&srvaddr), sizeof(srvaddr));
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret == 0) {
+        complete(connect_fd_);
+        return;
+    }
+
+    if (errno != EINPROGRESS) {
+        LOG(ERROR) << "[Connector] connect " << address_.host_ << ":" << address_.port_ << " failed: " << strerror(errno);
+        ::close(connect_fd_);
+        complete(-1);
+        return;
+    }
+
+    // The connection is established or failed when the fd is writable.
+    auto self = shared_from_this();
+    channel_.reset(new Channel(event_loop_, connect_fd_, false, true));
+    channel_->setWriteCallback([self]() {
+        self->connectHandle();
+    });
+    channel_->attachToEventLoop();
+
+    if (timeout_ms_ > 0) {
+        timer_ = event_loop_->addCycleTask(timeout_ms_, [self]() {
+            // The timer is finished, needn't cancel it when completed.
+            self->timer_.reset();
+
+            if (!self->completed_) {
+                LOG(ERROR) << "[Connector] connect " << self->address_.host_ << ":" << self->address_.port_ << " timedout";
+                ::close(self->connect_fd_);
+                self->complete(-1);
+            }
+        }, false);
+    }
+}
+
+void Connector::connectHandle() {
+    int so_error = 0;
+    socklen_t so_error_len = sizeof(so_error);
+
+    if (getsockopt(connect_fd_, SOL_SOCKET, SO_ERROR, &so_error, &so_error_len) < 0 || so_error != 0) {
+        LOG(ERROR) << "[Connector] connect " << address_.host_ << ":" << address_.port_ << " failed: " << strerror(so_error);
+        ::close(connect_fd_);
+        complete(-1);
+        return;
+    }
+
+    complete(connect_fd_);
+}
+
+void Connector::complete(int fd) {
+    if (completed_) {
+        return;
+    }
+
+    completed_ = true;
+
+    // The channel and timer callbacks hold this connector, keep it alive until completed.
+    auto self = shared_from_this();
+
+    // The fd ownership is moved to the callback, only release the channel event.
+    if (channel_) {
+        channel_->disableAllEvents();
+        channel_->close();
+    }
+
+    if (timer_) {
+        timer_->cancel();
+        timer_.reset();
+    }
+
+    if (ATP_NET_DEBUG_ON) {
+        LOG(INFO) << "[Connector] connect " << address_.host_ << ":" << address_.port_ << " fd: " << fd;
+    }
+
+    if (connect_fn_) {
+        connect_fn_(fd, address_.host_);
+    }
+}
+
+} /* end namespace atp */
@@ -0,0 +1,95 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ATP_CONNECTOR_H__
+#define __ATP_CONNECTOR_H__
+
+#include <memory>
+#include <functional>
+
+#include "net/atp_socket.h"
+
+namespace atp {
+
+class Channel;
+class EventLoop;
+class CycleTimer;
+
+/*
+ * Connector for the client side connection, connect the remote address with non-blocking socket
+ * in the event loop, the connected fd is handed to the connect callback to create Connection.
+ */
+class Connector : public SocketImpl, public std::enable_shared_from_this<Connector> {
+public:
+    /* The fd < 0 means connect failed, otherwise the callback owns the connected fd. */
+    using ConnectCallback = std::function<void(int fd, std::string& remote_addr)>;
+
+public:
+    explicit Connector(EventLoop* event_loop, const std::string& address, unsigned int port, int timeout_ms);
+
+    ~Connector();
+
+public:
+    /* Start connecting, the connect callback will be called once in the event loop. */
+    void start();
+
+    void setConnectCallback(const ConnectCallback& fn) {
+        connect_fn_ = fn;
+    }
+
+private:
+    void connectInLoop();
+
+    void connectHandle();
+
+    void complete(int fd);
+
+private:
+    EventLoop* event_loop_;
+    int connect_fd_;
+
+    struct {
+        std::string host_;
+        unsigned int port_;
+    } address_;
+
+    // Connect timeout ms, 0 is waiting for the kernel timeout.
+    int timeout_ms_;
+
+    bool completed_;
+
+    // Watch the connecting fd writable.
+    std::unique_ptr<Channel> channel_;
+
+    std::shared_ptr<CycleTimer> timer_;
+
+    ConnectCallback connect_fn_;
+};
+
+using ConnectorPtr = std::shared_ptr<Connector>;
+
+} /* end namespace atp */
+
+#endif /* __ATP_CONNECTOR_H__ */
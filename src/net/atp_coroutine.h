@@ -0,0 +1,504 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ATP_COROUTINE_H__
+#define __ATP_COROUTINE_H__
+
+/*
+ * The C++20 coroutine support, the library itself is built as C++11, so everything here is only
+ * available to the application built with -std=c++20, the header is empty otherwise.
+ */
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+
+#define ATP_COROUTINE_ENABLED
+
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <exception>
+#include <type_traits>
+#include <coroutine>
+
+#include "net/atp_cbs.h"
+#include "net/atp_config.h"
+#include "net/atp_buffer.hpp"
+#include "net/atp_tcp_conn.h"
+#include "net/atp_event_loop.h"
+
+namespace atp {
+
+/*
+ * The coroutine frame pool, the frames are recycled by size class in a free list of each thread.
+ * Each event loop runs in its own thread and its coroutines are created and resumed there, so it
+ * is the frame pool of the event loop. The frame larger than COROUTINE_FRAME_POOL_MAX_SIZE uses
+ * the global new/delete.
+ */
+class CoroutineFramePool {
+public:
+    static void* allocate(size_t size) {
+        size_t index = getSizeClass(size);
+        ThreadLocal& local = getThreadLocal();
+
+        if (index >= kSizeClasses) {
+            return ::operator new(size);
+        }
+
+        FreeBlock* block = local.exited_ ? nullptr : local.free_lists_[index];
+        if (block) {
+            local.free_lists_[index] = block->next_;
+            -- local.free_counts_[index];
+            return block;
+        }
+
+        // Allocate the whole size class even after the thread exited, the block may be freed to the
+        // free list of another thread and reused by any frame of the class.
+        return ::operator new((index + 1) * kSizeClassStep);
+    }
+
+    static void deallocate(void* mem, size_t size) {
+        size_t index = getSizeClass(size);
+        ThreadLocal& local = getThreadLocal();
+
+        if (index >= kSizeClasses || local.exited_ || local.free_counts_[index] >= COROUTINE_FRAME_POOL_MAX_FREE) {
+            ::operator delete(mem);
+            return;
+        }
+
+        // The frame freed by another thread goes to its free list, the blocks of a class are the same size.
+        FreeBlock* block = static_cast<FreeBlock*>(mem);
+        block->next_ = local.free_lists_[index];
+        local.free_lists_[index] = block;
+        ++ local.free_counts_[index];
+    }
+
+private:
+    static const size_t kSizeClassStep = 64;
+
+    static const size_t kSizeClasses = COROUTINE_FRAME_POOL_MAX_SIZE / kSizeClassStep;
+
+    struct FreeBlock {
+        FreeBlock* next_;
+    };
+
+    struct ThreadLocal {
+        FreeBlock* free_lists_[kSizeClasses];
+        size_t free_counts_[kSizeClasses];
+        bool exited_;
+
+        ThreadLocal() : exited_(false) {
+            for (size_t i = 0; i < kSizeClasses; ++ i) {
+                free_lists_[i] = nullptr;
+                free_counts_[i] = 0;
+            }
+        }
+
+        ~ThreadLocal() {
+            exited_ = true;
+            for (size_t i = 0; i < kSizeClasses; ++ i) {
+                while (free_lists_[i]) {
+                    FreeBlock* block = free_lists_[i];
+                    free_lists_[i] = block->next_;
+                    ::operator delete(block);
+                }
+            }
+        }
+    };
+
+    static size_t getSizeClass(size_t size) {
+        return (size + kSizeClassStep - 1) / kSizeClassStep - 1;
+    }
+
+    static ThreadLocal& getThreadLocal() {
+        static thread_local ThreadLocal local;
+        return local;
+    }
+};
+
+template <typename T>
+class CoTask;
+
+/*
+ * The promise common part, the frame is from the frame pool, the coroutine starts when it is awaited,
+ * and the awaiting coroutine is resumed by symmetric transfer when it finished, so the deep await
+ * chain doesn't grow the stack.
+ */
+class CoPromiseBase {
+public:
+    static void* operator new(size_t size) {
+        return CoroutineFramePool::allocate(size);
+    }
+
+    static void operator delete(void* mem, size_t size) {
+        CoroutineFramePool::deallocate(mem, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            std::coroutine_handle<> continuation = handle.promise().continuation_;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {
+
+        }
+    };
+
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+
+    // The library doesn't use the exception, the exception escaped from a coroutine is fatal.
+    void unhandled_exception() noexcept {
+        std::terminate();
+    }
+
+    void setContinuation(std::coroutine_handle<> continuation) {
+        continuation_ = continuation;
+    }
+
+private:
+    std::coroutine_handle<> continuation_;
+};
+
+template <typename T>
+class CoPromise : public CoPromiseBase {
+public:
+    CoTask<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& value) {
+        value_ = std::forward<U>(value);
+    }
+
+    T& getValue() {
+        return value_;
+    }
+
+private:
+    T value_;
+};
+
+template <>
+class CoPromise<void> : public CoPromiseBase {
+public:
+    CoTask<void> get_return_object() noexcept;
+
+    void return_void() noexcept {
+
+    }
+
+    void getValue() {
+
+    }
+};
+
+/*
+ * The coroutine handler type, the coroutine returns CoTask<T> can co_await the awaiters below and the
+ * other CoTask. The T must be default constructible. It is lazy, nothing runs until it is awaited or
+ * spawned to an event loop by coSpawn. The frame is destroyed with the CoTask.
+ *
+ *   CoTask<void> handle(ConnectionPtr conn) {
+ *       std::string header = co_await asyncRead(conn, 4);
+ *       ...
+ *       co_await asyncWrite(conn, response);
+ *   }
+ *
+ *   coSpawn(conn->getEventLoop(), handle(conn));
+ */
+template <typename T = void>
+class CoTask {
+public:
+    using promise_type = CoPromise<T>;
+
+    using Handle = std::coroutine_handle<promise_type>;
+
+public:
+    explicit CoTask(Handle handle) : handle_(handle) {
+
+    }
+
+    CoTask(CoTask&& other) noexcept : handle_(other.handle_) {
+        other.handle_ = nullptr;
+    }
+
+    CoTask& operator=(CoTask&& other) noexcept {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+
+            handle_ = other.handle_;
+            other.handle_ = nullptr;
+        }
+
+        return *this;
+    }
+
+    CoTask(const CoTask&) = delete;
+
+    CoTask& operator=(const CoTask&) = delete;
+
+    ~CoTask() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+public:
+    bool await_ready() const noexcept {
+        return !handle_ || handle_.done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+        handle_.promise().setContinuation(continuation);
+        return handle_;
+    }
+
+    decltype(auto) await_resume() {
+        if constexpr (std::is_void<T>::value) {
+            return;
+        } else {
+            return std::move(handle_.promise().getValue());
+        }
+    }
+
+private:
+    Handle handle_;
+};
+
+template <typename T>
+inline CoTask<T> CoPromise<T>::get_return_object() noexcept {
+    return CoTask<T>(std::coroutine_handle<CoPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object() noexcept {
+    return CoTask<void>(std::coroutine_handle<CoPromise<void>>::from_promise(*this));
+}
+
+/* The top level coroutine of coSpawn, it destroys its frame and the CoTask it runs when finished. */
+class CoDetached {
+public:
+    class promise_type : public CoPromiseBase {
+    public:
+        CoDetached get_return_object() noexcept {
+            return CoDetached(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() noexcept {
+
+        }
+    };
+
+public:
+    explicit CoDetached(std::coroutine_handle<> handle) : handle_(handle) {
+
+    }
+
+    std::coroutine_handle<> getHandle() const {
+        return handle_;
+    }
+
+private:
+    std::coroutine_handle<> handle_;
+};
+
+inline CoDetached coRunDetached(CoTask<void> task) {
+    co_await task;
+}
+
+/*
+ * Start the coroutine in the event loop, it runs inline if called in the event loop. The coroutine
+ * should only await the awaiters of this event loop, so it is always resumed in the event loop.
+ */
+inline void coSpawn(EventLoop* loop, CoTask<void> task) {
+    std::coroutine_handle<> handle = coRunDetached(std::move(task)).getHandle();
+
+    loop->sendToQueue([handle]() {
+        handle.resume();
+    });
+}
+
+/* Read n bytes(0 means the bytes already received), the result is empty if the connection closed before. */
+class CoReadAwaiter {
+public:
+    CoReadAwaiter(const ConnectionPtr& conn, size_t n) : conn_(conn), n_(n) {
+
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        return conn_->waitForRead(n_, [handle]() {
+            handle.resume();
+        });
+    }
+
+    std::string await_resume() {
+        ByteBuffer& buffer = conn_->getReadBuffer();
+        size_t len = n_ > 0 ? n_ : buffer.unreadBytes();
+
+        if (buffer.unreadBytes() == 0 || buffer.unreadBytes() < len) {
+            return std::string();
+        }
+
+        std::string data(buffer.data(), len);
+        ByteBufferedReader reader(buffer);
+        reader.remove(len);
+
+        return data;
+    }
+
+private:
+    ConnectionPtr conn_;
+
+    size_t n_;
+};
+
+/* Send the data and wait until it is written to the kernel, the result is false if the connection closed. */
+class CoWriteAwaiter {
+public:
+    CoWriteAwaiter(const ConnectionPtr& conn, const void* data, size_t len) : conn_(conn), data_(data), len_(len) {
+
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        // Send in the event loop either writes the data or copies it to the write buffer at once.
+        conn_->send(data_, len_);
+
+        return conn_->waitForWrite([handle]() {
+            handle.resume();
+        });
+    }
+
+    bool await_resume() const {
+        return !conn_->isClosed();
+    }
+
+private:
+    ConnectionPtr conn_;
+
+    const void* data_;
+
+    size_t len_;
+};
+
+/* Sleep ms in the event loop. */
+class CoSleepAwaiter {
+public:
+    CoSleepAwaiter(EventLoop* loop, int delay_ms) : loop_(loop), delay_ms_(delay_ms) {
+
+    }
+
+    bool await_ready() const noexcept {
+        return delay_ms_ <= 0;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        loop_->addTimerTask(static_cast<int64_t>(delay_ms_) * 1000, [handle]() {
+            handle.resume();
+        });
+    }
+
+    void await_resume() const noexcept {
+
+    }
+
+private:
+    EventLoop* loop_;
+
+    int delay_ms_;
+};
+
+/* Continue the coroutine in the event loop, e.g. back to the event loop after a blocking call done. */
+class CoSwitchAwaiter {
+public:
+    explicit CoSwitchAwaiter(EventLoop* loop) : loop_(loop) {
+
+    }
+
+    bool await_ready() const noexcept {
+        return loop_->threadSafety();
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        loop_->sendToQueue([handle]() {
+            handle.resume();
+        });
+    }
+
+    void await_resume() const noexcept {
+
+    }
+
+private:
+    EventLoop* loop_;
+};
+
+inline CoReadAwaiter asyncRead(const ConnectionPtr& conn, size_t n) {
+    return CoReadAwaiter(conn, n);
+}
+
+/* The data only needs to be valid in the co_await expression. */
+inline CoWriteAwaiter asyncWrite(const ConnectionPtr& conn, const void* data, size_t len) {
+    return CoWriteAwaiter(conn, data, len);
+}
+
+inline CoWriteAwaiter asyncWrite(const ConnectionPtr& conn, const std::string& data) {
+    return CoWriteAwaiter(conn, data.data(), data.size());
+}
+
+inline CoSleepAwaiter asyncSleep(EventLoop* loop, int delay_ms) {
+    return CoSleepAwaiter(loop, delay_ms);
+}
+
+inline CoSwitchAwaiter asyncSwitch(EventLoop* loop) {
+    return CoSwitchAwaiter(loop);
+}
+
+} /* end namespace atp */
+
+#endif /* __cplusplus >= 202002L && defined(__cpp_impl_coroutine) */
+
+#endif /* __ATP_COROUTINE_H__ */
@@ -4,38 +4,34 @@
 
 namespace atp {
 
-std::shared_ptr<CycleTimer> CycleTimer::newCycleTimer(EventLoop* loop, int delay_second, const ExpiresFunctor& cb, bool persist) {
-    std::shared_ptr<CycleTimer> timer(new CycleTimer(loop, delay_second, cb, persist));
-    timer->self_ = timer;
-
-    return timer;
+std::shared_ptr<CycleTimer> CycleTimer::newCycleTimer(EventLoop* loop, int delay_ms, const ExpiresFunctor& cb, bool persist) {
+    return std::shared_ptr<CycleTimer>(new CycleTimer(loop, delay_ms, cb, persist));
 }
 
-std::shared_ptr<CycleTimer> CycleTimer::newCycleTimer(EventLoop* loop, int delay_second, ExpiresFunctor&& cb, bool persist) {
-    std::shared_ptr<CycleTimer> timer(new CycleTimer(loop, delay_second, cb, persist));
-    timer->self_ = timer;
-    LOG(INFO) << "the timer create reference: " << timer->self_.use_count();
-
-    return timer;
+std::shared_ptr<CycleTimer> CycleTimer::newCycleTimer(EventLoop* loop, int delay_ms, ExpiresFunctor&& cb, bool persist) {
+    return std::shared_ptr<CycleTimer>(new CycleTimer(loop, delay_ms, std::move(cb), persist));
 }
 
 void CycleTimer::start() {
-    auto fn = [this]() {
-        // The std::bind with shared_from_this() will add one to shared_ptr reference
-        // So, in this, the self_.use_count() is four(timer timer->self_, and two std::bind)
-        timer_watcher_.reset(new TimerEventWatcher(loop_, std::bind(&CycleTimer::onTrigger, shared_from_this()), delay_second_));
-        timer_watcher_->setCancelCallback(std::bind(&CycleTimer::onCancel, shared_from_this()));
-        timer_watcher_->doInit();
-        timer_watcher_->asyncWait();
-    };
-
-    loop_->sendToQueue(std::move(fn));
+    // The timer task holds this timer until the timer node freed, after fired or canceled.
+    int64_t delay_us = static_cast<int64_t>(delay_ms_) * 1000;
+    timer_id_ = loop_->addTimerTask(delay_us, std::bind(&CycleTimer::onTrigger, shared_from_this()),
+                    persist_ ? delay_us : 0);
 }
 
 void CycleTimer::cancel() {
-    if (timer_watcher_) {
-        loop_->sendToQueue(std::bind(&TimerEventWatcher::doCancel, timer_watcher_));
+    if (!timer_id_.valid()) {
+        return;
     }
+
+    auto self = shared_from_this();
+    auto fn = [self]() {
+        if (self->loop_->getTimerQueue().cancel(self->timer_id_)) {
+            self->onCancel();
+        }
+    };
+
+    loop_->sendToQueue(std::move(fn));
 }
 
 CycleTimer::~CycleTimer() {
@@ -44,13 +40,13 @@ CycleTimer::~CycleTimer() {
     }
 }
 
-CycleTimer::CycleTimer(EventLoop* loop, int delay_second, const ExpiresFunctor& cb, bool persist)
-        : loop_(loop), expires_fn_(cb), delay_second_(delay_second), persist_(persist) {
+CycleTimer::CycleTimer(EventLoop* loop, int delay_ms, const ExpiresFunctor& cb, bool persist)
+        : loop_(loop), expires_fn_(cb), delay_ms_(delay_ms), persist_(persist) {
 
 }
 
-CycleTimer::CycleTimer(EventLoop* loop, int delay_second, ExpiresFunctor&& cb, bool persist)
-        : loop_(loop), expires_fn_(cb), delay_second_(delay_second), persist_(persist) {
+CycleTimer::CycleTimer(EventLoop* loop, int delay_ms, ExpiresFunctor&& cb, bool persist)
+        : loop_(loop), expires_fn_(std::move(cb)), delay_ms_(delay_ms), persist_(persist) {
 
 }
 
@@ -59,18 +55,10 @@ void CycleTimer::onTrigger() {
         expires_fn_();
     }
 
-    if (persist_) {
-        timer_watcher_->asyncWait();
-    } else {
+    // The persist timer is rearmed by the timer queue.
+    if (!persist_) {
         cancel_fn_ = ExpiresFunctor();
         expires_fn_ = ExpiresFunctor();
-
-        // NOTICE: the self_ reference count before reset timer_watcher_
-        timer_watcher_.reset();
-
-        // NOTICE: the self_ reference count after reset timer_watcher_
-        // Need to reset timer for hold self
-        self_.reset();
     }
 }
 
@@ -83,12 +71,6 @@ void CycleTimer::onCancel() {
     }
 
     expires_fn_ = ExpiresFunctor();
-
-    // NOTICE: the self_ reference count before reset timer_watcher_
-    timer_watcher_.reset();
-    // NOTICE: the self_ reference count after reset timer_watcher_
-    // Need to reset timer for hold self
-    self_.reset();
 }
 
 } /* end namespace atp */
@@ -4,19 +4,24 @@
 #include <memory>
 #include <functional>
 
+#include "net/atp_timer_queue.h"
+
 namespace atp {
 
 class EventLoop;
-class TimerEventWatcher;
 
+/*
+ * The shared handle of a timer of the event loop timer queue, the queue holds it until fired or canceled.
+ * The addTimerTask of the event loop is cheaper for the timers needn't the shared handle.
+ */
 class CycleTimer : public std::enable_shared_from_this<CycleTimer> {
 public:
     typedef std::function<void()> ExpiresFunctor;
 
 public:
-    static std::shared_ptr<CycleTimer> newCycleTimer(EventLoop* loop, int delay_second, const ExpiresFunctor& cb, bool persist);
+    static std::shared_ptr<CycleTimer> newCycleTimer(EventLoop* loop, int delay_ms, const ExpiresFunctor& cb, bool persist);
 
-    static std::shared_ptr<CycleTimer> newCycleTimer(EventLoop* loop, int delay_second, ExpiresFunctor&& cb, bool persist);
+    static std::shared_ptr<CycleTimer> newCycleTimer(EventLoop* loop, int delay_ms, ExpiresFunctor&& cb, bool persist);
 
     void start();
 
@@ -30,9 +35,9 @@ public:
     ~CycleTimer();
 
 private:
-    CycleTimer(EventLoop* loop, int delay_second, const ExpiresFunctor& cb, bool persist);
+    CycleTimer(EventLoop* loop, int delay_ms, const ExpiresFunctor& cb, bool persist);
 
-    CycleTimer(EventLoop* loop, int delay_second, ExpiresFunctor&& cb, bool persist);
+    CycleTimer(EventLoop* loop, int delay_ms, ExpiresFunctor&& cb, bool persist);
 
     void onTrigger();
 
@@ -40,10 +45,9 @@ private:
 
 private:
     EventLoop* loop_;
-    std::shared_ptr<TimerEventWatcher> timer_watcher_;
-    std::shared_ptr<CycleTimer> self_; // Hold myself
+    TimerId timer_id_;
     ExpiresFunctor expires_fn_;
-    int delay_second_;
+    int delay_ms_;
     bool persist_;
     ExpiresFunctor cancel_fn_;
 };
@@ -22,91 +22,455 @@
  * SOFTWARE.
  */
 
+#include <chrono>
+#include <algorithm>
+#include <system_error>
+
 #include "net/atp_dynamic_thread_pool.h"
 
 namespace atp {
 
-DynamicThreadPool::DynamicThreadPool(size_t core_threads) {
-    shutdown_ = false;
-    core_threads_ = core_threads;
-    current_threads_ = 0;
-    waiting_threads_ = 0;
-    max_threads_ = THREAD_POOL_MAX_THREADS;
+// One of the tasks added by each thread is timestamped, the clock costs as much as the queue.
+static const unsigned int kLatencySampleRate = 64;
+
+static int64_t steadyClockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+DynamicThreadPool::DynamicThreadPool(size_t core_threads, size_t max_threads,
+                    size_t queue_capacity, ThreadPoolRejectPolicy policy)
+    : shutdown_(false), core_threads_(core_threads), max_threads_(max_threads < core_threads ? core_threads : max_threads),
+      current_threads_(0), idle_threads_(0), deadline_size_(0), deadline_pop_count_(0), queue_capacity_(queue_capacity),
+      bounded_(queue_capacity > 0), policy_(policy), queue_size_(0), rejected_tasks_(0),
+      max_latency_ns_(0), last_pop_count_(0), blocked_producers_(0), manage_notified_(false) {
+    // The unbounded pool mostly queues the normal tasks, the others start with the smaller queue.
+    queues_[THREAD_POOL_PRIORITY_HIGH].reset(new TaskQueue(bounded_ ? queue_capacity_ : THREAD_POOL_PRIORITY_QUEUE_CAPACITY));
+    queues_[THREAD_POOL_PRIORITY_NORMAL].reset(new TaskQueue(bounded_ ? queue_capacity_ : THREAD_POOL_QUEUE_CAPACITY));
+    queues_[THREAD_POOL_PRIORITY_LOW].reset(new TaskQueue(bounded_ ? queue_capacity_ : THREAD_POOL_PRIORITY_QUEUE_CAPACITY));
 
-    std::lock_guard<std::mutex> lock(lock_);
     for (size_t i = 0; i < core_threads_; ++ i) {
-        current_threads_ ++;
-        new DynamicThread(this);
+        ++ current_threads_;
+        threads_.push_back(new DynamicThread(this));
     }
+
+    manager_.reset(new std::thread(&DynamicThreadPool::manager, this));
 }
 
 DynamicThreadPool::~DynamicThreadPool() {
-    std::unique_lock<std::mutex> lock(lock_);
-    shutdown_ = true;
-    cond_var_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(manage_lock_);
+        shutdown_ = true;
+        manage_cond_.notify_all();
+    }
+
+    manager_->join();
+    manager_.reset();
+
+    // The threads execute the queued tasks before exit.
+    {
+        std::lock_guard<std::mutex> lock(idle_lock_);
+        idle_cond_.notify_all();
+    }
 
-    while (current_threads_ != 0) {
-        cond_var_.wait(lock);
+    {
+        std::lock_guard<std::mutex> lock(space_lock_);
+        space_cond_.notify_all();
     }
 
-    reaper(&dead_threads_);
+    reaper(&threads_, true);
 }
 
-inline void DynamicThreadPool::add(const TaskPtr& callback) {
-    std::lock_guard<std::mutex> lock(lock_);
-    callbacks_.push(callback);
+bool DynamicThreadPool::add(const TaskPtr& callback) {
+    TaskItem item = {callback, sampleQueuedTime(), 0};
+    return addTask(item, THREAD_POOL_PRIORITY_NORMAL);
+}
 
-    // 1.waiting_threads_ is 0 and current_threads_ >= max_threads_, wait a idle thread from pool do task.
-    // 2.waiting_threads_ is 0 and current_threads_ < max_threads_, create a new thread do task.
-    // 3.waiting_threads_ is not 0, notify pool thread do task.
-    if (waiting_threads_ == 0 && current_threads_ >= max_threads_) {
-        return;
-    } else if (waiting_threads_ == 0) {
-        ++ current_threads_;
-        new DynamicThread(this);
-    } else {
-        cond_var_.notify_one();
+bool DynamicThreadPool::add(TaskPtr&& callback) {
+    TaskItem item = {std::move(callback), sampleQueuedTime(), 0};
+    return addTask(item, THREAD_POOL_PRIORITY_NORMAL);
+}
+
+bool DynamicThreadPool::add(const TaskPtr& callback, ThreadPoolPriority priority) {
+    if (priority == THREAD_POOL_PRIORITY_DEADLINE) {
+        return addWithDeadline(callback, 0);
+    }
+
+    TaskItem item = {callback, sampleQueuedTime(), 0};
+    return addTask(item, priority);
+}
+
+bool DynamicThreadPool::addWithDeadline(const TaskPtr& callback, int deadline_ms) {
+    int64_t now = steadyClockNs();
+    TaskItem item = {callback, now, now + static_cast<int64_t>(deadline_ms) * 1000000};
+    return addTask(item, THREAD_POOL_PRIORITY_DEADLINE);
+}
+
+size_t DynamicThreadPool::getTaskQueueSize() const {
+    return queue_size_.load();
+}
+
+size_t DynamicThreadPool::getTaskQueueSize(ThreadPoolPriority priority) const {
+    if (priority == THREAD_POOL_PRIORITY_DEADLINE) {
+        return deadline_size_.load();
     }
+
+    const TaskQueue* queue = queues_[priority].get();
+    return queue->callbacks_.size() + queue->overflow_size_.load();
 }
 
-inline size_t DynamicThreadPool::getTaskQueueSize() const {
-    return callbacks_.size();
+int64_t DynamicThreadPool::sampleQueuedTime() {
+    static thread_local unsigned int sequence = 0;
+
+    return (sequence ++ % kLatencySampleRate == 0) ? steadyClockNs() : 0;
+}
+
+bool DynamicThreadPool::addTask(TaskItem& item, ThreadPoolPriority priority) {
+    if (shutdown_.load()) {
+        return false;
+    }
+
+    if (!pushTask(item, priority)) {
+        switch (policy_) {
+        case THREAD_POOL_REJECT_DISCARD_OLDEST: {
+            // The deadline heap top is the most urgent one, drop the latest deadline of the heap instead.
+            if (priority == THREAD_POOL_PRIORITY_DEADLINE) {
+                if (!replaceLatestDeadline(item)) {
+                    return false;
+                }
+
+                break;
+            }
+
+            // Drop the oldest of the same priority.
+            TaskItem oldest;
+            while (!pushTask(item, priority)) {
+                if (popTask(&oldest, priority)) {
+                    ++ rejected_tasks_;
+                }
+            }
+
+            break;
+        }
+
+        case THREAD_POOL_REJECT_CALLER_RUNS:
+            item.callback_();
+            return true;
+
+        case THREAD_POOL_REJECT_BLOCK: {
+            ++ blocked_producers_;
+
+            std::unique_lock<std::mutex> lock(space_lock_);
+            while (!pushTask(item, priority)) {
+                if (shutdown_.load()) {
+                    -- blocked_producers_;
+                    ++ rejected_tasks_;
+                    return false;
+                }
+
+                // The timeout covers the notify missed between the push failed and the wait.
+                space_cond_.wait_for(lock, std::chrono::milliseconds(THREAD_POOL_MANAGE_INTERVAL));
+            }
+
+            -- blocked_producers_;
+            break;
+        }
+
+        default:
+            ++ rejected_tasks_;
+            return false;
+        }
+    }
+
+    // 1.idle_threads_ is not 0, notify a idle thread do task.
+    // 2.idle_threads_ is 0 and current_threads_ < max_threads_, notify the manager to check whether grow.
+    // 3.idle_threads_ is 0 and current_threads_ >= max_threads_, wait a busy thread from pool do task.
+    if (idle_threads_.load() > 0) {
+        std::lock_guard<std::mutex> lock(idle_lock_);
+        idle_cond_.notify_one();
+    } else if (current_threads_.load() < max_threads_ && !manage_notified_.load() && !manage_notified_.exchange(true)) {
+        std::lock_guard<std::mutex> lock(manage_lock_);
+        manage_cond_.notify_one();
+    }
+
+    return true;
+}
+
+bool DynamicThreadPool::pushTask(TaskItem& item, ThreadPoolPriority priority) {
+    // Count before push, so the thread found the queue_size_ 0 never misses the task.
+    ++ queue_size_;
+
+    if (priority == THREAD_POOL_PRIORITY_DEADLINE) {
+        std::lock_guard<std::mutex> lock(deadline_lock_);
+        if (bounded_ && deadline_tasks_.size() >= queue_capacity_) {
+            -- queue_size_;
+            return false;
+        }
+
+        deadline_tasks_.push_back(std::move(item));
+        std::push_heap(deadline_tasks_.begin(), deadline_tasks_.end(), DeadlineCompare());
+        ++ deadline_size_;
+        return true;
+    }
+
+    TaskQueue* queue = queues_[priority].get();
+
+    // Once overflowed, keep queueing to the overflow list until it drained, to keep the tasks in order.
+    if (!bounded_ && queue->overflow_size_.load() > 0) {
+        std::lock_guard<std::mutex> lock(queue->overflow_lock_);
+        queue->overflow_tasks_.push_back(std::move(item));
+        ++ queue->overflow_size_;
+        return true;
+    }
+
+    if (queue->callbacks_.push(std::move(item))) {
+        return true;
+    }
+
+    if (bounded_) {
+        -- queue_size_;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(queue->overflow_lock_);
+    queue->overflow_tasks_.push_back(std::move(item));
+    ++ queue->overflow_size_;
+
+    return true;
+}
+
+bool DynamicThreadPool::replaceLatestDeadline(TaskItem& item) {
+    std::lock_guard<std::mutex> lock(deadline_lock_);
+    if (deadline_tasks_.size() < queue_capacity_) {
+        // The workers made space since the push failed, nothing dropped.
+        ++ queue_size_;
+        ++ deadline_size_;
+        deadline_tasks_.push_back(std::move(item));
+        std::push_heap(deadline_tasks_.begin(), deadline_tasks_.end(), DeadlineCompare());
+        return true;
+    }
+
+    ++ rejected_tasks_;
+    if (deadline_tasks_.empty()) {
+        return false;
+    }
+
+    // The latest deadline is one of the leaves of the min heap.
+    auto latest = std::min_element(deadline_tasks_.begin() + deadline_tasks_.size() / 2, deadline_tasks_.end(),
+                                    DeadlineCompare());
+    if (latest->deadline_ns_ <= item.deadline_ns_) {
+        return false;
+    }
+
+    // The earlier deadline replaces it in place, the heap prefix up to it is still a heap, sift it up.
+    *latest = std::move(item);
+    std::push_heap(deadline_tasks_.begin(), latest + 1, DeadlineCompare());
+
+    return true;
+}
+
+bool DynamicThreadPool::popTask(TaskItem* item, ThreadPoolPriority priority) {
+    if (priority == THREAD_POOL_PRIORITY_DEADLINE) {
+        if (deadline_size_.load() == 0) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(deadline_lock_);
+        if (deadline_tasks_.empty()) {
+            return false;
+        }
+
+        std::pop_heap(deadline_tasks_.begin(), deadline_tasks_.end(), DeadlineCompare());
+        *item = std::move(deadline_tasks_.back());
+        deadline_tasks_.pop_back();
+        -- deadline_size_;
+        -- queue_size_;
+        deadline_pop_count_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    TaskQueue* queue = queues_[priority].get();
+    if (queue->callbacks_.pop(item)) {
+        -- queue_size_;
+        return true;
+    }
+
+    if (queue->overflow_size_.load() > 0) {
+        std::lock_guard<std::mutex> lock(queue->overflow_lock_);
+        if (!queue->overflow_tasks_.empty()) {
+            *item = std::move(queue->overflow_tasks_.front());
+            queue->overflow_tasks_.pop_front();
+            -- queue->overflow_size_;
+            -- queue_size_;
+            queue->overflow_pop_count_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool DynamicThreadPool::popTask(TaskItem* item, int start) {
+    for (int i = 0; i < THREAD_POOL_PRIORITY_SIZE; ++ i) {
+        if (popTask(item, static_cast<ThreadPoolPriority>((start + i) % THREAD_POOL_PRIORITY_SIZE))) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 void DynamicThreadPool::executerImpl() {
+    unsigned int taken = 0;
+    unsigned int turn = 0;
+
     for (; ;) {
-        std::unique_lock<std::mutex> lock(lock_);
-        if (!shutdown_ && callbacks_.empty()) {
-            if (waiting_threads_ >= core_threads_) {
-                lock.unlock();
-                return;
+        // Every interval tasks, start from the lower priorities in turn, so they are never starved.
+        int start = THREAD_POOL_PRIORITY_HIGH;
+        if (++ taken % THREAD_POOL_STARVATION_INTERVAL == 0) {
+            start = 1 + (turn ++ % (THREAD_POOL_PRIORITY_SIZE - 1));
+        }
+
+        TaskItem item;
+        if (popTask(&item, start)) {
+            if (item.queued_ns_ > 0) {
+                int64_t latency = steadyClockNs() - item.queued_ns_;
+                int64_t max_latency = max_latency_ns_.load(std::memory_order_relaxed);
+                while (latency > max_latency && !max_latency_ns_.compare_exchange_weak(max_latency, latency)) {
+                }
+            }
+
+            if (blocked_producers_.load() > 0) {
+                std::lock_guard<std::mutex> lock(space_lock_);
+                space_cond_.notify_one();
             }
 
-            ++ waiting_threads_;
-            cond_var_.wait(lock);
-            -- waiting_threads_;
+            item.callback_();
+            continue;
+        }
+
+        if (shutdown_.load()) {
+            -- current_threads_;
+            return;
+        }
+
+        // The task is counted but still being pushed, let the producer finish it.
+        if (queue_size_.load() > 0) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        bool timedout = false;
+        {
+            std::unique_lock<std::mutex> lock(idle_lock_);
+            ++ idle_threads_;
+            while (queue_size_.load() == 0 && !shutdown_.load()) {
+                if (idle_cond_.wait_for(lock, std::chrono::milliseconds(THREAD_POOL_IDLE_TIMEOUT)) == std::cv_status::timeout) {
+                    timedout = true;
+                    break;
+                }
+            }
+
+            -- idle_threads_;
+        }
+
+        if (timedout && queue_size_.load() == 0 && retireThread()) {
+            return;
         }
+    }
+}
 
-        if (!callbacks_.empty()) {
-            auto cb = callbacks_.front();
-            callbacks_.pop();
-            lock.unlock();
-            cb();
-        } else if (shutdown_) {
+bool DynamicThreadPool::retireThread() {
+    size_t current = current_threads_.load();
+    while (current > core_threads_) {
+        if (current_threads_.compare_exchange_weak(current, current - 1)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DynamicThreadPool::manager() {
+    std::unique_lock<std::mutex> lock(manage_lock_);
+    while (!shutdown_.load()) {
+        manage_cond_.wait_for(lock, std::chrono::milliseconds(THREAD_POOL_MANAGE_INTERVAL));
+        manage_notified_.store(false);
+        if (shutdown_.load()) {
             break;
         }
+
+        lock.unlock();
+
+        // The exited threads are joined at once, the dead threads never pile up and exhaust the thread limit.
+        reaper(&threads_, false);
+        growThreads();
+
+        lock.lock();
     }
 }
 
-void DynamicThreadPool::reaper(std::list<DynamicThread*>* tlist) {
-    for (auto t = tlist->begin(); t != tlist->end(); t = tlist->erase(t)) {
-        delete (*t);
+void DynamicThreadPool::growThreads() {
+    int64_t latency = max_latency_ns_.exchange(0);
+
+    size_t pop_count = deadline_pop_count_.load(std::memory_order_relaxed);
+    for (int i = 0; i < THREAD_POOL_PRIORITY_SIZE; ++ i) {
+        if (queues_[i]) {
+            pop_count += queues_[i]->callbacks_.popCount() + queues_[i]->overflow_pop_count_.load(std::memory_order_relaxed);
+        }
+    }
+
+    size_t popped = pop_count - last_pop_count_;
+    last_pop_count_ = pop_count;
+
+    size_t queued = queue_size_.load();
+    size_t current = current_threads_.load();
+    if (queued == 0 || idle_threads_.load() > 0 || current >= max_threads_) {
+        return;
+    }
+
+    // The queued tasks wait about queued / pop rate, nothing popped means all the threads are busy with the long tasks.
+    int64_t interval_ns = static_cast<int64_t>(THREAD_POOL_MANAGE_INTERVAL) * 1000000;
+    int64_t estimated = popped > 0 ? static_cast<int64_t>(queued * interval_ns / popped) : interval_ns;
+    if (latency < estimated) {
+        latency = estimated;
+    }
+
+    if (current > 0 && latency < static_cast<int64_t>(THREAD_POOL_GROW_LATENCY) * 1000000) {
+        return;
+    }
+
+    // Grow at most double the threads at once, the queued tasks may be short.
+    size_t grow = std::min(queued, std::max<size_t>(current, 1));
+    grow = std::min(grow, max_threads_ - current);
+
+    for (size_t i = 0; i < grow; ++ i) {
+        ++ current_threads_;
+
+        try {
+            threads_.push_back(new DynamicThread(this));
+        } catch (const std::system_error& e) {
+            -- current_threads_;
+            LOG(ERROR) << "DynamicThreadPool create thread failed: " << e.what();
+            break;
+        }
+    }
+}
+
+void DynamicThreadPool::reaper(std::list<DynamicThread*>* tlist, bool all) {
+    for (auto t = tlist->begin(); t != tlist->end();) {
+        if (all || (*t)->isExited()) {
+            delete (*t);
+            t = tlist->erase(t);
+        } else {
+            ++ t;
+        }
     }
 }
 
 
 DynamicThreadPool::DynamicThread::DynamicThread(DynamicThreadPool* pool)
-    : pool_(pool), thd_(new std::thread(&DynamicThreadPool::DynamicThread::executer, this)) {
+    : pool_(pool), exited_(false), thd_(new std::thread(&DynamicThreadPool::DynamicThread::executer, this)) {
 
 }
 
@@ -120,16 +484,9 @@ void DynamicThreadPool::DynamicThread::executer() {
     pool_->executerImpl();
 
     // Run in this only had two case:
-    // 1. shutdown is true.
-    // 2. current tasks is empty and waiting threads >= core threads.
-    std::lock_guard<std::mutex> lock(pool_->lock_);
-    pool_->current_threads_ --;
-    pool_->dead_threads_.push_back(this);
-
-    // When destroy pool, last thread must be notify.
-    if (pool_->shutdown_ && pool_->current_threads_ == 0) {
-        pool_->cond_var_.notify_one();
-    }
+    // 1. shutdown is true and the tasks are drained.
+    // 2. the thread exceeds the core threads idle timedout.
+    exited_.store(true);
 }
 
 } /* end namespace atp */
@@ -26,17 +26,53 @@
 #define __ATP_DYNAMIC_THREAD_POOL__
 
 #include <list>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <functional>
 #include <condition_variable>
 
 #include "net/atp_config.h"
+#include "net/atp_mpmc_queue.hpp"
 
 namespace atp {
 
+typedef enum {
+    /* Drop the new task, add returns false. */
+    THREAD_POOL_REJECT_DISCARD          =   (0),
+
+    /*
+     * Drop the oldest queued task and queue the new one, the deadline tasks drop the latest deadline
+     * one of the queued and the new tasks.
+     */
+    THREAD_POOL_REJECT_DISCARD_OLDEST   =   (1),
+
+    /* Run the new task in the caller thread, slows down the producer. */
+    THREAD_POOL_REJECT_CALLER_RUNS      =   (2),
+
+    /* Block the caller until the queue has space. */
+    THREAD_POOL_REJECT_BLOCK            =   (3)
+} ThreadPoolRejectPolicy;
+
+typedef enum {
+    /* The latency critical tasks, e.g. the health checks and the control plane. */
+    THREAD_POOL_PRIORITY_HIGH           =   (0),
+
+    /* The tasks added by addWithDeadline, the earliest deadline first. */
+    THREAD_POOL_PRIORITY_DEADLINE       =   (1),
+
+    /* The default priority of add. */
+    THREAD_POOL_PRIORITY_NORMAL         =   (2),
+
+    /* The background batch tasks. */
+    THREAD_POOL_PRIORITY_LOW            =   (3),
+
+    THREAD_POOL_PRIORITY_SIZE           =   (4)
+} ThreadPoolPriority;
+
 class BaseThreadPool {
 public:
     using TaskPtr = std::function<void()>;
@@ -44,12 +80,28 @@ public:
 public:
     BaseThreadPool() {}
 
-    ~BaseThreadPool() {}
+    virtual ~BaseThreadPool() {}
 
 public:
-    virtual void add(const TaskPtr& callback) = 0;
+    /* Return false if the task is rejected and will never run. */
+    virtual bool add(const TaskPtr& callback) = 0;
+
+    /* The pool without priorities queues all the tasks as the same. */
+    virtual bool add(const TaskPtr& callback, ThreadPoolPriority priority) {
+        return add(callback);
+    }
+
+    /* Run the task before the deadline_ms(from now) expired, the earliest deadline first. */
+    virtual bool addWithDeadline(const TaskPtr& callback, int deadline_ms) {
+        return add(callback, THREAD_POOL_PRIORITY_DEADLINE);
+    }
 
     virtual size_t getTaskQueueSize() const = 0;
+
+    /* The queued tasks of the priority, the pool without priorities counts them all as normal. */
+    virtual size_t getTaskQueueSize(ThreadPoolPriority priority) const {
+        return priority == THREAD_POOL_PRIORITY_NORMAL ? getTaskQueueSize() : 0;
+    }
 };
 
 
@@ -61,61 +113,211 @@ public:
 };
 
 
+/*
+ * The DynamicThreadPool keeps core_threads threads and grows up to max_threads under load.
+ *
+ * The tasks are queued in a lock free MPMC queue, the add never takes a lock unless an idle thread
+ * needs to be woken up. The threads are never created in add, a manager thread checks the queue every
+ * THREAD_POOL_MANAGE_INTERVAL ms(or at once when add found no idle thread), it creates the threads when
+ * the tasks wait in the queue more than THREAD_POOL_GROW_LATENCY ms, and reaps the exited threads.
+ * The queue latency is the max of the sampled tasks and the queued tasks divided by the pop rate.
+ * The thread exceeds the core threads exits after idle THREAD_POOL_IDLE_TIMEOUT ms, the long idle
+ * timeout against the short grow latency keeps the pool from growing and shrinking back and forth.
+ *
+ * The queue_capacity 0 is unbounded, the tasks overflow the lock free queue are queued in a list.
+ * Otherwise the pool is bounded(the capacity rounded up to the power of 2), the task added to the full
+ * queue is handled by the reject policy.
+ *
+ * Each priority has its own queue(the capacity applies to each), the threads take the tasks in the
+ * order of high, deadline, normal and low. Against the starvation, every THREAD_POOL_STARVATION_INTERVAL
+ * tasks taken by a thread, the thread starts from the next lower priority in turn, so each priority gets
+ * at least a share of the threads while the higher ones are saturated. The deadline tasks are kept in a
+ * min heap of the deadline, the expired ones still run.
+ */
 class DynamicThreadPool final: public BaseThreadPool {
 public:
-    explicit DynamicThreadPool(size_t core_threads);
+    explicit DynamicThreadPool(size_t core_threads, size_t max_threads = THREAD_POOL_MAX_THREADS,
+                        size_t queue_capacity = 0, ThreadPoolRejectPolicy policy = THREAD_POOL_REJECT_DISCARD);
 
     ~DynamicThreadPool();
 
 public:
-    inline void add(const TaskPtr& callback) override;
+    bool add(const TaskPtr& callback) override;
+
+    bool add(TaskPtr&& callback);
 
-    inline size_t getTaskQueueSize() const override;
+    bool add(const TaskPtr& callback, ThreadPoolPriority priority) override;
+
+    bool addWithDeadline(const TaskPtr& callback, int deadline_ms) override;
+
+    size_t getTaskQueueSize() const override;
+
+    size_t getTaskQueueSize(ThreadPoolPriority priority) const override;
+
+    size_t getCurrentThreads() const {
+        return current_threads_.load();
+    }
+
+    size_t getIdleThreads() const {
+        return idle_threads_.load();
+    }
+
+    /* The tasks dropped by the reject policy. */
+    size_t getRejectedTasks() const {
+        return rejected_tasks_.load();
+    }
 
 private:
+    struct TaskItem {
+        TaskPtr callback_;
+
+        // The steady clock ns when queued, only the sampled tasks have it, the others are 0.
+        int64_t queued_ns_;
+
+        // The steady clock ns deadline of the deadline task.
+        int64_t deadline_ns_;
+    };
+
+    // The later deadline is the lower priority in the heap.
+    struct DeadlineCompare {
+        bool operator()(const TaskItem& a, const TaskItem& b) const {
+            return a.deadline_ns_ > b.deadline_ns_;
+        }
+    };
+
+    // The queue of one priority, except the deadline.
+    struct TaskQueue {
+        explicit TaskQueue(size_t capacity) : callbacks_(capacity), overflow_size_(0), overflow_pop_count_(0) {
+
+        }
+
+        MPMCQueue<TaskItem> callbacks_;
+
+        std::mutex overflow_lock_;
+
+        std::deque<TaskItem> overflow_tasks_;
+
+        std::atomic<size_t> overflow_size_;
+
+        std::atomic<size_t> overflow_pop_count_;
+    };
+
     class DynamicThread {
         public:
             DynamicThread(DynamicThreadPool* pool);
 
             ~DynamicThread();
 
+            bool isExited() const {
+                return exited_.load();
+            }
+
         private:
             void executer();
 
         private:
             DynamicThreadPool* pool_;
+            std::atomic<bool> exited_;
             std::unique_ptr<std::thread> thd_;
     };
 
+    bool addTask(TaskItem& item, ThreadPoolPriority priority);
+
+    static int64_t sampleQueuedTime();
+
+    bool pushTask(TaskItem& item, ThreadPoolPriority priority);
+
+    /*
+     * The full deadline heap drops its latest deadline task for the item, return false if the item
+     * itself has the latest deadline and is dropped.
+     */
+    bool replaceLatestDeadline(TaskItem& item);
+
+    bool popTask(TaskItem* item, ThreadPoolPriority priority);
+
+    /* Take the task by the priorities, starting from the start one and wrapping around. */
+    bool popTask(TaskItem* item, int start);
+
     void executerImpl();
 
-    void reaper(std::list<DynamicThread*>* tlist);
+    /* The thread exceeds the core threads gives up its slot, return false if it must stay. */
+    bool retireThread();
+
+    void manager();
+
+    void growThreads();
+
+    void reaper(std::list<DynamicThread*>* tlist, bool all);
 
 private:
     // Pool state.
-    bool shutdown_;
+    std::atomic<bool> shutdown_;
 
     // Minimum thread number.
     size_t core_threads_;
 
+    // Max thread number.
+    size_t max_threads_;
+
     // Current thread number.
-    size_t current_threads_;
+    std::atomic<size_t> current_threads_;
 
     // Current waiting thread number.
-    size_t waiting_threads_;
+    std::atomic<size_t> idle_threads_;
 
-    // Max thread number.
-    size_t max_threads_;
+    // Task queues of the priorities, the deadline one is NULL, the overflow list is used only by the
+    // unbounded pool when the queue is full.
+    std::unique_ptr<TaskQueue> queues_[THREAD_POOL_PRIORITY_SIZE];
+
+    // The deadline tasks heap.
+    std::mutex deadline_lock_;
+
+    std::vector<TaskItem> deadline_tasks_;
+
+    std::atomic<size_t> deadline_size_;
+
+    std::atomic<size_t> deadline_pop_count_;
+
+    size_t queue_capacity_;
+
+    bool bounded_;
+
+    ThreadPoolRejectPolicy policy_;
+
+    // The tasks queued in all the priorities.
+    std::atomic<size_t> queue_size_;
+
+    std::atomic<size_t> rejected_tasks_;
+
+    // The max latency ns of the sampled tasks in the manage interval.
+    std::atomic<int64_t> max_latency_ns_;
+
+    // The tasks popped until the last manage, only accessed by the manager thread.
+    size_t last_pop_count_;
+
+    // The idle threads wait on it.
+    std::mutex idle_lock_;
+
+    std::condition_variable idle_cond_;
+
+    // The producers blocked by the full bounded queue wait on it.
+    std::mutex space_lock_;
+
+    std::condition_variable space_cond_;
+
+    std::atomic<size_t> blocked_producers_;
+
+    // The manager thread waits on it.
+    std::mutex manage_lock_;
 
-    // Task queue lock.
-    std::mutex lock_;
+    std::condition_variable manage_cond_;
 
-    std::condition_variable cond_var_;
+    std::atomic<bool> manage_notified_;
 
-    // Task queue.
-    std::queue<TaskPtr> callbacks_;
+    std::unique_ptr<std::thread> manager_;
 
-    std::list<DynamicThread*> dead_threads_;
+    // The threads, only accessed by the manager thread after constructed.
+    std::list<DynamicThread*> threads_;
 };
 
 } /* end namespace atp */
@@ -22,15 +22,41 @@
  * SOFTWARE.
  */
 
+#include <chrono>
+#include <unistd.h>
+#include <string.h>
+#include <sys/time.h>
+
 #include "net/atp_config.h"
 #include "net/atp_libevent.h"
+#include "net/atp_channel.h"
+#include "net/atp_io_uring.h"
 #include "net/atp_cycle_timer.h"
 #include "net/atp_event_loop.h"
 
 namespace atp {
 
-EventLoop::EventLoop()
-    : pending_tasks_size_(0), notified_(false) {
+static std::atomic<int> event_loop_sequence(0);
+
+EventLoop::EventLoop(IOBackend io_backend)
+    : event_base_(NULL), pending_tasks_size_(0), notified_(false),
+      memory_stats_("EventLoop-" + std::to_string(event_loop_sequence.fetch_add(1))),
+      cached_wall_us_(0), cached_now_ns_(0), io_uring_failed_(false),
+      io_backend_(io_backend == IO_BACKEND_EPOLL ? IO_BACKEND_EPOLL : IO_BACKEND_LIBEVENT),
+      epoll_fd_(-1), epoll_ready_(0), epoll_index_(0), epoll_running_(false), busy_poll_ns_(0), spinning_(false),
+      defer_wakeup_(ENABLED_DEFER_WAKEUP), awake_(false), wakeups_(0), task_rounds_(0), tasks_run_(0),
+      iteration_end_event_(NULL), iteration_end_scheduled_(false) {
+    if (io_backend_ == IO_BACKEND_EPOLL) {
+        // The native epoll loop needn't the event_base, the pending tasks and timers are watched by fds too.
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        assert(epoll_fd_ >= 0);
+
+        epoll_events_.resize(EPOLL_MAX_EVENTS);
+
+        doInit();
+        return;
+    }
+
     // Each event_base executes in a single thread,
     // so select event_base with no locks to reduce the performance cost of event_base underlying locking.
     struct event_config* cfg = event_config_new();
@@ -39,21 +65,44 @@ EventLoop::EventLoop()
     event_config_set_flag(cfg, EVENT_BASE_FLAG_NOLOCK);
     event_config_set_flag(cfg, EVENT_BASE_FLAG_EPOLL_USE_CHANGELIST);
 
+    // The epoll_wait timeout is ms, the precise timer waits by a timerfd for the sub ms timers.
+    if (ENABLED_PRECISE_TIMER) {
+        event_config_set_flag(cfg, EVENT_BASE_FLAG_PRECISE_TIMER);
+    }
+
     event_base_ = event_base_new_with_config(cfg);
     assert(event_base_ != NULL);
 
     event_config_free(cfg);
     cfg = NULL;
 
+    iteration_end_event_ = event_new(event_base_, -1, 0, &EventLoop::iterationEndHandle, this);
+    assert(iteration_end_event_ != NULL);
+
     doInit();
 }
 
 EventLoop::~EventLoop() {
+    // The timer, io_uring and pending task events must be deleted before the event_base_ or epoll_fd_ freed.
+    timer_queue_.reset();
+    io_uring_.reset();
+    event_watcher_.reset();
+
+    if (iteration_end_event_ != NULL) {
+        event_free(iteration_end_event_);
+        iteration_end_event_ = NULL;
+    }
+
     if (event_base_ != NULL) {
         event_base_free(event_base_);
         event_base_ = NULL;
     }
 
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+        epoll_fd_ = -1;
+    }
+
     if (pending_tasks_ != NULL) {
         delete pending_tasks_;
         pending_tasks_ = NULL;
@@ -74,6 +123,11 @@ void EventLoop::dispatch() {
     // Set really thread id.
     thread_id_ = std::this_thread::get_id();
 
+    if (io_backend_ == IO_BACKEND_EPOLL) {
+        epollDispatch();
+        return;
+    }
+
     int error = event_base_dispatch(event_base_);
     if (error == 1) {
         LOG(ERROR) << "EventLoop event_base_ no any event register!";
@@ -105,10 +159,9 @@ void EventLoop::sendToQueue(const TaskEventPtr& task) {
     }
 
     ++ pending_tasks_size_;
-    if (!notified_.load()) {
-        notified_.store(true);
-        event_watcher_->eventNotify();
-    }
+    memory_stats_.add(MEMORY_PENDING_TASK, sizeof(TaskEventPtr), 1);
+
+    wakeup();
 }
 
 void EventLoop::sendToQueue(TaskEventPtr&& task) {
@@ -125,12 +178,37 @@ void EventLoop::sendToQueue(TaskEventPtr&& task) {
     }
 
     ++ pending_tasks_size_;
-    if (!notified_.load()) {
-        notified_.store(true);
+    memory_stats_.add(MEMORY_PENDING_TASK, sizeof(TaskEventPtr), 1);
+
+    wakeup();
+}
+
+void EventLoop::wakeup() {
+    /*
+     * The spinning loop checks the pending tasks itself, it rechecks after the spinning_ cleared. The awake
+     * loop rechecks after the awake_ cleared, the pending_tasks_size_ is increased before they are read.
+     */
+    if (spinning_.load() || awake_.load()) {
+        return;
+    }
+
+    // Only the producer changed the flag writes the eventfd, the loop clears it before taking the tasks.
+    bool notified = false;
+    if (notified_.compare_exchange_strong(notified, true)) {
+        wakeups_.fetch_add(1, std::memory_order_relaxed);
         event_watcher_->eventNotify();
     }
 }
 
+WakeupStats EventLoop::getWakeupStats() const {
+    WakeupStats stats;
+    stats.wakeups_ = wakeups_.load(std::memory_order_relaxed);
+    stats.task_rounds_ = task_rounds_.load(std::memory_order_relaxed);
+    stats.tasks_ = tasks_run_.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
 std::shared_ptr<CycleTimer> EventLoop::addCycleTask(int delay_ms, const TaskEventPtr& task, bool persist) {
     std::shared_ptr<CycleTimer> cycle_timer = CycleTimer::newCycleTimer(this, delay_ms, task, persist);
     cycle_timer->start();
@@ -138,6 +216,75 @@ std::shared_ptr<CycleTimer> EventLoop::addCycleTask(int delay_ms, const TaskEven
     return cycle_timer;
 }
 
+int64_t EventLoop::now() {
+    updateTime();
+    return cached_now_ns_;
+}
+
+int64_t EventLoop::wallNow() {
+    updateTime();
+    return cached_wall_us_;
+}
+
+TimerId EventLoop::addTimerTask(int64_t delay_us, TaskEventPtr task, int64_t interval_us) {
+    return timer_queue_->add(delay_us, interval_us, std::move(task));
+}
+
+void EventLoop::cancelTimerTask(TimerId id) {
+    timer_queue_->cancel(id);
+}
+
+void EventLoop::runAtIterationEnd(TaskEventPtr task) {
+    assert(threadSafety());
+
+    iteration_end_tasks_.push_back(std::move(task));
+
+    // The native epoll loop runs them before the next epoll_wait.
+    if (!iteration_end_scheduled_) {
+        iteration_end_scheduled_ = true;
+        if (iteration_end_event_ != NULL) {
+            event_active(iteration_end_event_, EV_WRITE, 0);
+        }
+    }
+}
+
+void EventLoop::setBusyPoll(int64_t busy_poll_us) {
+    if (io_backend_ != IO_BACKEND_EPOLL && busy_poll_us > 0) {
+        LOG(WARNING) << "EventLoop busy poll is only supported by the native epoll loop";
+        return;
+    }
+
+    busy_poll_ns_ = busy_poll_us * 1000;
+}
+
+void EventLoop::removeReadyChannel(Channel* channel) {
+    for (int i = epoll_index_ + 1; i < epoll_ready_; ++ i) {
+        if (epoll_events_[i].data.ptr == channel) {
+            epoll_events_[i].data.ptr = NULL;
+        }
+    }
+}
+
+IoUring* EventLoop::getIoUring() {
+    assert(threadSafety());
+
+    // The io_uring submits by a libevent active event, the native epoll loop doesn't have it.
+    if (io_backend_ == IO_BACKEND_EPOLL) {
+        return nullptr;
+    }
+
+    if (!io_uring_ && !io_uring_failed_) {
+        io_uring_.reset(new IoUring(this));
+        if (!io_uring_->init()) {
+            LOG(ERROR) << "EventLoop io_uring init failed, fall back to libevent";
+            io_uring_.reset();
+            io_uring_failed_ = true;
+        }
+    }
+
+    return io_uring_.get();
+}
+
 void EventLoop::doInit() {
     // Set event loop current state.
     state_ = STATE_INIT;
@@ -159,23 +306,185 @@ void EventLoop::doInitEventWatcher() {
     event_watcher_.reset(new PipeEventWatcher(this, std::bind(&EventLoop::doPendingTasks, this)));
 #endif
     assert(event_watcher_->doInit());
+
+    timer_queue_.reset(new TimerQueue(this));
 }
 
 void EventLoop::doPendingTasks() {
-	// Why used a tmp_pending_tasks in here?
-	// 1.This is to prevent call this function blocking by insert new tasks.
-	// 2.Timely release pending_tasks_ accupation memory by std::vector swap method.
-	std::vector<TaskEventPtr> tmp_pending_tasks;
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        notified_.store(false);
-        pending_tasks_->swap(tmp_pending_tasks);
+    // The tasks sent while the rounds running are taken by the next round without the notify.
+    if (defer_wakeup_) {
+        awake_.store(true);
     }
 
-    for (size_t i = 0; i < tmp_pending_tasks.size(); ++ i) {
-        tmp_pending_tasks[i]();
-        -- pending_tasks_size_;
+    for (int round = 0; ; ++ round) {
+        // Why used a tmp_pending_tasks in here?
+        // 1.This is to prevent call this function blocking by insert new tasks.
+        // 2.Timely release pending_tasks_ accupation memory by std::vector swap method.
+        std::vector<TaskEventPtr> tmp_pending_tasks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            notified_.store(false);
+            pending_tasks_->swap(tmp_pending_tasks);
+        }
+
+        for (size_t i = 0; i < tmp_pending_tasks.size(); ++ i) {
+            tmp_pending_tasks[i]();
+            -- pending_tasks_size_;
+            memory_stats_.add(MEMORY_PENDING_TASK, -static_cast<int64_t>(sizeof(TaskEventPtr)), -1);
+        }
+
+        task_rounds_.store(task_rounds_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        tasks_run_.store(tasks_run_.load(std::memory_order_relaxed) + tmp_pending_tasks.size(), std::memory_order_relaxed);
+
+        if (!defer_wakeup_) {
+            break;
+        }
+
+        // The task sent before the awake_ cleared is seen here, the later ones notify.
+        awake_.store(false);
+        if (pending_tasks_size_.load() <= 0) {
+            break;
+        }
+
+        // Too many rounds, handle the IO events first, the notify brings the loop back to the rest.
+        if (round + 1 >= DEFER_WAKEUP_MAX_ROUNDS) {
+            wakeup();
+            break;
+        }
+
+        awake_.store(true);
+    }
+}
+
+void EventLoop::updateTime() {
+    // The native epoll loop refreshes the time after each epoll_wait, out of the dispatch reads the clock.
+    if (io_backend_ == IO_BACKEND_EPOLL) {
+        if (!epoll_running_) {
+            refreshTime();
+        }
+
+        return;
+    }
+
+    // The libevent caches the time after each poll, it is cheap to read in the callbacks.
+    struct timeval tv;
+    event_base_gettimeofday_cached(event_base_, &tv);
+
+    int64_t wall_us = static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    if (wall_us == cached_wall_us_) {
+        return;
+    }
+
+    cached_wall_us_ = wall_us;
+    cached_now_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void EventLoop::refreshTime() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    cached_wall_us_ = static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+    cached_now_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void EventLoop::epollDispatch() {
+    epoll_running_ = true;
+
+    // The busy poll spins until the loop is idle for busy_poll_ns_ since idle_since.
+    bool spinning = false;
+    int64_t idle_since = 0;
+
+    while (epoll_running_) {
+        if (iteration_end_scheduled_) {
+            doIterationEndTasks();
+        }
+
+        // All the timers wait by the timerfd, the epoll_wait needn't a timeout.
+        int ready = epoll_wait(epoll_fd_, &epoll_events_[0], static_cast<int>(epoll_events_.size()), spinning ? 0 : -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            LOG(ERROR) << "EventLoop epoll_wait failed: " << strerror(errno);
+            break;
+        }
+
+        refreshTime();
+
+        // The data.ptr is the channel, cleared if the channel is detached by the former callbacks.
+        epoll_ready_ = ready;
+        for (epoll_index_ = 0; epoll_index_ < epoll_ready_; ++ epoll_index_) {
+            Channel* channel = static_cast<Channel*>(epoll_events_[epoll_index_].data.ptr);
+            if (channel != NULL) {
+                channel->epollEventHandle(epoll_events_[epoll_index_].events);
+            }
+        }
+
+        epoll_ready_ = 0;
+        epoll_index_ = 0;
+
+        if (busy_poll_ns_ <= 0) {
+            continue;
+        }
+
+        // Woken from the blocking epoll_wait or got any event, spin again for the whole busy_poll_ns_.
+        bool busy = spinPendingTasks() || ready > 0;
+        if (busy || !spinning) {
+            idle_since = cached_now_ns_;
+            spinning = true;
+            spinning_.store(true);
+            continue;
+        }
+
+        if (cached_now_ns_ - idle_since < busy_poll_ns_) {
+            continue;
+        }
+
+        // The task sent right before the spinning_ cleared isn't notified, run it and keep spinning.
+        spinning = false;
+        spinning_.store(false);
+        if (spinPendingTasks()) {
+            idle_since = cached_now_ns_;
+            spinning = true;
+            spinning_.store(true);
+        }
     }
+
+    epoll_running_ = false;
+    spinning_.store(false);
+}
+
+bool EventLoop::spinPendingTasks() {
+    if (pending_tasks_size_.load() <= 0) {
+        return false;
+    }
+
+    doPendingTasks();
+    return true;
+}
+
+void EventLoop::doIterationEndTasks() {
+    while (!iteration_end_tasks_.empty()) {
+        std::vector<TaskEventPtr> tasks;
+        tasks.swap(iteration_end_tasks_);
+
+        for (size_t i = 0; i < tasks.size(); ++ i) {
+            tasks[i]();
+        }
+    }
+
+    // Cleared after the tasks, the tasks queued by them don't schedule again.
+    iteration_end_scheduled_ = false;
+}
+
+void EventLoop::iterationEndHandle(int fd, short which, void* args) {
+    EventLoop* event_loop = static_cast<EventLoop*>(args);
+    assert(event_loop);
+
+    event_loop->doIterationEndTasks();
 }
 
 void EventLoop::stopHandle() {
@@ -194,11 +503,18 @@ void EventLoop::stopHandle() {
 
     fn();
 
-    event_base_loopexit(event_base_, NULL);
+    if (io_backend_ == IO_BACKEND_EPOLL) {
+        epoll_running_ = false;
+    } else {
+        event_base_loopexit(event_base_, NULL);
+    }
 
     if (!pendingTaskQueueIsEmpty()) {
         LOG(INFO) << "After event loop stopped, the tasks size: " << getPendingTaskQueueSize();
 
+        int64_t dropped = static_cast<int64_t>(pending_tasks_->size());
+        memory_stats_.add(MEMORY_PENDING_TASK, -dropped * static_cast<int64_t>(sizeof(TaskEventPtr)), -dropped);
+
         std::vector<TaskEventPtr>().swap(*pending_tasks_);
     }
 
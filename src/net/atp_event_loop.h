@@ -31,8 +31,12 @@
 #include <vector>
 #include <atomic>
 #include <functional>
+#include <sys/epoll.h>
 
+#include "net/atp_io_uring.h"
 #include "net/atp_event_watcher.h"
+#include "net/atp_timer_queue.h"
+#include "net/atp_memory_stats.h"
 #include "net/atp_state_machine.hpp"
 
 struct event;
@@ -40,14 +44,31 @@ struct event_base;
 
 namespace atp {
 
+class Channel;
 class CycleTimer;
 
+/* The cross thread wakeup counters of the event loop, the tasks per wakeup is tasks_ / wakeups_. */
+typedef struct {
+    // The eventfd notifies by the sendToQueue, one at most until the loop takes the pending tasks.
+    uint64_t wakeups_;
+
+    // The rounds taking the pending tasks, the deferred wakeup runs many rounds for one wakeup.
+    uint64_t task_rounds_;
+
+    // The tasks run by the rounds.
+    uint64_t tasks_;
+} WakeupStats;
+
 class EventLoop final : public STATE_MACHINE_INTERFACE {
 public:
     using TaskEventPtr = std::function<void()>;
 
 public:
-    EventLoop();
+    /*
+     * The IO_BACKEND_EPOLL loop waits by its own epoll fd, the channels and watchers are added to it directly
+     * and dispatched from the epoll_wait without the libevent event_base. The other backends run on libevent.
+     */
+    explicit EventLoop(IOBackend io_backend = IO_BACKEND_LIBEVENT);
 
     ~EventLoop();
 
@@ -62,15 +83,73 @@ public:
 
     std::shared_ptr<CycleTimer> addCycleTask(int delay_ms, const TaskEventPtr& task, bool persist);
 
+    /*
+     * Run the task after delay_us, and then every interval_us if it is greater than 0. It is cheaper than
+     * the addCycleTask, the timer is a node of the loop timer queue, canceled by the returned id.
+     */
+    TimerId addTimerTask(int64_t delay_us, TaskEventPtr task, int64_t interval_us = 0);
+
+    /* Cancel the timer, the id of the fired or canceled timer is ignored. */
+    void cancelTimerTask(TimerId id);
+
+    /*
+     * Run the task once after the events and the pending tasks of this loop iteration handled, e.g. the
+     * connection flushes the data sent by all the callbacks of the iteration together. The task queued by
+     * the tasks runs in the same round. Only be used in the event loop thread.
+     */
+    void runAtIterationEnd(TaskEventPtr task);
+
+    /*
+     * The native epoll loop spins on the epoll_wait(0) and the pending tasks for busy_poll_us after the last
+     * event before it blocks, the tasks sent while it is spinning skip the eventfd notify. It trades the CPU
+     * for the latency, 0 disables it. Must be called before dispatch, the libevent loop ignores it.
+     */
+    void setBusyPoll(int64_t busy_poll_us);
+
+    /*
+     * The tasks sent while the loop is running the pending tasks skip the eventfd notify, the loop takes them
+     * in another round before it goes back to the IO. It is ENABLED_DEFER_WAKEUP by default, must be called
+     * before dispatch.
+     */
+    void setDeferWakeup(bool on) {
+        defer_wakeup_ = on;
+    }
+
+    /* It can be read from any thread. */
+    WakeupStats getWakeupStats() const;
+
 public:
+    /* The libevent event_base, it is NULL in the native epoll loop. */
     struct event_base* getEventBase() const {
         return event_base_;
     }
 
+    /* IO_BACKEND_EPOLL or IO_BACKEND_LIBEVENT, the io_uring runs on the libevent loop. */
+    IOBackend getIOBackend() const {
+        return io_backend_;
+    }
+
+    int getEpollFd() const {
+        return epoll_fd_;
+    }
+
+    /* Called when the channel detached, the events of it not dispatched yet in this iteration are dropped. */
+    void removeReadyChannel(Channel* channel);
+
     bool threadSafety() const {
         return thread_id_ == std::this_thread::get_id();
     }
 
+    /*
+     * The monotonic(steady clock) ns, it is cached once per loop iteration after the events polled, so
+     * all the callbacks of one iteration see the same time without the clock calls. Out of the dispatch
+     * it reads the clock every time. Only be used in the event loop thread.
+     */
+    int64_t now();
+
+    /* The wall clock us since epoch, cached the same as now(). Only be used in the event loop thread. */
+    int64_t wallNow();
+
     int pendingTaskQueueSize() const {
         return pending_tasks_size_.load();
     }
@@ -87,6 +166,21 @@ public:
         return pending_tasks_->empty();
     }
 
+    /* The memory counters of the connections, pending tasks and rpc calls on this event loop. */
+    MemoryStats& getMemoryStats() {
+        return memory_stats_;
+    }
+
+    TimerQueue& getTimerQueue() {
+        return *timer_queue_;
+    }
+
+    /*
+     * The io_uring of this event loop, created at the first call, nullptr if the kernel doesn't support it
+     * or the loop is the native epoll, the caller falls back to the channel. Only be used in the event loop thread.
+     */
+    IoUring* getIoUring();
+
 private:
     void doInit();
 
@@ -94,8 +188,25 @@ private:
 
     void doPendingTasks();
 
+    /* Notify the eventfd if the loop is not notified or awake yet. */
+    void wakeup();
+
     void stopHandle();
 
+    /* Refresh the cached time if it is a new loop iteration. */
+    void updateTime();
+
+    void refreshTime();
+
+    void epollDispatch();
+
+    /* Run the tasks sent while spinning, return true if there was any. */
+    bool spinPendingTasks();
+
+    void doIterationEndTasks();
+
+    static void iterationEndHandle(int fd, short which, void* args);
+
 private:
     struct event_base* event_base_;
 
@@ -113,6 +224,57 @@ private:
     std::atomic<int> pending_tasks_size_;
 
     std::atomic<bool> notified_;
+
+    MemoryStats memory_stats_;
+
+    std::unique_ptr<TimerQueue> timer_queue_;
+
+    // The libevent iteration cached wall time, a new value means a new iteration.
+    int64_t cached_wall_us_;
+
+    int64_t cached_now_ns_;
+
+    std::unique_ptr<IoUring> io_uring_;
+
+    // The io_uring init failed once, don't try again for each connection.
+    bool io_uring_failed_;
+
+    IOBackend io_backend_;
+
+    int epoll_fd_;
+
+    // The events of the current epoll_wait, [epoll_index_, epoll_ready_) are not dispatched yet.
+    std::vector<struct epoll_event> epoll_events_;
+
+    int epoll_ready_;
+
+    int epoll_index_;
+
+    bool epoll_running_;
+
+    int64_t busy_poll_ns_;
+
+    // The loop is busy polling, the sendToQueue needn't notify the eventfd.
+    std::atomic<bool> spinning_;
+
+    bool defer_wakeup_;
+
+    // The loop is running the pending tasks with the deferred wakeup, it checks the tasks again before it stops.
+    std::atomic<bool> awake_;
+
+    std::atomic<uint64_t> wakeups_;
+
+    // Only written by the loop thread.
+    std::atomic<uint64_t> task_rounds_;
+
+    std::atomic<uint64_t> tasks_run_;
+
+    std::vector<TaskEventPtr> iteration_end_tasks_;
+
+    // The libevent loop runs the iteration end tasks by an active event, the active events run after the polled ones.
+    struct event* iteration_end_event_;
+
+    bool iteration_end_scheduled_;
 };
 
 } /* end namespace atp */
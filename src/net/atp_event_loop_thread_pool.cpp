@@ -31,8 +31,8 @@
 
 namespace atp {
 
-EventLoopThread::EventLoopThread()
-    : event_loop_(new EventLoop()) {
+EventLoopThread::EventLoopThread(IOBackend io_backend)
+    : event_loop_(new EventLoop(io_backend)) {
     state_.store(STATE_INIT);
 }
 
@@ -82,8 +82,8 @@ void EventLoopThread::executer() {
 }
 
 
-EventLoopPool::EventLoopPool(size_t threads_num)
-    : threads_num_(threads_num), current_index_(-1) {
+EventLoopPool::EventLoopPool(size_t threads_num, IOBackend io_backend)
+    : threads_num_(threads_num), io_backend_(io_backend), busy_poll_us_(0), current_index_(-1) {
     state_.store(STATE_NULL);
 }
 
@@ -100,7 +100,8 @@ bool EventLoopPool::autoStart() {
     state_.store(STATE_INIT);
 
     for (size_t i = 0; i < threads_num_; ++ i) {
-        std::shared_ptr<EventLoopThread> thd(new EventLoopThread());
+        std::shared_ptr<EventLoopThread> thd(new EventLoopThread(io_backend_));
+        thd->getEventLoop()->setBusyPoll(busy_poll_us_);
         if (!thd->start()) {
             state_.store(STATE_STOPPED);
             return false;
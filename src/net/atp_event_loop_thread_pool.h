@@ -30,6 +30,7 @@
 #include <thread>
 #include <vector>
 
+#include "net/atp_io_uring.h"
 #include "net/atp_state_machine.hpp"
 
 namespace atp {
@@ -39,7 +40,7 @@ class EventLoop;
 // EventLoopThread and EventLoopThreadPool for TCP server (OLPT mode).
 class EventLoopThread : public STATE_MACHINE_INTERFACE {
 public:
-    EventLoopThread();
+    explicit EventLoopThread(IOBackend io_backend = IO_BACKEND_LIBEVENT);
     ~EventLoopThread();
 
 public:
@@ -65,7 +66,8 @@ private:
 
 class EventLoopPool    : public STATE_MACHINE_INTERFACE {
 public:
-    EventLoopPool(size_t threads_num);
+    /* The event loops are created with the io_backend, see EventLoop. */
+    EventLoopPool(size_t threads_num, IOBackend io_backend = IO_BACKEND_LIBEVENT);
     ~EventLoopPool();
 
 public:
@@ -79,8 +81,15 @@ public:
 
     size_t getThreadSize();
 
+    /* Must be called before autoStart, see EventLoop::setBusyPoll. */
+    void setBusyPoll(int64_t busy_poll_us) {
+        busy_poll_us_ = busy_poll_us;
+    }
+
 private:
     size_t threads_num_;
+    IOBackend io_backend_;
+    int64_t busy_poll_us_;
     std::atomic<int> current_index_;
     std::vector<std::shared_ptr<EventLoopThread>> threads_;
 };
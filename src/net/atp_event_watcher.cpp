@@ -24,16 +24,19 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <sys/timerfd.h>
 
 #include "net/atp_config.h"
 #include "net/atp_libevent.h"
+#include "net/atp_channel.h"
 #include "net/atp_event_loop.h"
 #include "net/atp_event_watcher.h"
 
 namespace atp {
 
-EventWatcher::EventWatcher(struct event_base* event_base, DoTasksEventPtr&& handle)
-    : event_base_(event_base), event_(NULL), attached_(false), do_tasks_handle(std::move(handle)) {
+EventWatcher::EventWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle)
+    : event_loop_(event_loop), event_base_(event_loop->getEventBase()), event_(NULL), attached_(false),
+      do_tasks_handle(std::move(handle)) {
 
     event_ = new event;
     memset(event_, 0, sizeof(*event_));
@@ -50,7 +53,11 @@ bool EventWatcher::doInit() {
         return false;
     }
 
-    event_add(event_, NULL);
+    // The channel is attached by doWatch.
+    if (!channel_) {
+        event_add(event_, NULL);
+    }
+
     return true;
 }
 
@@ -69,6 +76,8 @@ void EventWatcher::doCancel() {
 }
 
 void EventWatcher::doTerminate() {
+    // The channel must be detached before the fd closed by the doTerminateImpl.
+    closeChannel();
     doTerminateImpl();
 }
 
@@ -77,6 +86,8 @@ void EventWatcher::detachEventAndFree() {
         return;
     }
 
+    closeChannel();
+
     // If is already attached to event_base_, detach from it.
     if (attached_) {
         event_del(event_);
@@ -89,6 +100,31 @@ void EventWatcher::detachEventAndFree() {
 }
 
 bool EventWatcher::doWatch(struct timeval* tv) {
+    if (channel_) {
+        // Only the timer watcher has the tv, it arms the timerfd, the zero it_value disarms so use 1ns.
+        if (tv != NULL) {
+            struct itimerspec its;
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = tv->tv_sec;
+            its.it_value.tv_nsec = tv->tv_usec * 1000;
+            if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+                its.it_value.tv_nsec = 1;
+            }
+
+            if (timerfd_settime(channel_->getInternalFd(), 0, &its, NULL) != 0) {
+                LOG(ERROR) << "[EventWatcher] doWatch timerfd_settime error: " << strerror(errno);
+                return false;
+            }
+        }
+
+        if (!attached_) {
+            channel_->attachToEventLoop();
+            attached_ = channel_->isAttached();
+        }
+
+        return attached_;
+    }
+
     // Add pipe event to libevent event base.
     if (attached_ && event_) {
         if (event_del(event_) != 0) {
@@ -108,9 +144,22 @@ bool EventWatcher::doWatch(struct timeval* tv) {
     return true;
 }
 
+void EventWatcher::initChannel(int fd, std::function<void()>&& cb) {
+    channel_.reset(new Channel(event_loop_, fd, true, false));
+    channel_->setReadCallback(cb);
+}
+
+void EventWatcher::closeChannel() {
+    if (channel_) {
+        channel_->close();
+        channel_.reset();
+        attached_ = false;
+    }
+}
+
 
 EventfdWatcher::EventfdWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle, int eventfd_flags)
-    : EventWatcher(event_loop->getEventBase(), std::move(handle)) {
+    : EventWatcher(event_loop, std::move(handle)) {
     event_fd_ = -1;
     eventfd_flags_ = eventfd_flags;
 }
@@ -146,6 +195,11 @@ bool EventfdWatcher::doInitImpl() {
         return false;
     }
 
+    if (event_loop_->getIOBackend() == IO_BACKEND_EPOLL) {
+        initChannel(event_fd_, std::bind(&EventfdWatcher::eventfdNotifyHandle, event_fd_, EV_READ, this));
+        return true;
+    }
+
     event_assign(this->event_, this->event_base_, event_fd_, EV_READ | EV_PERSIST,
         &EventfdWatcher::eventfdNotifyHandle, this);
 
@@ -171,7 +225,7 @@ void EventfdWatcher::eventfdNotifyHandle(int fd, short which, void* args) {
 
 
 PipeEventWatcher::PipeEventWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle)
-    : EventWatcher(event_loop->getEventBase(), std::move(handle)) {
+    : EventWatcher(event_loop, std::move(handle)) {
     memset(&pipe_fds_, 0, sizeof(pipe_fds_));
 }
 
@@ -212,6 +266,11 @@ bool PipeEventWatcher::doInitImpl() {
         return false;
     }
 
+    if (event_loop_->getIOBackend() == IO_BACKEND_EPOLL) {
+        initChannel(pipe_fds_[0], std::bind(&PipeEventWatcher::pipeEventNotifyHandle, pipe_fds_[0], EV_READ, this));
+        return true;
+    }
+
     event_assign(this->event_, this->event_base_, pipe_fds_[0], EV_READ | EV_PERSIST,
         &PipeEventWatcher::pipeEventNotifyHandle, this);
 
@@ -238,10 +297,10 @@ void PipeEventWatcher::pipeEventNotifyHandle(int fd, short which, void* args) {
 }
 
 
-TimerEventWatcher::TimerEventWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle, int delay_second)
-    : EventWatcher(event_loop->getEventBase(), std::move(handle)) {
-    tv_.tv_sec = delay_second;
-    tv_.tv_usec = 0;
+TimerEventWatcher::TimerEventWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle, int delay_ms)
+    : EventWatcher(event_loop, std::move(handle)), timer_fd_(-1) {
+    tv_.tv_sec = delay_ms / 1000;
+    tv_.tv_usec = (delay_ms % 1000) * 1000;
 }
 
 TimerEventWatcher::~TimerEventWatcher() {
@@ -252,7 +311,26 @@ bool TimerEventWatcher::asyncWait() {
     return this->doWatch(&tv_);
 }
 
+bool TimerEventWatcher::asyncWait(int64_t delay_us) {
+    tv_.tv_sec = delay_us / 1000000;
+    tv_.tv_usec = delay_us % 1000000;
+
+    return this->doWatch(&tv_);
+}
+
 bool TimerEventWatcher::doInitImpl() {
+    // The native epoll loop waits by a timerfd, the same as the libevent precise timer.
+    if (event_loop_->getIOBackend() == IO_BACKEND_EPOLL) {
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd_ < 0) {
+            LOG(ERROR) << "[TimerEventWatcher] timerfd_create error: " << strerror(errno);
+            return false;
+        }
+
+        initChannel(timer_fd_, std::bind(&TimerEventWatcher::timerfdExecuteHandle, this));
+        return true;
+    }
+
     event_assign(this->event_, this->event_base_, -1, 0,
         &TimerEventWatcher::timerEventExecuteHandle, this);
 
@@ -261,6 +339,11 @@ bool TimerEventWatcher::doInitImpl() {
 
 void TimerEventWatcher::doTerminateImpl() {
     memset(&tv_, 0, sizeof(tv_));
+
+    if (timer_fd_ >= 0) {
+        close(timer_fd_);
+        timer_fd_ = -1;
+    }
 }
 
 void TimerEventWatcher::timerEventExecuteHandle(int fd, short which, void* args) {
@@ -270,4 +353,14 @@ void TimerEventWatcher::timerEventExecuteHandle(int fd, short which, void* args)
     timer_watcher->do_tasks_handle();
 }
 
+void TimerEventWatcher::timerfdExecuteHandle() {
+    // The timerfd rearmed by the former callbacks of this iteration is not readable any more.
+    uint64_t expirations;
+    if (read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    do_tasks_handle();
+}
+
 } /* end namespace atp */
@@ -25,6 +25,9 @@
 #ifndef __ATP_EVENT_WATCHER_H__
 #define __ATP_EVENT_WATCHER_H__
 
+#include <stdint.h>
+
+#include <memory>
 #include <functional>
 
 struct event;
@@ -35,6 +38,7 @@ namespace atp {
 #define HAVE_EVENTFD
 #define HAVE_EVENTPIPE
 
+class Channel;
 class EventLoop;
 
 // The EventWatcher is basic class, set structure function is protected destructure function is public.
@@ -43,7 +47,7 @@ public:
     using DoTasksEventPtr = std::function<void()>;
 
 protected:
-    explicit EventWatcher(struct event_base* event_base, DoTasksEventPtr&& handle);
+    explicit EventWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle);
 
 public:
     ~EventWatcher();
@@ -67,14 +71,24 @@ protected:
     virtual bool doInitImpl() = 0;
     virtual void doTerminateImpl() {}
 
+    /* The native epoll loop watches the fd by a channel instead of the event_. */
+    void initChannel(int fd, std::function<void()>&& cb);
+
+    void closeChannel();
+
 protected:
+    EventLoop* event_loop_;
+
     // The libevent event_base.
     struct event_base* event_base_;
 
     // The event for pipe read and write.
     struct event* event_;
 
-    // If attached_ is true, the event_ is already attached to event_base_.
+    // The channel of the native epoll loop, the event_ is not used when it is set.
+    std::unique_ptr<Channel> channel_;
+
+    // If attached_ is true, the event_ or channel_ is already attached to event loop.
     bool attached_;
 
     DoTasksEventPtr do_tasks_handle;
@@ -138,13 +152,16 @@ private:
 
 class TimerEventWatcher : public EventWatcher {
 public:
-    explicit TimerEventWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle, int delay_second);
+    explicit TimerEventWatcher(EventLoop* event_loop, DoTasksEventPtr&& handle, int delay_ms);
 
     ~TimerEventWatcher();
 
 public:
     bool asyncWait();
 
+    /* Wait the delay_us instead of the delay given at construction. */
+    bool asyncWait(int64_t delay_us);
+
 private:
     bool doInitImpl() override;
 
@@ -152,8 +169,13 @@ private:
 
     static void timerEventExecuteHandle(int fd, short which, void* args);
 
+    void timerfdExecuteHandle();
+
 private:
     struct timeval tv_;
+
+    // The timerfd of the native epoll loop.
+    int timer_fd_;
 };
 
 } /* end namespace atp */
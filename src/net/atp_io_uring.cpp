@@ -0,0 +1,424 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "net/atp_config.h"
+#include "net/atp_libevent.h"
+#include "net/atp_event_loop.h"
+#include "net/atp_event_watcher.h"
+#include "net/atp_io_uring.h"
+
+namespace atp {
+
+// The buffer group of the provided buffer ring, one group per event loop.
+#define IO_URING_BUFFER_GROUP          (0)
+
+// The op is kept in the low bits of the user data, the handler pointer is aligned.
+#define IO_URING_OP_MASK               (0x7)
+
+/* There is no liburing dependency, the ring is setup by the raw syscalls. */
+static int ioUringSetup(unsigned int entries, struct io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+}
+
+static int ioUringRegister(int fd, unsigned int opcode, const void* arg, unsigned int nr_args) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+IoUring::IoUring(EventLoop* event_loop)
+    : event_loop_(event_loop), ring_fd_(-1), ring_ptr_(NULL), ring_size_(0), sqes_(NULL), sqes_size_(0),
+      sq_head_(NULL), sq_tail_(NULL), sq_flags_(NULL), sq_mask_(0), sq_entries_(0),
+      cq_head_(NULL), cq_tail_(NULL), cq_mask_(0), cqes_(NULL), sqe_tail_(0),
+      buf_ring_(NULL), buf_ring_size_(0), buf_tail_(0), submit_event_(NULL), submit_scheduled_(false),
+      enter_calls_(0), submitted_requests_(0), completions_(0) {
+    assert(event_loop_ != nullptr);
+}
+
+IoUring::~IoUring() {
+    if (submit_event_ != NULL) {
+        event_free(submit_event_);
+        submit_event_ = NULL;
+    }
+
+    event_watcher_.reset();
+
+    // Close the ring first, it cancels the requests still using the buffers.
+    if (ring_fd_ >= 0) {
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+    }
+
+    if (buf_ring_ != NULL) {
+        munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = NULL;
+    }
+
+    if (sqes_ != NULL) {
+        munmap(sqes_, sqes_size_);
+        sqes_ = NULL;
+    }
+
+    if (ring_ptr_ != NULL) {
+        munmap(ring_ptr_, ring_size_);
+        ring_ptr_ = NULL;
+    }
+}
+
+bool IoUring::init() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+    params.cq_entries = IO_URING_CQ_ENTRIES;
+
+    ring_fd_ = ioUringSetup(IO_URING_SQ_ENTRIES, &params);
+    if (ring_fd_ < 0) {
+        LOG(ERROR) << "[IoUring] io_uring_setup failed: " << strerror(errno);
+        return false;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        LOG(ERROR) << "[IoUring] the kernel io_uring is too old, features: " << params.features;
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+
+    void* ptr = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        LOG(ERROR) << "[IoUring] mmap the ring failed: " << strerror(errno);
+        return false;
+    }
+
+    ring_ptr_ = ptr;
+
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        LOG(ERROR) << "[IoUring] mmap the sqes failed: " << strerror(errno);
+        return false;
+    }
+
+    sqes_ = static_cast<struct io_uring_sqe*>(ptr);
+
+    char* ring = static_cast<char*>(ring_ptr_);
+    sq_head_ = reinterpret_cast<unsigned int*>(ring + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned int*>(ring + params.sq_off.tail);
+    sq_flags_ = reinterpret_cast<unsigned int*>(ring + params.sq_off.flags);
+    sq_mask_ = *reinterpret_cast<unsigned int*>(ring + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    cq_head_ = reinterpret_cast<unsigned int*>(ring + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned int*>(ring + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned int*>(ring + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(ring + params.cq_off.cqes);
+
+    // The sq index array maps one to one, the sqes are used in the ring order.
+    unsigned int* sq_array = reinterpret_cast<unsigned int*>(ring + params.sq_off.array);
+    for (unsigned int i = 0; i < sq_entries_; ++ i) {
+        sq_array[i] = i;
+    }
+
+    sqe_tail_ = *sq_tail_;
+
+    // The provided buffer ring must be page aligned.
+    buf_ring_size_ = IO_URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    ptr = mmap(NULL, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        LOG(ERROR) << "[IoUring] mmap the buffer ring failed: " << strerror(errno);
+        return false;
+    }
+
+    buf_ring_ = static_cast<struct io_uring_buf_ring*>(ptr);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = IO_URING_BUFFER_COUNT;
+    reg.bgid = IO_URING_BUFFER_GROUP;
+
+    if (ioUringRegister(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG(ERROR) << "[IoUring] register the buffer ring failed: " << strerror(errno);
+        return false;
+    }
+
+    buffers_.reset(new char[IO_URING_BUFFER_COUNT * IO_URING_BUFFER_SIZE]);
+    for (int i = 0; i < IO_URING_BUFFER_COUNT; ++ i) {
+        addBuffer(static_cast<uint16_t>(i));
+    }
+
+    event_watcher_.reset(new EventfdWatcher(event_loop_, std::bind(&IoUring::reap, this), 0));
+    if (!event_watcher_->doInit()) {
+        LOG(ERROR) << "[IoUring] init the eventfd watcher failed";
+        return false;
+    }
+
+    int event_fd = -1;
+    event_watcher_->getEventfd(&event_fd);
+    if (ioUringRegister(ring_fd_, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+        LOG(ERROR) << "[IoUring] register the eventfd failed: " << strerror(errno);
+        return false;
+    }
+
+    if (!event_watcher_->asyncWait()) {
+        return false;
+    }
+
+    submit_event_ = event_new(event_loop_->getEventBase(), -1, 0, &IoUring::submitHandle, this);
+    if (submit_event_ == NULL) {
+        return false;
+    }
+
+    if (ATP_NET_DEBUG_ON) {
+        LOG(INFO) << "[IoUring] init ring fd: " << ring_fd_ << " sq entries: " << sq_entries_;
+    }
+
+    return true;
+}
+
+bool IoUring::prepareAcceptMultishot(int fd, IoUringHandler* handler, int op) {
+    struct io_uring_sqe* sqe = getSqe(handler, op);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+
+    return true;
+}
+
+bool IoUring::prepareRecvMultishot(int fd, IoUringHandler* handler, int op) {
+    struct io_uring_sqe* sqe = getSqe(handler, op);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IO_URING_BUFFER_GROUP;
+
+    return true;
+}
+
+bool IoUring::prepareSend(int fd, const void* data, size_t len, IoUringHandler* handler, int op) {
+    struct io_uring_sqe* sqe = getSqe(handler, op);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+    return true;
+}
+
+bool IoUring::prepareCancel(int fd) {
+    // The cancel request itself has no handler, its completion is dropped.
+    struct io_uring_sqe* sqe = getSqe(NULL, 0);
+    if (sqe == NULL) {
+        return false;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+
+    return true;
+}
+
+void IoUring::deferSubmit(IoUringHandler* handler) {
+    submit_handlers_.push_back(handler);
+    scheduleSubmit();
+}
+
+void IoUring::waitUntil(const std::function<bool()>& done) {
+    assert(event_loop_->threadSafety());
+
+    while (!done()) {
+        submit(1);
+        reap();
+    }
+}
+
+const char* IoUring::getBuffer(uint32_t flags) const {
+    uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+    assert(bid < IO_URING_BUFFER_COUNT);
+
+    return buffers_.get() + static_cast<size_t>(bid) * IO_URING_BUFFER_SIZE;
+}
+
+void IoUring::recycleBuffer(uint32_t flags) {
+    addBuffer(static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT));
+}
+
+void IoUring::addBuffer(uint16_t bid) {
+    /*
+     * The bufs of the uapi struct is a flexible array wrapped by an empty struct, the empty struct takes
+     * space in C++, so index the ring memory directly, the tail overlays the resv of the first buf.
+     */
+    struct io_uring_buf* bufs = reinterpret_cast<struct io_uring_buf*>(buf_ring_);
+    struct io_uring_buf* buf = &bufs[buf_tail_ & (IO_URING_BUFFER_COUNT - 1)];
+    buf->addr = reinterpret_cast<uint64_t>(buffers_.get() + static_cast<size_t>(bid) * IO_URING_BUFFER_SIZE);
+    buf->len = IO_URING_BUFFER_SIZE;
+    buf->bid = bid;
+
+    // The kernel sees the buffer once the tail published.
+    ++ buf_tail_;
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* IoUring::getSqe(IoUringHandler* handler, int op) {
+    assert(event_loop_->threadSafety());
+    assert((op & ~IO_URING_OP_MASK) == 0);
+    assert((reinterpret_cast<uint64_t>(handler) & IO_URING_OP_MASK) == 0);
+
+    if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        // More requests than the sq in one iteration, submit the prepared ones early.
+        submit(0);
+
+        if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            LOG(ERROR) << "[IoUring] the submission queue is full";
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+    ++ sqe_tail_;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = handler ? (reinterpret_cast<uint64_t>(handler) | static_cast<uint64_t>(op)) : 0;
+
+    scheduleSubmit();
+
+    return sqe;
+}
+
+void IoUring::submit(unsigned int min_complete) {
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+    unsigned int to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && min_complete == 0) {
+        return;
+    }
+
+    int ret = ioUringEnter(ring_fd_, to_submit, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+    ++ enter_calls_;
+
+    if (ret < 0) {
+        // The requests not consumed are kept in the sq, submitted again next time.
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            LOG(ERROR) << "[IoUring] io_uring_enter failed: " << strerror(errno);
+        }
+
+        return;
+    }
+
+    submitted_requests_ += ret;
+}
+
+void IoUring::reap() {
+    /*
+     * The handler may reap again in place(e.g. waitUntil), so the cq head is read from the ring
+     * and advanced before the dispatch, each completion is dispatched exactly once.
+     */
+    for (;;) {
+        unsigned int head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            // The overflowed completions are kept by the kernel(IORING_FEAT_NODROP), flush them to the cq.
+            if ((__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) == 0) {
+                break;
+            }
+
+            ++ enter_calls_;
+            if (ioUringEnter(ring_fd_, 0, 0, IORING_ENTER_GETEVENTS) < 0) {
+                break;
+            }
+
+            continue;
+        }
+
+        struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+        uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        uint32_t flags = cqe->flags;
+
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        ++ completions_;
+
+        if (user_data == 0) {
+            continue;
+        }
+
+        IoUringHandler* handler = reinterpret_cast<IoUringHandler*>(user_data & ~static_cast<uint64_t>(IO_URING_OP_MASK));
+        handler->onCompletion(static_cast<int>(user_data & IO_URING_OP_MASK), res, flags);
+    }
+}
+
+void IoUring::scheduleSubmit() {
+    if (!submit_scheduled_) {
+        submit_scheduled_ = true;
+        event_active(submit_event_, EV_WRITE, 0);
+    }
+}
+
+void IoUring::submitHandle(int fd, short which, void* args) {
+    IoUring* io_uring = static_cast<IoUring*>(args);
+    assert(io_uring);
+
+    // The deferred handlers may defer again, the new ones are called in the same batch.
+    while (!io_uring->submit_handlers_.empty()) {
+        std::vector<IoUringHandler*> handlers;
+        handlers.swap(io_uring->submit_handlers_);
+
+        for (IoUringHandler* handler : handlers) {
+            handler->onSubmit();
+        }
+    }
+
+    io_uring->submit(0);
+
+    // Cleared after the submit, the requests prepared by the handlers above don't schedule again.
+    io_uring->submit_scheduled_ = false;
+}
+
+} /* end namespace atp */
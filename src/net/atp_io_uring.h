@@ -0,0 +1,191 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ATP_IO_URING_H__
+#define __ATP_IO_URING_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <memory>
+#include <vector>
+#include <functional>
+
+struct event;
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace atp {
+
+class EventLoop;
+class EventfdWatcher;
+
+typedef enum {
+    /* The libevent epoll readiness, each read and write is one syscall. */
+    IO_BACKEND_LIBEVENT     =   (0),
+
+    /* The io_uring completion, the requests of one loop iteration are submitted by one syscall. */
+    IO_BACKEND_IO_URING     =   (1),
+
+    /* The native epoll of the event loop, epoll_wait returns the channels directly without the libevent. */
+    IO_BACKEND_EPOLL        =   (2)
+} IOBackend;
+
+/*
+ * The owner of the io_uring requests, the completion is dispatched to it with the op given at prepare.
+ * The handler must be alive until the last completion of its requests, the one without IORING_CQE_F_MORE.
+ */
+class IoUringHandler {
+public:
+    virtual ~IoUringHandler() {}
+
+    /* The res and flags of the cqe, res is the negative errno on error. */
+    virtual void onCompletion(int op, int res, uint32_t flags) = 0;
+
+    /* Called right before the batch submitted, requested by IoUring::deferSubmit. */
+    virtual void onSubmit() {}
+};
+
+/*
+ * The io_uring of one event loop. The libevent still waits for the events, the ring completions
+ * are signalled by an eventfd registered to the ring, and the requests prepared in one loop
+ * iteration are submitted together by one io_uring_enter at the end of the iteration.
+ *
+ * The multishot recv selects the buffers from the provided buffer ring of the event loop, the
+ * handler copies the data and gives the buffer back by recycleBuffer.
+ *
+ * It is created by EventLoop::getIoUring, all the functions must be called in the event loop thread.
+ */
+class IoUring {
+public:
+    explicit IoUring(EventLoop* event_loop);
+
+    ~IoUring();
+
+public:
+    /* Setup the ring, the provided buffers and the eventfd, false if the kernel doesn't support. */
+    bool init();
+
+    /* Accept connections until canceled, the res of each completion is the nonblocking fd. */
+    bool prepareAcceptMultishot(int fd, IoUringHandler* handler, int op);
+
+    /* Receive to the provided buffers until canceled, EOF or the buffers ran out. */
+    bool prepareRecvMultishot(int fd, IoUringHandler* handler, int op);
+
+    /* The data must not be changed until the completion. */
+    bool prepareSend(int fd, const void* data, size_t len, IoUringHandler* handler, int op);
+
+    /* Cancel all the requests of the fd, they complete with -ECANCELED. */
+    bool prepareCancel(int fd);
+
+    /* Call the handler onSubmit before the batch submitted, the handler defers again only after it is called. */
+    void deferSubmit(IoUringHandler* handler);
+
+    /* Submit and wait the completions in place until the done returns true, for the synchronous cancel. */
+    void waitUntil(const std::function<bool()>& done);
+
+    /* The data of the recv completion with IORING_CQE_F_BUFFER. */
+    const char* getBuffer(uint32_t flags) const;
+
+    /* Give the buffer of the recv completion back to the provided buffer ring. */
+    void recycleBuffer(uint32_t flags);
+
+public:
+    /* The io_uring_enter calls, the prepared requests and the reaped completions, for the benchmark. */
+    uint64_t getEnterCalls() const {
+        return enter_calls_;
+    }
+
+    uint64_t getSubmittedRequests() const {
+        return submitted_requests_;
+    }
+
+    uint64_t getCompletions() const {
+        return completions_;
+    }
+
+private:
+    struct io_uring_sqe* getSqe(IoUringHandler* handler, int op);
+
+    void addBuffer(uint16_t bid);
+
+    void submit(unsigned int min_complete);
+
+    void reap();
+
+    void scheduleSubmit();
+
+    static void submitHandle(int fd, short which, void* args);
+
+private:
+    EventLoop* event_loop_;
+
+    int ring_fd_;
+
+    // The mmapped rings, the sq and cq share one mapping(IORING_FEAT_SINGLE_MMAP).
+    void* ring_ptr_;
+    size_t ring_size_;
+
+    struct io_uring_sqe* sqes_;
+    size_t sqes_size_;
+
+    unsigned int* sq_head_;
+    unsigned int* sq_tail_;
+    unsigned int* sq_flags_;
+    unsigned int sq_mask_;
+    unsigned int sq_entries_;
+
+    unsigned int* cq_head_;
+    unsigned int* cq_tail_;
+    unsigned int cq_mask_;
+    struct io_uring_cqe* cqes_;
+
+    // The sq tail of the prepared requests, published to the kernel at submit.
+    unsigned int sqe_tail_;
+
+    // The provided buffer ring and the buffers, the bid is the buffer index.
+    struct io_uring_buf_ring* buf_ring_;
+    size_t buf_ring_size_;
+    std::unique_ptr<char[]> buffers_;
+    uint16_t buf_tail_;
+
+    // Signalled by the kernel when the completions posted.
+    std::unique_ptr<EventfdWatcher> event_watcher_;
+
+    // Activated by the first request of one loop iteration, runs after the other callbacks of the iteration.
+    struct event* submit_event_;
+    bool submit_scheduled_;
+
+    std::vector<IoUringHandler*> submit_handlers_;
+
+    uint64_t enter_calls_;
+    uint64_t submitted_requests_;
+    uint64_t completions_;
+};
+
+} /* end namespace atp */
+
+#endif /* __ATP_IO_URING_H__ */
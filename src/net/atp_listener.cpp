@@ -23,15 +23,19 @@
  * SOFTWARE.
  */
 
+#include <linux/io_uring.h>
+
 #include "net/atp_config.h"
 #include "net/atp_channel.h"
+#include "net/atp_libevent.h"
 #include "net/atp_listener.h"
 #include "net/atp_event_loop.h"
 
 namespace atp {
 
 Listener::Listener(EventLoop* event_loop, const std::string& address, unsigned int port)
-    : event_loop_(event_loop), listen_fd_(-1) {
+    : event_loop_(event_loop), listen_fd_(-1), io_backend_(IO_BACKEND_LIBEVENT), io_uring_(nullptr),
+      uring_accepting_(false), uring_stopped_(false), socket_busy_poll_us_(0) {
     address_.host_ = address;
     address_.port_ = port;
 }
@@ -62,16 +66,47 @@ void Listener::accept() {
     channel_.reset(new Channel(event_loop_, listen_fd_, true, false));
     channel_->setReadCallback(std::bind(&Listener::acceptHandle, this));
 
+    /* The listening fd shared by several native epoll loops wakes only one of them for each connection. */
+    channel_->setExclusive(true);
+
     /* Attach listen channel event to owner event loop. */
-    event_loop_->sendToQueue(std::bind(&Channel::attachToEventLoop, channel_.get()));
+    event_loop_->sendToQueue(std::bind(&Listener::attachToEventLoop, this));
 }
 
 void Listener::stop() {
     assert(event_loop_->threadSafety());
+
+    if (io_uring_) {
+        /*
+         * The listener may be destroyed right after stopped, wait the accept request canceled
+         * in place, its completion never comes after that.
+         */
+        uring_stopped_ = true;
+        if (uring_accepting_ && io_uring_->prepareCancel(listen_fd_)) {
+            io_uring_->waitUntil([this]() { return !uring_accepting_; });
+        }
+    }
+
     channel_->disableAllEvents();
     channel_->close();
 }
 
+void Listener::attachToEventLoop() {
+    if (io_backend_ == IO_BACKEND_IO_URING) {
+        io_uring_ = event_loop_->getIoUring();
+    }
+
+    if (!io_uring_) {
+        channel_->attachToEventLoop();
+        return;
+    }
+
+    uring_accepting_ = io_uring_->prepareAcceptMultishot(listen_fd_, this, 0);
+    if (!uring_accepting_) {
+        LOG(ERROR) << "[Listener] prepare the multishot accept failed";
+    }
+}
+
 void Listener::acceptHandle() {
     assert(event_loop_->threadSafety());
 
@@ -89,11 +124,51 @@ void Listener::acceptHandle() {
         LOG(INFO) << "[Listener] acceptHandle listener accept fd thread id: " << std::this_thread::get_id();
     }
 
-	// TCP_NODELAY and TCP_QUICKACK are need to used together.
     setOption(conn_fd, O_NONBLOCK, 1);
+    newConnection(conn_fd, remote_address);
+}
+
+void Listener::onCompletion(int op, int res, uint32_t flags) {
+    assert(event_loop_->threadSafety());
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        uring_accepting_ = false;
+    }
+
+    if (res >= 0) {
+        // The multishot accept shares one address buffer for all the completions, get the peer of each fd.
+        char buf[INET_ADDRSTRLEN] = {0};
+        struct sockaddr_in raddr;
+        socklen_t addr_len = sizeof(raddr);
+        if (getpeername(res, reinterpret_cast<struct sockaddr*>(&raddr), &addr_len) == 0) {
+            inet_ntop(raddr.sin_family, &raddr.sin_addr, buf, sizeof(buf));
+        }
+
+        if (uring_stopped_) {
+            ::close(res);
+        } else {
+            std::string remote_address(buf);
+            newConnection(res, remote_address);
+        }
+    } else if (res != -ECANCELED && !EVUTIL_ERR_ACCEPT_RETRIABLE(-res)) {
+        LOG(ERROR) << "[Listener] multishot accept connection met error: " << strerror(-res);
+    }
+
+    // The kernel stops the multishot accept on error(e.g. EMFILE), start it again.
+    if (!uring_accepting_ && !uring_stopped_) {
+        uring_accepting_ = io_uring_->prepareAcceptMultishot(listen_fd_, this, 0);
+    }
+}
+
+void Listener::newConnection(int conn_fd, std::string& remote_address) {
+	// TCP_NODELAY and TCP_QUICKACK are need to used together.
     setOption(conn_fd, TCP_NODELAY, 1);
     setOption(conn_fd, TCP_QUICKACK, 1);
 
+    if (socket_busy_poll_us_ > 0) {
+        setOption(conn_fd, SO_BUSY_POLL, socket_busy_poll_us_);
+    }
+
     // Notify application layer accept a new connectoin.
     if (new_conn_cb_) {
         new_conn_cb_(conn_fd, remote_address, NULL);
@@ -30,6 +30,7 @@
 #include <functional>
 
 #include "net/atp_socket.h"
+#include "net/atp_io_uring.h"
 #include "app/atp_uuid.h"
 
 namespace atp {
@@ -37,7 +38,7 @@ namespace atp {
 class Channel;
 class EventLoop;
 
-class Listener : public SocketImpl {
+class Listener : public SocketImpl, public IoUringHandler {
 public:
     using NewConnCallbackPtr = std::function<void(int fd, std::string& taddr, void* args)>;
 
@@ -57,9 +58,26 @@ public:
         new_conn_cb_ = cb;
     }
 
+    /* Must be set before accept, the IO_BACKEND_IO_URING accepts by one multishot accept request. */
+    void setIOBackend(IOBackend backend) {
+        io_backend_ = backend;
+    }
+
+    /* The SO_BUSY_POLL us of the accepted sockets, 0 doesn't set it. */
+    void setSocketBusyPoll(int busy_poll_us) {
+        socket_busy_poll_us_ = busy_poll_us;
+    }
+
 private:
     void acceptHandle();
 
+    void attachToEventLoop();
+
+    void newConnection(int conn_fd, std::string& remote_address);
+
+    /* The multishot accept completion, res is the accepted fd. */
+    void onCompletion(int op, int res, uint32_t flags) override;
+
 private:
     EventLoop* event_loop_;
     int listen_fd_;
@@ -74,6 +92,18 @@ private:
 
     // The variable fn_ will be set by function setNewConnCallback.
     NewConnCallbackPtr new_conn_cb_;
+
+    IOBackend io_backend_;
+
+    // The io_uring of the event loop, nullptr if the listener uses the libevent.
+    IoUring* io_uring_;
+
+    // The multishot accept request not completed.
+    bool uring_accepting_;
+
+    bool uring_stopped_;
+
+    int socket_busy_poll_us_;
 };
 
 } /* end namespace atp */
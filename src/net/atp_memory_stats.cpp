@@ -0,0 +1,236 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include "net/atp_memory_stats.h"
+
+namespace atp {
+
+namespace {
+
+struct Registry {
+    std::mutex mutex_;
+
+    // In the registration order.
+    std::vector<MemoryStats*> stats_;
+};
+
+// Never destroyed, the static MemoryStats may unregister after the other statics destroyed.
+Registry& getRegistry() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+void updateHighWater(std::atomic<int64_t>& high_water, int64_t value) {
+    int64_t current = high_water.load(std::memory_order_relaxed);
+    while (value > current && !high_water.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void appendUsageText(std::string& out, const std::string& name, MemoryCategory category, const MemoryUsage& usage) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s %s bytes: %lld objects: %lld high water bytes: %lld objects: %lld\n",
+        name.c_str(), MemoryStats::getCategoryName(category),
+        static_cast<long long>(usage.bytes_), static_cast<long long>(usage.objects_),
+        static_cast<long long>(usage.high_water_bytes_), static_cast<long long>(usage.high_water_objects_));
+    out.append(line);
+}
+
+void appendUsageJson(std::string& out, MemoryCategory category, const MemoryUsage& usage) {
+    char field[256];
+    snprintf(field, sizeof(field),
+        "\"%s\":{\"bytes\":%lld,\"objects\":%lld,\"high_water_bytes\":%lld,\"high_water_objects\":%lld}",
+        MemoryStats::getCategoryName(category),
+        static_cast<long long>(usage.bytes_), static_cast<long long>(usage.objects_),
+        static_cast<long long>(usage.high_water_bytes_), static_cast<long long>(usage.high_water_objects_));
+    out.append(field);
+}
+
+std::string escapeJson(const std::string& str) {
+    std::string out;
+    for (size_t i = 0; i < str.size(); ++ i) {
+        unsigned char c = static_cast<unsigned char>(str[i]);
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out.append(escaped);
+        } else {
+            out.push_back(c);
+        }
+    }
+
+    return out;
+}
+
+} /* end namespace */
+
+MemoryStats::MemoryStats(const std::string& name)
+    : name_(name) {
+    for (int i = 0; i < MEMORY_CATEGORY_SIZE; ++ i) {
+        counters_[i].bytes_ = 0;
+        counters_[i].objects_ = 0;
+        counters_[i].high_water_bytes_ = 0;
+        counters_[i].high_water_objects_ = 0;
+    }
+
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    registry.stats_.push_back(this);
+}
+
+MemoryStats::~MemoryStats() {
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    registry.stats_.erase(std::find(registry.stats_.begin(), registry.stats_.end(), this));
+}
+
+void MemoryStats::add(MemoryCategory category, int64_t bytes, int64_t objects) {
+    Counter& counter = counters_[category];
+
+    if (bytes != 0) {
+        int64_t value = counter.bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        updateHighWater(counter.high_water_bytes_, value);
+    }
+
+    if (objects != 0) {
+        int64_t value = counter.objects_.fetch_add(objects, std::memory_order_relaxed) + objects;
+        updateHighWater(counter.high_water_objects_, value);
+    }
+}
+
+MemoryUsage MemoryStats::get(MemoryCategory category) const {
+    const Counter& counter = counters_[category];
+
+    MemoryUsage usage;
+    usage.bytes_ = counter.bytes_.load(std::memory_order_relaxed);
+    usage.objects_ = counter.objects_.load(std::memory_order_relaxed);
+    usage.high_water_bytes_ = counter.high_water_bytes_.load(std::memory_order_relaxed);
+    usage.high_water_objects_ = counter.high_water_objects_.load(std::memory_order_relaxed);
+
+    return usage;
+}
+
+const char* MemoryStats::getCategoryName(MemoryCategory category) {
+    switch (category) {
+    case MEMORY_READ_BUFFER:
+        return "read_buffer";
+    case MEMORY_WRITE_BUFFER:
+        return "write_buffer";
+    case MEMORY_POOL:
+        return "pool";
+    case MEMORY_PENDING_TASK:
+        return "pending_task";
+    case MEMORY_RPC_CALL:
+        return "rpc_call";
+    default:
+        return "unknown";
+    }
+}
+
+MemoryUsage MemoryStats::getTotal(MemoryCategory category) {
+    MemoryUsage total = {0, 0, 0, 0};
+
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex_);
+    for (MemoryStats* stats : registry.stats_) {
+        MemoryUsage usage = stats->get(category);
+        total.bytes_ += usage.bytes_;
+        total.objects_ += usage.objects_;
+        total.high_water_bytes_ += usage.high_water_bytes_;
+        total.high_water_objects_ += usage.high_water_objects_;
+    }
+
+    return total;
+}
+
+std::string MemoryStats::dumpText() {
+    std::string out;
+
+    {
+        Registry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex_);
+        for (MemoryStats* stats : registry.stats_) {
+            for (int i = 0; i < MEMORY_CATEGORY_SIZE; ++ i) {
+                MemoryCategory category = static_cast<MemoryCategory>(i);
+                appendUsageText(out, stats->getName(), category, stats->get(category));
+            }
+        }
+    }
+
+    for (int i = 0; i < MEMORY_CATEGORY_SIZE; ++ i) {
+        MemoryCategory category = static_cast<MemoryCategory>(i);
+        appendUsageText(out, "total", category, getTotal(category));
+    }
+
+    return out;
+}
+
+std::string MemoryStats::dumpJson() {
+    std::string out("{\"owners\":[");
+
+    {
+        Registry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex_);
+
+        bool first = true;
+        for (MemoryStats* stats : registry.stats_) {
+            out.append(first ? "{\"name\":\"" : ",{\"name\":\"");
+            out.append(escapeJson(stats->getName()));
+            out.append("\"");
+
+            for (int i = 0; i < MEMORY_CATEGORY_SIZE; ++ i) {
+                MemoryCategory category = static_cast<MemoryCategory>(i);
+                out.append(",");
+                appendUsageJson(out, category, stats->get(category));
+            }
+
+            out.append("}");
+            first = false;
+        }
+    }
+
+    out.append("],\"total\":{");
+    for (int i = 0; i < MEMORY_CATEGORY_SIZE; ++ i) {
+        MemoryCategory category = static_cast<MemoryCategory>(i);
+        if (i > 0) {
+            out.append(",");
+        }
+
+        appendUsageJson(out, category, getTotal(category));
+    }
+
+    out.append("}}");
+
+    return out;
+}
+
+} /* end namespace atp */
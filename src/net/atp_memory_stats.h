@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ATP_MEMORY_STATS_H__
+#define __ATP_MEMORY_STATS_H__
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+namespace atp {
+
+typedef enum {
+    /* The connection read buffer capacity. */
+    MEMORY_READ_BUFFER      =   (0),
+
+    /* The connection write buffer capacity. */
+    MEMORY_WRITE_BUFFER     =   (1),
+
+    /* The memory pool chunks held by the connection arena. */
+    MEMORY_POOL             =   (2),
+
+    /* The tasks queued to the event loop and not executed yet. */
+    MEMORY_PENDING_TASK     =   (3),
+
+    /* The rpc calls outstanding on the client and inflight on the server. */
+    MEMORY_RPC_CALL         =   (4),
+
+    MEMORY_CATEGORY_SIZE    =   (5)
+} MemoryCategory;
+
+struct MemoryUsage {
+    int64_t bytes_;
+    int64_t objects_;
+
+    // The max bytes and objects ever reached.
+    int64_t high_water_bytes_;
+    int64_t high_water_objects_;
+};
+
+/*
+ * The live memory counters of one owner(the event loop), each category counts the bytes and the objects
+ * and keeps their high water marks. The counters are atomic, so they can be updated by any thread and
+ * queried at any time without stopping the owner.
+ *
+ * All the MemoryStats alive are registered, getTotal sums them up and dumpText/dumpJson print each of
+ * them and the total. The total high water mark is the sum of each owner high water mark, it is an
+ * upper bound, the owners may reach their peaks at different times.
+ */
+class MemoryStats {
+public:
+    explicit MemoryStats(const std::string& name);
+
+    ~MemoryStats();
+
+    MemoryStats(const MemoryStats&) = delete;
+
+    MemoryStats& operator=(const MemoryStats&) = delete;
+
+public:
+    /* Add the bytes and objects to the category, negative to release. */
+    void add(MemoryCategory category, int64_t bytes, int64_t objects);
+
+    MemoryUsage get(MemoryCategory category) const;
+
+    const std::string& getName() const {
+        return name_;
+    }
+
+public:
+    static const char* getCategoryName(MemoryCategory category);
+
+    /* The category usage summed up over all the registered MemoryStats. */
+    static MemoryUsage getTotal(MemoryCategory category);
+
+    /* One line per owner and category, then the total. */
+    static std::string dumpText();
+
+    /* {"owners":[{"name":...,"read_buffer":{...},...}],"total":{...}} */
+    static std::string dumpJson();
+
+private:
+    struct Counter {
+        std::atomic<int64_t> bytes_;
+        std::atomic<int64_t> objects_;
+        std::atomic<int64_t> high_water_bytes_;
+        std::atomic<int64_t> high_water_objects_;
+    };
+
+    std::string name_;
+
+    Counter counters_[MEMORY_CATEGORY_SIZE];
+};
+
+} /* end namespace atp */
+
+#endif /* __ATP_MEMORY_STATS_H__ */
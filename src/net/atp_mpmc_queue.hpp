@@ -0,0 +1,175 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ATP_MPMC_QUEUE_HPP__
+#define __ATP_MPMC_QUEUE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace atp {
+
+/*
+ * The bounded lock free multi producer multi consumer queue(Dmitry Vyukov), each cell has a sequence
+ * number tells the producers and consumers whether it is ready to write or read, so the producers and
+ * the consumers only contend on their own position with one CAS.
+ *
+ * The capacity is rounded up to the power of 2, push returns false when full and pop returns false
+ * when empty, they never block.
+ */
+template <typename T>
+class MPMCQueue {
+public:
+    explicit MPMCQueue(size_t capacity) {
+        capacity_ = 2;
+        while (capacity_ < capacity) {
+            capacity_ <<= 1;
+        }
+
+        mask_ = capacity_ - 1;
+        cells_.reset(new Cell[capacity_]);
+        for (size_t i = 0; i < capacity_; ++ i) {
+            cells_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+
+        enqueue_pos_.store(0, std::memory_order_relaxed);
+        dequeue_pos_.store(0, std::memory_order_relaxed);
+    }
+
+    ~MPMCQueue() {
+
+    }
+
+    MPMCQueue(const MPMCQueue&) = delete;
+
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+public:
+    template <typename U>
+    bool push(U&& data) {
+        Cell* cell = NULL;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+        for (; ;) {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The cell is still not read since the last round, the queue is full.
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data_ = std::forward<U>(data);
+        cell->sequence_.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool pop(T* data) {
+        Cell* cell = NULL;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+        for (; ;) {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence_.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // The cell is still not written, the queue is empty.
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        *data = std::move(cell->data_);
+        cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    /* The elements popped since created, for the consumer throughput. */
+    size_t popCount() const {
+        return dequeue_pos_.load(std::memory_order_relaxed);
+    }
+
+    /* The approximate size, the concurrent push and pop may be not counted. */
+    size_t size() const {
+        size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence_;
+        T data_;
+    };
+
+    // Keep the producers and the consumers position in the different cache lines.
+    static const size_t kCacheLineSize = 64;
+
+    size_t capacity_;
+
+    size_t mask_;
+
+    std::unique_ptr<Cell[]> cells_;
+
+    char padding0_[kCacheLineSize];
+
+    std::atomic<size_t> enqueue_pos_;
+
+    char padding1_[kCacheLineSize - sizeof(std::atomic<size_t>)];
+
+    std::atomic<size_t> dequeue_pos_;
+
+    char padding2_[kCacheLineSize - sizeof(std::atomic<size_t>)];
+};
+
+} /* end namespace atp */
+
+#endif /* __ATP_MPMC_QUEUE_HPP__ */
@@ -0,0 +1,372 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ATP_OBJECT_POOL_HPP__
+#define __ATP_OBJECT_POOL_HPP__
+
+#include <stddef.h>
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+#include "net/atp_config.h"
+
+namespace atp {
+
+struct ObjectPoolStats {
+    // The objects allocated and freed by the pool.
+    size_t allocs_;
+    size_t frees_;
+
+    // The objects freed by the thread other than the allocating one.
+    size_t remote_frees_;
+
+    // The blocks allocated and freed by operator new/delete, the others are recycled.
+    size_t news_;
+    size_t deletes_;
+
+    // The thread shards created, a shard of an exited thread is reused by the next thread.
+    size_t shards_;
+};
+
+template <typename T, typename Owner>
+class ObjectPoolAllocator;
+
+/*
+ * The typed object pool, each thread allocates from and frees to its own shard free list without lock.
+ * The object freed by another thread is pushed to the owner shard remote free list by CAS, the owner
+ * takes the whole remote list when its free list is empty. The shard of an exited thread is kept with
+ * its free objects and adopted by the next new thread, so the remote frees to it are never lost.
+ *
+ * ObjectPool<T>::allocate returns the raw storage of T, create/destroy construct and destruct it,
+ * makeShared allocates the object and the shared_ptr control block together as one block from the pool
+ * of the control block type, getSharedStats returns its stats.
+ */
+template <typename T>
+class ObjectPool {
+public:
+    static_assert(alignof(T) <= alignof(max_align_t), "The over aligned type is not supported");
+
+    static void* allocate() {
+        ThreadLocal& local = getThreadLocal();
+
+        // The thread is exiting, its shard already released, borrow a shard for this allocation.
+        if (local.exited_) {
+            Shard* shard = acquireShard();
+            void* mem = allocateFrom(shard);
+            releaseShard(shard);
+            return mem;
+        }
+
+        if (!local.shard_) {
+            local.shard_ = acquireShard();
+        }
+
+        return allocateFrom(local.shard_);
+    }
+
+    static void deallocate(void* mem) {
+        if (!mem) {
+            return;
+        }
+
+        Block* block = reinterpret_cast<Block*>(static_cast<unsigned char*>(mem) - offsetof(Block, storage_));
+        Shard* shard = block->owner_;
+
+        shard->frees_.fetch_add(1, std::memory_order_relaxed);
+
+        ThreadLocal& local = getThreadLocal();
+        if (!local.exited_ && local.shard_ == shard) {
+            if (shard->free_count_ >= OBJECT_POOL_MAX_FREE_OBJECTS) {
+                shard->deletes_.fetch_add(1, std::memory_order_relaxed);
+                ::operator delete(block);
+                return;
+            }
+
+            block->next_ = shard->free_list_;
+            shard->free_list_ = block;
+            ++ shard->free_count_;
+            return;
+        }
+
+        // The lock free push, only the owner pops by exchanging the whole list, so no ABA problem.
+        shard->remote_frees_.fetch_add(1, std::memory_order_relaxed);
+
+        Block* head = shard->remote_free_.load(std::memory_order_relaxed);
+        do {
+            block->next_ = head;
+        } while (!shard->remote_free_.compare_exchange_weak(head, block,
+                    std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    template <typename... Args>
+    static T* create(Args&&... args) {
+        void* mem = allocate();
+        try {
+            return ::new (mem) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(mem);
+            throw;
+        }
+    }
+
+    static void destroy(T* object) {
+        if (object) {
+            object->~T();
+            deallocate(object);
+        }
+    }
+
+    template <typename... Args>
+    static std::shared_ptr<T> makeShared(Args&&... args);
+
+    static ObjectPoolStats getStats() {
+        ObjectPoolStats stats = ObjectPoolStats();
+
+        Global& global = getGlobal();
+        std::lock_guard<std::mutex> lock(global.mutex_);
+
+        for (Shard* shard : global.shards_) {
+            stats.allocs_ += shard->allocs_.load(std::memory_order_relaxed);
+            stats.frees_ += shard->frees_.load(std::memory_order_relaxed);
+            stats.remote_frees_ += shard->remote_frees_.load(std::memory_order_relaxed);
+            stats.news_ += shard->news_.load(std::memory_order_relaxed);
+            stats.deletes_ += shard->deletes_.load(std::memory_order_relaxed);
+        }
+
+        stats.shards_ = global.shards_.size();
+
+        return stats;
+    }
+
+    static ObjectPoolStats getSharedStats() {
+        StatsFunction fn = getSharedStatsFunction().load(std::memory_order_acquire);
+        return fn ? fn() : ObjectPoolStats();
+    }
+
+private:
+    template <typename U, typename Owner>
+    friend class ObjectPoolAllocator;
+
+    typedef ObjectPoolStats (*StatsFunction)();
+
+    static std::atomic<StatsFunction>& getSharedStatsFunction() {
+        static std::atomic<StatsFunction> fn(nullptr);
+        return fn;
+    }
+
+    struct Shard;
+
+    struct Block {
+        Shard* owner_;
+        Block* next_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    };
+
+    struct Shard {
+        // Only touched by the owner thread.
+        Block* free_list_;
+        size_t free_count_;
+
+        std::atomic<Block*> remote_free_;
+
+        std::atomic<size_t> allocs_;
+        std::atomic<size_t> frees_;
+        std::atomic<size_t> remote_frees_;
+        std::atomic<size_t> news_;
+        std::atomic<size_t> deletes_;
+    };
+
+    struct Global {
+        std::mutex mutex_;
+
+        // All the shards ever created, the shards are never freed.
+        std::vector<Shard*> shards_;
+
+        // The shards of the exited threads.
+        std::vector<Shard*> orphans_;
+    };
+
+    struct ThreadLocal {
+        Shard* shard_;
+        bool exited_;
+
+        ThreadLocal() : shard_(nullptr), exited_(false) {}
+
+        ~ThreadLocal() {
+            exited_ = true;
+            if (shard_) {
+                releaseShard(shard_);
+                shard_ = nullptr;
+            }
+        }
+    };
+
+    static Global& getGlobal() {
+        // Never destroyed, the objects may be freed in the static destructors.
+        static Global* global = new Global();
+        return *global;
+    }
+
+    static ThreadLocal& getThreadLocal() {
+        static thread_local ThreadLocal local;
+        return local;
+    }
+
+    static Shard* acquireShard() {
+        Global& global = getGlobal();
+        std::lock_guard<std::mutex> lock(global.mutex_);
+
+        if (!global.orphans_.empty()) {
+            Shard* shard = global.orphans_.back();
+            global.orphans_.pop_back();
+            return shard;
+        }
+
+        Shard* shard = new Shard();
+        shard->free_list_ = nullptr;
+        shard->free_count_ = 0;
+        shard->remote_free_.store(nullptr);
+        global.shards_.push_back(shard);
+
+        return shard;
+    }
+
+    static void releaseShard(Shard* shard) {
+        Global& global = getGlobal();
+        std::lock_guard<std::mutex> lock(global.mutex_);
+        global.orphans_.push_back(shard);
+    }
+
+    static void* allocateFrom(Shard* shard) {
+        shard->allocs_.fetch_add(1, std::memory_order_relaxed);
+
+        if (!shard->free_list_) {
+            Block* head = shard->remote_free_.exchange(nullptr, std::memory_order_acquire);
+
+            size_t count = 0;
+            for (Block* block = head; block; block = block->next_) {
+                ++ count;
+            }
+
+            shard->free_list_ = head;
+            shard->free_count_ = count;
+        }
+
+        Block* block = shard->free_list_;
+        if (block) {
+            shard->free_list_ = block->next_;
+            -- shard->free_count_;
+        } else {
+            shard->news_.fetch_add(1, std::memory_order_relaxed);
+            block = static_cast<Block*>(::operator new(sizeof(Block)));
+            block->owner_ = shard;
+        }
+
+        return &block->storage_;
+    }
+};
+
+/*
+ * The STL allocator for std::allocate_shared, the single object allocation is from the ObjectPool of the
+ * rebound type, the Owner is kept by rebind and gets the stats of the rebound type pool.
+ */
+template <typename T, typename Owner = T>
+class ObjectPoolAllocator {
+public:
+    typedef T value_type;
+
+    ObjectPoolAllocator() {
+
+    }
+
+    template <typename U>
+    ObjectPoolAllocator(const ObjectPoolAllocator<U, Owner>&) {
+
+    }
+
+    T* allocate(size_t n) {
+        if (n == 1) {
+            auto& fn = ObjectPool<Owner>::getSharedStatsFunction();
+            if (!fn.load(std::memory_order_relaxed)) {
+                fn.store(&ObjectPool<T>::getStats, std::memory_order_release);
+            }
+
+            return static_cast<T*>(ObjectPool<T>::allocate());
+        }
+
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* mem, size_t n) {
+        if (n == 1) {
+            ObjectPool<T>::deallocate(mem);
+        } else {
+            ::operator delete(mem);
+        }
+    }
+};
+
+template <typename T, typename U, typename Owner>
+inline bool operator==(const ObjectPoolAllocator<T, Owner>&, const ObjectPoolAllocator<U, Owner>&) {
+    return true;
+}
+
+template <typename T, typename U, typename Owner>
+inline bool operator!=(const ObjectPoolAllocator<T, Owner>&, const ObjectPoolAllocator<U, Owner>&) {
+    return false;
+}
+
+template <typename T>
+template <typename... Args>
+std::shared_ptr<T> ObjectPool<T>::makeShared(Args&&... args) {
+    if (!ENABLED_OBJECT_POOL) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+
+    return std::allocate_shared<T>(ObjectPoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
+/*
+ * Recycle the objects created by new of the class, put it in the class body. The size differs from the
+ * class is the derived class, it uses the global new/delete. Use ::new for the placement new of the class.
+ */
+#define ATP_OBJECT_POOL_NEW_DELETE(T)                                                           \
+    static void* operator new(size_t size) {                                                    \
+        return (ENABLED_OBJECT_POOL && size == sizeof(T)) ?                                     \
+            ::atp::ObjectPool<T>::allocate() : ::operator new(size);                            \
+    }                                                                                           \
+    static void operator delete(void* mem, size_t size) {                                       \
+        (ENABLED_OBJECT_POOL && size == sizeof(T)) ?                                            \
+            ::atp::ObjectPool<T>::deallocate(mem) : ::operator delete(mem);                     \
+    }
+
+} /* end namespace atp */
+
+#endif /* __ATP_OBJECT_POOL_HPP__ */
@@ -95,6 +95,13 @@ void SocketImpl::setOption(int fd, int opt_id, int on) {
     case TCP_QUICKACK:
         setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &on, static_cast<socklen_t>(sizeof(on)));
         break;
+
+    // The on is the busy poll us of the socket receive, more than net.core.busy_read needs CAP_NET_ADMIN.
+    case SO_BUSY_POLL:
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &on, static_cast<socklen_t>(sizeof(on))) != 0) {
+            LOG(WARNING) << "setOption SO_BUSY_POLL failed: " << strerror(errno);
+        }
+        break;
 /*
     // TCP_DEFER_ACCEPT == SO_KEEPALIVE
     case SO_KEEPALIVE:
@@ -1,5 +1,14 @@
+#include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <linux/errqueue.h>
 
 #include "net/atp_config.h"
 #include "net/atp_channel.h"
@@ -7,10 +16,38 @@
 #include "net/atp_libevent.h"
 #include "net/atp_event_loop.h"
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
 namespace atp {
 
+// The io_uring requests of the connection.
+typedef enum {
+    URING_OP_RECV   =   (1),
+    URING_OP_SEND   =   (2)
+} ConnectionUringOp;
+
 Connection::Connection(EventLoop* event_loop, int fd, std::string id, std::string& remote_addr)
-    : event_loop_(event_loop), fd_(fd), id_(id), remote_addr_(remote_addr) {
+    : event_loop_(event_loop), fd_(fd), id_(id), remote_addr_(remote_addr),
+      send_buffer_(0, 0), zerocopy_threshold_(0), zerocopy_seq_(0), zerocopy_completed_(0),
+      zerocopy_bytes_(0), zerocopy_copied_(0), sending_queue_(false), read_buffer_accounted_(0), write_buffer_accounted_(0), pending_write_bytes_(0),
+      read_waiter_bytes_(0), io_backend_(IO_BACKEND_LIBEVENT), io_uring_(nullptr), cork_count_(0),
+      auto_cork_(ENABLED_AUTO_CORK), cork_flush_deferred_(false), uring_requests_(0),
+      uring_closed_(false), uring_sending_(false), uring_read_deferred_(false), uring_flush_deferred_(false),
+      uring_submit_deferred_(false) {
 
     /* Check the args is validity. */
     assert(event_loop_ != nullptr);
@@ -26,6 +63,12 @@ Connection::Connection(EventLoop* event_loop, int fd, std::string id, std::strin
     chan_->setReadCallback(std::bind(&Connection::netFdReadHandle, this));
     chan_->setWriteCallback(std::bind(&Connection::netFdWriteHandle, this));
 
+    MemoryStats& memory_stats = event_loop_->getMemoryStats();
+    memory_stats.add(MEMORY_READ_BUFFER, 0, 1);
+    memory_stats.add(MEMORY_WRITE_BUFFER, 0, 1);
+    arena_.setMemoryStats(&memory_stats);
+    updateMemoryStats();
+
     if (ATP_NET_DEBUG_ON) {
         LOG(INFO) << "[Connection] create connection: " << id_;
     }
@@ -35,6 +78,11 @@ Connection::~Connection() {
     ::close(fd_);
     fd_ = -1;
 
+    MemoryStats& memory_stats = event_loop_->getMemoryStats();
+    memory_stats.add(MEMORY_READ_BUFFER, -static_cast<int64_t>(read_buffer_accounted_), -1);
+    memory_stats.add(MEMORY_WRITE_BUFFER, -static_cast<int64_t>(write_buffer_accounted_), -1);
+    arena_.setMemoryStats(NULL);
+
     if (ATP_NET_DEBUG_ON) {
         LOG(INFO) << "[~Connection] destroy connection: " << id_;
     }
@@ -43,10 +91,19 @@ Connection::~Connection() {
 void Connection::attachToEventLoop() {
     assert(event_loop_->threadSafety());
 
+    if (io_backend_ == IO_BACKEND_IO_URING) {
+        io_uring_ = event_loop_->getIoUring();
+    }
+
     /*
      * Every connection attach to event loop default enable read event.
      */
-    chan_->enableEvents(true, false);
+    if (io_uring_) {
+        uring_self_ = shared_from_this();
+        uringRecv();
+    } else {
+        chan_->enableEvents(true, false);
+    }
 
     if (conn_fn_) {
         conn_fn_(shared_from_this());
@@ -58,36 +115,24 @@ void Connection::send(const void* data, size_t len) {
         return;
     }
 
-    auto fn = [&]() {
-        ssize_t nwrite = 0;
-        size_t remaining_data_size = len;
+    pending_write_bytes_.fetch_add(len, std::memory_order_relaxed);
 
-        /*
-         * If the write buffer unread bytes is not 0, it means had retransmissions data at last time.
-         * Need to make sure that send all the retransmissions data first, and then send this(data) data
-         * to make sure that write in order.
-         * The channel's writable is true only if retransmission data needs to be written.
-         */
-        if (!chan_->isWritable() && write_buffer_.unreadBytes() == 0) {
-            nwrite = ::send(fd_, static_cast<const char*>(data), len, MSG_NOSIGNAL);
-            if (nwrite >= 0) {
-                remaining_data_size -= nwrite;
-                if (remaining_data_size == 0 && write_complete_fn_) {
-                    write_complete_fn_(shared_from_this());
-                }
-            } else if (!EVUTIL_ERR_RW_RETRIABLE(errno)) {
-                netFdErrorHandle();
-            }
-        }
+    if (event_loop_->threadSafety()) {
+        sendInLoop(data, len);
+        return;
+    }
 
-        if (remaining_data_size > 0) {
-            ByteBufferedWriter writer(write_buffer_);
-            writer.append(static_cast<const char*>(data) + nwrite, remaining_data_size);
-            chan_->enableEvents(false, true);
-        }
+    /*
+     * Called from other thread(e.g. the rpc worker thread), the caller's data maybe released
+     * before the owner event loop handle it, so copy the data and hand back to the owner event loop.
+     */
+    auto self = shared_from_this();
+    std::string payload(static_cast<const char*>(data), len);
+    auto fn = [self, payload]() {
+        self->sendInLoop(payload.data(), payload.size());
     };
 
-    event_loop_->sendToQueue(fn);
+    event_loop_->sendToQueue(std::move(fn));
 }
 
 void Connection::send(ByteBuffer* buffer) {
@@ -101,66 +146,780 @@ void Connection::send(ByteBuffer* buffer) {
     send(reader.consume(len).void_type_data(), len);
 }
 
+void Connection::send(std::string&& data) {
+    if (data.empty()) {
+        return;
+    }
+
+    pending_write_bytes_.fetch_add(data.size(), std::memory_order_relaxed);
+
+    if (event_loop_->threadSafety()) {
+        sendZeroCopyInLoop(std::move(data));
+        return;
+    }
+
+    // The data is moved to the owner event loop, the std::function needs the copyable capture.
+    auto self = shared_from_this();
+    auto payload = std::make_shared<std::string>(std::move(data));
+    auto fn = [self, payload]() {
+        self->sendZeroCopyInLoop(std::move(*payload));
+    };
+
+    event_loop_->sendToQueue(std::move(fn));
+}
+
+bool Connection::enableZeroCopy(size_t threshold) {
+    assert(event_loop_->threadSafety());
+
+    if (io_backend_ == IO_BACKEND_IO_URING) {
+        LOG(ERROR) << "[Connection] zero copy is not supported by the io_uring backend: " << id_;
+        return false;
+    }
+
+    int on = 1;
+    if (setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+        LOG(ERROR) << "[Connection] set SO_ZEROCOPY failed: " << id_ << " errno: " << errno;
+        return false;
+    }
+
+    zerocopy_threshold_ = threshold > 0 ? threshold : 1;
+
+    return true;
+}
+
+void Connection::sendFile(int fd, off_t offset, size_t len, const SendFileCallback& cb) {
+    pending_write_bytes_.fetch_add(len, std::memory_order_relaxed);
+
+    if (event_loop_->threadSafety()) {
+        sendFileInLoop(fd, offset, len, cb);
+        return;
+    }
+
+    auto self = shared_from_this();
+    auto fn = [self, fd, offset, len, cb]() {
+        self->sendFileInLoop(fd, offset, len, cb);
+    };
+
+    event_loop_->sendToQueue(std::move(fn));
+}
+
+void Connection::cork() {
+    assert(event_loop_->threadSafety());
+
+    ++ cork_count_;
+}
+
+void Connection::uncork() {
+    assert(event_loop_->threadSafety());
+    assert(cork_count_ > 0);
+
+    if (-- cork_count_ == 0) {
+        flushCorked();
+    }
+}
+
 void Connection::close() {
     auto self = shared_from_this();
     auto fn = [self]() {
         assert(self->event_loop_->threadSafety());
-        self->netFdCloseHandle();
+
+        // The corked data was sent at once without the cork, the flush may close the connection by error.
+        self->flushCorked();
+        if (!self->isClosed()) {
+            self->netFdCloseHandle();
+        }
     };
 
     event_loop_->sendToQueue(fn);
 }
 
+bool Connection::waitForRead(size_t n, const std::function<void()>& fn) {
+    assert(event_loop_->threadSafety());
+    assert(!read_waiter_fn_);
+
+    if (isClosed() || (read_buffer_.unreadBytes() > 0 && read_buffer_.unreadBytes() >= n)) {
+        return false;
+    }
+
+    read_waiter_fn_ = fn;
+    read_waiter_bytes_ = n;
+
+    return true;
+}
+
+bool Connection::waitForWrite(const std::function<void()>& fn) {
+    assert(event_loop_->threadSafety());
+    assert(!write_waiter_fn_);
+
+    if (isClosed() || (write_buffer_.unreadBytes() == 0 && send_buffer_.unreadBytes() == 0 && send_queue_.empty())) {
+        return false;
+    }
+
+    write_waiter_fn_ = fn;
+
+    return true;
+}
+
+bool Connection::isClosed() const {
+    return io_uring_ ? uring_closed_ : !chan_->isAttached();
+}
+
+void Connection::sendInLoop(const void* data, size_t len) {
+    assert(event_loop_->threadSafety());
+
+    /* The connection already closed, the channel detached from event loop, the data counted by send is dropped. */
+    if (isClosed()) {
+        pending_write_bytes_.fetch_sub(len, std::memory_order_relaxed);
+        return;
+    }
+
+    /* The data of one loop iteration are sent together by one request when the iteration submits. */
+    if (io_uring_) {
+        ByteBufferedWriter writer(write_buffer_);
+        writer.append(static_cast<const char*>(data), len);
+        uringFlush();
+        updateMemoryStats();
+        return;
+    }
+
+    ssize_t nwrite = 0;
+    size_t remaining_data_size = len;
+    bool corked = auto_cork_ || cork_count_ > 0;
+
+    /*
+     * If the write buffer unread bytes is not 0, it means had retransmissions data at last time.
+     * Need to make sure that send all the retransmissions data first, and then send this(data) data
+     * to make sure that write in order.
+     * The channel's writable is true only if retransmission data needs to be written.
+     * The queued requests are sent before this data too, the channel isn't writable while waiting for the pipe.
+     * The corked data is buffered, except the large data nothing is corked before.
+     */
+    bool direct = !chan_->isWritable() && write_buffer_.unreadBytes() == 0 && send_queue_.empty() &&
+        (!corked || len >= CORK_FLUSH_SIZE);
+    if (direct) {
+        nwrite = ::send(fd_, static_cast<const char*>(data), len, MSG_NOSIGNAL);
+        if (nwrite >= 0) {
+            remaining_data_size -= nwrite;
+            pending_write_bytes_.fetch_sub(nwrite, std::memory_order_relaxed);
+            if (remaining_data_size == 0 && write_complete_fn_) {
+                write_complete_fn_(shared_from_this());
+            }
+        } else if (!EVUTIL_ERR_RW_RETRIABLE(errno)) {
+            pending_write_bytes_.fetch_sub(len, std::memory_order_relaxed);
+            netFdErrorHandle();
+            return;
+        } else {
+            nwrite = 0;
+        }
+    }
+
+    if (remaining_data_size > 0) {
+        ByteBufferedWriter writer(write_buffer_);
+        writer.append(static_cast<const char*>(data) + nwrite, remaining_data_size);
+
+        // Nothing is waiting for the writable, the corked data is sent by the flush or the uncork.
+        if (!direct && corked && !chan_->isWritable() && send_queue_.empty()) {
+            if (write_buffer_.unreadBytes() >= CORK_FLUSH_SIZE) {
+                netFdWriteHandle();
+            } else if (cork_count_ == 0) {
+                deferCorkFlush();
+            }
+        } else {
+            chan_->enableEvents(false, true);
+        }
+
+        updateMemoryStats();
+    }
+}
+
+void Connection::deferCorkFlush() {
+    if (!cork_flush_deferred_) {
+        cork_flush_deferred_ = true;
+        cork_self_ = shared_from_this();
+        event_loop_->runAtIterationEnd(std::bind(&Connection::corkFlushHandle, this));
+    }
+}
+
+void Connection::corkFlushHandle() {
+    // The connection may be released after the flush.
+    ConnectionPtr self;
+    self.swap(cork_self_);
+    cork_flush_deferred_ = false;
+
+    // Corked again by the later callbacks of the iteration, the uncork sends it.
+    if (cork_count_ == 0) {
+        flushCorked();
+    }
+}
+
+void Connection::flushCorked() {
+    if (!isClosed() && !io_uring_ && !chan_->isWritable() && send_queue_.empty() && write_buffer_.unreadBytes() > 0) {
+        netFdWriteHandle();
+    }
+}
+
+void Connection::sendFileInLoop(int fd, off_t offset, size_t len, const SendFileCallback& cb) {
+    assert(event_loop_->threadSafety());
+
+    // The io_uring sends the write buffer by its own requests, the file can't be ordered with them.
+    if (isClosed() || io_uring_ || len == 0) {
+        if (io_uring_) {
+            LOG(ERROR) << "[Connection] sendFile is not supported by the io_uring backend: " << id_;
+        }
+
+        pending_write_bytes_.fetch_sub(len, std::memory_order_relaxed);
+        if (cb) {
+            cb(shared_from_this(), !isClosed() && !io_uring_);
+        }
+
+        return;
+    }
+
+    SendRequest file;
+    file.fd_ = fd;
+    file.offset_ = offset;
+    file.remaining_ = len;
+    file.cb_ = cb;
+    file.zerocopy_sent_ = false;
+    file.last_seq_ = 0;
+
+    struct stat st;
+    file.pipe_ = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+
+    queueSendRequest(file);
+}
+
+void Connection::sendZeroCopyInLoop(std::string&& data) {
+    assert(event_loop_->threadSafety());
+
+    if (isClosed()) {
+        pending_write_bytes_.fetch_sub(data.size(), std::memory_order_relaxed);
+        return;
+    }
+
+    // The small data is copied to the kernel as the other sends, the io_uring never enables the zero copy.
+    if (zerocopy_threshold_ == 0 || data.size() < zerocopy_threshold_ || io_uring_) {
+        sendInLoop(data.data(), data.size());
+        return;
+    }
+
+    SendRequest request;
+    request.fd_ = -1;
+    request.offset_ = 0;
+    request.pipe_ = false;
+    request.remaining_ = data.size();
+    request.data_.reset(new std::string(std::move(data)));
+    request.zerocopy_sent_ = false;
+    request.last_seq_ = 0;
+
+    zerocopy_bytes_ += request.remaining_;
+    updateMemoryStats();
+
+    queueSendRequest(request);
+}
+
+void Connection::queueSendRequest(SendRequest& request) {
+    request.buffered_before_ = write_buffer_.unreadBytes();
+    for (const SendRequest& queued : send_queue_) {
+        request.buffered_before_ -= queued.buffered_before_;
+    }
+
+    send_queue_.push_back(std::move(request));
+
+    // Nothing is waiting, send it now, otherwise it is sent by the write handle in order.
+    if (send_queue_.size() == 1 && !chan_->isWritable() && !sending_queue_) {
+        netFdWriteHandle();
+    }
+}
+
+bool Connection::sendQueued() {
+    while (!send_queue_.empty()) {
+        SendRequest& file = send_queue_.front();
+
+        if (file.buffered_before_ > 0) {
+            ssize_t n = ::send(fd_, write_buffer_.data(), file.buffered_before_, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (EVUTIL_ERR_RW_RETRIABLE(errno)) {
+                    chan_->enableEvents(false, true);
+                } else {
+                    netFdErrorHandle();
+                }
+
+                return false;
+            }
+
+            ByteBufferedReader reader(write_buffer_);
+            reader.remove(n);
+            pending_write_bytes_.fetch_sub(n, std::memory_order_relaxed);
+
+            file.buffered_before_ -= n;
+            if (file.buffered_before_ > 0) {
+                chan_->enableEvents(false, true);
+                return false;
+            }
+        }
+
+        ssize_t n = 0;
+        if (file.data_) {
+            const char* data = file.data_->data() + file.data_->size() - file.remaining_;
+            n = ::send(fd_, data, file.remaining_, MSG_NOSIGNAL | MSG_ZEROCOPY);
+            if (n > 0) {
+                file.zerocopy_sent_ = true;
+                file.last_seq_ = zerocopy_seq_ ++;
+            } else if (n < 0 && errno == ENOBUFS) {
+                // The pinned pages over the optmem or the locked memory limit, copy this part.
+                n = ::send(fd_, data, file.remaining_, MSG_NOSIGNAL);
+            }
+        } else if (file.pipe_) {
+            n = splice(file.fd_, NULL, fd_, NULL, file.remaining_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } else {
+            n = sendfile(fd_, file.fd_, &file.offset_, file.remaining_);
+        }
+
+        if (n > 0) {
+            file.remaining_ -= n;
+            pending_write_bytes_.fetch_sub(n, std::memory_order_relaxed);
+            if (file.remaining_ == 0) {
+                finishSendRequest(true);
+                if (isClosed()) {
+                    return false;
+                }
+            }
+
+            continue;
+        }
+
+        // The end of the file or the pipe writer closed before len bytes.
+        if (n == 0) {
+            LOG(ERROR) << "[Connection] sendFile reached the end of fd " << file.fd_ << ", "
+                << file.remaining_ << " bytes not sent: " << id_;
+            finishSendRequest(false);
+            if (isClosed()) {
+                return false;
+            }
+
+            continue;
+        }
+
+        if (!EVUTIL_ERR_RW_RETRIABLE(errno)) {
+            netFdErrorHandle();
+            return false;
+        }
+
+        // The splice gets EAGAIN for both the empty pipe and the full socket.
+        int readable = 0;
+        if (file.pipe_ && ioctl(file.fd_, FIONREAD, &readable) == 0 && readable == 0) {
+            waitForPipe(file.fd_);
+        } else {
+            chan_->enableEvents(false, true);
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+void Connection::finishSendRequest(bool success) {
+    SendRequest file = std::move(send_queue_.front());
+    send_queue_.pop_front();
+
+    pending_write_bytes_.fetch_sub(file.remaining_, std::memory_order_relaxed);
+
+    // The data buffered before the failed file are sent before the next one.
+    if (!send_queue_.empty()) {
+        send_queue_.front().buffered_before_ += file.buffered_before_;
+    }
+
+    // The kernel may still read the data sent by MSG_ZEROCOPY, it is released by the completion.
+    if (file.data_) {
+        if (file.zerocopy_sent_) {
+            zerocopy_pending_.push_back({ file.last_seq_, std::move(file.data_) });
+        } else {
+            zerocopy_bytes_ -= file.data_->size();
+            updateMemoryStats();
+        }
+    }
+
+    if (file.cb_) {
+        file.cb_(shared_from_this(), success);
+    }
+}
+
+void Connection::waitForPipe(int fd) {
+    if (!pipe_chan_ || pipe_chan_->getInternalFd() != fd) {
+        if (pipe_chan_) {
+            pipe_chan_->close();
+        }
+
+        pipe_chan_.reset(new Channel(event_loop_, fd, false, false));
+        pipe_chan_->setReadCallback(std::bind(&Connection::pipeReadHandle, this));
+    }
+
+    chan_->disableEvents(false, true);
+    pipe_chan_->enableEvents(true, false);
+}
+
+void Connection::pipeReadHandle() {
+    // The channel is kept for the next wait, it can't be released in its own callback.
+    pipe_chan_->disableAllEvents();
+    netFdWriteHandle();
+}
+
+void Connection::updateMemoryStats() {
+    size_t read_caps = read_buffer_.getCaps();
+    size_t write_caps = write_buffer_.getCaps() + send_buffer_.getCaps() + zerocopy_bytes_;
+
+    // Only the buffer grown or shrunk is accounted, the buffers are the same size most of the time.
+    if (read_caps != read_buffer_accounted_) {
+        event_loop_->getMemoryStats().add(MEMORY_READ_BUFFER,
+            static_cast<int64_t>(read_caps) - static_cast<int64_t>(read_buffer_accounted_), 0);
+        read_buffer_accounted_ = read_caps;
+    }
+
+    if (write_caps != write_buffer_accounted_) {
+        event_loop_->getMemoryStats().add(MEMORY_WRITE_BUFFER,
+            static_cast<int64_t>(write_caps) - static_cast<int64_t>(write_buffer_accounted_), 0);
+        write_buffer_accounted_ = write_caps;
+    }
+}
+
+void Connection::notifyReadWaiter() {
+    if (read_waiter_fn_) {
+        // The waiter may wait again in the fn, clear it before the call.
+        std::function<void()> fn;
+        fn.swap(read_waiter_fn_);
+        fn();
+    }
+}
+
+void Connection::notifyWriteWaiter() {
+    if (write_waiter_fn_) {
+        std::function<void()> fn;
+        fn.swap(write_waiter_fn_);
+        fn();
+    }
+}
+
 void Connection::netFdReadHandle() {
+    // The zero copy completions in the error queue wake up the read event by EPOLLERR.
+    if (zerocopy_completed_ != zerocopy_seq_) {
+        zeroCopyCompleteHandle();
+    }
+
     ByteBufferedReader reader(read_buffer_);
     /*
      * Read data to ByteBuffer, only set the first parameter,
      * the second and third parameters are not supported.
      */
-    if (reader.readv(fd_, NULL, 0) <= 0) {
+    ssize_t n = reader.readv(fd_, NULL, 0);
+    if (n == RETRIABLE_ERROR) {
+        return;
+    }
+
+    if (n <= 0) {
         netFdErrorHandle();
         return;
     }
 
-    if (read_fn_) {
+    handleReadData();
+}
+
+void Connection::zeroCopyCompleteHandle() {
+    char control[128];
+
+    while (zerocopy_completed_ != zerocopy_seq_) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd_, &msg, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+
+            struct sock_extended_err* err = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cmsg));
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) {
+                continue;
+            }
+
+            // The sequences from ee_info to ee_data completed, the data sent by them can be released.
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zerocopy_copied_ += err->ee_data - err->ee_info + 1;
+            }
+
+            zerocopy_completed_ = err->ee_data + 1;
+
+            while (!zerocopy_pending_.empty() &&
+                static_cast<int32_t>(zerocopy_pending_.front().last_seq_ - err->ee_data) <= 0) {
+                zerocopy_bytes_ -= zerocopy_pending_.front().data_->size();
+                zerocopy_pending_.pop_front();
+            }
+        }
+    }
+
+    updateMemoryStats();
+}
+
+void Connection::handleReadData() {
+    if (read_waiter_fn_) {
+        // The coroutine owns the received data, it is resumed only when the data it wants arrived.
+        if (read_buffer_.unreadBytes() >= read_waiter_bytes_) {
+            notifyReadWaiter();
+        }
+    } else if (read_fn_) {
         read_fn_(shared_from_this(), read_buffer_);
     }
+
+    // The arena gives its block back to the pool helper, the idle connection holds no arena memory.
+    arena_.reset();
+
+    updateMemoryStats();
 }
 
 void Connection::netFdWriteHandle() {
     /*
      * The write callback only for send retransmissions data,
      * when the write data size > file description kernel buffer size.
+     * The queued files and the data before them are sent first, it is also called when the pipe readable.
      */
-    assert(chan_->isWritable());
+    if (!send_queue_.empty()) {
+        // The file cb may release the connection.
+        ConnectionPtr self = shared_from_this();
 
-    ssize_t n = ::send(fd_, write_buffer_.data(), write_buffer_.unreadBytes(), MSG_NOSIGNAL);
-    if (n > 0) {
-        ByteBufferedReader reader(write_buffer_);
-        reader.remove(n);
+        sending_queue_ = true;
+        bool drained = sendQueued();
+        sending_queue_ = false;
 
-        if (write_buffer_.unreadBytes() == 0) {
-            chan_->disableEvents(false, true);
-            if (write_complete_fn_) {
-                write_complete_fn_(shared_from_this());
-            }
+        if (!drained) {
+            return;
+        }
+    }
+
+    if (write_buffer_.unreadBytes() > 0) {
+        ssize_t n = ::send(fd_, write_buffer_.data(), write_buffer_.unreadBytes(), MSG_NOSIGNAL);
+        if (n > 0) {
+            ByteBufferedReader reader(write_buffer_);
+            reader.remove(n);
+            pending_write_bytes_.fetch_sub(n, std::memory_order_relaxed);
+        } else if (!EVUTIL_ERR_RW_RETRIABLE(errno)) {
+            netFdErrorHandle();
+            return;
         }
-    } else if (!EVUTIL_ERR_RW_RETRIABLE(errno)) {
-        netFdErrorHandle();
+    }
+
+    if (write_buffer_.unreadBytes() == 0) {
+        chan_->disableEvents(false, true);
+        updateMemoryStats();
+        if (write_complete_fn_) {
+            write_complete_fn_(shared_from_this());
+        }
+
+        notifyWriteWaiter();
+    } else {
+        chan_->enableEvents(false, true);
     }
 }
 
 void Connection::netFdCloseHandle() {
+    if (io_uring_) {
+        if (uring_closed_) {
+            return;
+        }
+
+        // The requests complete with -ECANCELED, the connection is released after the last one.
+        uring_closed_ = true;
+        if (uring_requests_ > 0) {
+            io_uring_->prepareCancel(fd_);
+        }
+    }
+
+    // The channel is never attached with the io_uring, but still owns the event memory.
     chan_->disableAllEvents();
     chan_->close();
 
+    if (pipe_chan_) {
+        pipe_chan_->disableAllEvents();
+        pipe_chan_->close();
+    }
+
+    // The queued requests are never sent, the callers get them back.
+    while (!send_queue_.empty()) {
+        finishSendRequest(false);
+    }
+
+    // Resume the waiting coroutines, they see the connection closed.
+    notifyReadWaiter();
+    notifyWriteWaiter();
+
     if (close_fn_) {
         close_fn_(shared_from_this());
     }
+
+    if (io_uring_ && uring_requests_ == 0 && !uring_submit_deferred_) {
+        uring_self_.reset();
+    }
 }
 
 void Connection::netFdErrorHandle() {
     netFdCloseHandle();
 }
 
+void Connection::onCompletion(int op, int res, uint32_t flags) {
+    // The uring_self_ may be the last reference, it is released after this call returned.
+    ConnectionPtr self = shared_from_this();
+
+    bool more = (flags & IORING_CQE_F_MORE) != 0;
+    if (!more) {
+        -- uring_requests_;
+    }
+
+    if (op == URING_OP_RECV) {
+        uringReadHandle(res, flags, more);
+    } else {
+        uringWriteHandle(res);
+    }
+
+    if (uring_closed_ && uring_requests_ == 0 && !uring_submit_deferred_) {
+        uring_self_.reset();
+    }
+}
+
+void Connection::onSubmit() {
+    ConnectionPtr self = shared_from_this();
+
+    // The data received by all the completions of this iteration is handled once, the same as one readv.
+    if (uring_read_deferred_) {
+        uring_read_deferred_ = false;
+        if (!uring_closed_) {
+            handleReadData();
+        }
+    }
+
+    // Cleared after the read handled, the data sent by the read callback goes with this request.
+    uring_submit_deferred_ = false;
+
+    if (uring_flush_deferred_ && !uring_closed_ && !uring_sending_) {
+        uring_flush_deferred_ = false;
+
+        // Send the data left by the short send first, then the data appended since the last request.
+        if (send_buffer_.unreadBytes() == 0) {
+            send_buffer_.swap(write_buffer_);
+        }
+
+        if (send_buffer_.unreadBytes() > 0) {
+            if (io_uring_->prepareSend(fd_, send_buffer_.data(), send_buffer_.unreadBytes(), this, URING_OP_SEND)) {
+                uring_sending_ = true;
+                ++ uring_requests_;
+            } else {
+                netFdErrorHandle();
+            }
+        }
+    }
+
+    if (uring_closed_ && uring_requests_ == 0) {
+        uring_self_.reset();
+    }
+}
+
+void Connection::uringReadHandle(int res, uint32_t flags, bool more) {
+    if (res > 0) {
+        // The provided buffer is given back at once, the buffers of one event loop are shared by all connections.
+        ByteBufferedWriter writer(read_buffer_);
+        writer.append(io_uring_->getBuffer(flags), static_cast<size_t>(res));
+        io_uring_->recycleBuffer(flags);
+    } else if (flags & IORING_CQE_F_BUFFER) {
+        io_uring_->recycleBuffer(flags);
+    }
+
+    if (uring_closed_) {
+        return;
+    }
+
+    if (res > 0) {
+        if (!uring_read_deferred_) {
+            uring_read_deferred_ = true;
+            deferSubmit();
+        }
+    } else if (res != -ENOBUFS) {
+        // The peer closed(0) or error, the data received before it is handled first.
+        if (uring_read_deferred_) {
+            uring_read_deferred_ = false;
+            handleReadData();
+        }
+
+        if (!uring_closed_) {
+            netFdErrorHandle();
+        }
+
+        return;
+    }
+
+    // The multishot recv stopped without error(e.g. the provided buffers ran out), start it again.
+    if (!more && !uring_closed_) {
+        uringRecv();
+    }
+}
+
+void Connection::uringWriteHandle(int res) {
+    uring_sending_ = false;
+
+    if (uring_closed_) {
+        return;
+    }
+
+    if (res < 0) {
+        if (res != -EAGAIN && res != -EINTR) {
+            netFdErrorHandle();
+            return;
+        }
+
+        res = 0;
+    }
+
+    ByteBufferedReader reader(send_buffer_);
+    reader.remove(static_cast<size_t>(res));
+    pending_write_bytes_.fetch_sub(static_cast<size_t>(res), std::memory_order_relaxed);
+
+    if (send_buffer_.unreadBytes() > 0 || write_buffer_.unreadBytes() > 0) {
+        uringFlush();
+        return;
+    }
+
+    updateMemoryStats();
+    if (write_complete_fn_) {
+        write_complete_fn_(shared_from_this());
+    }
+
+    notifyWriteWaiter();
+}
+
+void Connection::uringRecv() {
+    if (io_uring_->prepareRecvMultishot(fd_, this, URING_OP_RECV)) {
+        ++ uring_requests_;
+    } else {
+        netFdErrorHandle();
+    }
+}
+
+void Connection::uringFlush() {
+    if (!uring_sending_ && !uring_flush_deferred_) {
+        uring_flush_deferred_ = true;
+        deferSubmit();
+    }
+}
+
+void Connection::deferSubmit() {
+    if (!uring_submit_deferred_) {
+        uring_submit_deferred_ = true;
+        io_uring_->deferSubmit(this);
+    }
+}
+
 } /* end namespace atp */
@@ -1,34 +1,95 @@
 #ifndef __ATP_CONNECTION_H__
 #define __ATP_CONNECTION_H__
 
+#include <deque>
 #include <string>
+#include <atomic>
+#include <sys/types.h>
 
 #include "net/atp_cbs.h"
 #include "net/atp_buffer.hpp"
+#include "net/atp_io_uring.h"
 #include "app/atp_any.hpp"
+#include "app/atp_arena.h"
 
 namespace atp {
 
 class Channel;
 class EventLoop;
 
-class Connection : public std::enable_shared_from_this<Connection> {
+class Connection : public std::enable_shared_from_this<Connection>, public IoUringHandler {
 public:
     explicit Connection(EventLoop* event_loop, int fd, std::string id, std::string& remote_addr);
     ~Connection();
 
 public:
-    /* Attach the connection fd to libevent event_base. */
+    /* Attach the connection fd to libevent event_base, or start the io_uring recv. */
     void attachToEventLoop();
 
+    /*
+     * Must be set before attached. The IO_BACKEND_IO_URING receives by the multishot recv and
+     * sends the data of one loop iteration by one send request, it falls back to the libevent
+     * if the event loop has no io_uring.
+     */
+    void setIOBackend(IOBackend backend) {
+        io_backend_ = backend;
+    }
+
+    /*
+     * Send the data of send(std::string&&) not less than threshold by MSG_ZEROCOPY, the kernel reads the
+     * pages of the data directly and the connection owns the data until the completion is notified by the
+     * socket error queue. Return false if the kernel doesn't support it. Must be called in the owner event loop.
+     */
+    bool enableZeroCopy(size_t threshold = ZEROCOPY_SEND_THRESHOLD);
+
 public:
     /* Send data to peer for application layer. */
     void send(const void* data, size_t len);
     void send(ByteBuffer* buffer);
 
-    /* Close connection for application layer. */
+    /* Send the data without copy if the zero copy is enabled and the data is large enough, see enableZeroCopy. */
+    void send(std::string&& data);
+
+    /*
+     * Send len bytes of the file fd from offset, in order with the data sent before and after it. The file
+     * is written by sendfile, the pipe by splice(offset is ignored), the data never copied to the user space.
+     * The cb is called in the owner event loop with true once all the bytes written to the kernel, or false
+     * if the connection closed or the file is shorter than len. The fd must be kept open until the cb called.
+     * The io_uring backend doesn't support it, the cb is called with false.
+     */
+    void sendFile(int fd, off_t offset, size_t len, const SendFileCallback& cb = SendFileCallback());
+
+    /*
+     * Hold the data sent until uncork, so the data of many sends goes to the kernel by one send, the
+     * data reached CORK_FLUSH_SIZE is sent at once. The cork nests, the last uncork sends the held data.
+     * Without it the sends of one loop iteration are corked until the iteration end if the auto cork is on.
+     * The io_uring sends the data of one iteration together already, it ignores the cork. Must be called
+     * in the owner event loop.
+     */
+    void cork();
+    void uncork();
+
+    /* The auto cork is ENABLED_AUTO_CORK by default, the data sent is buffered until the iteration end. */
+    void setAutoCork(bool on) {
+        auto_cork_ = on;
+    }
+
+    /* Close connection for application layer, the corked data is sent before. */
     void close();
 
+    /*
+     * Call the fn once the read buffer has n unread bytes(0 means any byte) or the connection closed,
+     * the read message callback is not called while waiting. Return false and don't keep the fn if
+     * it is already satisfied. Must be called in the owner event loop, used by the coroutine awaiters.
+     */
+    bool waitForRead(size_t n, const std::function<void()>& fn);
+
+    /*
+     * Call the fn once the write buffer drained to the kernel or the connection closed. Return false
+     * and don't keep the fn if nothing is buffered. Must be called in the owner event loop.
+     */
+    bool waitForWrite(const std::function<void()>& fn);
+
 public:
     /* Get already generate connection uuid. */
     std::string getUUID() {
@@ -40,6 +101,32 @@ public:
         return remote_addr_;
     }
 
+    /* Get the IO event loop which the connection attached. */
+    EventLoop* getEventLoop() const {
+        return event_loop_;
+    }
+
+    /* The received data not consumed yet, only be used in the owner event loop. */
+    ByteBuffer& getReadBuffer() {
+        return read_buffer_;
+    }
+
+    /* The connection already closed, only be used in the owner event loop. */
+    bool isClosed() const;
+
+    /* The zero copy sends the kernel copied anyway(e.g. the loopback), the zero copy only costs more for them. */
+    uint64_t getZeroCopyCopiedSends() const {
+        return zerocopy_copied_;
+    }
+
+    /*
+     * The bytes passed to send but not written to the kernel yet, includes the data queued
+     * to the owner event loop and the write buffer. It can be read from any thread.
+     */
+    size_t getPendingWriteBytes() const {
+        return pending_write_bytes_.load(std::memory_order_relaxed);
+    }
+
     void setContext(const any& context) {
         context_ = context;
     }
@@ -48,6 +135,14 @@ public:
         return context_;
     }
 
+    /*
+     * The arena for the temporaries of the message handling, it is reset after each read message
+     * callback returned, so it can only be used in the owner event loop within the callback.
+     */
+    Arena& getArena() {
+        return arena_;
+    }
+
     /* For application layer set Connection read and write callback function. */
     void setConnectionCallback(const ConnectionCallback& fn) {
         conn_fn_ = fn;
@@ -69,6 +164,59 @@ public:
         close_fn_ = fn;
     }
 
+private:
+    struct SendRequest;
+
+    /* Really send data, must be called in the owner event loop. */
+    void sendInLoop(const void* data, size_t len);
+
+    void sendFileInLoop(int fd, off_t offset, size_t len, const SendFileCallback& cb);
+
+    void sendZeroCopyInLoop(std::string&& data);
+
+    /* Queue the request after the data already buffered, send it at once if nothing is waiting. */
+    void queueSendRequest(SendRequest& request);
+
+    /* Send the queued requests and the data buffered before them, return true if all of them sent. */
+    bool sendQueued();
+
+    /* Pop the front request and call its cb, the unsent bytes are no longer pending. */
+    void finishSendRequest(bool success);
+
+    /* Read the zero copy completions from the socket error queue, release the completed data. */
+    void zeroCopyCompleteHandle();
+
+    /* Send the corked data at the iteration end, the connection is kept alive until then. */
+    void deferCorkFlush();
+    void corkFlushHandle();
+
+    /* Send the corked data if nothing is sent before it. */
+    void flushCorked();
+
+    /* The pipe is empty, wait for it readable instead of the socket writable. */
+    void waitForPipe(int fd);
+    void pipeReadHandle();
+
+    /* Account the buffer capacity changes to the event loop memory stats. */
+    void updateMemoryStats();
+
+    /* Call and clear the read or write waiter. */
+    void notifyReadWaiter();
+    void notifyWriteWaiter();
+
+    /* Dispatch the received data to the read waiter or the read message callback. */
+    void handleReadData();
+
+    /* The io_uring requests, see IoUringHandler. */
+    void onCompletion(int op, int res, uint32_t flags) override;
+    void onSubmit() override;
+
+    void uringReadHandle(int res, uint32_t flags, bool more);
+    void uringWriteHandle(int res);
+    void uringRecv();
+    void uringFlush();
+    void deferSubmit();
+
 private:
     void netFdReadHandle();
     void netFdWriteHandle();
@@ -91,9 +239,72 @@ private:
     ByteBuffer read_buffer_;
     ByteBuffer write_buffer_;
 
+    /* The io_uring send request data, the write_buffer_ is swapped in when no request in flight. */
+    ByteBuffer send_buffer_;
+
+    /* The send queued by sendFile and the zero copy send, the data sent after it is buffered behind it. */
+    struct SendRequest {
+        /* The write_buffer_ bytes sent before it. */
+        size_t buffered_before_;
+
+        size_t remaining_;
+
+        /* The file region, the fd_ is -1 for the zero copy data. */
+        int fd_;
+        off_t offset_;
+        bool pipe_;
+        SendFileCallback cb_;
+
+        /* The zero copy data, the last_seq_ is the zero copy sequence of its last send. */
+        std::unique_ptr<std::string> data_;
+        bool zerocopy_sent_;
+        uint32_t last_seq_;
+    };
+
+    std::deque<SendRequest> send_queue_;
+
+    /* The zero copy data sent, the kernel may still read it until the completion of its last_seq_. */
+    struct ZeroCopyPending {
+        uint32_t last_seq_;
+        std::unique_ptr<std::string> data_;
+    };
+
+    /* The kernel notifies the completions of TCP in order, the data not completed is released with the connection. */
+    std::deque<ZeroCopyPending> zerocopy_pending_;
+
+    /* 0 is disabled, the data less than it is copied. */
+    size_t zerocopy_threshold_;
+
+    /* The sequence of the next MSG_ZEROCOPY send, counted by the kernel the same way. */
+    uint32_t zerocopy_seq_;
+
+    /* The sequence of the next completion, the error queue is empty if it is the zerocopy_seq_. */
+    uint32_t zerocopy_completed_;
+
+    /* The bytes of the queued and pending zero copy data, accounted as the write buffer. */
+    size_t zerocopy_bytes_;
+
+    uint64_t zerocopy_copied_;
+
+    /* Watch the empty pipe of the front file, created at the first wait. */
+    std::unique_ptr<Channel> pipe_chan_;
+
+    /* In the sendQueued, the request queued by the cb is sent by it. */
+    bool sending_queue_;
+
+    /* The buffer capacity already accounted to the event loop memory stats. */
+    size_t read_buffer_accounted_;
+    size_t write_buffer_accounted_;
+
+    /* The bytes waiting for write, for the application layer flow control. */
+    std::atomic<size_t> pending_write_bytes_;
+
     /* The context_ for timing wheel to save weak entry pointer. */
     any context_;
 
+    /* The request scoped arena, reset per read message callback. */
+    Arena arena_;
+
     /* When a Connection established, broken down, connecting failed, this callback will be called. */
     ConnectionCallback		conn_fn_;
 
@@ -108,6 +319,38 @@ private:
 
     /* When a Connection closed, this callback will be called. */
     CloseCallback           close_fn_;
+
+    /* The waiters for the read bytes and the write buffer drained, see waitForRead and waitForWrite. */
+    std::function<void()>   read_waiter_fn_;
+    size_t                  read_waiter_bytes_;
+    std::function<void()>   write_waiter_fn_;
+
+    IOBackend               io_backend_;
+
+    /* The io_uring of the event loop, nullptr if the connection uses the libevent. */
+    IoUring*                io_uring_;
+
+    /* The nested cork calls not uncorked yet. */
+    int                     cork_count_;
+
+    bool                    auto_cork_;
+
+    bool                    cork_flush_deferred_;
+    ConnectionPtr           cork_self_;
+
+    /* Keep the connection alive until the last io_uring request completed. */
+    ConnectionPtr           uring_self_;
+
+    /* The io_uring requests not completed, the multishot recv counts until it stopped. */
+    int                     uring_requests_;
+
+    bool                    uring_closed_;
+    bool                    uring_sending_;
+
+    /* The received data and the data to send are handled once per loop iteration, at onSubmit. */
+    bool                    uring_read_deferred_;
+    bool                    uring_flush_deferred_;
+    bool                    uring_submit_deferred_;
 };
 
 } /* end namespace atp */
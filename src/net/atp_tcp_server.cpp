@@ -22,12 +22,15 @@
  * SOFTWARE.
  */
 
+#include <vector>
+#include <unordered_map>
 #include <sys/sysinfo.h>
 
 #include "net/atp_config.h"
 #include "net/atp_tcp_conn.h"
 #include "net/atp_listener.h"
 #include "net/atp_tcp_server.h"
+#include "net/atp_object_pool.hpp"
 #include "net/atp_dynamic_thread_pool.h"
 #include "app/atp_uuid.h"
 
@@ -40,29 +43,32 @@ int getSystemCPUProcessers() {
     return get_nprocs();
 }
 
-Server::Server(std::string name, ServerAddress server_address, int thread_num) {
+Server::Server(std::string name, ServerAddress server_address, int thread_num, IOBackend io_backend) {
     /* Initialize all components for tcp server(mode 0). */
     state_.store(STATE_NULL);
 
     service_name_ = name;
     server_address_ = server_address;
     thread_num_ = thread_num;
+    io_backend_ = io_backend;
 
     /* Set tcp server mode. */
     server_mode_ = 0;
 
-    control_event_loop_.reset(new EventLoop());
+    control_event_loop_.reset(new EventLoop(io_backend_));
 
     doInit();
 }
 
-Server::Server(std::string name, EventLoop* event_loop, ServerAddress server_address, int thread_num) {
+Server::Server(std::string name, EventLoop* event_loop, ServerAddress server_address, int thread_num,
+                    IOBackend io_backend) {
     /* Initialize all components for tcp server(mode 1). */
     state_.store(STATE_NULL);
 
     service_name_ = name;
     server_address_ = server_address;
     thread_num_ = thread_num;
+    io_backend_ = io_backend;
 
     /* Set tcp server mode. */
     server_mode_ = 1;
@@ -80,6 +86,7 @@ void Server::doInit() {
     dynamic_thread_pool_size_ = getSystemCPUProcessers() * 2;
 
     listener_.reset(new Listener(control_event_loop_.get(), server_address_.addr_, server_address_.port_));
+    listener_->setIOBackend(io_backend_);
     uuid_generator_.reset(new UUIDGenerator());
     json_codec_.reset(new Codec());
     conns_table_.reset(new HashTableConn());
@@ -93,7 +100,7 @@ void Server::doInit() {
     }
 
     if (thread_num_ > 0) {
-        event_loop_thread_pool_.reset(new EventLoopPool(thread_num_));
+        event_loop_thread_pool_.reset(new EventLoopPool(thread_num_, io_backend_));
     }
 
     assert(control_event_loop_ != nullptr);
@@ -115,7 +122,7 @@ void Server::doInit() {
     assert(service_name_.length() != 0);
 
     if (ATP_NET_DEBUG_ON) {
-        LOG(INFO) << "[Server] create server: " << service_name_ << "|| mode: " << server_mode_;
+        LOG(INFO) << "[Server] create server: " << service_name_ << "|| mode: " << server_mode_ << "|| io backend: " << io_backend_;
     }
 
     state_.store(STATE_INIT);
@@ -128,9 +135,9 @@ void Server::start() {
     /* Start event_loop_pool, it mabe had none event_loop_thread. */
     startEventLoopPool();
 
-    /* Add a persist timer task for timing wheel. */
+    /* Add a persist timer task for timing wheel, the wheel step is one second. */
     if (ENABLED_TIMING_WHEEL) {
-        control_event_loop_->addCycleTask(1, [&]() {
+        control_event_loop_->addCycleTask(TIMIING_WHEEL_STEP * 1000, [&]() {
             if (ATP_NET_DEBUG_ON) {
                 LOG(INFO) << "The timer trigger for timing wheel.";
             }
@@ -168,6 +175,56 @@ void Server::stop() {
     state_.store(STATE_STOPPED);
 }
 
+void Server::setBusyPoll(int64_t busy_poll_us, int socket_busy_poll_us) {
+    assert(CHECK_STATE(STATE_INIT));
+
+    // The control event loop only accepts when there are IO event loops, it needn't spin.
+    if (thread_num_ > 0) {
+        event_loop_thread_pool_->setBusyPoll(busy_poll_us);
+    } else if (!server_mode_) {
+        control_event_loop_->setBusyPoll(busy_poll_us);
+    }
+
+    listener_->setSocketBusyPoll(socket_busy_poll_us);
+}
+
+void Server::broadcast(const std::shared_ptr<const std::string>& payload, const BroadcastFilter& filter) {
+    if (!payload || payload->empty()) {
+        return;
+    }
+
+    // The connections table is only used in the control event loop.
+    control_event_loop_->sendToQueue(std::bind(&Server::broadcastInLoop, this, payload, filter));
+}
+
+void Server::broadcast(const std::string& payload, const BroadcastFilter& filter) {
+    broadcast(std::make_shared<const std::string>(payload), filter);
+}
+
+void Server::broadcastInLoop(const std::shared_ptr<const std::string>& payload, const BroadcastFilter& filter) {
+    std::unordered_map<EventLoop*, std::vector<ConnectionPtr>> loop_conns;
+    for (auto& pair_val : *conns_table_) {
+        if (!filter || filter(pair_val.second)) {
+            loop_conns[pair_val.second->getEventLoop()].push_back(pair_val.second);
+        }
+    }
+
+    /*
+     * One task for all the connections of the event loop instead of one for each, the send in the owner
+     * event loop doesn't copy the payload to a task.
+     */
+    for (auto& loop_val : loop_conns) {
+        std::shared_ptr<std::vector<ConnectionPtr>> conns =
+            std::make_shared<std::vector<ConnectionPtr>>(std::move(loop_val.second));
+
+        loop_val.first->sendToQueue([payload, conns]() {
+            for (const ConnectionPtr& conn : *conns) {
+                conn->send(payload->data(), payload->size());
+            }
+        });
+    }
+}
+
 void Server::startEventLoopPool() {
     if (thread_num_ > 0) {
         event_loop_thread_pool_->autoStart();
@@ -187,7 +244,8 @@ void Server::handleNewConnection(int fd, std::string& taddr, void* args) {
     thread_num_ == 0 ? event_loop = control_event_loop_.get() : event_loop = getIOEventLoop();
     assert(event_loop != nullptr);
 
-    ConnectionPtr conn(new Connection(event_loop, fd, uuid_generator_->generateUUID(), taddr));
+    ConnectionPtr conn = ObjectPool<Connection>::makeShared(event_loop, fd, uuid_generator_->generateUUID(), taddr);
+    conn->setIOBackend(io_backend_);
     conn->setConnectionCallback(conn_fn_);
     conn->setReadMessageCallback(message_fn_);
     conn->setCloseCallback(std::bind(&Server::handleCloseConnection, this, std::placeholders::_1));
@@ -202,6 +260,10 @@ void Server::handleNewConnection(int fd, std::string& taddr, void* args) {
 }
 
 void Server::handleCloseConnection(const ConnectionPtr& conn) {
+    if (close_fn_) {
+        close_fn_(conn);
+    }
+
     auto fn = [this, conn]() {
         this->hashTableRemove(conn->getUUID());
     };
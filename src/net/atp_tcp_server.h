@@ -27,6 +27,7 @@
 
 #include "net/atp_cbs.h"
 #include "net/atp_tcp_conn.h"
+#include "net/atp_io_uring.h"
 #include "net/atp_event_loop.h"
 #include "net/atp_event_loop_thread_pool.h"
 #include "net/atp_timing_wheel.hpp"
@@ -50,10 +51,16 @@ int getSystemCPUProcessers();
 
 class Server : public STATE_MACHINE_INTERFACE {
 public:
-    explicit Server(std::string name, ServerAddress server_address, int thread_nums);
+    /*
+     * The io_backend is used by the listener and all the connections, see IOBackend. The IO_BACKEND_EPOLL
+     * creates the event loops with the native epoll, in mode 1 the given event_loop decides the listener.
+     */
+    explicit Server(std::string name, ServerAddress server_address, int thread_nums,
+                        IOBackend io_backend = IO_BACKEND_LIBEVENT);
 
     /* Multi accept mode(SO_REUSEPORT) */
-    explicit Server(std::string name, EventLoop* event_loop, ServerAddress server_address, int thread_num);
+    explicit Server(std::string name, EventLoop* event_loop, ServerAddress server_address, int thread_num,
+                        IOBackend io_backend = IO_BACKEND_LIBEVENT);
 
     ~Server();
 
@@ -71,6 +78,11 @@ public:
         message_fn_ = fn;
     }
 
+    /* Called in the connection event loop when the connection closed. */
+    void setCloseCallback(const CloseCallback& fn) {
+        close_fn_ = fn;
+    }
+
     void timingWheelInsert(EntryPtr& entry) {
         LOG(INFO) << "timing insert use1 count: " << entry.use_count();
         if (!server_mode_) {
@@ -83,6 +95,28 @@ public:
         LOG(INFO) << "timing insert use2 count: " << entry.use_count();
     }
 
+    /*
+     * Must be called before start. The IO event loops busy poll for busy_poll_us before blocking, and the
+     * accepted sockets set SO_BUSY_POLL to socket_busy_poll_us if it is greater than 0, see EventLoop::setBusyPoll.
+     * In mode 1 the given event_loop is not changed.
+     */
+    void setBusyPoll(int64_t busy_poll_us, int socket_busy_poll_us = 0);
+
+    /*
+     * Send the payload to the connections the filter returns true for, all the connections if no filter.
+     * It can be called from any thread. The connections are grouped by their IO event loops in the control
+     * event loop, the filter is called there, then each IO event loop gets one task sending the shared
+     * payload to all its connections.
+     */
+    void broadcast(const std::shared_ptr<const std::string>& payload, const BroadcastFilter& filter = BroadcastFilter());
+
+    void broadcast(const std::string& payload, const BroadcastFilter& filter = BroadcastFilter());
+
+    /* The scalable thread pool for application layer tasks, it is nullptr when disabled. */
+    DynamicThreadPool* getDynamicThreadPool() const {
+        return dynamic_thread_pool_.get();
+    }
+
 private:
     void doInit();
 
@@ -94,6 +128,8 @@ private:
 
     void handleCloseConnection(const ConnectionPtr& conn);
 
+    void broadcastInLoop(const std::shared_ptr<const std::string>& payload, const BroadcastFilter& filter);
+
     EventLoop* getIOEventLoop();
 
     size_t hashTableSize();
@@ -153,6 +189,9 @@ private:
 
     // Server mode for SO_REUSEPORT or not.
     int server_mode_;
+
+    // The libevent or io_uring for the listener and connections IO.
+    IOBackend io_backend_;
 };
 
 } /* end namespace atp */;
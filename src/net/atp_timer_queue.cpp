@@ -0,0 +1,324 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <chrono>
+
+#include "net/atp_config.h"
+#include "net/atp_libevent.h"
+#include "net/atp_event_loop.h"
+#include "net/atp_event_watcher.h"
+#include "net/atp_timer_queue.h"
+
+namespace atp {
+
+typedef enum {
+    /* In the free list. */
+    TIMER_NODE_FREE     =   (0),
+
+    /* Added, waiting for the event loop to insert it to the heap. */
+    TIMER_NODE_ADDING   =   (1),
+
+    /* In the heap. */
+    TIMER_NODE_QUEUED   =   (2),
+
+    /* The task is running. */
+    TIMER_NODE_RUNNING  =   (3),
+
+    /* Canceled before inserted or in its running task. */
+    TIMER_NODE_CANCELED =   (4)
+} TimerNodeState;
+
+struct TimerNode {
+    int64_t deadline_ns_;
+    int64_t interval_ns_;
+
+    TimerQueue::TimerTask task_;
+
+    // The sequence of the current use, 0 if free, read by cancel of any thread.
+    std::atomic<uint64_t> seq_;
+
+    // The position in the heap, only valid when queued.
+    size_t heap_index_;
+
+    int state_;
+
+    TimerNode* next_;
+};
+
+static int64_t steadyClockNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TimerQueue::TimerQueue(EventLoop* loop)
+    : loop_(loop), armed_ns_(0), firing_(false), free_nodes_(nullptr), next_seq_(1) {
+    watcher_.reset(new TimerEventWatcher(loop_, std::bind(&TimerQueue::onTimeout, this), 0));
+    if (!watcher_->doInit()) {
+        LOG(ERROR) << "[TimerQueue] init the timer watcher failed";
+    }
+}
+
+TimerQueue::~TimerQueue() {
+    watcher_.reset();
+
+    // The tasks may hold the objects, e.g. the CycleTimer, release them before the nodes.
+    for (size_t i = 0; i < heap_.size(); ++ i) {
+        heap_[i].node_->task_ = TimerTask();
+    }
+}
+
+TimerId TimerQueue::add(int64_t delay_us, int64_t interval_us, TimerTask&& task) {
+    TimerNode* node = allocNode();
+    uint64_t seq = node->seq_.load(std::memory_order_relaxed);
+
+    // The event loop cached time is the same clock, the timers added in one iteration share it.
+    bool in_loop = loop_->threadSafety();
+    int64_t now = in_loop ? loop_->now() : steadyClockNs();
+
+    node->deadline_ns_ = now + (delay_us > 0 ? delay_us * 1000 : 0);
+    node->interval_ns_ = interval_us > 0 ? interval_us * 1000 : 0;
+    node->task_ = std::move(task);
+    node->state_ = TIMER_NODE_ADDING;
+
+    if (in_loop) {
+        insert(node);
+    } else {
+        loop_->sendToQueue([this, node]() {
+            // Canceled before it is inserted.
+            if (node->state_ == TIMER_NODE_CANCELED) {
+                freeNode(node);
+                return;
+            }
+
+            insert(node);
+        });
+    }
+
+    return TimerId(node, seq);
+}
+
+bool TimerQueue::cancel(TimerId id) {
+    if (!id.valid()) {
+        return false;
+    }
+
+    if (loop_->threadSafety()) {
+        return cancelInLoop(id);
+    }
+
+    loop_->sendToQueue([this, id]() {
+        cancelInLoop(id);
+    });
+
+    return false;
+}
+
+bool TimerQueue::cancelInLoop(TimerId id) {
+    TimerNode* node = id.node_;
+
+    // The timer already fired or canceled, the node may be used by another timer now.
+    if (node->seq_.load(std::memory_order_relaxed) != id.seq_) {
+        return false;
+    }
+
+    switch (node->state_) {
+    case TIMER_NODE_QUEUED:
+        removeAt(node->heap_index_);
+        freeNode(node);
+        return true;
+
+    case TIMER_NODE_ADDING:
+    case TIMER_NODE_RUNNING:
+        // The node is freed by the insert task or after the task returned.
+        node->state_ = TIMER_NODE_CANCELED;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+TimerNode* TimerQueue::allocNode() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!free_nodes_) {
+        TimerNode* chunk = new TimerNode[TIMER_QUEUE_NODE_CHUNK];
+        chunks_.emplace_back(chunk);
+
+        for (size_t i = 0; i < TIMER_QUEUE_NODE_CHUNK; ++ i) {
+            chunk[i].seq_.store(0, std::memory_order_relaxed);
+            chunk[i].state_ = TIMER_NODE_FREE;
+            chunk[i].next_ = free_nodes_;
+            free_nodes_ = &chunk[i];
+        }
+    }
+
+    TimerNode* node = free_nodes_;
+    free_nodes_ = node->next_;
+    node->seq_.store(next_seq_ ++, std::memory_order_relaxed);
+
+    return node;
+}
+
+void TimerQueue::freeNode(TimerNode* node) {
+    // Release the captured objects out of the lock.
+    node->task_ = TimerTask();
+    node->state_ = TIMER_NODE_FREE;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    node->seq_.store(0, std::memory_order_relaxed);
+    node->next_ = free_nodes_;
+    free_nodes_ = node;
+}
+
+void TimerQueue::insert(TimerNode* node) {
+    node->state_ = TIMER_NODE_QUEUED;
+
+    HeapEntry entry = { node->deadline_ns_, node->seq_.load(std::memory_order_relaxed), node };
+    heap_.push_back(entry);
+    node->heap_index_ = heap_.size() - 1;
+    siftUp(heap_.size() - 1);
+
+    if (!firing_ && (armed_ns_ == 0 || node->deadline_ns_ < armed_ns_)) {
+        rearm();
+    }
+}
+
+void TimerQueue::removeAt(size_t index) {
+    size_t last = heap_.size() - 1;
+    if (index != last) {
+        place(index, heap_[last]);
+        heap_.pop_back();
+
+        // The moved last entry may be earlier than the parent of the removed one, or later than its children.
+        if (index > 0 && earlier(heap_[index], heap_[(index - 1) / 4])) {
+            siftUp(index);
+        } else {
+            siftDown(index);
+        }
+    } else {
+        heap_.pop_back();
+    }
+
+    // The armed deadline is kept, the early timeout finds nothing expired and rearms.
+}
+
+void TimerQueue::siftUp(size_t index) {
+    HeapEntry entry = heap_[index];
+
+    while (index > 0) {
+        size_t parent = (index - 1) / 4;
+        if (!earlier(entry, heap_[parent])) {
+            break;
+        }
+
+        place(index, heap_[parent]);
+        index = parent;
+    }
+
+    place(index, entry);
+}
+
+void TimerQueue::siftDown(size_t index) {
+    HeapEntry entry = heap_[index];
+    size_t size = heap_.size();
+
+    while (true) {
+        size_t first = index * 4 + 1;
+        if (first >= size) {
+            break;
+        }
+
+        size_t last = first + 4 < size ? first + 4 : size;
+        size_t min = first;
+        for (size_t child = first + 1; child < last; ++ child) {
+            if (earlier(heap_[child], heap_[min])) {
+                min = child;
+            }
+        }
+
+        if (!earlier(heap_[min], entry)) {
+            break;
+        }
+
+        place(index, heap_[min]);
+        index = min;
+    }
+
+    place(index, entry);
+}
+
+void TimerQueue::place(size_t index, const HeapEntry& entry) {
+    heap_[index] = entry;
+    entry.node_->heap_index_ = index;
+}
+
+void TimerQueue::onTimeout() {
+    firing_ = true;
+    armed_ns_ = 0;
+
+    int64_t now = loop_->now();
+
+    while (!heap_.empty() && heap_[0].deadline_ns_ <= now) {
+        TimerNode* node = heap_[0].node_;
+        removeAt(0);
+
+        node->state_ = TIMER_NODE_RUNNING;
+        node->task_();
+
+        if (node->state_ == TIMER_NODE_RUNNING && node->interval_ns_ > 0) {
+            // The late persist timer skips the missed periods instead of firing them all at once.
+            node->deadline_ns_ += node->interval_ns_;
+            if (node->deadline_ns_ <= now) {
+                node->deadline_ns_ = now + node->interval_ns_;
+            }
+
+            insert(node);
+        } else {
+            freeNode(node);
+        }
+    }
+
+    firing_ = false;
+    rearm();
+}
+
+void TimerQueue::rearm() {
+    if (heap_.empty()) {
+        return;
+    }
+
+    int64_t deadline = heap_[0].deadline_ns_;
+    int64_t delay_ns = deadline - steadyClockNs();
+
+    // Round up, the timeout fires never earlier than the deadline.
+    int64_t delay_us = delay_ns > 0 ? (delay_ns + 999) / 1000 : 0;
+
+    if (watcher_->asyncWait(delay_us)) {
+        armed_ns_ = deadline;
+    }
+}
+
+} /* end namespace atp */
@@ -0,0 +1,165 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ATP_TIMER_QUEUE_H__
+#define __ATP_TIMER_QUEUE_H__
+
+#include <stdint.h>
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+
+namespace atp {
+
+class EventLoop;
+class TimerEventWatcher;
+
+struct TimerNode;
+
+/*
+ * The handle of a timer to cancel it, it is two words and cheap to copy. The timer node is recycled
+ * by the timer queue with a new sequence, so the handle of a fired or canceled timer is ignored safely.
+ */
+class TimerId {
+public:
+    TimerId() : node_(nullptr), seq_(0) {
+
+    }
+
+    bool valid() const {
+        return node_ != nullptr;
+    }
+
+private:
+    friend class TimerQueue;
+
+    TimerId(TimerNode* node, uint64_t seq) : node_(node), seq_(seq) {
+
+    }
+
+private:
+    TimerNode* node_;
+
+    uint64_t seq_;
+};
+
+/*
+ * The timer queue of an event loop, the timers are kept in a 4-ary min heap ordered by the deadline,
+ * insert and cancel are O(log n), the heap is shallower than the binary heap and a node's children
+ * share a cache line. Only the earliest deadline is armed to the libevent by one timer event, with
+ * the precise timer of the event loop the timeout has microsecond resolution.
+ *
+ * The timer nodes are allocated in chunks and recycled by the queue, they are never freed until the
+ * queue destroyed, so millions of timers are added and canceled without the heap allocations except
+ * the task functor captured more than the small buffer.
+ */
+class TimerQueue {
+public:
+    using TimerTask = std::function<void()>;
+
+public:
+    explicit TimerQueue(EventLoop* loop);
+
+    ~TimerQueue();
+
+public:
+    /*
+     * Run the task after delay_us, and then every interval_us if it is greater than 0, until canceled.
+     * It can be called in any thread, the timer is inserted in the event loop.
+     */
+    TimerId add(int64_t delay_us, int64_t interval_us, TimerTask&& task);
+
+    /*
+     * Cancel the timer, it can be called in any thread, the cancel is done in the event loop.
+     * In the event loop it returns true if the timer is canceled before it fired.
+     */
+    bool cancel(TimerId id);
+
+    /* The timers waiting in the heap, only be used in the event loop. */
+    size_t size() const {
+        return heap_.size();
+    }
+
+private:
+    struct HeapEntry {
+        int64_t deadline_ns_;
+        uint64_t seq_;
+        TimerNode* node_;
+    };
+
+    static bool earlier(const HeapEntry& a, const HeapEntry& b) {
+        return a.deadline_ns_ < b.deadline_ns_ || (a.deadline_ns_ == b.deadline_ns_ && a.seq_ < b.seq_);
+    }
+
+    TimerNode* allocNode();
+
+    void freeNode(TimerNode* node);
+
+    bool cancelInLoop(TimerId id);
+
+    void insert(TimerNode* node);
+
+    void removeAt(size_t index);
+
+    void siftUp(size_t index);
+
+    void siftDown(size_t index);
+
+    void place(size_t index, const HeapEntry& entry);
+
+    void onTimeout();
+
+    void rearm();
+
+private:
+    EventLoop* loop_;
+
+    // The only libevent timer of the queue, armed to the earliest deadline.
+    std::unique_ptr<TimerEventWatcher> watcher_;
+
+    // The deadline the watcher armed to, 0 if not armed.
+    int64_t armed_ns_;
+
+    // Firing the expired timers, the watcher is rearmed after all fired.
+    bool firing_;
+
+    std::vector<HeapEntry> heap_;
+
+    // Protect the free nodes and the node chunks, the timer may be added by the other threads.
+    std::mutex mutex_;
+
+    TimerNode* free_nodes_;
+
+    std::vector<std::unique_ptr<TimerNode[]>> chunks_;
+
+    uint64_t next_seq_;
+};
+
+} /* end namespace atp */
+
+#endif /* __ATP_TIMER_QUEUE_H__ */
@@ -32,6 +32,7 @@
 #include "net/atp_config.h"
 #include "net/atp_cbs.h"
 #include "net/atp_tcp_conn.h"
+#include "net/atp_object_pool.hpp"
 #include "net/atp_ring_buffer.hpp"
 
 namespace atp {
@@ -94,6 +95,8 @@ struct Entry {
 #endif
 
 struct Entry {
+    ATP_OBJECT_POOL_NEW_DELETE(Entry)
+
     Entry(const WeakConnectionPtr conn)
         : conn_(conn) {
 
@@ -0,0 +1,190 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ATP_WORK_STEALING_DEQUE_HPP__
+#define __ATP_WORK_STEALING_DEQUE_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+namespace atp {
+
+/*
+ * The Chase-Lev work stealing deque(the C11 version of Le, Pop, Cohen and Zappa Nardelli), the owner
+ * thread pushes and pops the bottom without CAS except for the last element, the other threads steal
+ * the top with one CAS. The array grows when full, the old arrays are kept until the deque destroyed,
+ * because the thieves may still read them.
+ *
+ * T must be a pointer, NULL means empty.
+ */
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity) : top_(0), bottom_(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+
+        array_.store(new Array(size), std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque() {
+        delete array_.load(std::memory_order_relaxed);
+
+        for (size_t i = 0; i < retired_.size(); ++ i) {
+            delete retired_[i];
+        }
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+public:
+    /* Only called by the owner thread. */
+    void push(T item) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_acquire);
+        Array* array = array_.load(std::memory_order_relaxed);
+
+        if (bottom - top > array->mask_) {
+            array = grow(array, top, bottom);
+        }
+
+        array->put(bottom, item);
+        bottom_.store(bottom + 1, std::memory_order_release);
+    }
+
+    /* Only called by the owner thread, return the last pushed one. */
+    T pop() {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* array = array_.load(std::memory_order_relaxed);
+
+        // The seq_cst store and load order the bottom_ reserved before reading the top_, against the thieves.
+        bottom_.store(bottom, std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_seq_cst);
+
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return NULL;
+        }
+
+        T item = array->get(bottom);
+        if (top == bottom) {
+            // The last one, race with the thieves.
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = NULL;
+            }
+
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+
+        return item;
+    }
+
+    /* Called by any thread, return the first pushed one, NULL if empty or lost the race. */
+    T steal() {
+        int64_t top = top_.load(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_seq_cst);
+
+        if (top >= bottom) {
+            return NULL;
+        }
+
+        Array* array = array_.load(std::memory_order_acquire);
+        T item = array->get(top);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return NULL;
+        }
+
+        return item;
+    }
+
+    /* The approximate size. */
+    size_t size() const {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_relaxed);
+
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    struct Array {
+        explicit Array(size_t size) : mask_(static_cast<int64_t>(size) - 1), items_(new std::atomic<T>[size]) {
+
+        }
+
+        ~Array() {
+            delete[] items_;
+        }
+
+        T get(int64_t index) const {
+            return items_[index & mask_].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t index, T item) {
+            items_[index & mask_].store(item, std::memory_order_relaxed);
+        }
+
+        int64_t mask_;
+        std::atomic<T>* items_;
+    };
+
+    Array* grow(Array* array, int64_t top, int64_t bottom) {
+        Array* bigger = new Array(static_cast<size_t>(array->mask_ + 1) << 1);
+        for (int64_t i = top; i < bottom; ++ i) {
+            bigger->put(i, array->get(i));
+        }
+
+        retired_.push_back(array);
+        array_.store(bigger, std::memory_order_release);
+
+        return bigger;
+    }
+
+private:
+    std::atomic<int64_t> top_;
+
+    // The owner side in the other cache line, the thieves only read it.
+    char padding_[64 - sizeof(std::atomic<int64_t>)];
+
+    std::atomic<int64_t> bottom_;
+
+    std::atomic<Array*> array_;
+
+    // The arrays before grown, only accessed by the owner thread.
+    std::vector<Array*> retired_;
+};
+
+} /* end namespace atp */
+
+#endif /* __ATP_WORK_STEALING_DEQUE_HPP__ */
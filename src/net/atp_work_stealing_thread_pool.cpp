@@ -0,0 +1,285 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "net/atp_work_stealing_thread_pool.h"
+
+namespace atp {
+
+// The pool and the worker of the current thread, set by the worker thread itself.
+static thread_local const void* current_pool = NULL;
+static thread_local void* current_worker = NULL;
+
+static void futexWait(std::atomic<uint32_t>* word, uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(std::atomic<uint32_t>* word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static uint32_t xorshift(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+WorkStealingThreadPool::WorkStealingThreadPool(size_t threads)
+    : shutdown_(false), injected_(THREAD_POOL_QUEUE_CAPACITY), epoch_(0), parked_workers_(0), steals_(0) {
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    // All the workers are created before any thread starts, the thieves index the workers_ without lock.
+    for (size_t i = 0; i < threads; ++ i) {
+        workers_.push_back(std::unique_ptr<Worker>(new Worker(i)));
+    }
+
+    for (size_t i = 0; i < threads; ++ i) {
+        workers_[i]->thd_.reset(new std::thread(&WorkStealingThreadPool::executer, this, workers_[i].get()));
+    }
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool() {
+    shutdown_ = true;
+    epoch_.fetch_add(1);
+    futexWake(&epoch_, INT_MAX);
+
+    // The workers run all the queued tasks before exit.
+    for (size_t i = 0; i < workers_.size(); ++ i) {
+        workers_[i]->thd_->join();
+    }
+
+    // The tasks added while the workers exiting.
+    TaskNode* node = NULL;
+    while (injected_.pop(&node)) {
+        runTask(node);
+    }
+}
+
+bool WorkStealingThreadPool::add(const TaskPtr& callback) {
+    if (shutdown_.load()) {
+        return false;
+    }
+
+    return addTask(new TaskNode{callback});
+}
+
+bool WorkStealingThreadPool::add(TaskPtr&& callback) {
+    if (shutdown_.load()) {
+        return false;
+    }
+
+    return addTask(new TaskNode{std::move(callback)});
+}
+
+size_t WorkStealingThreadPool::getTaskQueueSize() const {
+    size_t size = injected_.size();
+    for (size_t i = 0; i < workers_.size(); ++ i) {
+        size += workers_[i]->deque_.size();
+    }
+
+    return size;
+}
+
+bool WorkStealingThreadPool::runOneTask() {
+    TaskNode* node = findTask(getCurrentWorker());
+    if (!node) {
+        return false;
+    }
+
+    runTask(node);
+
+    return true;
+}
+
+WorkStealingThreadPool::Worker* WorkStealingThreadPool::getCurrentWorker() const {
+    return current_pool == this ? static_cast<Worker*>(current_worker) : NULL;
+}
+
+bool WorkStealingThreadPool::addTask(TaskNode* node) {
+    Worker* worker = getCurrentWorker();
+    if (worker) {
+        worker->deque_.push(node);
+    } else {
+        while (!injected_.push(node)) {
+            // The shared queue is full, help running the tasks instead of growing it.
+            TaskNode* other = findTask(NULL);
+            if (other) {
+                runTask(other);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    notify();
+
+    return true;
+}
+
+WorkStealingThreadPool::TaskNode* WorkStealingThreadPool::findTask(Worker* worker) {
+    TaskNode* node = NULL;
+    if (worker) {
+        node = worker->deque_.pop();
+        if (node) {
+            return node;
+        }
+    }
+
+    if (injected_.pop(&node)) {
+        return node;
+    }
+
+    return stealTask(worker);
+}
+
+WorkStealingThreadPool::TaskNode* WorkStealingThreadPool::stealTask(Worker* worker) {
+    static thread_local uint32_t random = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&random)) | 1;
+
+    size_t size = workers_.size();
+    size_t start = xorshift(worker ? &worker->random_ : &random) % size;
+
+    for (size_t i = 0; i < size; ++ i) {
+        Worker* victim = workers_[(start + i) % size].get();
+        if (victim == worker) {
+            continue;
+        }
+
+        TaskNode* node = victim->deque_.steal();
+        if (node) {
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+void WorkStealingThreadPool::runTask(TaskNode* node) {
+    node->callback_();
+    delete node;
+}
+
+void WorkStealingThreadPool::executer(Worker* worker) {
+    current_pool = this;
+    current_worker = worker;
+
+    for (; ;) {
+        TaskNode* node = NULL;
+        for (int round = 0; round < WORK_STEALING_SPIN_ROUNDS && !node; ++ round) {
+            node = findTask(worker);
+            if (!node && round + 1 < WORK_STEALING_SPIN_ROUNDS) {
+                std::this_thread::yield();
+            }
+        }
+
+        if (node) {
+            runTask(node);
+            continue;
+        }
+
+        if (shutdown_.load()) {
+            break;
+        }
+
+        park(worker);
+    }
+
+    current_pool = NULL;
+    current_worker = NULL;
+}
+
+void WorkStealingThreadPool::park(Worker* worker) {
+    uint32_t epoch = epoch_.load();
+
+    // Announce parking before the last check, the task added after the check sees it and wakes this worker.
+    parked_workers_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    bool found = !injected_.empty() || shutdown_.load();
+    for (size_t i = 0; i < workers_.size() && !found; ++ i) {
+        found = !workers_[i]->deque_.empty();
+    }
+
+    if (!found) {
+        futexWait(&epoch_, epoch);
+    }
+
+    parked_workers_.fetch_sub(1);
+}
+
+void WorkStealingThreadPool::notify() {
+    // Pairs with the fence in park, either the parking worker sees the task or this sees the parked worker.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (parked_workers_.load(std::memory_order_relaxed) > 0) {
+        epoch_.fetch_add(1);
+        futexWake(&epoch_, 1);
+    }
+}
+
+
+TaskGroup::TaskGroup(WorkStealingThreadPool* pool)
+    : pool_(pool), pending_(0) {
+
+}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::run(const BaseThreadPool::TaskPtr& task) {
+    ++ pending_;
+
+    std::atomic<size_t>* pending = &pending_;
+    auto fn = [task, pending]() {
+        task();
+        pending->fetch_sub(1, std::memory_order_release);
+    };
+
+    // The pool is shutting down, run it here.
+    if (!pool_->add(std::move(fn))) {
+        task();
+        -- pending_;
+    }
+}
+
+void TaskGroup::wait() {
+    while (pending_.load(std::memory_order_acquire) > 0) {
+        if (!pool_->runOneTask()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+} /* end namespace atp */
@@ -0,0 +1,173 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 pengwang7(https://github.com/pengwang7/libatp)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ATP_WORK_STEALING_THREAD_POOL_H__
+#define __ATP_WORK_STEALING_THREAD_POOL_H__
+
+#include <stdint.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+#include "net/atp_config.h"
+#include "net/atp_mpmc_queue.hpp"
+#include "net/atp_object_pool.hpp"
+#include "net/atp_work_stealing_deque.hpp"
+#include "net/atp_dynamic_thread_pool.h"
+
+namespace atp {
+
+/*
+ * The work stealing thread pool for the CPU bound tasks, each worker has its own Chase-Lev deque.
+ * The task added by a worker is pushed to its own deque and popped LIFO by itself, so the spawned
+ * tasks run hot in the cache. The task added by the other threads is queued to the shared lock free
+ * queue, when it is full the adding thread helps running the tasks until there is room.
+ *
+ * The worker without task takes from the shared queue, then steals FIFO from a random worker, and
+ * parks on a futex after WORK_STEALING_SPIN_ROUNDS scans found nothing.
+ *
+ * The tasks should not block, a blocked worker can't run its deque, the stealers still can.
+ */
+class WorkStealingThreadPool final : public BaseThreadPool {
+public:
+    explicit WorkStealingThreadPool(size_t threads);
+
+    ~WorkStealingThreadPool();
+
+public:
+    // The priorities and deadlines are not supported, all the tasks are queued as normal.
+    using BaseThreadPool::add;
+    using BaseThreadPool::getTaskQueueSize;
+
+    bool add(const TaskPtr& callback) override;
+
+    bool add(TaskPtr&& callback);
+
+    size_t getTaskQueueSize() const override;
+
+    /* Run one queued task in the caller thread, return false if no task found, for the joining thread to help. */
+    bool runOneTask();
+
+    size_t getThreads() const {
+        return workers_.size();
+    }
+
+    /* The tasks taken from the other worker deques. */
+    uint64_t getStealCount() const {
+        return steals_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct TaskNode {
+        ATP_OBJECT_POOL_NEW_DELETE(TaskNode)
+
+        TaskPtr callback_;
+    };
+
+    struct Worker {
+        explicit Worker(size_t index) : index_(index), deque_(WORK_STEALING_DEQUE_SIZE), random_(index * 2654435761u + 1) {
+
+        }
+
+        size_t index_;
+
+        WorkStealingDeque<TaskNode*> deque_;
+
+        // The xorshift state for picking the victim.
+        uint32_t random_;
+
+        std::unique_ptr<std::thread> thd_;
+    };
+
+    /* The worker of this pool running in the caller thread, NULL for the other threads. */
+    Worker* getCurrentWorker() const;
+
+    bool addTask(TaskNode* node);
+
+    /* The task for the worker(NULL for the other threads): its own deque, the shared queue, then steal. */
+    TaskNode* findTask(Worker* worker);
+
+    TaskNode* stealTask(Worker* worker);
+
+    void runTask(TaskNode* node);
+
+    void executer(Worker* worker);
+
+    void park(Worker* worker);
+
+    void notify();
+
+private:
+    std::atomic<bool> shutdown_;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    // The tasks added by the non worker threads.
+    MPMCQueue<TaskNode*> injected_;
+
+    // The futex word, bumped by each notify to the parked workers.
+    std::atomic<uint32_t> epoch_;
+
+    std::atomic<size_t> parked_workers_;
+
+    std::atomic<uint64_t> steals_;
+};
+
+/*
+ * The fork/join helper on the work stealing pool, run forks the task and wait joins all the forked tasks.
+ * The waiting thread runs the queued tasks instead of blocking, so the nested fork/join in the worker
+ * never deadlocks, e.g. the recursive fib:
+ *
+ *   TaskGroup group(&pool);
+ *   group.run([&]() { x = fib(n - 1); });
+ *   y = fib(n - 2);
+ *   group.wait();
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(WorkStealingThreadPool* pool);
+
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+public:
+    void run(const BaseThreadPool::TaskPtr& task);
+
+    void wait();
+
+private:
+    WorkStealingThreadPool* pool_;
+
+    std::atomic<size_t> pending_;
+};
+
+} /* end namespace atp */
+
+#endif /* __ATP_WORK_STEALING_THREAD_POOL_H__ */